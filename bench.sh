@@ -0,0 +1,26 @@
+#!/bin/bash
+
+# builds every bench/bench_*.c against the decoder sources (everything in src but main.c)
+# and runs them one after another - pass -build-only to skip running
+sources=($(find src -iname '*.c' ! -name 'main.c'))
+#shared bench code - everything in bench that is not a bench itself
+helpers=($(find bench -iname '*.c' ! -name 'bench_*'))
+flags=(-O2 -g -pthread -Isrc -DLOG_MIN_LEVEL=LOG_WARNING)
+#allocation counting in bench/common.c relies on these
+wrap_flags=(-Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=aligned_alloc)
+line_separator="\n============="
+
+mkdir -p build
+for bench in bench/bench_*.c; do
+	name=$(basename "$bench" .c)
+	echo -e "compiling $name $line_separator"
+	gcc -o "build/$name" "${flags[@]}" "$bench" "${helpers[@]}" "${sources[@]}" libz.a "${wrap_flags[@]}" || exit 1
+done
+
+[[ "$1" == "-build-only" ]] && exit 0
+
+for bench in bench/bench_*.c; do
+	name=$(basename "$bench" .c)
+	echo -e "running $name $line_separator"
+	"./build/$name"
+done
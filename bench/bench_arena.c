@@ -0,0 +1,126 @@
+//allocation cost of decoding a batch of images of different sizes with one decoder
+//heap mode allocates the result of every image, arena mode should settle at zero calls
+//into the backing allocator once the arena has grown to fit the biggest image
+//arena stream decodes the same images through the read callback - arena K is what the arena holds after the last
+//decode, and has to stay the same as with in memory input instead of growing with every decode
+
+#include "common.h"
+#include "png_decoder.h"
+#include "logger.h"
+#include "zlib.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IMAGE_COUNT		16
+#define CHANNELS		4
+#define REPETITIONS		20
+//read callback hands out input in pieces of this size, like a pipe would
+#define READ_SIZE		4096
+
+typedef struct {
+	const bench_buffer_s* png;
+	size_t offset;
+} reader_s;
+
+static void build_png(bench_buffer_s* _png, const uint _width, const uint _height, uint32_t _seed)
+{
+	const size_t raw_size = (size_t)_height * (_width * CHANNELS + 1);
+	uint8_t* raw = malloc(raw_size);
+	for(size_t i = 0; i < raw_size; ++i) {
+		_seed = _seed * 1103515245 + 12345;
+		//mostly flat with a bit of noise, so it compresses like a real image would
+		raw[i] = ((_seed >> 16) & 0x7) + (i / 97) % 64;
+	}
+	for(size_t y = 0; y < _height; ++y) {
+		raw[y * (_width * CHANNELS + 1)] = y % 5;
+	}
+
+	uLongf compressed_size = compressBound(raw_size);
+	uint8_t* compressed = malloc(compressed_size);
+	compress2(compressed, &compressed_size, raw, raw_size, 6);
+
+	bench_write_signature(_png);
+	bench_write_ihdr(_png, _width, _height, 8, 6, 0);
+	bench_write_chunk(_png, "IDAT", compressed, compressed_size);
+	bench_write_chunk(_png, "IEND", NULL, 0);
+
+	free(compressed);
+	free(raw);
+}
+
+static size_t read_png(void* _user, uint8_t* _buffer, const size_t _size)
+{
+	reader_s* reader = _user;
+	const size_t left = reader->png->size - reader->offset;
+	size_t size		  = _size < READ_SIZE ? _size : READ_SIZE;
+	size			  = size < left ? size : left;
+	memcpy(_buffer, reader->png->data + reader->offset, size);
+	reader->offset += size;
+	return size;
+}
+
+static bool decode_batch(png_decoder_s* _decoder, bench_buffer_s* _pngs, const bool _streamed)
+{
+	bool succeeded = true;
+	for(int i = 0; i < IMAGE_COUNT; ++i) {
+		reader_s reader = {.png = &_pngs[i]};
+		png_external_context_s* decoded = _streamed ? png_decoder_decode_stream(_decoder, read_png, &reader) :
+										  png_decoder_decode(_decoder, (char*)_pngs[i].data, _pngs[i].size);
+		succeeded &= decoded != NULL;
+		free_decoded_png(decoded);
+	}
+	return succeeded;
+}
+
+int main()
+{
+	logger_init(LOG_ERROR, "logs/bench_arena");
+
+	bench_buffer_s pngs[IMAGE_COUNT] = {0};
+	for(int i = 0; i < IMAGE_COUNT; ++i) {
+		//sizes jump around, so the heap version cannot just keep recycling one block
+		const uint side = 64 + (i * 37) % 448;
+		build_png(&pngs[i], side, side + i, 1000 + i);
+	}
+
+	printf("%14s %14s %16s %16s %10s\n", "mode", "us / image", "allocs / image", "bytes / image", "arena K");
+
+	static const char* mode_names[] = {"heap", "arena", "arena stream"};
+	for(int mode = 0; mode < 3; ++mode) {
+		png_decoder_options_s options = {.use_arena = mode > 0};
+		png_decoder_s* decoder = png_decoder_create(&options);
+		const bool streamed	   = mode == 2;
+
+		//first pass grows scratch buffers and the arena
+		bool succeeded = decode_batch(decoder, pngs, streamed);
+
+		bench_alloc_reset();
+		succeeded &= decode_batch(decoder, pngs, streamed);
+		const bench_alloc_stats_s allocs = bench_alloc_get();
+
+		const double start = bench_now();
+		for(int r = 0; r < REPETITIONS; ++r) {
+			succeeded &= decode_batch(decoder, pngs, streamed);
+		}
+		const double elapsed = (bench_now() - start) / (REPETITIONS * IMAGE_COUNT);
+
+		printf("%14s %14.1f %16.2f %16.0f %10zu%s\n", mode_names[mode], elapsed * 1e6,
+				(double)allocs.count / IMAGE_COUNT, (double)allocs.bytes / IMAGE_COUNT, decoder->arena.used / 1024,
+				succeeded ? "" : "  (decode failed)");
+
+		png_decoder_destroy(decoder);
+	}
+
+	for(int i = 0; i < IMAGE_COUNT; ++i) {
+		bench_buffer_free(&pngs[i]);
+	}
+	logger_close();
+	return 0;
+}
+
+#undef IMAGE_COUNT
+#undef CHANNELS
+#undef REPETITIONS
+#undef READ_SIZE
@@ -0,0 +1,94 @@
+//png_decode_batch scaling over a batch of thumbnails
+//sizes are mixed on purpose, so the static split is uneven and stealing has something to do
+//usage: bench_batch [max threads]   (defaults to the number of online cpus)
+
+#include "common.h"
+#include "corpus.h"
+#include "png_batch.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define IMAGE_COUNT	 512
+#define REPETITIONS	 5
+
+typedef struct {
+	const png_batch_input_s* inputs;
+	png_external_context_s** outputs;
+	long					 threads;
+} batch_job_s;
+
+static bool batch_run(void* _job)
+{
+	batch_job_s* job = _job;
+	return png_decode_batch(job->inputs, IMAGE_COUNT, job->outputs, job->threads, NULL);
+}
+
+static void batch_after(void* _job, const bool _fastest)
+{
+	batch_job_s* job = _job;
+	for(int i = 0; i < IMAGE_COUNT; ++i) {
+		free_decoded_png(job->outputs[i]);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	logger_init(LOG_ERROR, "logs/bench_batch");
+
+	long max_threads = argc > 1 ? atol(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+	max_threads = max_threads < 1 ? 1 : max_threads;
+
+	//a handful of distinct thumbnails, repeated - every input is decoded independently anyway
+	static const uint32_t sizes[] = {64, 96, 128, 160, 200, 256, 320, 400};
+	corpus_image_s images[sizeof(sizes) / sizeof(sizes[0])];
+	for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		const corpus_spec_s spec = {
+			.width = sizes[i], .height = sizes[i] * 3 / 4, .color_type = i % 2 ? 6 : 2, .bit_depth = 8,
+			.filter_mix = MIX_ADAPTIVE, .compression_level = 6,
+		};
+		corpus_generate(&spec, &images[i]);
+	}
+
+	png_batch_input_s* inputs = malloc(sizeof(png_batch_input_s) * IMAGE_COUNT);
+	png_external_context_s** outputs = malloc(sizeof(png_external_context_s*) * IMAGE_COUNT);
+	for(int i = 0; i < IMAGE_COUNT; ++i) {
+		//big ones are bunched up at the end, so the last worker's share is the heaviest
+		const size_t image = (size_t)i * (sizeof(sizes) / sizeof(sizes[0])) / IMAGE_COUNT;
+		inputs[i].data = (char*)images[image].png.data;
+		inputs[i].size = images[image].png.size;
+	}
+
+	printf("%8s %14s %12s %10s %12s\n", "threads", "images / s", "ms / batch", "speedup", "efficiency");
+
+	double single_thread = 0;
+	//powers of two, then the maximum itself
+	for(long threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+		bool succeeded = true;
+		batch_job_s batch = {.inputs = inputs, .outputs = outputs, .threads = threads};
+		const bench_job_s job = {.run = batch_run, .after = batch_after, .arg = &batch};
+		const double best = bench_best_of(&job, REPETITIONS, &succeeded);
+		if(threads == 1) {
+			single_thread = best;
+		}
+
+		printf("%8ld %14.0f %12.2f %9.2fx %11.0f%%%s\n", threads, IMAGE_COUNT / best, best * 1e3,
+				single_thread / best, single_thread / best / threads * 100, succeeded ? "" : "  (decode failed)");
+		if(threads == max_threads) {
+			break;
+		}
+	}
+
+	free(inputs);
+	free(outputs);
+	for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		corpus_free(&images[i]);
+	}
+	logger_close();
+	return 0;
+}
+
+#undef IMAGE_COUNT
+#undef REPETITIONS
@@ -0,0 +1,186 @@
+//chunk walk cost as a function of the number of IDAT chunks
+//same pixels every time, only the way the zlib stream is split changes - time, stack depth
+//and allocation count should stay flat no matter how many chunks there are
+//second table puts ancillary chunks in front of the data instead - skipped, or handed to a caller handler that
+//wants the text ones - ns per chunk is what each of them adds on top of the image alone, from medians of many runs, and
+//only where the chunks take at least as long as the image itself - below that the difference is mostly run to run noise
+
+#include "common.h"
+#include "png_decoder.h"
+#include "logger.h"
+#include "zlib.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define IMAGE_WIDTH		256
+#define IMAGE_HEIGHT	256
+#define CHANNELS		3
+#define REPETITIONS		20
+//medians the ns per chunk column is worked out from
+#define MEDIAN_REPETITIONS 101
+//share of the image alone's decode time the chunks have to add before ns per chunk means anything - a thousand
+//chunks add a tenth or two, which whole decode medians still wander by between runs
+#define MIN_CHUNK_SHARE 1.0
+#define TEXT_SIZE		64
+
+typedef struct {
+	png_decoder_s* decoder;
+	bench_buffer_s* png;
+	bool succeeded;
+} decode_job_s;
+
+static void build_png(bench_buffer_s* _png, const uint8_t* _compressed, const size_t _compressed_size, const uint _chunks)
+{
+	bench_write_signature(_png);
+	bench_write_ihdr(_png, IMAGE_WIDTH, IMAGE_HEIGHT, 8, 2, 0);
+
+	const size_t piece = (_compressed_size + _chunks - 1) / _chunks;
+	for(size_t offset = 0; offset < _compressed_size; offset += piece) {
+		const size_t size = offset + piece > _compressed_size ? _compressed_size - offset : piece;
+		bench_write_chunk(_png, "IDAT", _compressed + offset, size);
+	}
+	bench_write_chunk(_png, "IEND", NULL, 0);
+}
+
+static void build_metadata_png(bench_buffer_s* _png, const uint8_t* _compressed, const size_t _compressed_size, const uint _chunks)
+{
+	//the mix a camera or an editor leaves behind - text, colour space bits and a private chunk nobody knows
+	static const char* types[] = {"tEXt", "gAMA", "prVt", "sRGB"};
+	static const uint32_t sizes[] = {TEXT_SIZE, 4, 256, 1};
+	static const uint8_t payload[256] = "Comment";
+	bench_write_signature(_png);
+	bench_write_ihdr(_png, IMAGE_WIDTH, IMAGE_HEIGHT, 8, 2, 0);
+	for(uint c = 0; c < _chunks; ++c) {
+		bench_write_chunk(_png, types[c % 4], payload, sizes[c % 4]);
+	}
+	bench_write_chunk(_png, "IDAT", _compressed, _compressed_size);
+	bench_write_chunk(_png, "IEND", NULL, 0);
+}
+
+static void decode_job(void* _job)
+{
+	decode_job_s* job = _job;
+	png_external_context_s* decoded = png_decoder_decode(job->decoder, (char*)job->png->data, job->png->size);
+	job->succeeded = decoded != NULL;
+	free_decoded_png(decoded);
+}
+
+static bool count_text(void* _user, const uint32_t _type, const uint8_t* _data, const uint32_t _size)
+{
+	(void)_type;
+	(void)_data;
+	*(uint64_t*)_user += _size;
+	return true;
+}
+
+static bool decode_run(void* _job)
+{
+	decode_job(_job);
+	return ((decode_job_s*)_job)->succeeded;
+}
+
+static double time_decodes(decode_job_s* _job)
+{
+	//first decode grows the scratch buffers
+	bool succeeded = decode_run(_job);
+	const bench_job_s job = {.run = decode_run, .arg = _job};
+	const double median = bench_median_of(&job, MEDIAN_REPETITIONS, &succeeded);
+	_job->succeeded = succeeded;
+	return median;
+}
+
+int main()
+{
+	logger_init(LOG_ERROR, "logs/bench_chunks");
+
+	//noisy pixels, so the compressed stream is long enough to be cut into 10k pieces
+	const size_t raw_size = (size_t)IMAGE_HEIGHT * (IMAGE_WIDTH * CHANNELS + 1);
+	uint8_t* raw = malloc(raw_size);
+	uint32_t seed = 12345;
+	for(size_t i = 0; i < raw_size; ++i) {
+		seed = seed * 1103515245 + 12345;
+		raw[i] = (seed >> 16) & 0xff;
+	}
+	for(size_t y = 0; y < IMAGE_HEIGHT; ++y) {
+		raw[y * (IMAGE_WIDTH * CHANNELS + 1)] = y % 5;
+	}
+
+	uLongf compressed_size = compressBound(raw_size);
+	uint8_t* compressed = malloc(compressed_size);
+	compress2(compressed, &compressed_size, raw, raw_size, 6);
+
+	printf("%8s %10s %14s %12s %14s %12s\n", "chunks", "png bytes", "us / decode", "allocs", "alloc bytes", "stack bytes");
+
+	static const uint chunk_counts[] = {1, 10, 100, 1000, 10000};
+	for(size_t i = 0; i < sizeof(chunk_counts) / sizeof(chunk_counts[0]); ++i) {
+		bench_buffer_s png = {0};
+		build_png(&png, compressed, compressed_size, chunk_counts[i]);
+
+		decode_job_s job = {.decoder = png_decoder_create(NULL), .png = &png};
+
+		//first decode grows the scratch buffers, everything after that should only allocate the result
+		decode_job(&job);
+
+		bench_alloc_reset();
+		decode_job(&job);
+		const bench_alloc_stats_s allocs = bench_alloc_get();
+
+		const size_t stack = bench_stack_usage(decode_job, &job);
+
+		const double start = bench_now();
+		for(int r = 0; r < REPETITIONS; ++r) {
+			decode_job(&job);
+		}
+		const double elapsed = (bench_now() - start) / REPETITIONS;
+
+		printf("%8u %10zu %14.1f %12llu %14llu %12zu%s\n", chunk_counts[i], png.size, elapsed * 1e6,
+				(unsigned long long)allocs.count, (unsigned long long)allocs.bytes, stack,
+				job.succeeded ? "" : "  (decode failed)");
+
+		png_decoder_destroy(job.decoder);
+		bench_buffer_free(&png);
+	}
+
+	printf("\n%8s %10s %14s %14s %14s\n", "ancillary", "png bytes", "us skipped", "us handled", "ns / chunk");
+	static const uint ancillary_counts[] = {0, 10, 100, 1000, 10000};
+	double baseline = 0;
+	for(size_t i = 0; i < sizeof(ancillary_counts) / sizeof(ancillary_counts[0]); ++i) {
+		bench_buffer_s png = {0};
+		build_metadata_png(&png, compressed, compressed_size, ancillary_counts[i]);
+
+		uint64_t text_bytes = 0;
+		const png_chunk_handler_s handler = {.type = PNG_CHUNK_TYPE('t', 'E', 'X', 't'), .handle = count_text, .user = &text_bytes};
+		const png_decoder_options_s options = {.chunk_handlers = &handler, .chunk_handler_count = 1};
+		decode_job_s skipped = {.decoder = png_decoder_create(NULL), .png = &png};
+		decode_job_s handled = {.decoder = png_decoder_create(&options), .png = &png};
+		const double skipped_seconds = time_decodes(&skipped);
+		const double handled_seconds = time_decodes(&handled);
+		baseline = i == 0 ? skipped_seconds : baseline;
+
+		const bool text_seen = text_bytes == (uint64_t)(MEDIAN_REPETITIONS + 1) * ((ancillary_counts[i] + 3) / 4) * TEXT_SIZE;
+		char per_chunk[16] = "-";
+		if(skipped_seconds - baseline > baseline * MIN_CHUNK_SHARE) {
+			snprintf(per_chunk, sizeof(per_chunk), "%.1f", (skipped_seconds - baseline) * 1e9 / ancillary_counts[i]);
+		}
+		printf("%8u %10zu %14.1f %14.1f %14s%s\n", ancillary_counts[i], png.size, skipped_seconds * 1e6, handled_seconds * 1e6,
+				per_chunk, skipped.succeeded && handled.succeeded && text_seen ? "" : "  (decode failed)");
+
+		png_decoder_destroy(handled.decoder);
+		png_decoder_destroy(skipped.decoder);
+		bench_buffer_free(&png);
+	}
+
+	free(compressed);
+	free(raw);
+	logger_close();
+	return 0;
+}
+
+#undef IMAGE_WIDTH
+#undef IMAGE_HEIGHT
+#undef CHANNELS
+#undef REPETITIONS
+#undef MEDIAN_REPETITIONS
+#undef MIN_CHUNK_SHARE
+#undef TEXT_SIZE
@@ -0,0 +1,293 @@
+//decode throughput over a generated corpus, broken down by stage
+//every stage is timed on its own, on exactly the bytes the decoder sees:
+//  crc      - png_crc32 over type and data of every chunk, MB/s counted in png bytes
+//  inflate  - png_inflate_builtin over the concatenated IDAT payloads, MB/s counted in inflated bytes
+//  unfilter - unfilter_row over every inflated scanline, MB/s counted in inflated bytes
+//  rest     - whole decode minus the above: chunk walk, sample expansion and allocation
+//whole decode MB/s is counted in output bytes - ns/px is per image pixel everywhere
+//usage: bench_decode [-full] [-csv]   (-full adds sizes up to 16k x 16k, needs a few GB of memory)
+
+#include "common.h"
+#include "corpus.h"
+#include "png_decoder.h"
+#include "png_filter.h"
+#include "png_crc.h"
+#include "png_inflate.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ADAM7_PASSES	7
+#define MIN_BENCH_TIME	0.2		//seconds every stage gets measured for, at least
+#define MAX_REPETITIONS 1000
+
+typedef enum {
+	STAGE_TOTAL = 0,
+	STAGE_CRC,
+	STAGE_INFLATE,
+	STAGE_UNFILTER,
+	STAGE_REST,
+	STAGE_SIZE
+} stage_e;
+
+typedef struct {
+	const corpus_spec_s* spec;
+	corpus_image_s* image;
+	png_decoder_s*	decoder;
+	uint8_t*		filtered;	//inflated stream, filters still applied
+	uint8_t*		work;		//copy of filtered that gets unfiltered in place
+	bool			succeeded;
+} stage_job_s;
+
+////////////////////////// global variables
+static const uint8_t adam7_start_x[ADAM7_PASSES] = {0, 4, 0, 2, 0, 1, 0};
+static const uint8_t adam7_start_y[ADAM7_PASSES] = {0, 0, 4, 0, 2, 0, 1};
+static const uint8_t adam7_step_x[ADAM7_PASSES]	 = {8, 8, 4, 4, 2, 2, 1};
+static const uint8_t adam7_step_y[ADAM7_PASSES]	 = {8, 8, 8, 4, 4, 2, 2};
+
+static const char* stage_names[STAGE_SIZE] = {"total", "crc", "inflate", "unfilter", "rest"};
+static bool csv_output;
+
+////////////////////////// stages
+static void run_decode(stage_job_s* _job)
+{
+	png_external_context_s* decoded = png_decoder_decode(_job->decoder, (char*)_job->image->png.data, _job->image->png.size);
+	_job->succeeded &= decoded != NULL;
+	free_decoded_png(decoded);
+}
+
+static void run_crc(stage_job_s* _job)
+{
+	//same walk the decoder does, minus everything else
+	const uint8_t* png = _job->image->png.data;
+	size_t offset = 8;
+	volatile uint32_t sink = 0;
+	while(offset + 12 <= _job->image->png.size) {
+		const uint32_t length = ((uint32_t)png[offset] << 24) | ((uint32_t)png[offset + 1] << 16) |
+								((uint32_t)png[offset + 2] << 8) | png[offset + 3];
+		sink ^= png_crc32(0, png + offset + 4, length + 4);
+		offset += length + 12;
+	}
+	(void)sink;
+}
+
+static void run_inflate(stage_job_s* _job)
+{
+	//what in memory decodes inflate with - the payloads are gathered where they are, one piece is the same work
+	const png_span_s compressed = {.data = _job->image->compressed.data, .size = _job->image->compressed.size};
+	_job->succeeded &= png_inflate_builtin(NULL, &compressed, 1, _job->filtered, _job->image->filtered_size);
+}
+
+static void run_unfilter(stage_job_s* _job)
+{
+	const corpus_spec_s* spec = _job->spec;
+	const uint8_t channels = spec->color_type == 2 ? 3 : spec->color_type == 4 ? 2 : spec->color_type == 6 ? 4 : 1;
+	const size_t  bits_per_pixel = (size_t)channels * spec->bit_depth;
+	const uint8_t bpp = bits_per_pixel < 8 ? 1 : bits_per_pixel / 8;
+	static const uint8_t zero_row[16384 * 8 + 64];
+
+	uint8_t* scanline = _job->work;
+	const uint passes = spec->interlace ? ADAM7_PASSES : 1;
+	for(uint pass = 0; pass < passes; ++pass) {
+		const uint32_t start_x = spec->interlace ? adam7_start_x[pass] : 0;
+		const uint32_t start_y = spec->interlace ? adam7_start_y[pass] : 0;
+		const uint32_t step_x  = spec->interlace ? adam7_step_x[pass]  : 1;
+		const uint32_t step_y  = spec->interlace ? adam7_step_y[pass]  : 1;
+		const uint32_t width  = spec->width  > start_x ? (spec->width  - start_x + step_x - 1) / step_x : 0;
+		const uint32_t height = spec->height > start_y ? (spec->height - start_y + step_y - 1) / step_y : 0;
+		if(width == 0 || height == 0) {
+			continue;
+		}
+		const size_t row_size = ((size_t)width * bits_per_pixel + 7) / 8;
+		const uint8_t* prev = zero_row;
+		for(uint32_t y = 0; y < height; ++y) {
+			_job->succeeded &= unfilter_row(scanline[0], scanline + 1, prev, row_size, bpp);
+			prev = scanline + 1;
+			scanline += row_size + 1;
+		}
+	}
+}
+
+static double measure(void (*_stage)(stage_job_s*), stage_job_s* _job, const bool _refresh_work)
+{
+	//one warm up run, then enough repetitions to fill MIN_BENCH_TIME
+	if(_refresh_work) {
+		memcpy(_job->work, _job->filtered, _job->image->filtered_size);
+	}
+	double start = bench_now();
+	_stage(_job);
+	const double first = bench_now() - start;
+
+	int repetitions = first <= 0 ? MAX_REPETITIONS : (int)(MIN_BENCH_TIME / first) + 1;
+	repetitions = repetitions > MAX_REPETITIONS ? MAX_REPETITIONS : repetitions;
+
+	double elapsed = 0;
+	for(int r = 0; r < repetitions; ++r) {
+		if(_refresh_work) {
+			//unfilter works in place - copying fresh input back is not part of the stage
+			memcpy(_job->work, _job->filtered, _job->image->filtered_size);
+		}
+		start = bench_now();
+		_stage(_job);
+		elapsed += bench_now() - start;
+	}
+	return elapsed / repetitions;
+}
+
+////////////////////////// reporting
+static void print_header(const char* _section)
+{
+	if(csv_output) {
+		static bool printed = false;
+		if(!printed) {
+			printf("section,config,png_bytes,idat_count");
+			for(int s = 0; s < STAGE_SIZE; ++s) {
+				printf(",%s_ns_per_px,%s_mb_s", stage_names[s], stage_names[s]);
+			}
+			printf("\n");
+			printed = true;
+		}
+		return;
+	}
+	printf("\n== %s\n", _section);
+	printf("%-32s %9s |", "config", "png KB");
+	for(int s = 0; s < STAGE_SIZE; ++s) {
+		printf(" %8s %-8s|", stage_names[s], "ns/px");
+	}
+	printf("\n%-32s %9s |", "", "");
+	for(int s = 0; s < STAGE_SIZE; ++s) {
+		printf(" %8s %-8s|", "MB/s", "");
+	}
+	printf("\n");
+}
+
+static void run_config(const char* _section, const corpus_spec_s* _spec)
+{
+	char label[64];
+	corpus_describe(_spec, label, sizeof(label));
+
+	corpus_image_s image;
+	if(!corpus_generate(_spec, &image)) {
+		printf("%-32s could not generate\n", label);
+		return;
+	}
+
+	stage_job_s job = {
+		.spec	   = _spec,
+		.image	   = &image,
+		.decoder   = png_decoder_create(NULL),
+		.filtered  = malloc(image.filtered_size),
+		.work	   = malloc(image.filtered_size),
+		.succeeded = true,
+	};
+
+	double seconds[STAGE_SIZE];
+	seconds[STAGE_TOTAL]	= measure(run_decode, &job, false);
+	const bool decoded		= job.succeeded;
+	seconds[STAGE_CRC]		= measure(run_crc, &job, false);
+	seconds[STAGE_INFLATE]	= measure(run_inflate, &job, false);
+	seconds[STAGE_UNFILTER] = measure(run_unfilter, &job, true);
+	seconds[STAGE_REST]		= seconds[STAGE_TOTAL] - seconds[STAGE_CRC] - seconds[STAGE_INFLATE] - seconds[STAGE_UNFILTER];
+	if(seconds[STAGE_REST] < 0) {
+		seconds[STAGE_REST] = 0;
+	}
+
+	const double pixels = (double)_spec->width * _spec->height;
+	const double stage_bytes[STAGE_SIZE] = {
+		[STAGE_TOTAL]	 = image.decoded_size,
+		[STAGE_CRC]		 = image.png.size,
+		[STAGE_INFLATE]	 = image.filtered_size,
+		[STAGE_UNFILTER] = image.filtered_size,
+		[STAGE_REST]	 = image.decoded_size,
+	};
+
+	if(csv_output) {
+		printf("%s,%s,%zu,%u", _section, label, image.png.size, image.idat_count);
+	} else {
+		printf("%-32s %9.1f |", label, image.png.size / 1024.0);
+	}
+	for(int s = 0; s < STAGE_SIZE; ++s) {
+		const double ns_per_pixel = seconds[s] * 1e9 / pixels;
+		const double mb_per_second = seconds[s] > 0 ? stage_bytes[s] / seconds[s] / (1024 * 1024) : 0;
+		if(csv_output) {
+			printf(",%.3f,%.1f", ns_per_pixel, mb_per_second);
+		} else {
+			printf(" %8.2f %-8.0f|", ns_per_pixel, mb_per_second);
+		}
+	}
+	printf("%s\n", decoded ? "" : (csv_output ? ",decode failed" : "  (decode failed)"));
+	fflush(stdout);
+
+	png_decoder_destroy(job.decoder);
+	free(job.filtered);
+	free(job.work);
+	corpus_free(&image);
+}
+
+int main(int argc, char** argv)
+{
+	bool full = false;
+	for(int i = 1; i < argc; ++i) {
+		full	   |= strcmp(argv[i], "-full") == 0;
+		csv_output |= strcmp(argv[i], "-csv") == 0;
+	}
+
+	logger_init(LOG_ERROR, "logs/bench_decode");
+	if(!csv_output) {
+		printf("unfilter implementation: %d, crc implementation: %d\n", unfilter_get_impl(), png_crc32_get_impl());
+	}
+
+	//every colour type with every bit depth it allows, plain and interlaced
+	static const uint8_t formats[][2] = {
+		{0, 1}, {0, 2}, {0, 4}, {0, 8}, {0, 16},
+		{2, 8}, {2, 16},
+		{3, 1}, {3, 2}, {3, 4}, {3, 8},
+		{4, 8}, {4, 16},
+		{6, 8}, {6, 16},
+	};
+	print_header("formats");
+	for(size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+		for(uint8_t interlace = 0; interlace <= 1; ++interlace) {
+			const corpus_spec_s spec = {
+				.width = 512, .height = 512, .color_type = formats[f][0], .bit_depth = formats[f][1],
+				.interlace = interlace, .filter_mix = MIX_ADAPTIVE, .compression_level = 6,
+			};
+			run_config("formats", &spec);
+		}
+	}
+
+	//one filter for the whole image, for every filter, at the pixel sizes the kernels care about
+	static const uint8_t filter_formats[][2] = {{0, 8}, {4, 8}, {2, 8}, {6, 8}, {2, 16}, {6, 16}};
+	print_header("filters");
+	for(size_t f = 0; f < sizeof(filter_formats) / sizeof(filter_formats[0]); ++f) {
+		for(int mix = 0; mix < MIX_SIZE; ++mix) {
+			const corpus_spec_s spec = {
+				.width = 1024, .height = 1024, .color_type = filter_formats[f][0], .bit_depth = filter_formats[f][1],
+				.filter_mix = mix, .compression_level = 6,
+			};
+			run_config("filters", &spec);
+		}
+	}
+
+	static const uint32_t sizes[] = {16, 64, 256, 1024, 2048, 4096, 8192, 16384};
+	const size_t size_count = full ? sizeof(sizes) / sizeof(sizes[0]) : 5;
+	print_header("sizes");
+	for(size_t s = 0; s < size_count; ++s) {
+		for(uint8_t color_type = 2; color_type <= 6; color_type += 4) {
+			const corpus_spec_s spec = {
+				.width = sizes[s], .height = sizes[s], .color_type = color_type, .bit_depth = 8,
+				.filter_mix = MIX_ADAPTIVE, .compression_level = 6,
+			};
+			run_config("sizes", &spec);
+		}
+	}
+
+	logger_close();
+	return 0;
+}
+
+#undef ADAM7_PASSES
+#undef MIN_BENCH_TIME
+#undef MAX_REPETITIONS
@@ -0,0 +1,151 @@
+//encode throughput against the number of deflate threads, with what the full flushes between blocks cost in size
+//one thread is a single block, which is what plain serial zlib writes - the filter columns time adaptive filter
+//selection alone, simd against the scalar reference, in input bytes per second
+
+#include "common.h"
+#include "corpus.h"
+#include "png_decoder.h"
+#include "png_encoder.h"
+#include "png_filter.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define REPETITIONS 3
+
+typedef struct {
+	const png_image_s*			 image;
+	const png_encoder_options_s* options;
+	png_encoded_s*				 encoded;
+	size_t						 size;	//of the last encode
+} encode_job_s;
+
+typedef struct {
+	const png_image_s* image;
+	uint8_t*		   out;
+	size_t			   row_size;
+	uint8_t			   bpp;
+	bool			   simd;
+} filter_job_s;
+
+static bool encode_run(void* _job)
+{
+	encode_job_s* job = _job;
+	job->encoded = encode_to_png(job->image, job->options);
+	return job->encoded != NULL;
+}
+
+static void encode_after(void* _job, const bool _fastest)
+{
+	encode_job_s* job = _job;
+	job->size = job->encoded != NULL ? job->encoded->size : 0;
+	free_encoded_png(job->encoded);
+	job->encoded = NULL;
+}
+
+static bool filter_run(void* _job)
+{
+	const filter_job_s* job = _job;
+	const png_image_s* image = job->image;
+	for(uint32_t y = 1; y < image->height; ++y) {
+		const uint8_t* row = image->pixels + (size_t)y * image->stride;
+		if(job->simd) {
+			(void)filter_row_adaptive(row, row - image->stride, job->out, job->row_size, job->bpp);
+		} else {
+			(void)filter_row_adaptive_scalar(row, row - image->stride, job->out, job->row_size, job->bpp);
+		}
+	}
+	return true;
+}
+
+static double best_encode(const png_image_s* _image, const png_encoder_options_s* _options, size_t* _size, bool* _succeeded)
+{
+	encode_job_s encode = {.image = _image, .options = _options};
+	const bench_job_s job = {.run = encode_run, .after = encode_after, .arg = &encode};
+	const double best = bench_best_of(&job, REPETITIONS, _succeeded);
+	*_size = encode.size;
+	return best;
+}
+
+static double best_filter(const png_image_s* _image, uint8_t* _out, const size_t _row_size, const uint8_t _bpp, const bool _simd)
+{
+	filter_job_s filter = {.image = _image, .out = _out, .row_size = _row_size, .bpp = _bpp, .simd = _simd};
+	const bench_job_s job = {.run = filter_run, .arg = &filter};
+	bool succeeded = true;
+	return bench_best_of(&job, REPETITIONS, &succeeded);
+}
+
+static void run_config(const corpus_spec_s* _spec)
+{
+	char label[64];
+	corpus_describe(_spec, label, sizeof(label));
+
+	corpus_image_s corpus;
+	if(!corpus_generate(_spec, &corpus)) {
+		printf("%-32s could not generate\n", label);
+		return;
+	}
+	//8 bit native pixels are the scanlines as they were before filtering
+	png_external_context_s* decoded = decode_from_png((char*)corpus.png.data, corpus.png.size);
+	if(decoded == NULL) {
+		printf("%-32s could not decode\n", label);
+		corpus_free(&corpus);
+		return;
+	}
+
+	const png_image_s image = {
+		.pixels = decoded->pixels, .stride = decoded->stride, .width = decoded->width, .height = decoded->height,
+		.color_type = _spec->color_type, .bit_depth = _spec->bit_depth,
+	};
+	const size_t  row_size	 = (size_t)decoded->width * decoded->channels;
+	const size_t  input_size = row_size * decoded->height;
+	uint8_t* filtered = malloc(row_size + 1);
+	const double simd	= best_filter(&image, filtered, row_size, decoded->channels, true);
+	const double scalar = best_filter(&image, filtered, row_size, decoded->channels, false);
+	free(filtered);
+
+	static const uint threads[] = {1, 2, 4, 8, 0};
+	size_t serial_size = 0;
+	for(size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); ++t) {
+		const png_encoder_options_s options = {.compression_level = _spec->compression_level, .threads = threads[t]};
+		size_t size = 0;
+		bool succeeded = true;
+		const double seconds = best_encode(&image, &options, &size, &succeeded);
+		serial_size = t == 0 ? size : serial_size;
+		char thread_text[8];
+		snprintf(thread_text, sizeof(thread_text), threads[t] == 0 ? "all" : "%u", threads[t]);
+		printf("%-32s %-7s %10.2f %10.1f %12zu %+8.2f%% %10.2f %10.2f%s\n", label, thread_text, seconds * 1e3, input_size / seconds / 1e6,
+				size, 100.0 * ((double)size - serial_size) / serial_size, input_size / simd / 1e9, input_size / scalar / 1e9,
+				succeeded ? "" : "  (encode failed)");
+		fflush(stdout);
+	}
+
+	free_decoded_png(decoded);
+	corpus_free(&corpus);
+}
+
+int main()
+{
+	logger_init(LOG_ERROR, "logs/bench_encode");
+	static const char* impl_names[] = {"scalar", "sse2", "ssse3", "avx2"};
+	printf("filter selection kernels: %s\n", impl_names[filter_get_impl()]);
+	printf("%-32s %-7s %10s %10s %12s %9s %10s %10s\n", "config", "threads", "ms", "MB/s in", "bytes", "size", "filt GB/s", "scalar");
+
+	static const uint32_t sizes[] = {1024, 4096};
+	static const uint8_t formats[][2] = {{2, 8}, {6, 8}};
+	for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+		for(size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+			const corpus_spec_s spec = {
+				.width = sizes[s], .height = sizes[s], .color_type = formats[f][0], .bit_depth = formats[f][1],
+				.filter_mix = MIX_ADAPTIVE, .compression_level = 6,
+			};
+			run_config(&spec);
+		}
+	}
+
+	logger_close();
+	return 0;
+}
+
+#undef REPETITIONS
@@ -0,0 +1,168 @@
+//push decoding in fragments the size of network reads, against collecting every fragment first and decoding the whole
+//file once the last one is in - "tail" is the time from the last fragment to the finished image, which is what is
+//left once transfer is over, and "first row" is how much of the file had been fed when the first row came out
+//allocations are per decode, after the decoder's scratch has grown to the image
+
+#include "common.h"
+#include "corpus.h"
+#include "png_decoder.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REPETITIONS 5
+
+typedef struct {
+	size_t fed;				//bytes handed over so far
+	size_t first_row_fed;	//fed when on_rows was called for the first time, 0 until then
+} feed_progress_s;
+
+typedef struct {
+	double seconds;
+	double tail;
+	double first_row;	//fraction of the file
+	bench_alloc_stats_s allocations;
+	bool succeeded;
+} feed_run_s;
+
+static void on_rows(void* _user, const uint _first, const uint _count, const png_external_context_s* _image)
+{
+	feed_progress_s* progress = _user;
+	if(progress->first_row_fed == 0) {
+		progress->first_row_fed = progress->fed;
+	}
+}
+
+static png_external_context_s* decode_pushed(png_decoder_s* _decoder, const bench_buffer_s* _png, const size_t _fragment,
+		feed_progress_s* _progress, double* _last_fed)
+{
+	png_decoder_begin_push(_decoder);
+	png_feed_e status = PNG_FEED_MORE;
+	for(size_t offset = 0; offset < _png->size && status == PNG_FEED_MORE; offset += _fragment) {
+		const size_t size = _png->size - offset < _fragment ? _png->size - offset : _fragment;
+		_progress->fed	  = offset + size;
+		*_last_fed		  = bench_now();
+		status			  = png_feed(_decoder, _png->data + offset, size);
+	}
+	return png_feed_finish(_decoder);
+}
+
+static png_external_context_s* decode_collected(png_decoder_s* _decoder, const bench_buffer_s* _png, const size_t _fragment,
+		double* _last_fed)
+{
+	//what a caller without push input does - grow a buffer by every fragment and decode it once it is all there
+	bench_buffer_s collected = {0};
+	for(size_t offset = 0; offset < _png->size; offset += _fragment) {
+		const size_t size = _png->size - offset < _fragment ? _png->size - offset : _fragment;
+		bench_buffer_append(&collected, _png->data + offset, size);
+	}
+	*_last_fed = bench_now();
+	png_external_context_s* decoded = png_decoder_decode(_decoder, (char*)collected.data, collected.size);
+	bench_buffer_free(&collected);
+	return decoded;
+}
+
+typedef struct {
+	png_decoder_s*			decoder;
+	const corpus_image_s*	image;
+	size_t					fragment;
+	bool					push;
+	feed_progress_s*		progress;
+	png_external_context_s* decoded;
+	double					last_fed;	//of the current run
+	double					end;
+	bench_alloc_stats_s		allocations;
+	feed_run_s				fastest;
+} decode_job_s;
+
+static bool decode_run(void* _job)
+{
+	decode_job_s* job = _job;
+	*job->progress = (feed_progress_s){0};
+	bench_alloc_reset();
+	job->decoded = job->push ? decode_pushed(job->decoder, &(job->image->png), job->fragment, job->progress, &(job->last_fed)) :
+							   decode_collected(job->decoder, &(job->image->png), job->fragment, &(job->last_fed));
+	job->end		 = bench_now();
+	job->allocations = bench_alloc_get();
+	return job->decoded != NULL;
+}
+
+static void decode_after(void* _job, const bool _fastest)
+{
+	decode_job_s* job = _job;
+	free_decoded_png(job->decoded);
+	job->decoded = NULL;
+	if(_fastest) {
+		const size_t size		 = job->image->png.size;
+		job->fastest.tail		 = job->end - job->last_fed;
+		job->fastest.first_row	 = (double)(job->push ? job->progress->first_row_fed : size) / size;
+		job->fastest.allocations = job->allocations;
+	}
+}
+
+static feed_run_s best_decode(png_decoder_s* _decoder, const corpus_image_s* _image, const size_t _fragment, const bool _push,
+		feed_progress_s* _progress)
+{
+	decode_job_s decode = {.decoder = _decoder, .image = _image, .fragment = _fragment, .push = _push, .progress = _progress};
+	const bench_job_s job = {.run = decode_run, .after = decode_after, .arg = &decode};
+	bool succeeded = true;
+	decode.fastest.seconds	 = bench_best_of(&job, REPETITIONS, &succeeded);
+	decode.fastest.succeeded = succeeded;
+	return decode.fastest;
+}
+
+static void run_config(const corpus_spec_s* _spec)
+{
+	char label[64];
+	corpus_describe(_spec, label, sizeof(label));
+
+	corpus_image_s image;
+	if(!corpus_generate(_spec, &image)) {
+		printf("%-32s could not generate\n", label);
+		return;
+	}
+
+	feed_progress_s progress;
+	const png_decoder_options_s options = {.on_rows = on_rows, .on_rows_user = &progress};
+	png_decoder_s* decoder = png_decoder_create(&options);
+
+	//one tcp segment, a typical socket read and a large one
+	static const size_t fragments[] = {1460, 16 * 1024, 256 * 1024};
+	for(size_t f = 0; f < sizeof(fragments) / sizeof(fragments[0]); ++f) {
+		for(int push = 0; push < 2; ++push) {
+			const feed_run_s run = best_decode(decoder, &image, fragments[f], push, &progress);
+			printf("%-32s %-10s %8zu %10.2f %10.3f %9.1f%% %8llu %12llu%s\n", label, push ? "push" : "collected", fragments[f],
+					run.seconds * 1e3, run.tail * 1e3, 100.0 * run.first_row, (unsigned long long)run.allocations.count,
+					(unsigned long long)run.allocations.bytes, run.succeeded ? "" : "  (decode failed)");
+			fflush(stdout);
+		}
+	}
+
+	png_decoder_destroy(decoder);
+	corpus_free(&image);
+}
+
+int main()
+{
+	logger_init(LOG_ERROR, "logs/bench_feed");
+	printf("%-32s %-10s %8s %10s %10s %10s %8s %12s\n", "config", "input", "fragment", "ms", "tail ms", "first row", "allocs", "bytes");
+
+	static const uint32_t sizes[] = {512, 2048};
+	static const uint8_t formats[][2] = {{2, 8}, {6, 8}};
+	for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+		for(size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+			const corpus_spec_s spec = {
+				.width = sizes[s], .height = sizes[s], .color_type = formats[f][0], .bit_depth = formats[f][1],
+				.filter_mix = MIX_ADAPTIVE, .compression_level = 6,
+			};
+			run_config(&spec);
+		}
+	}
+
+	logger_close();
+	return 0;
+}
+
+#undef REPETITIONS
@@ -0,0 +1,122 @@
+//decode straight into every output format, against the native decode and against converting its result in a second sweep
+//conversion runs on every row right after it is unfiltered, so "fused" should cost well under what "separate" adds on
+//top of native - the separate sweep only exists for 8 bit non-indexed sources, whose native pixels are the scanlines
+
+#include "common.h"
+#include "corpus.h"
+#include "png_decoder.h"
+#include "png_convert.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define REPETITIONS 3
+#define FORMATS		7
+
+static const char* format_names[FORMATS] = {"native", "rgba8", "bgra8", "rgb8", "gray8", "rgba16", "rgba8 premul"};
+
+typedef struct {
+	png_decoder_s*			decoder;
+	const corpus_image_s*	image;
+	const png_converter_s*	separate;	//converts the native result as a second pass, NULL for none
+	png_external_context_s* decoded;
+} decode_job_s;
+
+static bool decode_run(void* _job)
+{
+	decode_job_s* job = _job;
+	png_external_context_s* decoded = png_decoder_decode(job->decoder, (char*)job->image->png.data, job->image->png.size);
+	if(decoded != NULL && job->separate != NULL) {
+		//output is allocated and faulted in per image, same as the decoder does for the fused one
+		const size_t stride = (size_t)decoded->width * 8;
+		uint8_t* out = malloc(stride * decoded->height);
+		for(uint y = 0; y < decoded->height; ++y) {
+			png_convert_row(job->separate, PNG_ROW(decoded, y), out + y * stride, 0, decoded->width);
+		}
+		free(out);
+	}
+	job->decoded = decoded;
+	return decoded != NULL;
+}
+
+static void decode_after(void* _job, const bool _fastest)
+{
+	decode_job_s* job = _job;
+	free_decoded_png(job->decoded);
+	job->decoded = NULL;
+}
+
+static double best_decode(png_decoder_s* _decoder, const corpus_image_s* _image, const png_converter_s* _separate, bool* _succeeded)
+{
+	decode_job_s decode = {.decoder = _decoder, .image = _image, .separate = _separate};
+	const bench_job_s job = {.run = decode_run, .after = decode_after, .arg = &decode};
+	return bench_best_of(&job, REPETITIONS, _succeeded);
+}
+
+static void run_config(const corpus_spec_s* _spec, png_decoder_s** _decoders)
+{
+	char label[64];
+	corpus_describe(_spec, label, sizeof(label));
+
+	corpus_image_s image;
+	if(!corpus_generate(_spec, &image)) {
+		printf("%-32s could not generate\n", label);
+		return;
+	}
+
+	const bool separable = _spec->bit_depth == 8 && _spec->color_type != 3;
+
+	bool succeeded = true;
+	const double native = best_decode(_decoders[PNG_FORMAT_NATIVE], &image, NULL, &succeeded);
+	for(int f = PNG_FORMAT_RGBA8; f < FORMATS; ++f) {
+		const double fused = best_decode(_decoders[f], &image, NULL, &succeeded);
+		char separate_text[16] = "-";
+		if(separable) {
+			png_converter_s converter;
+			png_converter_init(&converter, f, _spec->color_type, _spec->bit_depth, NULL, NULL);
+			const double separate = best_decode(_decoders[PNG_FORMAT_NATIVE], &image, &converter, &succeeded);
+			snprintf(separate_text, sizeof(separate_text), "%.2f", separate * 1e3);
+		}
+		printf("%-32s %-13s %10.2f %10.2f %10s %9.1f%%%s\n", label, format_names[f], native * 1e3, fused * 1e3, separate_text,
+				100.0 * (fused - native) / native, succeeded ? "" : "  (decode failed)");
+		fflush(stdout);
+	}
+
+	corpus_free(&image);
+}
+
+int main()
+{
+	logger_init(LOG_ERROR, "logs/bench_formats");
+	static const char* impl_names[] = {"scalar", "ssse3"};
+	printf("conversion kernels: %s\n", impl_names[png_convert_get_impl()]);
+	printf("%-32s %-13s %10s %10s %10s %10s\n", "config", "format", "native ms", "fused ms", "separate", "fused +");
+
+	png_decoder_s* decoders[FORMATS];
+	for(int f = 0; f < FORMATS; ++f) {
+		const png_decoder_options_s options = {.format = f};
+		decoders[f] = png_decoder_create(&options);
+	}
+
+	static const uint32_t sizes[] = {1024, 4096};
+	static const uint8_t formats[][2] = {{0, 8}, {2, 8}, {6, 8}, {6, 16}, {3, 8}};
+	for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+		for(size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+			const corpus_spec_s spec = {
+				.width = sizes[s], .height = sizes[s], .color_type = formats[f][0], .bit_depth = formats[f][1],
+				.filter_mix = MIX_ADAPTIVE, .compression_level = 6,
+			};
+			run_config(&spec, decoders);
+		}
+	}
+
+	for(int f = 0; f < FORMATS; ++f) {
+		png_decoder_destroy(decoders[f]);
+	}
+	logger_close();
+	return 0;
+}
+
+#undef REPETITIONS
+#undef FORMATS
@@ -0,0 +1,150 @@
+//inflate backends on whole in memory streams - the built-in table driven decoder against the same stream fed through
+//zlib's inflate() piece by piece, both handed the IDAT payloads where they are, and the whole decode with either one
+//inflate GB/s is counted in inflated bytes, decode ms is png_decoder_decode() from memory, stack is the deepest a decode gets
+
+#include "common.h"
+#include "corpus.h"
+#include "png_decoder.h"
+#include "png_inflate.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REPETITIONS 5
+#define MAX_PIECES	4096
+
+typedef struct {
+	png_decoder_s*	 decoder;
+	const bench_buffer_s* png;
+	bool			 succeeded;
+} decode_job_s;
+
+typedef struct {
+	png_inflate_fn	  inflate;
+	const png_span_s* spans;
+	size_t			  count;
+	uint8_t*		  out;
+	size_t			  out_size;
+} inflate_job_s;
+
+static void decode_job(void* _job)
+{
+	decode_job_s* job = _job;
+	png_external_context_s* decoded = png_decoder_decode(job->decoder, (char*)job->png->data, job->png->size);
+	job->succeeded &= decoded != NULL;
+	free_decoded_png(decoded);
+}
+
+static size_t find_idat_payloads(const bench_buffer_s* _png, png_span_s* _spans)
+{
+	//same pieces the decoder hands its inflater
+	size_t count  = 0;
+	size_t offset = 8;
+	while(offset + 12 <= _png->size && count < MAX_PIECES) {
+		const uint8_t* chunk  = _png->data + offset;
+		const uint32_t length = ((uint32_t)chunk[0] << 24) | ((uint32_t)chunk[1] << 16) | ((uint32_t)chunk[2] << 8) | chunk[3];
+		if(memcmp(chunk + 4, "IDAT", 4) == 0) {
+			_spans[count++] = (png_span_s){.data = chunk + 8, .size = length};
+		}
+		offset += (size_t)length + 12;
+	}
+	return count;
+}
+
+static bool decode_run(void* _job)
+{
+	decode_job(_job);
+	return ((decode_job_s*)_job)->succeeded;
+}
+
+static bool inflate_run(void* _job)
+{
+	const inflate_job_s* job = _job;
+	return job->inflate(NULL, job->spans, job->count, job->out, job->out_size);
+}
+
+static double best_inflate(const png_inflate_fn _inflate, const png_span_s* _spans, const size_t _count, uint8_t* _out,
+		const size_t _out_size, bool* _succeeded)
+{
+	inflate_job_s inflate = {.inflate = _inflate, .spans = _spans, .count = _count, .out = _out, .out_size = _out_size};
+	const bench_job_s job = {.run = inflate_run, .arg = &inflate};
+	return bench_best_of(&job, REPETITIONS, _succeeded);
+}
+
+static double best_decode(decode_job_s* _job)
+{
+	const bench_job_s job = {.run = decode_run, .arg = _job};
+	return bench_best_of(&job, REPETITIONS, &(_job->succeeded));
+}
+
+static void run_config(const corpus_spec_s* _spec)
+{
+	static const char*			backend_names[] = {"built-in", "zlib"};
+	static const png_inflate_fn backends[]		= {png_inflate_builtin, png_inflate_zlib};
+	char label[64];
+	corpus_describe(_spec, label, sizeof(label));
+
+	corpus_image_s image;
+	if(!corpus_generate(_spec, &image)) {
+		printf("%-32s could not generate\n", label);
+		return;
+	}
+	png_span_s* spans = malloc(sizeof(png_span_s) * MAX_PIECES);
+	const size_t count = find_idat_payloads(&(image.png), spans);
+	uint8_t* filtered  = malloc(image.filtered_size);
+
+	double inflate_seconds[2];
+	bool   inflated[2] = {true, true};
+	for(int b = 0; b < 2; ++b) {
+		inflate_seconds[b] = best_inflate(backends[b], spans, count, filtered, image.filtered_size, &inflated[b]);
+	}
+	for(int b = 0; b < 2; ++b) {
+		const png_decoder_options_s options = {.inflater = {.inflate = backends[b]}};
+		decode_job_s job = {.decoder = png_decoder_create(&options), .png = &(image.png), .succeeded = true};
+		decode_job(&job);
+		const double decode_seconds = best_decode(&job);
+		const size_t stack			= bench_stack_usage(decode_job, &job);
+		png_decoder_destroy(job.decoder);
+
+		printf("%-32s %5d %-9s %6zu %10.3f %8.2fx %10.2f %8zu%s\n", label, _spec->compression_level, backend_names[b], count,
+				image.filtered_size / inflate_seconds[b] / 1e9, inflate_seconds[1] / inflate_seconds[b], decode_seconds * 1e3,
+				stack / 1024, inflated[b] && job.succeeded ? "" : "  (inflate failed)");
+		fflush(stdout);
+	}
+
+	free(filtered);
+	free(spans);
+	corpus_free(&image);
+}
+
+int main()
+{
+	logger_init(LOG_ERROR, "logs/bench_inflate");
+	printf("%-32s %5s %-9s %6s %10s %9s %10s %8s\n", "config", "level", "inflater", "IDATs", "GB/s", "vs zlib", "decode ms", "stack K");
+
+	static const uint32_t sizes[] = {512, 2048};
+	static const uint8_t formats[][2] = {{2, 8}, {6, 8}, {0, 8}};
+	static const filter_mix_e mixes[] = {MIX_ADAPTIVE, MIX_NONE};
+	static const int levels[] = {1, 6, 9};
+	for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+		for(size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+			for(size_t m = 0; m < sizeof(mixes) / sizeof(mixes[0]); ++m) {
+				for(size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+					const corpus_spec_s spec = {
+						.width = sizes[s], .height = sizes[s], .color_type = formats[f][0], .bit_depth = formats[f][1],
+						.filter_mix = mixes[m], .compression_level = levels[l], .idat_size = 8192,
+					};
+					run_config(&spec);
+				}
+			}
+		}
+	}
+
+	logger_close();
+	return 0;
+}
+
+#undef REPETITIONS
+#undef MAX_PIECES
@@ -0,0 +1,121 @@
+//adam7 decode against the plain decode of the same pixels, and how early the coarse passes show up
+//passes are reconstructed and scattered as soon as each one is inflated, so the 1/64 preview should arrive after
+//a small fraction of the total time - scatter itself is what the interlaced / plain ratio pays for
+
+#include "common.h"
+#include "corpus.h"
+#include "png_decoder.h"
+#include "logger.h"
+
+#include <stdio.h>
+
+#define REPETITIONS 3
+#define ADAM7_PASSES 7
+
+typedef struct {
+	double start;
+	double pass_time[ADAM7_PASSES];
+} pass_timing_s;
+
+static void on_pass(void* _timing, const uint _pass, const png_external_context_s* _preview, const png_external_context_s* _image)
+{
+	pass_timing_s* timing = _timing;
+	timing->pass_time[_pass] = bench_now() - timing->start;
+}
+
+typedef struct {
+	png_decoder_s*			decoder;
+	const corpus_image_s*	image;
+	png_external_context_s* decoded;
+	pass_timing_s*			timing;		//what on_pass fills in, NULL when passes are not timed
+	pass_timing_s			fastest;	//pass times of the fastest run
+} decode_job_s;
+
+static bool decode_run(void* _job)
+{
+	decode_job_s* job = _job;
+	if(job->timing != NULL) {
+		job->timing->start = bench_now();
+	}
+	job->decoded = png_decoder_decode(job->decoder, (char*)job->image->png.data, job->image->png.size);
+	return job->decoded != NULL;
+}
+
+static void decode_after(void* _job, const bool _fastest)
+{
+	decode_job_s* job = _job;
+	free_decoded_png(job->decoded);
+	job->decoded = NULL;
+	if(_fastest && job->timing != NULL) {
+		job->fastest = *job->timing;
+	}
+}
+
+static double best_decode(png_decoder_s* _decoder, const corpus_image_s* _image, pass_timing_s* _timing, bool* _succeeded)
+{
+	decode_job_s decode = {.decoder = _decoder, .image = _image, .timing = _timing};
+	const bench_job_s job = {.run = decode_run, .after = decode_after, .arg = &decode};
+	const double best = bench_best_of(&job, REPETITIONS, _succeeded);
+	if(_timing != NULL) {
+		*_timing = decode.fastest;
+	}
+	return best;
+}
+
+static void run_config(corpus_spec_s* _spec)
+{
+	char label[64];
+	corpus_describe(_spec, label, sizeof(label));
+
+	corpus_image_s plain, interlaced;
+	_spec->interlace = 0;
+	const bool generated = corpus_generate(_spec, &plain);
+	_spec->interlace = 1;
+	if(!generated || !corpus_generate(_spec, &interlaced)) {
+		printf("%-32s could not generate\n", label);
+		return;
+	}
+
+	pass_timing_s timing = {0};
+	const png_decoder_options_s options = {.on_pass = on_pass, .on_pass_user = &timing};
+	png_decoder_s* decoder = png_decoder_create(NULL);
+	png_decoder_s* progressive = png_decoder_create(&options);
+
+	bool succeeded = true;
+	const double plain_time		 = best_decode(decoder, &plain, NULL, &succeeded);
+	const double interlaced_time = best_decode(decoder, &interlaced, NULL, &succeeded);
+	const double preview_time	 = best_decode(progressive, &interlaced, &timing, &succeeded);
+
+	printf("%-32s %10.2f %10.2f %10.2f %10.2f %9.1f%%%s\n", label, plain_time * 1e3, interlaced_time * 1e3, preview_time * 1e3,
+			timing.pass_time[0] * 1e3, 100.0 * timing.pass_time[0] / preview_time, succeeded ? "" : "  (decode failed)");
+	fflush(stdout);
+
+	png_decoder_destroy(decoder);
+	png_decoder_destroy(progressive);
+	corpus_free(&plain);
+	corpus_free(&interlaced);
+}
+
+int main()
+{
+	logger_init(LOG_ERROR, "logs/bench_interlace");
+	printf("%-32s %10s %10s %10s %10s %10s\n", "config", "plain ms", "adam7 ms", "+previews", "pass 0 ms", "of total");
+
+	static const uint32_t sizes[] = {512, 2048, 4096};
+	static const uint8_t formats[][2] = {{0, 1}, {2, 8}, {6, 8}, {6, 16}};
+	for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+		for(size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+			corpus_spec_s spec = {
+				.width = sizes[s], .height = sizes[s], .color_type = formats[f][0], .bit_depth = formats[f][1],
+				.filter_mix = MIX_ADAPTIVE, .compression_level = 6,
+			};
+			run_config(&spec);
+		}
+	}
+
+	logger_close();
+	return 0;
+}
+
+#undef REPETITIONS
+#undef ADAM7_PASSES
@@ -0,0 +1,193 @@
+//what reading metadata costs - a full decode that hands text, exif and time chunks to chunk handlers on the way, against
+//indexing the chunks and reading the same ones through the accessors, which never inflate IDAT
+//index is png_chunk_index_build() alone, read adds every text chunk (zTXt inflated), exif and time on top of it
+//allocs are what one indexed read allocates once the index is warm
+
+#include "common.h"
+#include "corpus.h"
+#include "png_decoder.h"
+#include "png_metadata.h"
+#include "logger.h"
+#include "zlib.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REPETITIONS 20
+#define EXIF_SIZE	4096
+#define TEXT_REPEAT 200
+
+static void splice_metadata(const bench_buffer_s* _image, bench_buffer_s* _png)
+{
+	//what an editor leaves behind - text of every kind, exif, time and a profile, all between IHDR and the data
+	static const char plain[]	= "Title\0A picture";
+	static const char intl[]	= "Author\0\0\0en\0Author\0Someone";
+	static const char comment[] = "processed by a long chain of tools ";
+	static const uint8_t stamp[] = {0x07, 0xe8, 2, 29, 12, 30, 0};
+	const size_t ihdr_end = 8 + 12 + 13;
+	bench_buffer_append(_png, _image->data, ihdr_end);
+
+	uint8_t* exif = calloc(1, EXIF_SIZE);
+	memcpy(exif, "MM\0*\0\0\0\x08", 8);
+	uint8_t* raw = malloc(TEXT_REPEAT * (sizeof(comment) - 1));
+	for(int r = 0; r < TEXT_REPEAT; ++r) {
+		memcpy(raw + r * (sizeof(comment) - 1), comment, sizeof(comment) - 1);
+	}
+	uLongf packed_size = compressBound(TEXT_REPEAT * (sizeof(comment) - 1));
+	uint8_t* packed = malloc(packed_size + 16);
+	memcpy(packed, "Comment\0\0", 9);
+	compress2(packed + 9, &packed_size, raw, TEXT_REPEAT * (sizeof(comment) - 1), 9);
+
+	bench_write_chunk(_png, "tEXt", (const uint8_t*)plain, sizeof(plain) - 1);
+	bench_write_chunk(_png, "zTXt", packed, packed_size + 9);
+	bench_write_chunk(_png, "iTXt", (const uint8_t*)intl, sizeof(intl) - 1);
+	bench_write_chunk(_png, "eXIf", exif, EXIF_SIZE);
+	bench_write_chunk(_png, "tIME", stamp, sizeof(stamp));
+	bench_buffer_append(_png, _image->data + ihdr_end, _image->size - ihdr_end);
+
+	free(packed);
+	free(raw);
+	free(exif);
+}
+
+static bool collect_chunk(void* _user, const uint32_t _type, const uint8_t* _data, const uint32_t _size)
+{
+	(void)_type;
+	(void)_data;
+	*(uint64_t*)_user += _size;
+	return true;
+}
+
+static bool read_metadata(png_chunk_index_s* _index, const bench_buffer_s* _png, uint64_t* _bytes)
+{
+	if(!png_chunk_index_build(_index, _png->data, _png->size)) {
+		return false;
+	}
+	bool succeeded = true;
+	for(const png_chunk_entry_s* entry = png_metadata_next_text(_index, NULL); entry != NULL; entry = png_metadata_next_text(_index, entry)) {
+		png_text_s text;
+		succeeded &= png_metadata_text(_index, entry, &text);
+		*_bytes	  += text.text_size;
+		png_text_free(_index, &text);
+	}
+	png_span_s exif;
+	png_time_s time;
+	succeeded &= png_metadata_exif(_index, &exif) && png_metadata_time(_index, &time);
+	*_bytes += exif.size;
+	return succeeded;
+}
+
+typedef struct {
+	png_decoder_s*			decoder;
+	const bench_buffer_s*	png;
+	png_external_context_s* decoded;
+} decode_job_s;
+
+typedef struct {
+	png_chunk_index_s*	  index;
+	const bench_buffer_s* png;
+	uint64_t			  bytes;
+} index_job_s;
+
+static bool decode_run(void* _job)
+{
+	decode_job_s* job = _job;
+	job->decoded = png_decoder_decode(job->decoder, (char*)job->png->data, job->png->size);
+	return job->decoded != NULL;
+}
+
+static void decode_after(void* _job, const bool _fastest)
+{
+	decode_job_s* job = _job;
+	free_decoded_png(job->decoded);
+	job->decoded = NULL;
+}
+
+static bool index_run(void* _job)
+{
+	index_job_s* job = _job;
+	return png_chunk_index_build(job->index, job->png->data, job->png->size);
+}
+
+static bool read_run(void* _job)
+{
+	index_job_s* job = _job;
+	return read_metadata(job->index, job->png, &(job->bytes));
+}
+
+static void run_config(const corpus_spec_s* _spec)
+{
+	char label[64];
+	corpus_describe(_spec, label, sizeof(label));
+
+	corpus_image_s image;
+	if(!corpus_generate(_spec, &image)) {
+		printf("%-32s could not generate\n", label);
+		return;
+	}
+	bench_buffer_s png = {0};
+	splice_metadata(&(image.png), &png);
+
+	uint64_t handled = 0;
+	const png_chunk_handler_s handlers[] = {
+		{.type = PNG_CHUNK_TYPE('t', 'E', 'X', 't'), .handle = collect_chunk, .user = &handled},
+		{.type = PNG_CHUNK_TYPE('z', 'T', 'X', 't'), .handle = collect_chunk, .user = &handled},
+		{.type = PNG_CHUNK_TYPE('i', 'T', 'X', 't'), .handle = collect_chunk, .user = &handled},
+		{.type = PNG_CHUNK_TYPE('e', 'X', 'I', 'f'), .handle = collect_chunk, .user = &handled},
+		{.type = PNG_CHUNK_TYPE('t', 'I', 'M', 'E'), .handle = collect_chunk, .user = &handled},
+	};
+	const png_decoder_options_s options = {.chunk_handlers = handlers, .chunk_handler_count = sizeof(handlers) / sizeof(handlers[0])};
+	png_decoder_s* decoder = png_decoder_create(&options);
+	bool succeeded = true;
+	//first round only grows the scratch buffers
+	decode_job_s decode = {.decoder = decoder, .png = &png};
+	succeeded &= decode_run(&decode);
+	decode_after(&decode, false);
+	const bench_job_s decode_job = {.run = decode_run, .after = decode_after, .arg = &decode};
+	const double decode_seconds = bench_best_of(&decode_job, REPETITIONS, &succeeded);
+	png_decoder_destroy(decoder);
+
+	png_chunk_index_s index;
+	png_chunk_index_init(&index, NULL);
+	index_job_s indexed = {.index = &index, .png = &png};
+	succeeded &= read_run(&indexed);
+	const bench_job_s index_job = {.run = index_run, .arg = &indexed};
+	const bench_job_s read_job	= {.run = read_run, .arg = &indexed};
+	const double index_seconds	= bench_best_of(&index_job, REPETITIONS, &succeeded);
+	const double read_seconds	= bench_best_of(&read_job, REPETITIONS, &succeeded);
+	uint64_t read_bytes = 0;
+	bench_alloc_reset();
+	succeeded &= read_metadata(&index, &png, &read_bytes);
+	const bench_alloc_stats_s allocs = bench_alloc_get();
+	png_chunk_index_release(&index);
+
+	printf("%-32s %8zu %12.1f %10.2f %10.2f %10.0fx %7llu%s\n", label, png.size / 1024, decode_seconds * 1e6, index_seconds * 1e6,
+			read_seconds * 1e6, decode_seconds / read_seconds, (unsigned long long)allocs.count,
+			succeeded && handled > 0 ? "" : "  (failed)");
+	fflush(stdout);
+
+	bench_buffer_free(&png);
+	corpus_free(&image);
+}
+
+int main()
+{
+	logger_init(LOG_ERROR, "logs/bench_metadata");
+	printf("%-32s %8s %12s %10s %10s %11s %7s\n", "config", "png K", "decode us", "index us", "read us", "vs decode", "allocs");
+
+	static const uint32_t sizes[] = {256, 1024, 4096};
+	for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+		const corpus_spec_s spec = {
+			.width = sizes[s], .height = sizes[s], .color_type = 6, .bit_depth = 8, .filter_mix = MIX_ADAPTIVE, .compression_level = 6,
+		};
+		run_config(&spec);
+	}
+
+	logger_close();
+	return 0;
+}
+
+#undef REPETITIONS
+#undef EXIF_SIZE
+#undef TEXT_REPEAT
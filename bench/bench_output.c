@@ -0,0 +1,118 @@
+//decodes into caller owned staging memory, against decoder allocated results and against copying those into the staging
+//buffer afterwards, which is what callers had to do before - allocations are per decode, after the decoder's scratch
+//has grown to the image, so with an output only the small result struct is left
+
+#include "common.h"
+#include "corpus.h"
+#include "png_decoder.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REPETITIONS 5
+
+typedef enum {
+	RUN_ALLOCATED = 0,	//result owns its pixels
+	RUN_COPIED,			//result owns its pixels and they get copied into staging
+	RUN_OUTPUT,			//pixels go to staging directly
+	RUN_SIZE
+} run_e;
+
+typedef struct {
+	png_decoder_s*		  decoder;
+	const corpus_image_s* image;
+	run_e				  run;
+	uint8_t*			  staging;
+	size_t				  staging_stride;
+	bench_alloc_stats_s	  allocations;	//of the last run
+} decode_job_s;
+
+static bool decode_run(void* _job)
+{
+	//freeing the result is timed too - it is part of what handing out owned pixels costs
+	decode_job_s* job = _job;
+	bench_alloc_reset();
+	png_external_context_s* decoded = png_decoder_decode(job->decoder, (char*)job->image->png.data, job->image->png.size);
+	const bool succeeded = decoded != NULL;
+	if(decoded != NULL && job->run == RUN_COPIED) {
+		const size_t row_bytes = (size_t)decoded->width * decoded->channels * decoded->bytes_per_channel;
+		for(uint y = 0; y < decoded->height; ++y) {
+			memcpy(job->staging + y * job->staging_stride, PNG_ROW(decoded, y), row_bytes);
+		}
+	}
+	free_decoded_png(decoded);
+	job->allocations = bench_alloc_get();
+	return succeeded;
+}
+
+static double best_decode(png_decoder_s* _decoder, const corpus_image_s* _image, const run_e _run, uint8_t* _staging,
+		const size_t _staging_stride, bench_alloc_stats_s* _allocations, bool* _succeeded)
+{
+	decode_job_s decode = {.decoder = _decoder, .image = _image, .run = _run, .staging = _staging, .staging_stride = _staging_stride};
+	const bench_job_s job = {.run = decode_run, .arg = &decode};
+	const double best = bench_best_of(&job, REPETITIONS, _succeeded);
+	*_allocations = decode.allocations;
+	return best;
+}
+
+static void run_config(const corpus_spec_s* _spec)
+{
+	static const char* run_names[RUN_SIZE] = {"allocated", "+copy", "output"};
+	char label[64];
+	corpus_describe(_spec, label, sizeof(label));
+
+	corpus_image_s image;
+	if(!corpus_generate(_spec, &image)) {
+		printf("%-32s could not generate\n", label);
+		return;
+	}
+
+	//staging is allocated and touched once up front, like a pinned upload buffer that lives across images
+	const size_t stride = (size_t)_spec->width * 4;
+	uint8_t* staging = malloc(stride * _spec->height);
+	memset(staging, 0, stride * _spec->height);
+
+	const png_decoder_options_s options = {.format = PNG_FORMAT_RGBA8};
+	png_decoder_s* decoder = png_decoder_create(&options);
+	const png_output_s output = {.pixels = staging, .stride = stride, .size = stride * _spec->height, .format = PNG_FORMAT_RGBA8};
+
+	bool succeeded = true;
+	for(int run = 0; run < RUN_SIZE; ++run) {
+		png_decoder_set_output(decoder, run == RUN_OUTPUT ? &output : NULL);
+		bench_alloc_stats_s allocations;
+		const double seconds = best_decode(decoder, &image, run, staging, stride, &allocations, &succeeded);
+		printf("%-32s %-10s %10.2f %10.2f %8llu %12llu%s\n", label, run_names[run], seconds * 1e3,
+				(double)stride * _spec->height / seconds / 1e9, (unsigned long long)allocations.count,
+				(unsigned long long)allocations.bytes, succeeded ? "" : "  (decode failed)");
+		fflush(stdout);
+	}
+
+	png_decoder_destroy(decoder);
+	free(staging);
+	corpus_free(&image);
+}
+
+int main()
+{
+	logger_init(LOG_ERROR, "logs/bench_output");
+	printf("%-32s %-10s %10s %10s %8s %12s\n", "config", "pixels", "ms", "GB/s out", "allocs", "bytes");
+
+	static const uint32_t sizes[] = {512, 2048, 4096};
+	static const uint8_t formats[][2] = {{2, 8}, {6, 8}, {3, 8}};
+	for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+		for(size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+			const corpus_spec_s spec = {
+				.width = sizes[s], .height = sizes[s], .color_type = formats[f][0], .bit_depth = formats[f][1],
+				.filter_mix = MIX_ADAPTIVE, .compression_level = 6,
+			};
+			run_config(&spec);
+		}
+	}
+
+	logger_close();
+	return 0;
+}
+
+#undef REPETITIONS
@@ -0,0 +1,80 @@
+//palette expansion throughput per bit depth, simd against the scalar reference and against plain memcpy of the output
+//"memory speed" means the simd column should sit close to memcpy once rows stop fitting in cache
+
+#include "common.h"
+#include "png_palette.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_BENCH_TIME 0.2
+//in output bytes - one row that stays in l1, one wide image row, and a whole 4k x 4k image that only fits in memory
+#define SIZE_CASES 3
+
+static double measure(const uint8_t* _src, uint8_t* _dst, const size_t _pixels, const uint8_t _bit_depth, const png_palette_lut_s* _lut,
+		const int _which)
+{
+	//_which: 0 simd, 1 scalar, 2 memcpy of the same number of output bytes
+	double elapsed = 0;
+	size_t rounds = 0;
+	while(elapsed < MIN_BENCH_TIME) {
+		const double start = bench_now();
+		switch(_which) {
+			case 0: png_expand_palette(_src, _dst, 0, _pixels, _bit_depth, _lut); break;
+			case 1: png_expand_palette_scalar(_src, _dst, 0, _pixels, _bit_depth, _lut); break;
+			default: memcpy(_dst, _dst + 4 * _pixels, 4 * _pixels); break;
+		}
+		elapsed += bench_now() - start;
+		++rounds;
+	}
+	return 4.0 * _pixels * rounds / elapsed / 1e9;
+}
+
+int main()
+{
+	logger_init(LOG_ERROR, "logs/bench_palette");
+
+	static const char* impl_names[] = {"scalar", "ssse3", "avx2"};
+	printf("palette kernels: %s\n", impl_names[png_expand_palette_get_impl()]);
+	printf("%6s %12s %12s %12s %12s\n", "depth", "pixels", "simd GB/s", "scalar GB/s", "memcpy GB/s");
+
+	png_palette_lut_s lut;
+	uint32_t seed = 12345;
+	for(int i = 0; i < 256; ++i) {
+		for(int c = 0; c < 4; ++c) {
+			seed = seed * 1103515245 + 12345;
+			lut.rgba[i][c] = seed >> 24;
+		}
+	}
+	png_palette_lut_update(&lut);
+
+	static const size_t pixel_counts[SIZE_CASES] = {1024, 16384, 4096 * 4096};
+	const size_t max_pixels = pixel_counts[SIZE_CASES - 1];
+	uint8_t* src = malloc(max_pixels);
+	//twice the output, memcpy reads from the second half
+	uint8_t* dst = malloc(8 * max_pixels);
+	for(size_t i = 0; i < max_pixels; ++i) {
+		seed = seed * 1103515245 + 12345;
+		src[i] = seed >> 24;
+	}
+	memset(dst, 0, 8 * max_pixels);
+
+	for(uint8_t depth = 1; depth <= 8; depth *= 2) {
+		for(int s = 0; s < SIZE_CASES; ++s) {
+			const size_t pixels = pixel_counts[s];
+			printf("%6d %12zu %12.2f %12.2f %12.2f\n", depth, pixels, measure(src, dst, pixels, depth, &lut, 0),
+					measure(src, dst, pixels, depth, &lut, 1), measure(src, dst, pixels, depth, &lut, 2));
+			fflush(stdout);
+		}
+	}
+
+	free(src);
+	free(dst);
+	logger_close();
+	return 0;
+}
+
+#undef MIN_BENCH_TIME
+#undef SIZE_CASES
@@ -0,0 +1,139 @@
+//parallel inflate over large images written with a full flush every few rows, against the plain serial decode
+//the unflushed control shows what collecting the stream costs when there turn out to be no restart points
+//usage: bench_parallel [max threads] [-full]   (threads default to the number of online cpus, -full adds 8k x 8k)
+
+#include "common.h"
+#include "corpus.h"
+#include "png_decoder.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define REPETITIONS 3
+#define FLUSH_ROWS	64
+
+typedef struct {
+	png_decoder_s*			decoder;
+	const corpus_image_s*	image;
+	png_external_context_s* decoded;
+	png_external_context_s* kept;	//result of the last run, to check against the serial one
+} decode_job_s;
+
+static bool decode_run(void* _job)
+{
+	decode_job_s* job = _job;
+	job->decoded = png_decoder_decode(job->decoder, (char*)job->image->png.data, job->image->png.size);
+	return job->decoded != NULL;
+}
+
+static void decode_after(void* _job, const bool _fastest)
+{
+	decode_job_s* job = _job;
+	free_decoded_png(job->kept);
+	job->kept	 = job->decoded;
+	job->decoded = NULL;
+}
+
+static bool same_pixels(const png_external_context_s* _a, const png_external_context_s* _b)
+{
+	if(_a->width != _b->width || _a->height != _b->height || _a->channels != _b->channels
+			|| _a->bytes_per_channel != _b->bytes_per_channel) {
+		return false;
+	}
+	return bench_same_rows(_a->pixels, _a->stride, _b->pixels, _b->stride, (size_t)_a->width * _a->channels * _a->bytes_per_channel,
+			_a->height);
+}
+
+static double best_decode(const corpus_image_s* _image, const uint _threads, png_external_context_s** _decoded, bool* _succeeded)
+{
+	const png_decoder_options_s options = {.inflate_threads = _threads};
+	decode_job_s decode = {.decoder = png_decoder_create(&options), .image = _image};
+	const bench_job_s job = {.run = decode_run, .after = decode_after, .arg = &decode};
+	const double best = bench_best_of(&job, REPETITIONS, _succeeded);
+	png_decoder_destroy(decode.decoder);
+	*_decoded = decode.kept;
+	return best;
+}
+
+static void run_config(const corpus_spec_s* _spec, const long _max_threads)
+{
+	char label[64];
+	corpus_describe(_spec, label, sizeof(label));
+
+	corpus_image_s image;
+	if(!corpus_generate(_spec, &image)) {
+		printf("%-32s could not generate\n", label);
+		return;
+	}
+
+	bool succeeded = true;
+	png_external_context_s* serial_result = NULL;
+	const double serial = best_decode(&image, 0, &serial_result, &succeeded);
+	printf("%-32s %8s %12.2f\n", label, _spec->flush_rows ? "flushed" : "plain", serial * 1e3);
+	//powers of two, then the maximum itself
+	for(long threads = 2; ; threads = threads * 2 < _max_threads ? threads * 2 : _max_threads) {
+		png_external_context_s* parallel_result = NULL;
+		bool parallel_succeeded = true;
+		const double parallel = best_decode(&image, threads, &parallel_result, &parallel_succeeded);
+		//segments stitched together in the wrong place still decode, just to the wrong pixels - no speedup for those
+		if(!parallel_succeeded || serial_result == NULL) {
+			printf("%-32s %8ld %12.2f  (decode failed)\n", "", threads, parallel * 1e3);
+		} else if(!same_pixels(serial_result, parallel_result)) {
+			printf("%-32s %8ld %12.2f  (pixels differ)\n", "", threads, parallel * 1e3);
+		} else {
+			printf("%-32s %8ld %12.2f %9.2fx\n", "", threads, parallel * 1e3, serial / parallel);
+		}
+		succeeded &= parallel_succeeded;
+		free_decoded_png(parallel_result);
+		if(threads == _max_threads) {
+			break;
+		}
+	}
+	if(!succeeded) {
+		printf("%-32s decode failed\n", label);
+	}
+	fflush(stdout);
+	free_decoded_png(serial_result);
+	corpus_free(&image);
+}
+
+int main(int argc, char** argv)
+{
+	long max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	bool full = false;
+	for(int i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "-full") == 0) {
+			full = true;
+		} else {
+			max_threads = atol(argv[i]);
+		}
+	}
+	//two threads at least, otherwise there is nothing to compare
+	max_threads = max_threads < 2 ? 2 : max_threads;
+
+	logger_init(LOG_ERROR, "logs/bench_parallel");
+	printf("%-32s %8s %12s %10s\n", "config", "threads", "ms", "speedup");
+
+	static const uint32_t sizes[] = {2048, 4096, 8192};
+	const size_t size_count = full ? sizeof(sizes) / sizeof(sizes[0]) : 2;
+	for(size_t s = 0; s < size_count; ++s) {
+		for(uint8_t color_type = 2; color_type <= 6; color_type += 4) {
+			for(uint32_t flush_rows = 0; flush_rows <= FLUSH_ROWS; flush_rows += FLUSH_ROWS) {
+				const corpus_spec_s spec = {
+					.width = sizes[s], .height = sizes[s], .color_type = color_type, .bit_depth = 8,
+					.filter_mix = MIX_ADAPTIVE, .compression_level = 6, .flush_rows = flush_rows,
+				};
+				run_config(&spec, max_threads);
+			}
+		}
+	}
+
+	logger_close();
+	return 0;
+}
+
+#undef REPETITIONS
+#undef FLUSH_ROWS
@@ -0,0 +1,121 @@
+//serial vs row-pipelined decode of single large images
+//pipelined unfilters rows on a second thread while inflate is still running, so the gain is bounded
+//by the cheaper of the two stages - paeth and 16 bit images have the most expensive unfilter
+//usage: bench_pipeline [-full]   (-full adds 8k x 8k images)
+
+#include "common.h"
+#include "corpus.h"
+#include "png_decoder.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REPETITIONS 5
+
+typedef struct {
+	png_decoder_s*			decoder;
+	const corpus_image_s*	image;
+	png_external_context_s* decoded;
+	png_external_context_s* kept;	//result of the last run, to check against another decoder's
+} decode_job_s;
+
+static bool decode_run(void* _job)
+{
+	decode_job_s* job = _job;
+	job->decoded = png_decoder_decode(job->decoder, (char*)job->image->png.data, job->image->png.size);
+	return job->decoded != NULL;
+}
+
+static void decode_after(void* _job, const bool _fastest)
+{
+	decode_job_s* job = _job;
+	free_decoded_png(job->kept);
+	job->kept	 = job->decoded;
+	job->decoded = NULL;
+}
+
+static bool same_pixels(const png_external_context_s* _a, const png_external_context_s* _b)
+{
+	if(_a->width != _b->width || _a->height != _b->height || _a->channels != _b->channels
+			|| _a->bytes_per_channel != _b->bytes_per_channel) {
+		return false;
+	}
+	return bench_same_rows(_a->pixels, _a->stride, _b->pixels, _b->stride, (size_t)_a->width * _a->channels * _a->bytes_per_channel,
+			_a->height);
+}
+
+static double best_decode(png_decoder_s* _decoder, const corpus_image_s* _image, png_external_context_s** _decoded, bool* _succeeded)
+{
+	decode_job_s decode = {.decoder = _decoder, .image = _image};
+	const bench_job_s job = {.run = decode_run, .after = decode_after, .arg = &decode};
+	const double best = bench_best_of(&job, REPETITIONS, _succeeded);
+	*_decoded = decode.kept;
+	return best;
+}
+
+static void run_config(const corpus_spec_s* _spec)
+{
+	char label[64];
+	corpus_describe(_spec, label, sizeof(label));
+
+	corpus_image_s image;
+	if(!corpus_generate(_spec, &image)) {
+		printf("%-32s could not generate\n", label);
+		return;
+	}
+
+	const png_decoder_options_s serial_options	  = {0};
+	const png_decoder_options_s pipelined_options = {.pipeline = true};
+	png_decoder_s* serial	 = png_decoder_create(&serial_options);
+	png_decoder_s* pipelined = png_decoder_create(&pipelined_options);
+
+	bool succeeded = true;
+	png_external_context_s* serial_result	 = NULL;
+	png_external_context_s* pipelined_result = NULL;
+	const double serial_time	= best_decode(serial, &image, &serial_result, &succeeded);
+	const double pipelined_time = best_decode(pipelined, &image, &pipelined_result, &succeeded);
+	//a pipeline that hands rows over out of order is fast and wrong - the speedup only counts when the pixels match
+	const bool same = !succeeded || same_pixels(serial_result, pipelined_result);
+
+	printf("%-32s %12.2f %12.2f %9.2fx%s%s\n", label, serial_time * 1e3, pipelined_time * 1e3, serial_time / pipelined_time,
+			succeeded ? "" : "  (decode failed)", same ? "" : "  (pixels differ)");
+	fflush(stdout);
+
+	free_decoded_png(serial_result);
+	free_decoded_png(pipelined_result);
+
+	png_decoder_destroy(serial);
+	png_decoder_destroy(pipelined);
+	corpus_free(&image);
+}
+
+int main(int argc, char** argv)
+{
+	const bool full = argc > 1 && strcmp(argv[1], "-full") == 0;
+	logger_init(LOG_ERROR, "logs/bench_pipeline");
+
+	printf("%-32s %12s %12s %10s\n", "config", "serial ms", "pipelined ms", "speedup");
+
+	static const uint32_t sizes[] = {1024, 2048, 4096, 8192};
+	static const uint8_t formats[][2] = {{2, 8}, {6, 8}, {6, 16}};
+	static const filter_mix_e mixes[] = {MIX_UP, MIX_PAETH, MIX_ADAPTIVE};
+	const size_t size_count = full ? sizeof(sizes) / sizeof(sizes[0]) : 3;
+	for(size_t s = 0; s < size_count; ++s) {
+		for(size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+			for(size_t m = 0; m < sizeof(mixes) / sizeof(mixes[0]); ++m) {
+				const corpus_spec_s spec = {
+					.width = sizes[s], .height = sizes[s], .color_type = formats[f][0], .bit_depth = formats[f][1],
+					.filter_mix = mixes[m], .compression_level = 6,
+				};
+				run_config(&spec);
+			}
+		}
+	}
+
+	logger_close();
+	return 0;
+}
+
+#undef REPETITIONS
@@ -0,0 +1,107 @@
+//header-only probes against full decodes of the same images
+//probe cost should not depend on the image size at all, and it must never allocate - allocation counts are per call
+
+#include "common.h"
+#include "corpus.h"
+#include "png_decoder.h"
+#include "logger.h"
+
+#include <stdio.h>
+
+#define PROBES		 1000000
+#define DECODES		 5
+//a few hundred bytes of text in front of IDAT, like editors leave behind
+#define ANCILLARY_CHUNKS 8
+
+static double probe_time(const bench_buffer_s* _png, const bool _scan_chunks, bool* _succeeded)
+{
+	png_probe_s info;
+	const double start = bench_now();
+	for(int r = 0; r < PROBES; ++r) {
+		*_succeeded &= png_probe((const char*)_png->data, _png->size, _scan_chunks, &info);
+	}
+	return (bench_now() - start) / PROBES;
+}
+
+typedef struct {
+	const bench_buffer_s*	png;
+	png_external_context_s* decoded;
+} decode_job_s;
+
+static bool decode_run(void* _job)
+{
+	decode_job_s* job = _job;
+	job->decoded = decode_from_png((char*)job->png->data, job->png->size);
+	return job->decoded != NULL;
+}
+
+static void decode_after(void* _job, const bool _fastest)
+{
+	decode_job_s* job = _job;
+	free_decoded_png(job->decoded);
+	job->decoded = NULL;
+}
+
+static void run_config(const corpus_spec_s* _spec)
+{
+	char label[64];
+	corpus_describe(_spec, label, sizeof(label));
+
+	corpus_image_s image;
+	if(!corpus_generate(_spec, &image)) {
+		printf("%-32s could not generate\n", label);
+		return;
+	}
+
+	//same image with ancillary chunks between IHDR and IDAT, which the chunk scan has to step over
+	static const uint8_t text[] = "Comment\0written by a synthetic corpus generator, only here to be skipped";
+	const size_t header_end = 8 + 4 + 4 + 13 + 4;
+	bench_buffer_s padded = {0};
+	bench_buffer_append(&padded, image.png.data, header_end);
+	for(int c = 0; c < ANCILLARY_CHUNKS; ++c) {
+		bench_write_chunk(&padded, "tEXt", text, sizeof(text) - 1);
+	}
+	bench_buffer_append(&padded, image.png.data + header_end, image.png.size - header_end);
+
+	bool succeeded = true;
+	bench_alloc_reset();
+	const double header = probe_time(&image.png, false, &succeeded);
+	const double scan	= probe_time(&image.png, true, &succeeded);
+	const double padded_scan = probe_time(&padded, true, &succeeded);
+	const bench_alloc_stats_s allocations = bench_alloc_get();
+
+	decode_job_s decoding = {.png = &(image.png)};
+	const bench_job_s job = {.run = decode_run, .after = decode_after, .arg = &decoding};
+	const double decode	  = bench_best_of(&job, DECODES, &succeeded);
+
+	printf("%-32s %10.1f %10.1f %10.1f %12.1f %8llu%s\n", label, header * 1e9, scan * 1e9, padded_scan * 1e9, decode * 1e6,
+			(unsigned long long)allocations.count, succeeded ? "" : "  (failed)");
+	fflush(stdout);
+	bench_buffer_free(&padded);
+	corpus_free(&image);
+}
+
+int main()
+{
+	logger_init(LOG_ERROR, "logs/bench_probe");
+	printf("%-32s %10s %10s %10s %12s %8s\n", "config", "ihdr ns", "scan ns", "+text ns", "decode us", "allocs");
+
+	static const uint32_t sizes[] = {64, 1024, 4096};
+	static const uint8_t formats[][2] = {{3, 8}, {6, 8}};
+	for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+		for(size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+			const corpus_spec_s spec = {
+				.width = sizes[s], .height = sizes[s], .color_type = formats[f][0], .bit_depth = formats[f][1],
+				.filter_mix = MIX_ADAPTIVE, .compression_level = 6,
+			};
+			run_config(&spec);
+		}
+	}
+
+	logger_close();
+	return 0;
+}
+
+#undef PROBES
+#undef DECODES
+#undef ANCILLARY_CHUNKS
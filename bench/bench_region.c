@@ -0,0 +1,102 @@
+//region decodes of a tall image against decoding all of it
+//rows above a band still have to be inflated and reconstructed, so cost grows with how far down the band ends -
+//everything below it is never read, and output and scratch only ever cover the band
+//bands that end at the bottom cannot stop early, so they decode like the whole image and are never slower than it
+
+#include "common.h"
+#include "corpus.h"
+#include "png_decoder.h"
+#include "logger.h"
+
+#include <stdio.h>
+
+#define REPETITIONS 5
+#define WIDTH		1024
+#define HEIGHT		16384
+
+typedef struct {
+	png_decoder_s*			decoder;
+	const corpus_image_s*	image;
+	png_external_context_s* decoded;
+} decode_job_s;
+
+static bool decode_run(void* _job)
+{
+	decode_job_s* job = _job;
+	bench_alloc_reset();
+	job->decoded = png_decoder_decode(job->decoder, (char*)job->image->png.data, job->image->png.size);
+	return job->decoded != NULL;
+}
+
+static void decode_after(void* _job, const bool _fastest)
+{
+	decode_job_s* job = _job;
+	free_decoded_png(job->decoded);
+	job->decoded = NULL;
+}
+
+static void run_region(png_decoder_s* _decoder, const corpus_image_s* _image, const char* _label, const png_region_s* _region,
+		const double _full)
+{
+	png_decoder_set_region(_decoder, _region);
+	bool succeeded = true;
+	decode_job_s decode = {.decoder = _decoder, .image = _image};
+	const bench_job_s job = {.run = decode_run, .after = decode_after, .arg = &decode};
+	const double best = bench_best_of(&job, REPETITIONS, &succeeded);
+	const bench_alloc_stats_s allocations = bench_alloc_get();
+
+	printf("%-28s %12.2f %9.2fx %14.1f%s\n", _label, best * 1e3, _full > 0 ? _full / best : 1.0,
+			allocations.bytes / (1024.0 * 1024.0), succeeded ? "" : "  (decode failed)");
+	fflush(stdout);
+}
+
+int main()
+{
+	logger_init(LOG_ERROR, "logs/bench_region");
+
+	const corpus_spec_s spec = {
+		.width = WIDTH, .height = HEIGHT, .color_type = 6, .bit_depth = 8,
+		.filter_mix = MIX_ADAPTIVE, .compression_level = 6,
+	};
+	corpus_image_s image;
+	if(!corpus_generate(&spec, &image)) {
+		printf("could not generate the image\n");
+		return 1;
+	}
+
+	char label[64];
+	corpus_describe(&spec, label, sizeof(label));
+	printf("%s\n%-28s %12s %10s %14s\n", label, "region", "ms", "speedup", "allocated MB");
+
+	png_decoder_s* decoder = png_decoder_create(NULL);
+
+	//first decode grows the scratch, so the full one is timed after it like the rest
+	png_external_context_s* warm_up = png_decoder_decode(decoder, (char*)image.png.data, image.png.size);
+	free_decoded_png(warm_up);
+	const double start = bench_now();
+	for(int r = 0; r < REPETITIONS; ++r) {
+		free_decoded_png(png_decoder_decode(decoder, (char*)image.png.data, image.png.size));
+	}
+	const double full = (bench_now() - start) / REPETITIONS;
+	printf("%-28s %12.2f %9.2fx\n", "whole image", full * 1e3, 1.0);
+
+	const png_region_s top		  = {.x = 0, .y = 0, .width = WIDTH, .height = 200};
+	const png_region_s middle	  = {.x = 0, .y = HEIGHT / 2, .width = WIDTH, .height = 200};
+	const png_region_s bottom	  = {.x = 0, .y = HEIGHT - 200, .width = WIDTH, .height = 200};
+	const png_region_s crop		  = {.x = WIDTH / 4, .y = HEIGHT / 4, .width = WIDTH / 2, .height = HEIGHT / 4};
+	const png_region_s whole	  = {.x = 0, .y = 0, .width = WIDTH, .height = HEIGHT};
+	run_region(decoder, &image, "200 rows at the top", &top, full);
+	run_region(decoder, &image, "200 rows in the middle", &middle, full);
+	run_region(decoder, &image, "200 rows at the bottom", &bottom, full);
+	run_region(decoder, &image, "centre crop", &crop, full);
+	run_region(decoder, &image, "whole image as a region", &whole, full);
+
+	png_decoder_destroy(decoder);
+	corpus_free(&image);
+	logger_close();
+	return 0;
+}
+
+#undef REPETITIONS
+#undef WIDTH
+#undef HEIGHT
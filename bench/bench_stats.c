@@ -0,0 +1,105 @@
+//what options.stats costs, and what it reports - the same decoder decodes each image with stats off and on, alternating,
+//best of each is kept - the breakdown is the share of total_cycles every stage got in the last decode with stats on,
+//and the unfilter columns split that stage by filter type, in ns per row
+
+#include "common.h"
+#include "corpus.h"
+#include "png_decoder.h"
+#include "png_stats.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define REPETITIONS 7
+
+static double timed_decode(png_decoder_s* _decoder, const corpus_image_s* _image, bool* _succeeded)
+{
+	const double start = bench_now();
+	png_external_context_s* decoded = png_decoder_decode(_decoder, (char*)_image->png.data, _image->png.size);
+	const double elapsed = bench_now() - start;
+	*_succeeded &= decoded != NULL;
+	free_decoded_png(decoded);
+	return elapsed;
+}
+
+static void run_config(const corpus_spec_s* _spec)
+{
+	char label[64];
+	corpus_describe(_spec, label, sizeof(label));
+
+	corpus_image_s image;
+	if(!corpus_generate(_spec, &image)) {
+		printf("%-32s could not generate\n", label);
+		return;
+	}
+
+	png_stats_s stats;
+	const png_decoder_options_s off_options = {0};
+	const png_decoder_options_s on_options	= {.stats = &stats};
+	png_decoder_s* off = png_decoder_create(&off_options);
+	png_decoder_s* on  = png_decoder_create(&on_options);
+
+	//first round only grows the scratch buffers
+	bool succeeded = true;
+	(void)timed_decode(off, &image, &succeeded);
+	(void)timed_decode(on, &image, &succeeded);
+	double best_off = 0;
+	double best_on	= 0;
+	for(int r = 0; r < REPETITIONS; ++r) {
+		const double seconds_off = timed_decode(off, &image, &succeeded);
+		const double seconds_on	 = timed_decode(on, &image, &succeeded);
+		best_off = (r == 0 || seconds_off < best_off) ? seconds_off : best_off;
+		best_on	 = (r == 0 || seconds_on < best_on) ? seconds_on : best_on;
+	}
+
+	printf("%-32s %8.2f %8.2f %+7.2f%% |", label, best_off * 1e3, best_on * 1e3, 100.0 * (best_on - best_off) / best_off);
+	for(int s = 0; s < PNG_STAGE_SIZE; ++s) {
+		printf(" %6.1f%%", 100.0 * stats.cycles[s] / stats.total_cycles);
+	}
+	printf(" |");
+	const double ns_per_tick = 1e9 / png_stats_ticks_per_second();
+	for(int f = 0; f < FILTER_SIZE; ++f) {
+		if(stats.unfilter_rows[f] == 0) {
+			printf(" %7s", "-");
+			continue;
+		}
+		printf(" %7.0f", stats.unfilter_cycles[f] * ns_per_tick / stats.unfilter_rows[f]);
+	}
+	printf(" | %6llu %8zu%s\n", (unsigned long long)stats.allocations, stats.peak_scratch / 1024, succeeded ? "" : "  (decode failed)");
+	fflush(stdout);
+
+	png_decoder_destroy(on);
+	png_decoder_destroy(off);
+	corpus_free(&image);
+}
+
+int main()
+{
+	logger_init(LOG_ERROR, "logs/bench_stats");
+	printf("cycle counter: %.3f GHz\n", png_stats_ticks_per_second() / 1e9);
+	printf("%-32s %8s %8s %8s |", "config", "off ms", "on ms", "cost");
+	for(int s = 0; s < PNG_STAGE_SIZE; ++s) {
+		printf(" %7s", png_stats_stage_name(s));
+	}
+	printf(" | %7s %7s %7s %7s %7s | %6s %8s\n", "none", "sub", "up", "average", "paeth", "allocs", "scratchK");
+
+	static const uint32_t sizes[] = {512, 2048};
+	static const uint8_t formats[][2] = {{2, 8}, {6, 8}, {3, 8}, {0, 16}};
+	for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+		for(size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+			for(uint8_t interlace = 0; interlace < 2; ++interlace) {
+				const corpus_spec_s spec = {
+					.width = sizes[s], .height = sizes[s], .color_type = formats[f][0], .bit_depth = formats[f][1],
+					.interlace = interlace, .filter_mix = MIX_ADAPTIVE, .compression_level = 6,
+				};
+				run_config(&spec);
+			}
+		}
+	}
+
+	logger_close();
+	return 0;
+}
+
+#undef REPETITIONS
@@ -0,0 +1,114 @@
+//reconstruction throughput of every filter and pixel size, the kernel unfilter_row dispatches to against the scalar
+//reference on the same row - the selected kernel has to be byte identical and never slower, rows where it is get flagged
+//sub, average and paeth carry a dependency from pixel to pixel, so ns per byte there is latency, not bandwidth
+
+#include "common.h"
+#include "png_filter.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//rows per timed run, and runs the fastest one is taken from - simd and scalar take turns, so both see the same machine
+#define ROWS_PER_RUN 64
+#define REPETITIONS	 25
+//a 4k wide row - stays in l1 together with the one above it, so only the kernel itself is measured
+#define ROW_PIXELS 4096
+//slower than the scalar reference by more than this is reported, anything below it is noise
+#define SLOWER_MARGIN 1.05
+
+typedef struct {
+	uint8_t		   filter;
+	uint8_t*	   row;
+	const uint8_t* prev;
+	size_t		   row_size;
+	uint8_t		   bpp;
+	bool		   scalar;
+} unfilter_job_s;
+
+static bool unfilter_run(void* _job)
+{
+	//rows get unfiltered over and over in place - the bytes change, the work per byte does not
+	const unfilter_job_s* job = _job;
+	bool succeeded = true;
+	for(int r = 0; r < ROWS_PER_RUN; ++r) {
+		if(job->scalar) {
+			unfilter_row_scalar(job->filter, job->row, job->prev, job->row_size, job->bpp);
+		} else {
+			succeeded &= unfilter_row(job->filter, job->row, job->prev, job->row_size, job->bpp);
+		}
+	}
+	return succeeded;
+}
+
+int main()
+{
+	logger_init(LOG_ERROR, "logs/bench_unfilter");
+
+	static const char* impl_names[]	  = {"scalar", "sse2", "ssse3", "avx2"};
+	static const char* filter_names[] = {"none", "sub", "up", "average", "paeth"};
+	printf("unfilter kernels: %s\n", impl_names[unfilter_get_impl()]);
+	printf("%8s %4s %14s %14s %9s\n", "filter", "bpp", "simd ns/byte", "scalar ns/byte", "speedup");
+
+	static const uint8_t bpp_values[] = {1, 2, 3, 4, 6, 8};
+	const size_t max_size = ROW_PIXELS * 8;
+	uint8_t* filtered = malloc(max_size);
+	uint8_t* prev	  = malloc(max_size);
+	uint8_t* row	  = malloc(max_size);
+	uint8_t* expected = malloc(max_size);
+	uint32_t seed = 12345;
+	for(size_t i = 0; i < max_size; ++i) {
+		seed = seed * 1103515245 + 12345;
+		filtered[i] = seed >> 24;
+		seed = seed * 1103515245 + 12345;
+		prev[i] = seed >> 24;
+	}
+
+	bool all_faster = true;
+	for(uint8_t f = FILTER_SUB; f < FILTER_SIZE; ++f) {
+		for(size_t b = 0; b < sizeof(bpp_values) / sizeof(bpp_values[0]); ++b) {
+			const uint8_t bpp	   = bpp_values[b];
+			const size_t row_size = (size_t)ROW_PIXELS * bpp;
+
+			memcpy(expected, filtered, row_size);
+			unfilter_row_scalar(f, expected, prev, row_size, bpp);
+			memcpy(row, filtered, row_size);
+			bool same = unfilter_row(f, row, prev, row_size, bpp) && memcmp(row, expected, row_size) == 0;
+
+			unfilter_job_s simd_job	  = {.filter = f, .row = row, .prev = prev, .row_size = row_size, .bpp = bpp};
+			unfilter_job_s scalar_job = simd_job;
+			scalar_job.scalar		  = true;
+			const bench_job_s simd_run	 = {.run = unfilter_run, .arg = &simd_job};
+			const bench_job_s scalar_run = {.run = unfilter_run, .arg = &scalar_job};
+			double simd = 0, scalar = 0;
+			for(int r = 0; r < REPETITIONS; ++r) {
+				const double simd_seconds	= bench_best_of(&simd_run, 1, &same);
+				const double scalar_seconds = bench_best_of(&scalar_run, 1, &same);
+				simd   = r == 0 || simd_seconds < simd ? simd_seconds : simd;
+				scalar = r == 0 || scalar_seconds < scalar ? scalar_seconds : scalar;
+			}
+			simd   *= 1e9 / ((double)ROWS_PER_RUN * row_size);
+			scalar *= 1e9 / ((double)ROWS_PER_RUN * row_size);
+			const bool slower	= simd > scalar * SLOWER_MARGIN;
+			all_faster &= !slower;
+			printf("%8s %4u %14.3f %14.3f %8.2fx%s%s\n", filter_names[f], bpp, simd, scalar, scalar / simd,
+					same ? "" : "  (output differs)", slower ? "  (slower than scalar)" : "");
+		}
+	}
+	if(!all_faster) {
+		printf("\nsome selected kernels are slower than the scalar reference\n");
+	}
+
+	free(expected);
+	free(row);
+	free(prev);
+	free(filtered);
+	logger_close();
+	return 0;
+}
+
+#undef ROWS_PER_RUN
+#undef REPETITIONS
+#undef ROW_PIXELS
+#undef SLOWER_MARGIN
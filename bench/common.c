@@ -0,0 +1,229 @@
+#include "common.h"
+#include "zlib.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define STACK_PROBE_SIZE	(1 << 20)
+#define STACK_PAINT			0xa5
+
+////////////////////////// global variables
+static bench_alloc_stats_s alloc_stats;
+
+////////////////////////// allocator wrappers
+//every bench is linked with -Wl,--wrap=... so calls from the decoder and zlib land here first
+void* __real_malloc(size_t);
+void* __real_calloc(size_t, size_t);
+void* __real_realloc(void*, size_t);
+void* __real_aligned_alloc(size_t, size_t);
+
+static void count_alloc(const size_t _size)
+{
+	__atomic_add_fetch(&alloc_stats.count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&alloc_stats.bytes, _size, __ATOMIC_RELAXED);
+}
+
+void* __wrap_malloc(size_t _size)
+{
+	count_alloc(_size);
+	return __real_malloc(_size);
+}
+
+void* __wrap_calloc(size_t _n, size_t _size)
+{
+	count_alloc(_n * _size);
+	return __real_calloc(_n, _size);
+}
+
+void* __wrap_realloc(void* _ptr, size_t _size)
+{
+	count_alloc(_size);
+	return __real_realloc(_ptr, _size);
+}
+
+void* __wrap_aligned_alloc(size_t _alignment, size_t _size)
+{
+	count_alloc(_size);
+	return __real_aligned_alloc(_alignment, _size);
+}
+
+////////////////////////// definitions
+double bench_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double bench_best_of(const bench_job_s* _job, const int _repetitions, bool* _succeeded)
+{
+	double best = 0;
+	for(int r = 0; r < _repetitions; ++r) {
+		const double start	   = bench_now();
+		const bool	 succeeded = _job->run(_job->arg);
+		const double elapsed   = bench_now() - start;
+		const bool	 fastest   = r == 0 || elapsed < best;
+		best		 = fastest ? elapsed : best;
+		*_succeeded &= succeeded;
+		if(_job->after != NULL) {
+			_job->after(_job->arg, fastest);
+		}
+	}
+	return best;
+}
+
+static int compare_seconds(const void* _a, const void* _b)
+{
+	const double a = *(const double*)_a;
+	const double b = *(const double*)_b;
+	return (a > b) - (a < b);
+}
+
+double bench_median_of(const bench_job_s* _job, const int _repetitions, bool* _succeeded)
+{
+	double* times = malloc(sizeof(double) * _repetitions);
+	double best = 0;
+	for(int r = 0; r < _repetitions; ++r) {
+		const double start	   = bench_now();
+		const bool	 succeeded = _job->run(_job->arg);
+		times[r]			   = bench_now() - start;
+		const bool	 fastest   = r == 0 || times[r] < best;
+		best		 = fastest ? times[r] : best;
+		*_succeeded &= succeeded;
+		if(_job->after != NULL) {
+			_job->after(_job->arg, fastest);
+		}
+	}
+	qsort(times, _repetitions, sizeof(double), compare_seconds);
+	const double median = _repetitions % 2 ? times[_repetitions / 2] : (times[_repetitions / 2 - 1] + times[_repetitions / 2]) / 2;
+	free(times);
+	return median;
+}
+
+void bench_alloc_reset()
+{
+	__atomic_store_n(&alloc_stats.count, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&alloc_stats.bytes, 0, __ATOMIC_RELAXED);
+}
+
+bench_alloc_stats_s bench_alloc_get()
+{
+	bench_alloc_stats_s stats;
+	stats.count = __atomic_load_n(&alloc_stats.count, __ATOMIC_RELAXED);
+	stats.bytes = __atomic_load_n(&alloc_stats.bytes, __ATOMIC_RELAXED);
+	return stats;
+}
+
+typedef struct {
+	void (*fn)(void*);
+	void* arg;
+} stack_probe_s;
+
+static void* stack_probe_entry(void* _probe)
+{
+	stack_probe_s* probe = _probe;
+	probe->fn(probe->arg);
+	return NULL;
+}
+
+size_t bench_stack_usage(void (*_fn)(void*), void* _arg)
+{
+	uint8_t* stack = mmap(NULL, STACK_PROBE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(stack == MAP_FAILED) {
+		perror("mmap");
+		return 0;
+	}
+	memset(stack, STACK_PAINT, STACK_PROBE_SIZE);
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstack(&attr, stack, STACK_PROBE_SIZE);
+
+	stack_probe_s probe = {.fn = _fn, .arg = _arg};
+	pthread_t thread;
+	pthread_create(&thread, &attr, stack_probe_entry, &probe);
+	pthread_join(thread, NULL);
+	pthread_attr_destroy(&attr);
+
+	//stack grows down - first byte that lost its paint marks the deepest point
+	size_t untouched = 0;
+	while(untouched < STACK_PROBE_SIZE && stack[untouched] == STACK_PAINT) {
+		++untouched;
+	}
+	munmap(stack, STACK_PROBE_SIZE);
+	return STACK_PROBE_SIZE - untouched;
+}
+
+void bench_buffer_append(bench_buffer_s* _buffer, const void* _data, const size_t _size)
+{
+	if(_buffer->size + _size > _buffer->capacity) {
+		size_t capacity = _buffer->capacity ? _buffer->capacity : 4096;
+		while(capacity < _buffer->size + _size) {
+			capacity *= 2;
+		}
+		_buffer->data	  = realloc(_buffer->data, capacity);
+		_buffer->capacity = capacity;
+	}
+	memcpy(_buffer->data + _buffer->size, _data, _size);
+	_buffer->size += _size;
+}
+
+void bench_buffer_free(bench_buffer_s* _buffer)
+{
+	free(_buffer->data);
+	memset(_buffer, 0, sizeof(bench_buffer_s));
+}
+
+static void write_u32(bench_buffer_s* _buffer, const uint32_t _value)
+{
+	const uint8_t bytes[4] = {_value >> 24, _value >> 16, _value >> 8, _value};
+	bench_buffer_append(_buffer, bytes, 4);
+}
+
+void bench_write_chunk(bench_buffer_s* _png, const char* _type, const uint8_t* _data, const uint32_t _size)
+{
+	write_u32(_png, _size);
+	bench_buffer_append(_png, _type, 4);
+	if(_size > 0) {
+		bench_buffer_append(_png, _data, _size);
+	}
+	uLong crc = crc32(0L, (const Bytef*)_type, 4);
+	if(_size > 0) {
+		crc = crc32(crc, _data, _size);
+	}
+	write_u32(_png, (uint32_t)crc);
+}
+
+void bench_write_signature(bench_buffer_s* _png)
+{
+	bench_buffer_append(_png, "\x89\x50\x4e\x47\x0d\x0a\x1a\x0a", 8);
+}
+
+void bench_write_ihdr(bench_buffer_s* _png, const uint32_t _width, const uint32_t _height,
+		const uint8_t _bit_depth, const uint8_t _color_type, const uint8_t _interlace)
+{
+	const uint8_t ihdr[13] = {
+		_width >> 24, _width >> 16, _width >> 8, _width,
+		_height >> 24, _height >> 16, _height >> 8, _height,
+		_bit_depth, _color_type, 0, 0, _interlace
+	};
+	bench_write_chunk(_png, "IHDR", ihdr, sizeof(ihdr));
+}
+
+bool bench_same_rows(const uint8_t* _a, const size_t _a_stride, const uint8_t* _b, const size_t _b_stride,
+		const size_t _row_size, const size_t _rows)
+{
+	for(size_t y = 0; y < _rows; ++y) {
+		if(memcmp(_a + y * _a_stride, _b + y * _b_stride, _row_size) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+#undef STACK_PROBE_SIZE
+#undef STACK_PAINT
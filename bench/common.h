@@ -0,0 +1,56 @@
+#ifndef __BENCH_COMMON__
+#define __BENCH_COMMON__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+////////////////////////// typedefs
+typedef struct {
+	uint8_t* data;
+	size_t	 size;
+	size_t	 capacity;
+} bench_buffer_s;
+
+typedef struct {
+	//filled by the --wrap'ed allocator functions, see bench.sh
+	uint64_t count;
+	uint64_t bytes;
+} bench_alloc_stats_s;
+
+typedef struct {
+	//what a bench times - run is the part under the clock and says whether it succeeded, after (optional) comes right
+	//after the clock stopped, with whether that run was the fastest so far - for cleanup that should not be timed and
+	//for keeping whatever the fastest run measured besides its time
+	bool (*run)(void* _arg);
+	void (*after)(void* _arg, const bool _fastest);
+	void* arg;
+} bench_job_s;
+
+////////////////////////// declarations
+double bench_now();
+//fastest of _repetitions runs of _job in seconds - _succeeded is cleared when any run failed
+double bench_best_of(const bench_job_s* _job, const int _repetitions, bool* _succeeded);
+//median of the same - for differences between two timings, where one lucky best-of run on either side skews the result
+double bench_median_of(const bench_job_s* _job, const int _repetitions, bool* _succeeded);
+
+void bench_alloc_reset();
+bench_alloc_stats_s bench_alloc_get();
+
+//runs _fn on a fresh thread with a painted stack and returns how many bytes of it got touched
+size_t bench_stack_usage(void (*_fn)(void*), void* _arg);
+
+void bench_buffer_append(bench_buffer_s* _buffer, const void* _data, const size_t _size);
+void bench_buffer_free(bench_buffer_s* _buffer);
+
+//appends a complete chunk - length, type, data and crc
+void bench_write_chunk(bench_buffer_s* _png, const char* _type, const uint8_t* _data, const uint32_t _size);
+void bench_write_signature(bench_buffer_s* _png);
+void bench_write_ihdr(bench_buffer_s* _png, const uint32_t _width, const uint32_t _height,
+		const uint8_t _bit_depth, const uint8_t _color_type, const uint8_t _interlace);
+
+//compares _rows rows of _row_size bytes each - whatever pads a row out to its stride is not compared
+bool bench_same_rows(const uint8_t* _a, const size_t _a_stride, const uint8_t* _b, const size_t _b_stride,
+		const size_t _row_size, const size_t _rows);
+
+#endif //__BENCH_COMMON__
@@ -0,0 +1,281 @@
+//synthetic png generator for the benches
+//pixels are a smooth gradient with a bit of noise on top, so they compress roughly like photos do,
+//rows are filtered the way the spec says and the whole stream goes through zlib the way def() in
+//png_decoder.c does it, just into memory instead of a FILE
+
+#include "corpus.h"
+#include "zlib.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ADAM7_PASSES		7
+#define DEFAULT_IDAT_SIZE	(64 * 1024)
+#define DEFLATE_CHUNK		(64 * 1024)
+
+////////////////////////// global variables
+static const uint8_t adam7_start_x[ADAM7_PASSES] = {0, 4, 0, 2, 0, 1, 0};
+static const uint8_t adam7_start_y[ADAM7_PASSES] = {0, 0, 4, 0, 2, 0, 1};
+static const uint8_t adam7_step_x[ADAM7_PASSES]	 = {8, 8, 4, 4, 2, 2, 1};
+static const uint8_t adam7_step_y[ADAM7_PASSES]	 = {8, 8, 8, 4, 4, 2, 2};
+
+static const char* mix_names[MIX_SIZE] = {"none", "sub", "up", "average", "paeth", "adaptive"};
+
+////////////////////////// declarations
+static uint8_t get_channels(const uint8_t _color_type);
+static uint32_t get_sample(const corpus_spec_s* _spec, const uint32_t _x, const uint32_t _y, const uint8_t _channel);
+static void pack_row(const corpus_spec_s* _spec, uint8_t* _row, const size_t _row_size, const uint32_t _y,
+		const uint32_t _start_x, const uint32_t _step_x, const uint32_t _width);
+static void filter_row(const uint8_t _type, const uint8_t* _row, const uint8_t* _prev, uint8_t* _out, const size_t _row_size, const uint8_t _bpp);
+static uint8_t choose_filter(const filter_mix_e _mix, const uint8_t* _row, const uint8_t* _prev,
+		uint8_t* _scratch, const size_t _row_size, const uint8_t _bpp);
+static bool deflate_bytes(z_stream* _stream, bench_buffer_s* _out, const uint8_t* _data, const size_t _size, const int _flush);
+static void write_palette(bench_buffer_s* _png, const uint8_t _bit_depth);
+
+
+////////////////////////// definitions
+bool corpus_generate(const corpus_spec_s* _spec, corpus_image_s* _image)
+{
+	memset(_image, 0, sizeof(corpus_image_s));
+
+	const uint8_t channels		 = get_channels(_spec->color_type);
+	const size_t  bits_per_pixel = (size_t)channels * _spec->bit_depth;
+	const uint8_t bpp			 = bits_per_pixel < 8 ? 1 : bits_per_pixel / 8;
+	const size_t  max_row_size	 = ((size_t)_spec->width * bits_per_pixel + 7) / 8;
+
+	uint8_t* row	 = calloc(max_row_size + 1, 1);
+	uint8_t* prev	 = calloc(max_row_size + 1, 1);
+	uint8_t* out	 = calloc(max_row_size + 1, 1);
+	uint8_t* scratch = calloc(max_row_size + 1, 1);
+
+	z_stream stream;
+	memset(&stream, 0, sizeof(z_stream));
+	bool ok = row != NULL && prev != NULL && out != NULL && scratch != NULL &&
+		deflateInit(&stream, _spec->compression_level) == Z_OK;
+
+	const uint passes = _spec->interlace ? ADAM7_PASSES : 1;
+	for(uint pass = 0; ok && pass < passes; ++pass) {
+		const uint32_t start_x = _spec->interlace ? adam7_start_x[pass] : 0;
+		const uint32_t start_y = _spec->interlace ? adam7_start_y[pass] : 0;
+		const uint32_t step_x  = _spec->interlace ? adam7_step_x[pass]	: 1;
+		const uint32_t step_y  = _spec->interlace ? adam7_step_y[pass]	: 1;
+		const uint32_t pass_width  = _spec->width  > start_x ? (_spec->width  - start_x + step_x - 1) / step_x : 0;
+		const uint32_t pass_height = _spec->height > start_y ? (_spec->height - start_y + step_y - 1) / step_y : 0;
+		if(pass_width == 0 || pass_height == 0) {
+			continue;
+		}
+
+		const size_t row_size = ((size_t)pass_width * bits_per_pixel + 7) / 8;
+		memset(prev, 0, row_size);
+		for(uint32_t i = 0; ok && i < pass_height; ++i) {
+			const uint32_t y = start_y + i * step_y;
+			pack_row(_spec, row, row_size, y, start_x, step_x, pass_width);
+			out[0] = choose_filter(_spec->filter_mix, row, prev, scratch, row_size, bpp);
+			filter_row(out[0], row, prev, out + 1, row_size, bpp);
+			const bool flush = _spec->flush_rows != 0 && (i + 1) % _spec->flush_rows == 0 && i + 1 < pass_height;
+			ok = deflate_bytes(&stream, &_image->compressed, out, row_size + 1, flush ? Z_FULL_FLUSH : Z_NO_FLUSH);
+			_image->filtered_size += row_size + 1;
+
+			uint8_t* temp = prev;
+			prev = row;
+			row	 = temp;
+		}
+	}
+	ok = ok && deflate_bytes(&stream, &_image->compressed, NULL, 0, Z_FINISH);
+	(void)deflateEnd(&stream);
+
+	free(row);
+	free(prev);
+	free(out);
+	free(scratch);
+	if(!ok) {
+		corpus_free(_image);
+		return false;
+	}
+
+	//what the decoder hands back - sub byte samples get a byte each, 16 bit ones stay two bytes
+	//indexed images come out as rgba
+	_image->decoded_size = (size_t)_spec->width * _spec->height * (_spec->color_type == 3 ? 4 : channels) * (_spec->bit_depth == 16 ? 2 : 1);
+
+	bench_write_signature(&_image->png);
+	bench_write_ihdr(&_image->png, _spec->width, _spec->height, _spec->bit_depth, _spec->color_type, _spec->interlace);
+	if(_spec->color_type == 3) {
+		write_palette(&_image->png, _spec->bit_depth);
+	}
+	const size_t idat_size = _spec->idat_size == 0 ? DEFAULT_IDAT_SIZE : _spec->idat_size;
+	for(size_t offset = 0; offset < _image->compressed.size; offset += idat_size) {
+		const size_t size = offset + idat_size > _image->compressed.size ? _image->compressed.size - offset : idat_size;
+		bench_write_chunk(&_image->png, "IDAT", _image->compressed.data + offset, size);
+		++_image->idat_count;
+	}
+	bench_write_chunk(&_image->png, "IEND", NULL, 0);
+	return true;
+}
+
+void corpus_free(corpus_image_s* _image)
+{
+	bench_buffer_free(&_image->png);
+	bench_buffer_free(&_image->compressed);
+	memset(_image, 0, sizeof(corpus_image_s));
+}
+
+const char* corpus_mix_name(const filter_mix_e _mix)
+{
+	return _mix < MIX_SIZE ? mix_names[_mix] : "unknown";
+}
+
+void corpus_describe(const corpus_spec_s* _spec, char* _buffer, const size_t _size)
+{
+	snprintf(_buffer, _size, "ct%d %2dbit %ux%u%s %s", _spec->color_type, _spec->bit_depth, _spec->width, _spec->height,
+			_spec->interlace ? " adam7" : "", corpus_mix_name(_spec->filter_mix));
+}
+
+static uint8_t get_channels(const uint8_t _color_type)
+{
+	switch(_color_type) {
+		case 0: return 1;
+		case 2: return 3;
+		case 3: return 1;
+		case 4: return 2;
+		case 6: return 4;
+	}
+	return 0;
+}
+
+static uint32_t get_sample(const corpus_spec_s* _spec, const uint32_t _x, const uint32_t _y, const uint8_t _channel)
+{
+	//gradient that drifts per channel, plus a few bits of hash noise
+	uint32_t hash = _x * 73856093u ^ _y * 19349663u ^ _channel * 83492791u;
+	hash ^= hash >> 13;
+	hash *= 0x5bd1e995u;
+	hash ^= hash >> 15;
+
+	const uint32_t gradient = (_x * 3 + _y * 2) / 4 + _channel * 60;
+	switch(_spec->bit_depth) {
+		case 16: return ((gradient * 257) + (hash & 0xff)) & 0xffff;
+		case 8:	 return (gradient + (hash & 0x7)) & 0xff;
+		//few levels only - noise would turn the whole image into noise
+		default: return ((gradient >> 5) + ((hash & 0xf) == 0)) & ((1u << _spec->bit_depth) - 1);
+	}
+}
+
+static void pack_row(const corpus_spec_s* _spec, uint8_t* _row, const size_t _row_size, const uint32_t _y,
+		const uint32_t _start_x, const uint32_t _step_x, const uint32_t _width)
+{
+	const uint8_t channels = get_channels(_spec->color_type);
+	memset(_row, 0, _row_size);
+
+	size_t bit = 0;
+	for(uint32_t i = 0; i < _width; ++i) {
+		const uint32_t x = _start_x + i * _step_x;
+		for(uint8_t c = 0; c < channels; ++c) {
+			const uint32_t sample = get_sample(_spec, x, _y, c);
+			switch(_spec->bit_depth) {
+				case 16: {
+					_row[bit / 8]	  = sample >> 8;
+					_row[bit / 8 + 1] = sample & 0xff;
+					break;
+				}
+				case 8: {
+					_row[bit / 8] = sample;
+					break;
+				}
+				default: {
+					//most significant bits first
+					_row[bit / 8] |= sample << (8 - _spec->bit_depth - bit % 8);
+					break;
+				}
+			}
+			bit += _spec->bit_depth;
+		}
+	}
+}
+
+static uint8_t paeth(const uint8_t _a, const uint8_t _b, const uint8_t _c)
+{
+	const int p	 = (int)_a + _b - _c;
+	const int pa = abs(p - _a);
+	const int pb = abs(p - _b);
+	const int pc = abs(p - _c);
+	if(pa <= pb && pa <= pc) {
+		return _a;
+	}
+	return pb <= pc ? _b : _c;
+}
+
+static void filter_row(const uint8_t _type, const uint8_t* _row, const uint8_t* _prev, uint8_t* _out, const size_t _row_size, const uint8_t _bpp)
+{
+	for(size_t i = 0; i < _row_size; ++i) {
+		const uint8_t a = i >= _bpp ? _row[i - _bpp]  : 0;
+		const uint8_t b = _prev[i];
+		const uint8_t c = i >= _bpp ? _prev[i - _bpp] : 0;
+		switch(_type) {
+			case 0: _out[i] = _row[i];						   break;
+			case 1: _out[i] = _row[i] - a;					   break;
+			case 2: _out[i] = _row[i] - b;					   break;
+			case 3: _out[i] = _row[i] - ((a + b) >> 1);		   break;
+			case 4: _out[i] = _row[i] - paeth(a, b, c);		   break;
+		}
+	}
+}
+
+static uint8_t choose_filter(const filter_mix_e _mix, const uint8_t* _row, const uint8_t* _prev,
+		uint8_t* _scratch, const size_t _row_size, const uint8_t _bpp)
+{
+	if(_mix != MIX_ADAPTIVE) {
+		return (uint8_t)_mix;
+	}
+
+	//minimum sum of absolute differences, bytes taken as signed
+	uint8_t best_type = 0;
+	uint64_t best_sum = UINT64_MAX;
+	for(uint8_t type = 0; type < 5; ++type) {
+		filter_row(type, _row, _prev, _scratch, _row_size, _bpp);
+		uint64_t sum = 0;
+		for(size_t i = 0; i < _row_size; ++i) {
+			sum += abs((int8_t)_scratch[i]);
+		}
+		if(sum < best_sum) {
+			best_sum  = sum;
+			best_type = type;
+		}
+	}
+	return best_type;
+}
+
+static bool deflate_bytes(z_stream* _stream, bench_buffer_s* _out, const uint8_t* _data, const size_t _size, const int _flush)
+{
+	uint8_t chunk[DEFLATE_CHUNK];
+	_stream->next_in  = (Bytef*)_data;
+	_stream->avail_in = _size;
+	int ret;
+	do {
+		_stream->next_out  = chunk;
+		_stream->avail_out = sizeof(chunk);
+		ret = deflate(_stream, _flush);
+		if(ret == Z_STREAM_ERROR) {
+			fprintf(stderr, "deflate failed\n");
+			return false;
+		}
+		bench_buffer_append(_out, chunk, sizeof(chunk) - _stream->avail_out);
+	} while(_stream->avail_out == 0 || (_flush == Z_FINISH && ret != Z_STREAM_END));
+	return true;
+}
+
+static void write_palette(bench_buffer_s* _png, const uint8_t _bit_depth)
+{
+	//every index the samples can produce gets an entry
+	const uint entries = 1u << _bit_depth;
+	uint8_t palette[256 * 3];
+	for(uint i = 0; i < entries; ++i) {
+		palette[i * 3]	   = i * 255 / (entries - 1);
+		palette[i * 3 + 1] = (i * 97) & 0xff;
+		palette[i * 3 + 2] = 255 - i * 255 / (entries - 1);
+	}
+	bench_write_chunk(_png, "PLTE", palette, entries * 3);
+}
+
+#undef ADAM7_PASSES
+#undef DEFAULT_IDAT_SIZE
+#undef DEFLATE_CHUNK
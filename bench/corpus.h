@@ -0,0 +1,48 @@
+#ifndef __BENCH_CORPUS__
+#define __BENCH_CORPUS__
+
+#include "common.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+////////////////////////// typedefs
+typedef enum {
+	//which filter the generator puts in front of every row
+	MIX_NONE = 0,
+	MIX_SUB,
+	MIX_UP,
+	MIX_AVERAGE,
+	MIX_PAETH,
+	MIX_ADAPTIVE,	//per row minimum sum of absolute differences - what most encoders do
+	MIX_SIZE
+} filter_mix_e;
+
+typedef struct {
+	uint32_t	 width, height;
+	uint8_t		 color_type, bit_depth, interlace;
+	filter_mix_e filter_mix;
+	int			 compression_level;	//zlib level, 0 - 9
+	uint32_t	 idat_size;			//max payload of a single IDAT, 0 means 64KB
+	uint32_t	 flush_rows;		//full flush after every this many rows, like parallel encoders do - 0 means never
+} corpus_spec_s;
+
+typedef struct {
+	//a generated image together with the intermediate forms the stage benches need
+	bench_buffer_s png;
+	bench_buffer_s compressed;	//concatenated IDAT payloads - one zlib stream
+	size_t		   filtered_size;	//size of the inflated stream, filter bytes included
+	size_t		   decoded_size;	//size of the decoder output with its row padding left out
+	uint32_t	   idat_count;
+} corpus_image_s;
+
+////////////////////////// declarations
+//deterministic - the same spec always gives the same bytes
+bool corpus_generate(const corpus_spec_s* _spec, corpus_image_s* _image);
+void corpus_free(corpus_image_s* _image);
+
+const char* corpus_mix_name(const filter_mix_e _mix);
+//"ct6 8bit 1024x1024 paeth" style label
+void corpus_describe(const corpus_spec_s* _spec, char* _buffer, const size_t _size);
+
+#endif //__BENCH_CORPUS__
@@ -1,7 +1,7 @@
 #!/bin/bash
 
 sources=($(find src -iname '*.c'))
-flags=(-g)
+flags=(-g -pthread)
 output_name="build/prog"
 line_separator="\n============="
 
@@ -1,10 +1,48 @@
 #include "logger.h"
 
-#define LOGGER_MAX_LEVEL_LEN 8
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
-static log_level_e current_log_level;
+//every thread formats into its own ring, so logging never waits on another thread
+//rings are only drained into the file when they fill up, on errors, on flush and on close
+#define LOGGER_RING_SIZE (64 * 1024)
+#define LOGGER_LINE_MAX  1024
+
+typedef struct logger_ring_s {
+	//single producer (the owning thread), single consumer (whoever holds drain_lock)
+	_Atomic size_t head;
+	_Atomic size_t tail;
+	atomic_bool	   in_use;			//released rings get picked up by new threads
+	struct logger_ring_s* next;		//registry link - rings are only ever added
+	char data[LOGGER_RING_SIZE];
+} logger_ring_s;
+
+log_level_e logger_current_level;
 static FILE* log_file_pointer;
 
+static _Atomic(logger_ring_s*) ring_registry;
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t  ring_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t   ring_key;
+static __thread logger_ring_s* thread_ring;
+
+static const char* level_names[LOG_SIZE + 1] = {
+	[LOG_DEBUG_CRITICAL] = "TEMP_DEB",
+	[LOG_ERROR]			 = "ERROR",
+	[LOG_WARNING]		 = "WARNING",
+	[LOG_INFO]			 = "INFO",
+	[LOG_DEBUG_1]		 = "DEBUG_1",
+	[LOG_DEBUG_2]		 = "DEBUG_2",
+	[LOG_DEBUG_3]		 = "DEBUG_3",
+	[LOG_SIZE]			 = "UNKNOWN",
+};
+
+static logger_ring_s* get_thread_ring();
+static void release_thread_ring(void* _ring);
+static void create_ring_key();
+static void drain_ring(logger_ring_s* _ring);
+static void drain_all_rings();
 
 
 void logger_init(const log_level_e _log_level, const char* _file_path)
@@ -18,7 +56,7 @@ void logger_init(const log_level_e _log_level, const char* _file_path)
 		exit(1);
 	}
 
-	current_log_level = _log_level;
+	logger_current_level = _log_level;
 
 	LOG(LOG_INFO, "logging started");
 }
@@ -30,50 +68,165 @@ void write_simple_log(
 		const char* _func,
 		...)
 {
+	//level was already checked by the macro - this is only reached for messages that get written
+	const int saved_errno = errno;
 	ASSERT_AND_FLUSH(log_file_pointer != NULL);
-	if(current_log_level < _log_level) {
+	ASSERT_AND_FLUSH(_log_level <= LOG_SIZE);
+
+	//formatted on the stack, then copied into the ring in one go
+	char line[LOGGER_LINE_MAX];
+	int len = snprintf(line, sizeof(line), "<%s> [%s]: ", level_names[_log_level], _func);
+	if(len < (int)sizeof(line)) {
+		va_list args;
+		va_start(args, _func);
+		const int written = vsnprintf(line + len, sizeof(line) - len, _msg, args);
+		va_end(args);
+		len += written < 0 ? 0 : written;
+	}
+	if(_use_errno && len < (int)sizeof(line)) {
+		len += snprintf(line + len, sizeof(line) - len, " ==> errno: %s", strerror(saved_errno));
+	}
+	if(len > (int)sizeof(line) - 2) {
+		//too long - cut it, but keep the line ending
+		len = sizeof(line) - 2;
+	}
+	line[len++] = '\n';
+
+	logger_ring_s* ring = get_thread_ring();
+	if(ring == NULL) {
+		//no ring could be made - fall back to writing directly
+		fwrite(line, 1, len, log_file_pointer);
 		return;
 	}
 
-	char level[LOGGER_MAX_LEVEL_LEN] = {0};
-	switch(_log_level) {
-		case LOG_INFO:		strncpy(level, "INFO",	  LOGGER_MAX_LEVEL_LEN); break;
-		case LOG_WARNING:	strncpy(level, "WARNING", LOGGER_MAX_LEVEL_LEN); break;
-		case LOG_ERROR:		strncpy(level, "ERROR",   LOGGER_MAX_LEVEL_LEN); break;
-		case LOG_DEBUG_1:	strncpy(level, "DEBUG_1", LOGGER_MAX_LEVEL_LEN); break;
-		case LOG_DEBUG_2:	strncpy(level, "DEBUG_2", LOGGER_MAX_LEVEL_LEN); break;
-		case LOG_DEBUG_3:	strncpy(level, "DEBUG_3", LOGGER_MAX_LEVEL_LEN); break;
-		case LOG_SIZE:		strncpy(level, "UNKNOWN", LOGGER_MAX_LEVEL_LEN); break;
-		case LOG_DEBUG_CRITICAL:	strncpy(level, "TEMP_DEB", LOGGER_MAX_LEVEL_LEN); break;
-	}
-	ASSERT_AND_FLUSH(memcmp(level, "\0\0\0\0\0\0\0\0", LOGGER_MAX_LEVEL_LEN) != 0);
-
-	fprintf(log_file_pointer, "<%s> [%s]: ", level, _func);
-    va_list args;
-    va_start(args, _func);
-    vfprintf(log_file_pointer, _msg, args);
-    va_end(args);
-	if(_use_errno) {
-		fprintf(log_file_pointer, " ==> errno: %s", strerror(errno));
-	}
-	fprintf(log_file_pointer, "\n");
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if(LOGGER_RING_SIZE - (head - atomic_load_explicit(&ring->tail, memory_order_acquire)) < (size_t)len) {
+		drain_ring(ring);
+	}
+
+	const size_t offset = head % LOGGER_RING_SIZE;
+	const size_t first	= (size_t)len < LOGGER_RING_SIZE - offset ? (size_t)len : LOGGER_RING_SIZE - offset;
+	memcpy(ring->data + offset, line, first);
+	memcpy(ring->data, line + first, len - first);
+	atomic_store_explicit(&ring->head, head + len, memory_order_release);
+
+	//errors should not get lost if the process dies right after
+	if(_log_level <= LOG_ERROR) {
+		drain_ring(ring);
+	}
 }
 
 void change_log_level(const log_level_e _log_level)
 {
-	current_log_level = _log_level;
+	logger_current_level = _log_level;
 }
 
 void logger_close()
 {
 	ASSERT_AND_FLUSH(log_file_pointer != NULL);
-	fflush(log_file_pointer);
 	LOG(LOG_INFO, "logging ended");
+	drain_all_rings();
+
+	//every other logging thread has to be done by now - their rings go away here
+	pthread_mutex_lock(&drain_lock);
+	logger_ring_s* ring = atomic_exchange(&ring_registry, NULL);
+	while(ring != NULL) {
+		logger_ring_s* next = ring->next;
+		free(ring);
+		ring = next;
+	}
+	thread_ring = NULL;
+	pthread_setspecific(ring_key, NULL);
 	fclose(log_file_pointer);
+	log_file_pointer = NULL;
+	pthread_mutex_unlock(&drain_lock);
 }
 
 void logger_flush()
 {
-	fflush(log_file_pointer);
+	if(log_file_pointer == NULL) {
+		return;
+	}
+	drain_all_rings();
+}
+
+static logger_ring_s* get_thread_ring()
+{
+	if(thread_ring != NULL) {
+		return thread_ring;
+	}
+	pthread_once(&ring_key_once, create_ring_key);
+
+	//reuse a ring some finished thread left behind before making a new one
+	for(logger_ring_s* ring = atomic_load(&ring_registry); ring != NULL; ring = ring->next) {
+		bool expected = false;
+		if(atomic_compare_exchange_strong(&ring->in_use, &expected, true)) {
+			thread_ring = ring;
+			break;
+		}
+	}
+
+	if(thread_ring == NULL) {
+		logger_ring_s* ring = malloc(sizeof(logger_ring_s));
+		if(ring == NULL) {
+			return NULL;
+		}
+		atomic_init(&ring->head, 0);
+		atomic_init(&ring->tail, 0);
+		atomic_init(&ring->in_use, true);
+		ring->next = atomic_load(&ring_registry);
+		while(!atomic_compare_exchange_weak(&ring_registry, &ring->next, ring)) {
+			//someone else pushed first - ring->next got refreshed, try again
+		}
+		thread_ring = ring;
+	}
+
+	pthread_setspecific(ring_key, thread_ring);
+	return thread_ring;
+}
+
+static void release_thread_ring(void* _ring)
+{
+	//thread is exiting - whatever it logged goes out now and the ring is up for grabs
+	logger_ring_s* ring = _ring;
+	if(log_file_pointer != NULL) {
+		drain_ring(ring);
+	}
+	atomic_store(&ring->in_use, false);
+}
+
+static void create_ring_key()
+{
+	pthread_key_create(&ring_key, release_thread_ring);
+}
+
+static void drain_ring(logger_ring_s* _ring)
+{
+	pthread_mutex_lock(&drain_lock);
+	const size_t tail = atomic_load_explicit(&_ring->tail, memory_order_relaxed);
+	const size_t head = atomic_load_explicit(&_ring->head, memory_order_acquire);
+	if(head != tail && log_file_pointer != NULL) {
+		const size_t offset = tail % LOGGER_RING_SIZE;
+		const size_t size	= head - tail;
+		const size_t first	= size < LOGGER_RING_SIZE - offset ? size : LOGGER_RING_SIZE - offset;
+		fwrite(_ring->data + offset, 1, first, log_file_pointer);
+		fwrite(_ring->data, 1, size - first, log_file_pointer);
+	}
+	atomic_store_explicit(&_ring->tail, head, memory_order_release);
+	pthread_mutex_unlock(&drain_lock);
+}
+
+static void drain_all_rings()
+{
+	for(logger_ring_s* ring = atomic_load(&ring_registry); ring != NULL; ring = ring->next) {
+		drain_ring(ring);
+	}
+	pthread_mutex_lock(&drain_lock);
+	if(log_file_pointer != NULL) {
+		fflush(log_file_pointer);
+	}
+	pthread_mutex_unlock(&drain_lock);
 }
 
+#undef LOGGER_RING_SIZE
+#undef LOGGER_LINE_MAX
@@ -22,14 +22,28 @@ typedef enum{
 	LOG_SIZE
 } log_level_e;
 
+//anything more verbose than this is compiled out, arguments included - build with e.g. -DLOG_MIN_LEVEL=LOG_WARNING
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_DEBUG_3
+#endif
+
+//runtime level - read by the LOG macros before any argument gets evaluated
+extern log_level_e logger_current_level;
+
 void logger_init(const log_level_e, const char*);
 void logger_close();
 void write_simple_log(const bool _use_errno, const log_level_e, const char*, const char*, ...);
 void change_log_level(const log_level_e);
 void logger_flush();
 
-#define LOG(_log_level, _fmt, args...) write_simple_log(false, _log_level, _fmt, __FUNCTION__, ##args)
-#define LOG_ERRNO(_log_level, _fmt, args...) write_simple_log(true, _log_level, _fmt, __FUNCTION__, ##args)
-#define ASSERT_AND_FLUSH(_expr) do{logger_flush(); assert(_expr);} while(0);
+#define LOG_ENABLED(_log_level) ((_log_level) <= LOG_MIN_LEVEL && (_log_level) <= logger_current_level)
+#define LOG(_log_level, _fmt, args...) do{ if(LOG_ENABLED(_log_level)) write_simple_log(false, _log_level, _fmt, __FUNCTION__, ##args); }while(0)
+#define LOG_ERRNO(_log_level, _fmt, args...) do{ if(LOG_ENABLED(_log_level)) write_simple_log(true, _log_level, _fmt, __FUNCTION__, ##args); }while(0)
+//logs only get flushed when the assertion is about to fire
+#ifdef NDEBUG
+#define ASSERT_AND_FLUSH(_expr) do{} while(0);
+#else
+#define ASSERT_AND_FLUSH(_expr) do{ if(!(_expr)) { logger_flush(); assert(_expr); } } while(0);
+#endif
 
 #endif //__LOGGER__
@@ -2,10 +2,15 @@
 
 //////////////////////////custom includes
 #include "png_decoder.h"
+#include "png_encoder.h"
 #include "logger.h"
 
 #define FILE_PATH_PNG "assets/read_png.png"
-#define WRITE_FILE_PATH_PNG "assets/write.png"
+#define FILE_PATH_OUT "assets/write.png"
+
+////////////////////////// declarations
+static bool write_png(const png_external_context_s* _decoded, const char* _path);
+static void log_stats(const png_stats_s* _stats);
 
 
 int main()
@@ -18,45 +23,72 @@ int main()
 	//transform it into binary
 
 	//////////////////////////CURRENT WORKFLOW
-	//read this png garbage
-	FILE* fp;
-	fp = fopen(FILE_PATH_PNG, "r");
-	if(fp == NULL) {
-		LOG_ERRNO(LOG_ERROR, "cannot open a file");
+	//file is mapped and decoded in place - no heap copy of the compressed data
+	//rgba8 rows are already what a colour type 6 scanline looks like, so they can go straight back to the encoder
+	//stats of the decode end up in the log next to everything else
+	png_stats_s stats;
+	const png_decoder_options_s options = {.format = PNG_FORMAT_RGBA8, .stats = &stats};
+	png_decoder_s* decoder = png_decoder_create(&options);
+	if(decoder == NULL) {
+		LOG(LOG_ERROR, "could not create decoder");
+		logger_close();
 		return 1;
 	}
 
-	//read whole file
-	fseek(fp, 0, SEEK_END);
-	long num_of_bytes = ftell(fp);
-	(void)fseek(fp, 0, SEEK_SET);
-	char* file_contents = (char*)malloc(sizeof(char) * (num_of_bytes + 1));
-	fread(file_contents, num_of_bytes, sizeof(char), fp);
-	file_contents[num_of_bytes] = '\0';
-	fclose(fp);
-
-	LOG(LOG_INFO, "read %d, bytes from og file", num_of_bytes);
-
-	fopen(WRITE_FILE_PATH_PNG, "w+");
-	if(fp == NULL) {
-		LOG_ERRNO(LOG_ERROR, "cannot open a file");
-		return 1;
-	}
-	fseek(fp, 0, SEEK_SET);
-	fwrite(file_contents , num_of_bytes, sizeof(char), fp);
-	fclose(fp);
-
-	//now that we have a full file we can start doing shit with it
-	png_external_context_s* decoded_png = decode_from_png(file_contents, num_of_bytes);
+	png_external_context_s* decoded_png = png_decoder_decode_file(decoder, FILE_PATH_PNG);
+	int ret = decoded_png == NULL ? 1 : 0;
 	if(decoded_png == NULL) {
 		LOG(LOG_ERROR, "failure decoding png");
+	} else {
+		LOG(LOG_INFO, "decoded %dx%d image", decoded_png->width, decoded_png->height);
+		log_stats(&stats);
+		ret = write_png(decoded_png, FILE_PATH_OUT) ? 0 : 1;
 	}
-
-	/*arena_s arena;*/
-	/*arena_init(&arena);*/
+	free_decoded_png(decoded_png);
+	png_decoder_destroy(decoder);
 
 	logger_close();
-	return 0;
+	return ret;
+}
+
+static bool write_png(const png_external_context_s* _decoded, const char* _path)
+{
+	const png_image_s image = {
+		.pixels = _decoded->pixels, .stride = _decoded->stride, .width = _decoded->width, .height = _decoded->height,
+		.color_type = 6, .bit_depth = 8,
+	};
+	png_encoded_s* encoded = encode_to_png(&image, NULL);
+	if(encoded == NULL) {
+		LOG(LOG_ERROR, "failure encoding png");
+		return false;
+	}
+	FILE* file = fopen(_path, "wb");
+	const bool written = file != NULL && fwrite(encoded->data, 1, encoded->size, file) == encoded->size;
+	if(file != NULL) {
+		fclose(file);
+	}
+	if(!written) {
+		LOG_ERRNO(LOG_ERROR, "could not write %s", _path);
+	} else {
+		LOG(LOG_INFO, "wrote %zu bytes to %s", encoded->size, _path);
+	}
+	free_encoded_png(encoded);
+	return written;
+}
+
+static void log_stats(const png_stats_s* _stats)
+{
+	const double ms_per_tick = 1e3 / png_stats_ticks_per_second();
+	LOG(LOG_INFO, "decode took %.3f ms - %llu bytes in, %llu inflated, %llu out, %llu allocations, %zu bytes of scratch",
+			_stats->total_cycles * ms_per_tick, (unsigned long long)_stats->bytes_in, (unsigned long long)_stats->inflated_bytes,
+			(unsigned long long)_stats->bytes_out, (unsigned long long)_stats->allocations, _stats->peak_scratch);
+	for(int s = 0; s < PNG_STAGE_SIZE; ++s) {
+		LOG(LOG_INFO, "  %-8s %.3f ms", png_stats_stage_name(s), _stats->cycles[s] * ms_per_tick);
+	}
+	for(uint32_t c = 0; c < _stats->chunk_types; ++c) {
+		LOG(LOG_INFO, "  %.4s x %u", _stats->chunks[c].type, _stats->chunks[c].count);
+	}
 }
 
 #undef FILE_PATH_PNG
+#undef FILE_PATH_OUT
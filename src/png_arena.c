@@ -0,0 +1,163 @@
+#include "png_arena.h"
+#include "logger.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+//block headers are padded so the data behind them keeps the block alignment
+#define ARENA_BLOCK_ALIGNMENT	64
+#define ARENA_HEADER_SIZE		((sizeof(png_arena_block_s) + ARENA_BLOCK_ALIGNMENT - 1) & ~(size_t)(ARENA_BLOCK_ALIGNMENT - 1))
+#define ARENA_MIN_BLOCK_SIZE	(64 * 1024)
+
+////////////////////////// declarations
+static void* default_alloc(void* _user, const size_t _size, const size_t _alignment);
+static void  default_free(void* _user, void* _ptr);
+static void* arena_alloc_callback(void* _user, const size_t _size, const size_t _alignment);
+static void  arena_free_callback(void* _user, void* _ptr);
+static void  release_blocks(png_arena_s* _arena);
+
+
+////////////////////////// definitions
+png_allocator_s png_default_allocator()
+{
+	png_allocator_s allocator = {.alloc = default_alloc, .free = default_free, .user = NULL};
+	return allocator;
+}
+
+void png_arena_init(png_arena_s* _arena, const png_allocator_s* _backing, const size_t _block_size)
+{
+	ASSERT_AND_FLUSH(_arena != NULL);
+	_arena->backing			= (_backing != NULL && _backing->alloc != NULL) ? *_backing : png_default_allocator();
+	_arena->blocks			= NULL;
+	_arena->next_block_size = _block_size < ARENA_MIN_BLOCK_SIZE ? ARENA_MIN_BLOCK_SIZE : _block_size;
+	_arena->used			= 0;
+	_arena->peak			= 0;
+}
+
+void* png_arena_alloc(png_arena_s* _arena, const size_t _size, const size_t _alignment)
+{
+	ASSERT_AND_FLUSH(_arena != NULL);
+	ASSERT_AND_FLUSH(_alignment != 0 && (_alignment & (_alignment - 1)) == 0);
+	ASSERT_AND_FLUSH(_alignment <= ARENA_BLOCK_ALIGNMENT);
+
+	png_arena_block_s* block = _arena->blocks;
+	if(block != NULL) {
+		uint8_t* data	  = (uint8_t*)block + ARENA_HEADER_SIZE;
+		const size_t start = (block->used + _alignment - 1) & ~(_alignment - 1);
+		if(start + _size <= block->size) {
+			block->used   = start + _size;
+			_arena->used += _size;
+			if(_arena->used > _arena->peak) {
+				_arena->peak = _arena->used;
+			}
+			return data + start;
+		}
+	}
+
+	//current block is full - grab a new one, at least twice as big as the last so growth stays logarithmic
+	size_t block_size = _arena->next_block_size;
+	if(block != NULL && block_size < block->size * 2) {
+		block_size = block->size * 2;
+	}
+	if(block_size < _size) {
+		block_size = _size;
+	}
+	block_size = (block_size + ARENA_BLOCK_ALIGNMENT - 1) & ~(size_t)(ARENA_BLOCK_ALIGNMENT - 1);
+
+	png_arena_block_s* new_block = _arena->backing.alloc(_arena->backing.user, ARENA_HEADER_SIZE + block_size, ARENA_BLOCK_ALIGNMENT);
+	if(new_block == NULL) {
+		LOG(LOG_ERROR, "arena could not get a new block of %zu bytes", block_size);
+		return NULL;
+	}
+	new_block->next = _arena->blocks;
+	new_block->size = block_size;
+	new_block->used = _size;
+	_arena->blocks	= new_block;
+
+	_arena->used += _size;
+	if(_arena->used > _arena->peak) {
+		_arena->peak = _arena->used;
+	}
+	return (uint8_t*)new_block + ARENA_HEADER_SIZE;
+}
+
+void png_arena_reset(png_arena_s* _arena)
+{
+	ASSERT_AND_FLUSH(_arena != NULL);
+	if(_arena->blocks == NULL) {
+		_arena->used = 0;
+		return;
+	}
+
+	if(_arena->blocks->next == NULL) {
+		//steady state - one block that fits a whole image, just rewind it
+		_arena->blocks->used = 0;
+		_arena->used		 = 0;
+		return;
+	}
+
+	//last round spilled over several blocks - drop them and make the next one big enough for everything
+	size_t total = 0;
+	for(png_arena_block_s* block = _arena->blocks; block != NULL; block = block->next) {
+		total += block->size;
+	}
+	release_blocks(_arena);
+	_arena->next_block_size = total;
+	_arena->used			= 0;
+}
+
+void png_arena_release(png_arena_s* _arena)
+{
+	ASSERT_AND_FLUSH(_arena != NULL);
+	release_blocks(_arena);
+	_arena->used = 0;
+}
+
+png_allocator_s png_arena_allocator(png_arena_s* _arena)
+{
+	png_allocator_s allocator = {.alloc = arena_alloc_callback, .free = arena_free_callback, .user = _arena};
+	return allocator;
+}
+
+static void release_blocks(png_arena_s* _arena)
+{
+	png_arena_block_s* block = _arena->blocks;
+	while(block != NULL) {
+		png_arena_block_s* next = block->next;
+		_arena->backing.free(_arena->backing.user, block);
+		block = next;
+	}
+	_arena->blocks = NULL;
+}
+
+static void* default_alloc(void* _user, const size_t _size, const size_t _alignment)
+{
+	(void)_user;
+	if(_alignment <= sizeof(max_align_t)) {
+		return malloc(_size);
+	}
+	//aligned_alloc wants the size to be a multiple of the alignment
+	return aligned_alloc(_alignment, (_size + _alignment - 1) & ~(_alignment - 1));
+}
+
+static void default_free(void* _user, void* _ptr)
+{
+	(void)_user;
+	free(_ptr);
+}
+
+static void* arena_alloc_callback(void* _user, const size_t _size, const size_t _alignment)
+{
+	return png_arena_alloc((png_arena_s*)_user, _size, _alignment);
+}
+
+static void arena_free_callback(void* _user, void* _ptr)
+{
+	//memory goes back all at once on reset
+	(void)_user;
+	(void)_ptr;
+}
+
+#undef ARENA_BLOCK_ALIGNMENT
+#undef ARENA_HEADER_SIZE
+#undef ARENA_MIN_BLOCK_SIZE
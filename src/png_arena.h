@@ -0,0 +1,41 @@
+#ifndef __PNG_ARENA__
+#define __PNG_ARENA__
+
+#include <stdint.h>
+#include <stddef.h>
+
+////////////////////////// typedefs
+typedef struct {
+	//where the decoder gets its memory from - _alignment is always a power of two
+	void* (*alloc)(void* _user, const size_t _size, const size_t _alignment);
+	void  (*free)(void* _user, void* _ptr);
+	void* user;
+} png_allocator_s;
+
+typedef struct png_arena_block_s {
+	struct png_arena_block_s* next;
+	size_t size;	//usable bytes after the header
+	size_t used;
+} png_arena_block_s;
+
+typedef struct {
+	//bump allocator - individual frees are no-ops, everything goes away on reset
+	png_allocator_s	   backing;
+	png_arena_block_s* blocks;			//newest first, allocations only come from the head
+	size_t			   next_block_size;	//after a reset this covers everything the last round needed
+	size_t			   used;			//bytes handed out since the last reset
+	size_t			   peak;			//biggest used seen between two resets
+} png_arena_s;
+
+////////////////////////// declarations
+png_allocator_s png_default_allocator();
+
+void  png_arena_init(png_arena_s* _arena, const png_allocator_s* _backing, const size_t _block_size);
+void* png_arena_alloc(png_arena_s* _arena, const size_t _size, const size_t _alignment);
+//keeps the memory around - if it took more than one block, they get merged into one on the next allocation
+void  png_arena_reset(png_arena_s* _arena);
+void  png_arena_release(png_arena_s* _arena);
+//allocator view of the arena, free does nothing
+png_allocator_s png_arena_allocator(png_arena_s* _arena);
+
+#endif //__PNG_ARENA__
@@ -0,0 +1,184 @@
+#include "png_batch.h"
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define CACHE_LINE 64
+//a range is packed into one word - low half is the next image to take, high half is one past the last
+#define RANGE_PACK(_begin, _end) (((uint64_t)(_end) << 32) | (uint32_t)(_begin))
+#define RANGE_BEGIN(_range)		 ((uint32_t)(_range))
+#define RANGE_END(_range)		 ((uint32_t)((_range) >> 32))
+
+typedef struct batch_s batch_s;
+
+typedef struct {
+	//owner takes images from the front, thieves cut off the back - both through a cas on range
+	_Atomic uint64_t range;
+	png_decoder_s*	 decoder;
+	batch_s*		 batch;
+	uint			 index;
+	pthread_t		 thread;
+} __attribute__((aligned(CACHE_LINE))) batch_worker_s;
+
+struct batch_s {
+	const png_batch_input_s* inputs;
+	png_external_context_s** outputs;
+	batch_worker_s*			 workers;
+	uint					 worker_count;
+	atomic_bool				 all_decoded;
+};
+
+////////////////////////// declarations
+static void* worker_loop(void* _worker);
+static const int64_t take_own(batch_worker_s* _worker);
+static const int64_t steal(batch_worker_s* _worker);
+
+
+////////////////////////// definitions
+bool png_decode_batch(const png_batch_input_s* _inputs, const size_t _count, png_external_context_s** _outputs,
+		const uint _threads, const png_decoder_options_s* _options)
+{
+	ASSERT_AND_FLUSH(_inputs  != NULL || _count == 0);
+	ASSERT_AND_FLUSH(_outputs != NULL || _count == 0);
+	if(_count == 0) {
+		return true;
+	}
+	if(_count > UINT32_MAX) {
+		LOG(LOG_ERROR, "batch of %zu images is too big", _count);
+		return false;
+	}
+
+	uint worker_count = _threads;
+	if(worker_count == 0) {
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		worker_count = cpus > 0 ? (uint)cpus : 1;
+	}
+	if(worker_count > _count) {
+		worker_count = _count;
+	}
+
+	png_decoder_options_s options = {0};
+	if(_options != NULL) {
+		options = *_options;
+	}
+	options.use_arena = false;
+
+	batch_worker_s* workers = aligned_alloc(CACHE_LINE, sizeof(batch_worker_s) * worker_count);
+	if(workers == NULL) {
+		LOG_ERRNO(LOG_ERROR, "could not allocate %d workers", worker_count);
+		return false;
+	}
+
+	batch_s batch = {
+		.inputs		  = _inputs,
+		.outputs	  = _outputs,
+		.workers	  = workers,
+		.worker_count = worker_count,
+	};
+	atomic_init(&batch.all_decoded, true);
+
+	//contiguous, evenly sized starting ranges - stealing evens out whatever the sizes get wrong
+	for(uint w = 0; w < worker_count; ++w) {
+		const size_t begin = _count * w / worker_count;
+		const size_t end   = _count * (w + 1) / worker_count;
+		atomic_init(&workers[w].range, RANGE_PACK(begin, end));
+		workers[w].batch   = &batch;
+		workers[w].index   = w;
+		workers[w].decoder = png_decoder_create(&options);
+		if(workers[w].decoder == NULL) {
+			atomic_store(&batch.all_decoded, false);
+		}
+	}
+	for(size_t i = 0; i < _count; ++i) {
+		_outputs[i] = NULL;
+	}
+
+	//caller is worker 0, so a single thread batch never spawns anything
+	uint started = 1;
+	for(uint w = 1; w < worker_count; ++w, ++started) {
+		if(pthread_create(&workers[w].thread, NULL, worker_loop, &workers[w]) != 0) {
+			//whoever did start steals its images
+			LOG(LOG_WARNING, "could only start %d out of %d workers", started, worker_count);
+			break;
+		}
+	}
+	(void)worker_loop(&workers[0]);
+	for(uint w = 1; w < started; ++w) {
+		pthread_join(workers[w].thread, NULL);
+	}
+
+	for(uint w = 0; w < worker_count; ++w) {
+		png_decoder_destroy(workers[w].decoder);
+	}
+	free(workers);
+	return atomic_load(&batch.all_decoded);
+}
+
+static void* worker_loop(void* _worker)
+{
+	batch_worker_s* worker = _worker;
+	batch_s* batch = worker->batch;
+
+	while(true) {
+		int64_t image = take_own(worker);
+		if(image < 0) {
+			image = steal(worker);
+		}
+		if(image < 0) {
+			//nothing left anywhere - images only ever leave ranges, so this is final
+			break;
+		}
+
+		png_external_context_s* decoded = NULL;
+		if(worker->decoder != NULL) {
+			const png_batch_input_s* input = &(batch->inputs[image]);
+			decoded = png_decoder_decode(worker->decoder, input->data, input->size);
+		}
+		if(decoded == NULL) {
+			LOG(LOG_ERROR, "image %ld of the batch could not be decoded", image);
+			atomic_store_explicit(&batch->all_decoded, false, memory_order_relaxed);
+		}
+		batch->outputs[image] = decoded;
+	}
+	return NULL;
+}
+
+static const int64_t take_own(batch_worker_s* _worker)
+{
+	uint64_t range = atomic_load_explicit(&_worker->range, memory_order_acquire);
+	while(RANGE_BEGIN(range) < RANGE_END(range)) {
+		const uint64_t taken = RANGE_PACK(RANGE_BEGIN(range) + 1, RANGE_END(range));
+		if(atomic_compare_exchange_weak_explicit(&_worker->range, &range, taken, memory_order_acq_rel, memory_order_acquire)) {
+			return RANGE_BEGIN(range);
+		}
+	}
+	return -1;
+}
+
+static const int64_t steal(batch_worker_s* _worker)
+{
+	batch_s* batch = _worker->batch;
+	//victims are visited starting from the neighbour, so thieves spread out instead of all hitting worker 0
+	for(uint offset = 1; offset < batch->worker_count; ++offset) {
+		batch_worker_s* victim = &(batch->workers[(_worker->index + offset) % batch->worker_count]);
+		uint64_t range = atomic_load_explicit(&victim->range, memory_order_acquire);
+		while(RANGE_BEGIN(range) < RANGE_END(range)) {
+			const uint32_t begin  = RANGE_BEGIN(range);
+			const uint32_t end	  = RANGE_END(range);
+			const uint32_t stolen = (end - begin + 1) / 2;
+			if(atomic_compare_exchange_weak_explicit(&victim->range, &range, RANGE_PACK(begin, end - stolen),
+						memory_order_acq_rel, memory_order_acquire)) {
+				//first stolen image is decoded right away, the rest becomes our own range and can be stolen back
+				atomic_store_explicit(&_worker->range, RANGE_PACK(end - stolen + 1, end), memory_order_release);
+				return end - stolen;
+			}
+		}
+	}
+	return -1;
+}
+
+#undef CACHE_LINE
+#undef RANGE_PACK
+#undef RANGE_BEGIN
+#undef RANGE_END
@@ -0,0 +1,22 @@
+#ifndef __PNG_BATCH__
+#define __PNG_BATCH__
+
+#include "png_decoder.h"
+
+////////////////////////// typedefs
+typedef struct {
+	char* data;
+	uint  size;
+} png_batch_input_s;
+
+////////////////////////// declarations
+//decodes _count independent images on _threads threads (0 means one per online cpu, the caller counts as one)
+//every worker owns a decoder, so scratch buffers and inflate state are reused from image to image
+//and idle workers steal the back half of a busy worker's remaining images
+//_outputs[i] is NULL where image i failed - free the rest with free_decoded_png()
+//options.use_arena is ignored, results have to outlive the workers
+//returns true only if every image decoded
+bool png_decode_batch(const png_batch_input_s* _inputs, const size_t _count, png_external_context_s** _outputs,
+		const uint _threads, const png_decoder_options_s* _options);
+
+#endif //__PNG_BATCH__
@@ -0,0 +1,56 @@
+#ifndef __PNG_CHUNK__
+#define __PNG_CHUNK__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+////////////////////////// defines
+//layout every png shares - the signature, then chunks of length, type, payload and crc one after another
+#define PNG_MAGIC_NUMBER	 "\x89\x50\x4e\x47\x0d\x0a\x1a\x0a"
+#define PNG_MAGIC_NUM_LEN	 8
+//length and type in front of every payload
+#define PNG_CHUNK_HEADER_LEN 8
+#define PNG_CRC_LEN			 4
+
+////////////////////////// typedefs
+typedef enum {
+	CHUNK_WALK_OK = 0,
+	CHUNK_WALK_END,			//fewer bytes left than a chunk header
+	CHUNK_WALK_TRUNCATED,	//header is there, the payload or crc behind it is not - type and size are still filled in
+	CHUNK_WALK_TOO_LONG,	//length does not fit in 31 bits
+} png_chunk_walk_e;
+
+typedef struct {
+	uint32_t type;		//PNG_CHUNK_TYPE()
+	uint32_t size;		//of the payload
+	size_t	 payload;	//offset of the payload from the start of the input
+} png_chunk_view_s;
+
+////////////////////////// definitions
+static inline uint32_t png_read_be32(const uint8_t* _bytes)
+{
+	return ((uint32_t)_bytes[0] << 24) | ((uint32_t)_bytes[1] << 16) | ((uint32_t)_bytes[2] << 8) | (uint32_t)_bytes[3];
+}
+
+//one step of a walk over a png held in memory - only the 8 bytes in front of the chunk at _offset are read, and on
+//CHUNK_WALK_OK _offset is moved past its crc to the next one
+static inline png_chunk_walk_e png_chunk_next(const uint8_t* _png, const size_t _size, size_t* _offset, png_chunk_view_s* _chunk)
+{
+	if(*_offset > _size || _size - *_offset < PNG_CHUNK_HEADER_LEN) {
+		return CHUNK_WALK_END;
+	}
+	_chunk->size	= png_read_be32(_png + *_offset);
+	_chunk->type	= png_read_be32(_png + *_offset + sizeof(uint32_t));
+	_chunk->payload = *_offset + PNG_CHUNK_HEADER_LEN;
+	if(_chunk->size > INT32_MAX) {
+		return CHUNK_WALK_TOO_LONG;
+	}
+	if((size_t)_chunk->size + PNG_CRC_LEN > _size - _chunk->payload) {
+		return CHUNK_WALK_TRUNCATED;
+	}
+	*_offset = _chunk->payload + _chunk->size + PNG_CRC_LEN;
+	return CHUNK_WALK_OK;
+}
+
+#endif //__PNG_CHUNK__
@@ -0,0 +1,466 @@
+#include "png_convert.h"
+#include "logger.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CONVERT_X86
+#include <immintrin.h>
+#endif
+
+#define FORMAT_COUNT (PNG_FORMAT_RGBA8_PREMULTIPLIED + 1)
+//rounds x / 257 to nearest, which is what 16 to 8 bit has to be to stay exact for samples that came from 8 bit ones
+#define TO_8(_x) ((((uint32_t)(_x)) * 255 + 32895) >> 16)
+//bt.601 weights out of 256 - grey in gives the same grey out
+#define LUMA(_r, _g, _b) ((77 * (uint32_t)(_r) + 150 * (uint32_t)(_g) + 29 * (uint32_t)(_b) + 128) >> 8)
+
+////////////////////////// global variables
+//one kernel per bit depth (8, 16), source channels and format, filled once at startup from cpuid - afterwards only read
+static png_convert_fn direct_table[2][4][FORMAT_COUNT];
+static png_convert_fn gray_bits_table[FORMAT_COUNT];
+static png_convert_fn palette_table[FORMAT_COUNT];
+static convert_impl_e selected_impl = CONVERT_IMPL_SCALAR;
+
+
+////////////////////////// declarations
+static uint8_t source_channels(const uint8_t _color_type);
+static bool format_has_alpha(const png_format_e _format);
+static void convert_native(const png_converter_s* _conv, const uint8_t* _src, uint8_t* _dst, const size_t _x, const size_t _width);
+static void convert_palette(const png_converter_s* _conv, const uint8_t* _src, uint8_t* _dst, const size_t _x, const size_t _width);
+static void convert_generic(const png_converter_s* _conv, const uint8_t* _src, uint8_t* _dst, const size_t _x, const size_t _width);
+static void convert_init() __attribute__((constructor));
+
+
+////////////////////////// definitions
+bool png_format_valid(const png_format_e _format)
+{
+	return (unsigned)_format < FORMAT_COUNT;
+}
+
+uint8_t png_format_channels(const png_format_e _format, const uint8_t _color_type)
+{
+	switch(_format) {
+		//indices are looked up in the palette on the way out
+		case PNG_FORMAT_NATIVE: return _color_type == 3 ? 4 : source_channels(_color_type);
+		case PNG_FORMAT_RGB8:	return 3;
+		case PNG_FORMAT_GRAY8:	return 1;
+		default:				return 4;
+	}
+}
+
+uint8_t png_format_bytes_per_channel(const png_format_e _format, const uint8_t _bit_depth)
+{
+	switch(_format) {
+		case PNG_FORMAT_NATIVE: return _bit_depth == 16 ? 2 : 1;
+		case PNG_FORMAT_RGBA16: return 2;
+		default:				return 1;
+	}
+}
+
+void png_converter_init(png_converter_s* _conv, const png_format_e _format, const uint8_t _color_type, const uint8_t _bit_depth,
+		const png_palette_lut_s* _palette, const uint16_t* _colour_key)
+{
+	ASSERT_AND_FLUSH(_conv != NULL);
+	ASSERT_AND_FLUSH(png_format_valid(_format));
+
+	_conv->format		  = _format;
+	_conv->color_type	  = _color_type;
+	_conv->bit_depth	  = _bit_depth;
+	_conv->has_colour_key = _colour_key != NULL;
+	if(_colour_key != NULL) {
+		memcpy(_conv->colour_key, _colour_key, sizeof(_conv->colour_key));
+	}
+
+	if(_color_type == 3) {
+		//whatever the lut can absorb is done once on its 256 entries instead of on every pixel
+		ASSERT_AND_FLUSH(_palette != NULL);
+		_conv->lut	   = *_palette;
+		_conv->convert = convert_palette;
+		switch(_format) {
+			case PNG_FORMAT_NATIVE:
+			case PNG_FORMAT_RGBA8: {
+				return;
+			}
+			case PNG_FORMAT_BGRA8: {
+				for(int i = 0; i < 256; ++i) {
+					const uint8_t r = _conv->lut.rgba[i][0];
+					_conv->lut.rgba[i][0] = _conv->lut.rgba[i][2];
+					_conv->lut.rgba[i][2] = r;
+				}
+				png_palette_lut_update(&(_conv->lut));
+				return;
+			}
+			case PNG_FORMAT_RGBA8_PREMULTIPLIED: {
+				for(int i = 0; i < 256; ++i) {
+					for(int c = 0; c < 3; ++c) {
+						const uint32_t t = (uint32_t)_conv->lut.rgba[i][c] * _conv->lut.rgba[i][3] + 128;
+						_conv->lut.rgba[i][c] = (t + (t >> 8)) >> 8;
+					}
+				}
+				png_palette_lut_update(&(_conv->lut));
+				return;
+			}
+			default: {
+				_conv->convert = palette_table[_format];
+				return;
+			}
+		}
+	}
+
+	if(_format == PNG_FORMAT_NATIVE) {
+		_conv->convert = convert_native;
+	} else if(_conv->has_colour_key && format_has_alpha(_format)) {
+		_conv->convert = convert_generic;
+	} else if(_bit_depth < 8) {
+		_conv->convert = gray_bits_table[_format];
+	} else {
+		_conv->convert = direct_table[_bit_depth == 16][source_channels(_color_type) - 1][_format];
+	}
+	ASSERT_AND_FLUSH(_conv->convert != NULL);
+}
+
+convert_impl_e png_convert_get_impl()
+{
+	return selected_impl;
+}
+
+static uint8_t source_channels(const uint8_t _color_type)
+{
+	switch(_color_type) {
+		case 0: return 1;	//grayscale
+		case 2: return 3;	//rgb
+		case 3: return 1;	//palette index
+		case 4: return 2;	//grayscale + alpha
+		case 6: return 4;	//rgb + alpha
+	}
+	return 0;
+}
+
+static bool format_has_alpha(const png_format_e _format)
+{
+	return _format == PNG_FORMAT_RGBA8 || _format == PNG_FORMAT_BGRA8 || _format == PNG_FORMAT_RGBA16 ||
+		   _format == PNG_FORMAT_RGBA8_PREMULTIPLIED;
+}
+
+////////////////////////// scalar kernels
+static inline uint32_t load_sample(const uint8_t* _pixel, const size_t _index, const uint8_t _depth)
+{
+	return _depth == 16 ? ((uint32_t)_pixel[2 * _index] << 8) | _pixel[2 * _index + 1] : _pixel[_index];
+}
+
+static inline uint8_t premultiply(const uint32_t _c, const uint32_t _a)
+{
+	//_c * _a / 255, rounded, without the division
+	const uint32_t t = _c * _a + 128;
+	return (t + (t >> 8)) >> 8;
+}
+
+static inline void store_pixel(uint8_t* _dst, const size_t _i, uint32_t _r, uint32_t _g, uint32_t _b, uint32_t _a,
+		const uint8_t _depth, const png_format_e _format)
+{
+	//samples come in at _depth bits (8 or 16) - inlined with constants, only the branch of _format is left
+	if(_format == PNG_FORMAT_RGBA16) {
+		const uint16_t pixel[4] = {
+			_depth == 16 ? _r : _r * 257, _depth == 16 ? _g : _g * 257, _depth == 16 ? _b : _b * 257, _depth == 16 ? _a : _a * 257,
+		};
+		memcpy(_dst + 8 * _i, pixel, sizeof(pixel));
+		return;
+	}
+	if(_depth == 16) {
+		_r = TO_8(_r);
+		_g = TO_8(_g);
+		_b = TO_8(_b);
+		_a = TO_8(_a);
+	}
+	switch(_format) {
+		case PNG_FORMAT_RGBA8: {
+			uint8_t* dst = _dst + 4 * _i;
+			dst[0] = _r; dst[1] = _g; dst[2] = _b; dst[3] = _a;
+			break;
+		}
+		case PNG_FORMAT_BGRA8: {
+			uint8_t* dst = _dst + 4 * _i;
+			dst[0] = _b; dst[1] = _g; dst[2] = _r; dst[3] = _a;
+			break;
+		}
+		case PNG_FORMAT_RGBA8_PREMULTIPLIED: {
+			uint8_t* dst = _dst + 4 * _i;
+			dst[0] = premultiply(_r, _a); dst[1] = premultiply(_g, _a); dst[2] = premultiply(_b, _a); dst[3] = _a;
+			break;
+		}
+		case PNG_FORMAT_RGB8: {
+			uint8_t* dst = _dst + 3 * _i;
+			dst[0] = _r; dst[1] = _g; dst[2] = _b;
+			break;
+		}
+		case PNG_FORMAT_GRAY8: {
+			_dst[_i] = LUMA(_r, _g, _b);
+			break;
+		}
+		default: {
+			LOG(LOG_ERROR, "no scalar store for format %d", _format);
+			ASSERT_AND_FLUSH(0);
+		}
+	}
+}
+
+static inline void convert_direct(const uint8_t* _src, uint8_t* _dst, const size_t _width, const uint8_t _channels, const uint8_t _depth,
+		const png_format_e _format)
+{
+	//8 and 16 bit samples without a colour key - inlined with constants only, so every instance is one plain loop
+	const bool same = _depth == 8 && ((_channels == 4 && _format == PNG_FORMAT_RGBA8) || (_channels == 3 && _format == PNG_FORMAT_RGB8) ||
+									  (_channels == 1 && _format == PNG_FORMAT_GRAY8));
+	if(same) {
+		memcpy(_dst, _src, _width * _channels);
+		return;
+	}
+	const size_t   pixel_size = (size_t)_channels * _depth / 8;
+	const uint32_t opaque	  = _depth == 16 ? 0xffff : 0xff;
+	for(size_t i = 0; i < _width; ++i) {
+		const uint8_t* pixel = _src + i * pixel_size;
+		const uint32_t r = load_sample(pixel, 0, _depth);
+		const uint32_t g = _channels >= 3 ? load_sample(pixel, 1, _depth) : r;
+		const uint32_t b = _channels >= 3 ? load_sample(pixel, 2, _depth) : r;
+		const uint32_t a = _channels == 2 ? load_sample(pixel, 1, _depth) : (_channels == 4 ? load_sample(pixel, 3, _depth) : opaque);
+		store_pixel(_dst, i, r, g, b, a, _depth, _format);
+	}
+}
+
+static inline void convert_gray_bits(const uint8_t* _src, uint8_t* _dst, const size_t _x, const size_t _width, const uint8_t _depth,
+		const png_format_e _format)
+{
+	//1, 2 or 4 bit grey - samples are packed from the most significant bit and stretched to the full 8 bit range
+	const uint8_t mask	= (1 << _depth) - 1;
+	const uint8_t scale = 255 / mask;
+	for(size_t i = 0; i < _width; ++i) {
+		const size_t  bit  = (_x + i) * _depth;
+		const uint8_t grey = ((_src[bit >> 3] >> (8 - _depth - (bit & 7))) & mask) * scale;
+		store_pixel(_dst, i, grey, grey, grey, 0xff, 8, _format);
+	}
+}
+
+//every combination gets its own function, so the format is never looked at inside a row
+#define DIRECT_KERNEL(_channels, _depth, _format, _name) \
+static void direct_##_channels##_##_depth##_##_name(const png_converter_s* _conv, const uint8_t* _src, uint8_t* _dst, const size_t _x, const size_t _width) \
+{ \
+	convert_direct(_src + _x * ((_channels) * (_depth) / 8), _dst, _width, _channels, _depth, _format); \
+}
+#define DIRECT_KERNELS(_channels, _depth) \
+	DIRECT_KERNEL(_channels, _depth, PNG_FORMAT_RGBA8,				 rgba8) \
+	DIRECT_KERNEL(_channels, _depth, PNG_FORMAT_BGRA8,				 bgra8) \
+	DIRECT_KERNEL(_channels, _depth, PNG_FORMAT_RGB8,				 rgb8) \
+	DIRECT_KERNEL(_channels, _depth, PNG_FORMAT_GRAY8,				 gray8) \
+	DIRECT_KERNEL(_channels, _depth, PNG_FORMAT_RGBA16,				 rgba16) \
+	DIRECT_KERNEL(_channels, _depth, PNG_FORMAT_RGBA8_PREMULTIPLIED, premultiplied)
+#define DIRECT_ROW(_channels, _depth) { \
+	[PNG_FORMAT_RGBA8]				 = direct_##_channels##_##_depth##_rgba8, \
+	[PNG_FORMAT_BGRA8]				 = direct_##_channels##_##_depth##_bgra8, \
+	[PNG_FORMAT_RGB8]				 = direct_##_channels##_##_depth##_rgb8, \
+	[PNG_FORMAT_GRAY8]				 = direct_##_channels##_##_depth##_gray8, \
+	[PNG_FORMAT_RGBA16]				 = direct_##_channels##_##_depth##_rgba16, \
+	[PNG_FORMAT_RGBA8_PREMULTIPLIED] = direct_##_channels##_##_depth##_premultiplied, \
+}
+DIRECT_KERNELS(1, 8)
+DIRECT_KERNELS(2, 8)
+DIRECT_KERNELS(3, 8)
+DIRECT_KERNELS(4, 8)
+DIRECT_KERNELS(1, 16)
+DIRECT_KERNELS(2, 16)
+DIRECT_KERNELS(3, 16)
+DIRECT_KERNELS(4, 16)
+
+#define GRAY_BITS_KERNEL(_format, _name) \
+static void gray_bits_##_name(const png_converter_s* _conv, const uint8_t* _src, uint8_t* _dst, const size_t _x, const size_t _width) \
+{ \
+	convert_gray_bits(_src, _dst, _x, _width, _conv->bit_depth, _format); \
+}
+GRAY_BITS_KERNEL(PNG_FORMAT_RGBA8,				 rgba8)
+GRAY_BITS_KERNEL(PNG_FORMAT_BGRA8,				 bgra8)
+GRAY_BITS_KERNEL(PNG_FORMAT_RGB8,				 rgb8)
+GRAY_BITS_KERNEL(PNG_FORMAT_GRAY8,				 gray8)
+GRAY_BITS_KERNEL(PNG_FORMAT_RGBA16,				 rgba16)
+GRAY_BITS_KERNEL(PNG_FORMAT_RGBA8_PREMULTIPLIED, premultiplied)
+
+static inline void convert_indices(const png_converter_s* _conv, const uint8_t* _src, uint8_t* _dst, const size_t _x, const size_t _width,
+		const png_format_e _format)
+{
+	//formats the lut cannot be laid out for - entries are still looked up whole, only their store depends on _format
+	const uint8_t depth = _conv->bit_depth;
+	const uint8_t mask	= (1 << depth) - 1;
+	for(size_t i = 0; i < _width; ++i) {
+		const size_t  bit	= (_x + i) * depth;
+		const uint8_t index = depth == 8 ? _src[_x + i] : (_src[bit >> 3] >> (8 - depth - (bit & 7))) & mask;
+		const uint8_t* entry = _conv->lut.rgba[index];
+		store_pixel(_dst, i, entry[0], entry[1], entry[2], entry[3], 8, _format);
+	}
+}
+
+#define PALETTE_KERNEL(_format, _name) \
+static void palette_##_name(const png_converter_s* _conv, const uint8_t* _src, uint8_t* _dst, const size_t _x, const size_t _width) \
+{ \
+	convert_indices(_conv, _src, _dst, _x, _width, _format); \
+}
+PALETTE_KERNEL(PNG_FORMAT_RGB8,	  rgb8)
+PALETTE_KERNEL(PNG_FORMAT_GRAY8,  gray8)
+PALETTE_KERNEL(PNG_FORMAT_RGBA16, rgba16)
+
+static void convert_native(const png_converter_s* _conv, const uint8_t* _src, uint8_t* _dst, const size_t _x, const size_t _width)
+{
+	//one sample per channel: sub byte samples are unpacked to a byte each and 16 bit ones are swapped to host order
+	const size_t channels = source_channels(_conv->color_type);
+	const size_t samples  = _width * channels;
+	const size_t first	  = _x * channels;
+	switch(_conv->bit_depth) {
+		case 8: {
+			memcpy(_dst, _src + first, samples);
+			break;
+		}
+		case 16: {
+			uint16_t* dst = (uint16_t*)_dst;
+			const uint8_t* src = _src + 2 * first;
+			for(size_t i = 0; i < samples; ++i) {
+				dst[i] = (uint16_t)((src[2 * i] << 8) | src[2 * i + 1]);
+			}
+			break;
+		}
+		default: {
+			//1, 2 or 4 bits - samples are packed from the most significant bit
+			const uint8_t depth = _conv->bit_depth;
+			const uint8_t mask	= (1 << depth) - 1;
+			for(size_t i = 0; i < samples; ++i) {
+				const size_t bit = (first + i) * depth;
+				_dst[i] = (_src[bit >> 3] >> (8 - depth - (bit & 7))) & mask;
+			}
+			break;
+		}
+	}
+}
+
+static void convert_palette(const png_converter_s* _conv, const uint8_t* _src, uint8_t* _dst, const size_t _x, const size_t _width)
+{
+	png_expand_palette(_src, _dst, _x, _width, _conv->bit_depth, &(_conv->lut));
+}
+
+static void convert_generic(const png_converter_s* _conv, const uint8_t* _src, uint8_t* _dst, const size_t _x, const size_t _width)
+{
+	//colour keys - every decision is taken again per pixel
+	const uint8_t depth		 = _conv->bit_depth;
+	const uint8_t channels	 = source_channels(_conv->color_type);
+	const uint8_t out_depth	 = depth == 16 ? 16 : 8;
+	const bool	  keyed		 = _conv->has_colour_key && format_has_alpha(_conv->format);
+	const uint8_t mask		 = depth < 8 ? (1 << depth) - 1 : 0;
+	for(size_t i = 0; i < _width; ++i) {
+		uint32_t sample[4] = {0};
+		if(depth < 8) {
+			const size_t bit = (_x + i) * depth;
+			sample[0] = (_src[bit >> 3] >> (8 - depth - (bit & 7))) & mask;
+		} else {
+			const uint8_t* pixel = _src + (_x + i) * channels * (depth / 8);
+			for(uint8_t c = 0; c < channels; ++c) {
+				sample[c] = load_sample(pixel, c, depth);
+			}
+		}
+
+		uint32_t r = sample[0];
+		uint32_t g = channels >= 3 ? sample[1] : r;
+		uint32_t b = channels >= 3 ? sample[2] : r;
+		uint32_t a = channels == 2 ? sample[1] : (channels == 4 ? sample[3] : (out_depth == 16 ? 0xffff : 0xff));
+		//key is compared against samples as stored, before any scaling
+		if(keyed && sample[0] == _conv->colour_key[0] &&
+				(channels == 1 || (sample[1] == _conv->colour_key[1] && sample[2] == _conv->colour_key[2]))) {
+			a = 0;
+		}
+		if(depth < 8) {
+			r = g = b = r * (255 / mask);
+		}
+		store_pixel(_dst, i, r, g, b, a, out_depth, _conv->format);
+	}
+}
+
+#ifdef CONVERT_X86
+////////////////////////// x86 simd kernels
+//8 bit rgb and rgba only need their bytes moved around - pshufb does 4 pixels per instruction, alpha is or-ed in
+
+__attribute__((target("ssse3")))
+static inline size_t rgb_to_4_ssse3(const uint8_t* _src, uint8_t* _dst, const size_t _width, const __m128i _order)
+{
+	//every load reads 16 bytes for the 12 it uses, so the last 2 pixels are always left to the scalar tail
+	const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+	size_t i = 0;
+	for(; 3 * i + 16 <= 3 * _width; i += 4) {
+		const __m128i pixels = _mm_loadu_si128((const __m128i*)(_src + 3 * i));
+		_mm_storeu_si128((__m128i*)(_dst + 4 * i), _mm_or_si128(_mm_shuffle_epi8(pixels, _order), alpha));
+	}
+	return i;
+}
+
+__attribute__((target("ssse3")))
+static void direct_3_8_rgba8_ssse3(const png_converter_s* _conv, const uint8_t* _src, uint8_t* _dst, const size_t _x, const size_t _width)
+{
+	const __m128i order = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const size_t done = rgb_to_4_ssse3(_src + 3 * _x, _dst, _width, order);
+	direct_3_8_rgba8(_conv, _src, _dst + 4 * done, _x + done, _width - done);
+}
+
+__attribute__((target("ssse3")))
+static void direct_3_8_bgra8_ssse3(const png_converter_s* _conv, const uint8_t* _src, uint8_t* _dst, const size_t _x, const size_t _width)
+{
+	const __m128i order = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+	const size_t done = rgb_to_4_ssse3(_src + 3 * _x, _dst, _width, order);
+	direct_3_8_bgra8(_conv, _src, _dst + 4 * done, _x + done, _width - done);
+}
+
+__attribute__((target("ssse3")))
+static void direct_4_8_bgra8_ssse3(const png_converter_s* _conv, const uint8_t* _src, uint8_t* _dst, const size_t _x, const size_t _width)
+{
+	const __m128i order = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	const uint8_t* src = _src + 4 * _x;
+	size_t i = 0;
+	for(; i + 4 <= _width; i += 4) {
+		const __m128i pixels = _mm_loadu_si128((const __m128i*)(src + 4 * i));
+		_mm_storeu_si128((__m128i*)(_dst + 4 * i), _mm_shuffle_epi8(pixels, order));
+	}
+	direct_4_8_bgra8(_conv, _src, _dst + 4 * i, _x + i, _width - i);
+}
+#endif //CONVERT_X86
+
+static void convert_init()
+{
+	static const png_convert_fn direct[2][4][FORMAT_COUNT] = {
+		{DIRECT_ROW(1, 8),	DIRECT_ROW(2, 8),  DIRECT_ROW(3, 8),  DIRECT_ROW(4, 8)},
+		{DIRECT_ROW(1, 16), DIRECT_ROW(2, 16), DIRECT_ROW(3, 16), DIRECT_ROW(4, 16)},
+	};
+	memcpy(direct_table, direct, sizeof(direct_table));
+	gray_bits_table[PNG_FORMAT_RGBA8]				= gray_bits_rgba8;
+	gray_bits_table[PNG_FORMAT_BGRA8]				= gray_bits_bgra8;
+	gray_bits_table[PNG_FORMAT_RGB8]				= gray_bits_rgb8;
+	gray_bits_table[PNG_FORMAT_GRAY8]				= gray_bits_gray8;
+	gray_bits_table[PNG_FORMAT_RGBA16]				= gray_bits_rgba16;
+	gray_bits_table[PNG_FORMAT_RGBA8_PREMULTIPLIED] = gray_bits_premultiplied;
+	palette_table[PNG_FORMAT_RGB8]					= palette_rgb8;
+	palette_table[PNG_FORMAT_GRAY8]					= palette_gray8;
+	palette_table[PNG_FORMAT_RGBA16]				= palette_rgba16;
+	selected_impl = CONVERT_IMPL_SCALAR;
+
+#ifdef CONVERT_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("ssse3")) {
+		direct_table[0][2][PNG_FORMAT_RGBA8] = direct_3_8_rgba8_ssse3;
+		direct_table[0][2][PNG_FORMAT_BGRA8] = direct_3_8_bgra8_ssse3;
+		direct_table[0][3][PNG_FORMAT_BGRA8] = direct_4_8_bgra8_ssse3;
+		selected_impl = CONVERT_IMPL_SSSE3;
+	}
+#endif
+}
+
+#undef FORMAT_COUNT
+#undef TO_8
+#undef LUMA
+#undef DIRECT_KERNEL
+#undef DIRECT_KERNELS
+#undef DIRECT_ROW
+#undef GRAY_BITS_KERNEL
+#undef PALETTE_KERNEL
+#ifdef CONVERT_X86
+#undef CONVERT_X86
+#endif
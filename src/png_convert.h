@@ -0,0 +1,61 @@
+#ifndef __PNG_CONVERT__
+#define __PNG_CONVERT__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "png_palette.h"
+
+////////////////////////// typedefs
+typedef enum {
+	//what decoded pixels look like - every format but native is the same whatever the colour type and bit depth are
+	PNG_FORMAT_NATIVE = 0,			//default - channels of the colour type, sub byte samples unpacked to a byte each as they are,
+									//16 bit samples in host order, indexed images as rgba8
+	PNG_FORMAT_RGBA8,
+	PNG_FORMAT_BGRA8,
+	PNG_FORMAT_RGB8,				//alpha is dropped
+	PNG_FORMAT_GRAY8,				//rgb is weighted down to luma, alpha is dropped
+	PNG_FORMAT_RGBA16,				//host order
+	PNG_FORMAT_RGBA8_PREMULTIPLIED,
+} png_format_e;
+
+typedef enum {
+	//which implementation got picked for the running cpu
+	CONVERT_IMPL_SCALAR = 0,
+	CONVERT_IMPL_SSSE3,
+} convert_impl_e;
+
+typedef struct png_converter_s png_converter_s;
+//turns _width pixels of a reconstructed scanline, starting at pixel _x, into _width pixels of the output format
+typedef void (*png_convert_fn)(const png_converter_s* _conv, const uint8_t* _src, uint8_t* _dst, const size_t _x, const size_t _width);
+
+struct png_converter_s {
+	//everything converting a row needs - worked out once per image, before its first row
+	png_convert_fn	  convert;
+	png_format_e	  format;
+	uint8_t			  color_type;
+	uint8_t			  bit_depth;
+	bool			  has_colour_key;	//tRNS of grey and rgb images - only formats with alpha look at it
+	uint16_t		  colour_key[3];	//as stored, grey uses the first one
+	png_palette_lut_s lut;				//indexed images - already in output order and premultiplied when the format wants it
+};
+
+////////////////////////// declarations
+//false for a format this build does not know
+bool png_format_valid(const png_format_e _format);
+uint8_t png_format_channels(const png_format_e _format, const uint8_t _color_type);
+uint8_t png_format_bytes_per_channel(const png_format_e _format, const uint8_t _bit_depth);
+
+//_palette is only read for indexed images and _colour_key only when it is not NULL
+void png_converter_init(png_converter_s* _conv, const png_format_e _format, const uint8_t _color_type, const uint8_t _bit_depth,
+		const png_palette_lut_s* _palette, const uint16_t* _colour_key);
+
+static inline void png_convert_row(const png_converter_s* _conv, const uint8_t* _src, uint8_t* _dst, const size_t _x, const size_t _width)
+{
+	_conv->convert(_conv, _src, _dst, _x, _width);
+}
+
+convert_impl_e png_convert_get_impl();
+
+#endif //__PNG_CONVERT__
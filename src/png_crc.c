@@ -0,0 +1,211 @@
+#include "png_crc.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CRC_X86
+#include <immintrin.h>
+#endif
+
+//reflected polynomial of crc-32 used by png (and zlib)
+#define CRC_POLYNOMIAL	0xedb88320u
+//folding needs at least four 16 byte blocks to get going
+#define CRC_FOLD_MIN	64
+
+////////////////////////// global variables
+//filled once at startup - afterwards only read, so it is safe to share between threads
+static uint32_t	  crc_table[8][256];
+static crc_impl_e selected_impl = CRC_IMPL_SLICING_BY_8;
+
+
+////////////////////////// declarations
+static uint32_t crc_slicing_by_8(uint32_t _crc, const uint8_t* _data, size_t _size);
+#ifdef CRC_X86
+static uint32_t crc_fold(uint32_t _crc, const uint8_t* _data, size_t _size);
+#endif
+static void crc_init() __attribute__((constructor));
+
+
+////////////////////////// definitions
+uint32_t png_crc32(const uint32_t _crc, const uint8_t* _data, const size_t _size)
+{
+	uint32_t crc = ~_crc;
+#ifdef CRC_X86
+	if(selected_impl == CRC_IMPL_PCLMUL && _size >= CRC_FOLD_MIN) {
+		const size_t folded = _size & ~(size_t)15;
+		crc = crc_fold(crc, _data, folded);
+		return ~crc_slicing_by_8(crc, _data + folded, _size - folded);
+	}
+#endif
+	return ~crc_slicing_by_8(crc, _data, _size);
+}
+
+uint32_t png_crc32_slicing(const uint32_t _crc, const uint8_t* _data, const size_t _size)
+{
+	return ~crc_slicing_by_8(~_crc, _data, _size);
+}
+
+crc_impl_e png_crc32_get_impl()
+{
+	return selected_impl;
+}
+
+static uint32_t crc_slicing_by_8(uint32_t _crc, const uint8_t* _data, size_t _size)
+{
+	//eight input bytes per step, each looked up in its own table - the lookups are independent
+	//so they can all be in flight at once instead of forming one long dependency chain
+	while(_size >= 8) {
+		uint32_t low, high;
+		memcpy(&low,  _data,	 4);
+		memcpy(&high, _data + 4, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		low	 = __builtin_bswap32(low);
+		high = __builtin_bswap32(high);
+#endif
+		low ^= _crc;
+		_crc = crc_table[7][low		   & 0xff] ^
+			   crc_table[6][(low >> 8)  & 0xff] ^
+			   crc_table[5][(low >> 16) & 0xff] ^
+			   crc_table[4][low >> 24]			^
+			   crc_table[3][high		& 0xff] ^
+			   crc_table[2][(high >> 8)	& 0xff] ^
+			   crc_table[1][(high >> 16) & 0xff] ^
+			   crc_table[0][high >> 24];
+		_data += 8;
+		_size -= 8;
+	}
+	while(_size--) {
+		_crc = crc_table[0][(_crc ^ *_data++) & 0xff] ^ (_crc >> 8);
+	}
+	return _crc;
+}
+
+#ifdef CRC_X86
+//carry-less multiplication folding, after intel's "fast crc computation for generic polynomials
+//using pclmulqdq". constants are the bit-reflected x^n mod P values for crc-32
+//_size has to be a multiple of 16 and at least CRC_FOLD_MIN, _crc is the inverted running state
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc_fold(uint32_t _crc, const uint8_t* _data, size_t _size)
+{
+	static const uint64_t __attribute__((aligned(16))) k1k2[] = {0x0154442bd4, 0x01c6e41596};
+	static const uint64_t __attribute__((aligned(16))) k3k4[] = {0x01751997d0, 0x00ccaa009e};
+	static const uint64_t __attribute__((aligned(16))) k5k0[] = {0x0163cd6124, 0x0000000000};
+	static const uint64_t __attribute__((aligned(16))) poly[] = {0x01db710641, 0x01f7011641};
+
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((const __m128i*)(_data + 0x00));
+	x2 = _mm_loadu_si128((const __m128i*)(_data + 0x10));
+	x3 = _mm_loadu_si128((const __m128i*)(_data + 0x20));
+	x4 = _mm_loadu_si128((const __m128i*)(_data + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(_crc));
+	x0 = _mm_load_si128((const __m128i*)k1k2);
+	_data += 64;
+	_size -= 64;
+
+	//four independent accumulators, 64 bytes per iteration
+	while(_size >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		y5 = _mm_loadu_si128((const __m128i*)(_data + 0x00));
+		y6 = _mm_loadu_si128((const __m128i*)(_data + 0x10));
+		y7 = _mm_loadu_si128((const __m128i*)(_data + 0x20));
+		y8 = _mm_loadu_si128((const __m128i*)(_data + 0x30));
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+		_data += 64;
+		_size -= 64;
+	}
+
+	//fold the four accumulators into one
+	x0 = _mm_load_si128((const __m128i*)k3k4);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	//remaining 16 byte blocks
+	while(_size >= 16) {
+		x2 = _mm_loadu_si128((const __m128i*)_data);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		_data += 16;
+		_size -= 16;
+	}
+
+	//128 bits down to 64
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	//barrett reduction down to 32 bits
+	x0 = _mm_load_si128((const __m128i*)poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+#endif //CRC_X86
+
+static void crc_init()
+{
+	for(uint32_t i = 0; i < 256; ++i) {
+		uint32_t crc = i;
+		for(int bit = 0; bit < 8; ++bit) {
+			crc = (crc & 1) ? (crc >> 1) ^ CRC_POLYNOMIAL : crc >> 1;
+		}
+		crc_table[0][i] = crc;
+	}
+	//table k holds the crc of a byte followed by k zero bytes
+	for(uint32_t i = 0; i < 256; ++i) {
+		for(int k = 1; k < 8; ++k) {
+			const uint32_t prev = crc_table[k - 1][i];
+			crc_table[k][i] = crc_table[0][prev & 0xff] ^ (prev >> 8);
+		}
+	}
+
+	selected_impl = CRC_IMPL_SLICING_BY_8;
+#ifdef CRC_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+		selected_impl = CRC_IMPL_PCLMUL;
+	}
+#endif
+}
+
+#undef CRC_POLYNOMIAL
+#undef CRC_FOLD_MIN
+#ifdef CRC_X86
+#undef CRC_X86
+#endif
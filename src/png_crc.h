@@ -0,0 +1,23 @@
+#ifndef __PNG_CRC__
+#define __PNG_CRC__
+
+#include <stdint.h>
+#include <stddef.h>
+
+////////////////////////// typedefs
+typedef enum {
+	//which implementation got picked for the running cpu
+	CRC_IMPL_SLICING_BY_8 = 0,
+	CRC_IMPL_PCLMUL,
+} crc_impl_e;
+
+////////////////////////// declarations
+//same contract as zlib's crc32(): start with 0 and feed the previous result back in to continue
+uint32_t png_crc32(const uint32_t _crc, const uint8_t* _data, const size_t _size);
+
+//table driven version only - useful for checking the folding path against
+uint32_t png_crc32_slicing(const uint32_t _crc, const uint8_t* _data, const size_t _size);
+
+crc_impl_e png_crc32_get_impl();
+
+#endif //__PNG_CRC__
@@ -1,55 +1,135 @@
 #include "png_decoder.h"
+#include "png_chunk.h"
+#include "png_filter.h"
+#include "png_crc.h"
+#include "png_parallel.h"
+#include "png_palette.h"
+#include "png_convert.h"
 #include "zlib.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
-
-#define TEMP_SAVE_FILE "generated/compressed.bin"
-#define MAGIC_NUM_LEN 8
-#define PNG_MAGIC_NUMBER "\x89\x50\x4e\x47\x0d\x0a\x1a\x0a"
-#define CRC_LEN		4
-#define ADVANCE_BYTE(_x) \
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define IHDR_LEN	13
+#define ADAM7_PASSES 7
+//how much a streamed decode asks the read callback for at once
+#define INPUT_WINDOW_SIZE (64 * 1024)
+//push decodes only keep what the walk got stuck on - a chunk header, a crc or a whole PLTE at most
+#define PUSH_WINDOW_SIZE 1024
+//compressed data says nothing in hex - only the start of every IDAT ends up in debug logs
+#define IDAT_DUMP_LEN 32
+//below this much filtered data a second thread costs more than it saves
+#ifndef PIPELINE_MIN_SIZE
+#define PIPELINE_MIN_SIZE (4 * 1024 * 1024)
+#endif
+//rows in flight between inflate and reconstruct - small enough to stay in cache
+//same for collecting the stream and splitting it between threads
+#ifndef PARALLEL_MIN_SIZE
+#define PARALLEL_MIN_SIZE (4 * 1024 * 1024)
+#endif
+#ifndef PIPELINE_RING_SIZE
+#define PIPELINE_RING_SIZE (512 * 1024)
+#endif
+#define PIPELINE_MIN_ROWS 8
+//sliding scanline window of region decodes
+#ifndef ROW_WINDOW_SIZE
+#define ROW_WINDOW_SIZE (256 * 1024)
+#endif
+#define ROW_WINDOW_MIN_ROWS 4
+//IDAT payloads recorded before the list has to grow - encoders mostly write 8k to 64k of data per chunk
+#define IDAT_SPANS_MIN 64
+#define ADVANCE_BYTE(_decoder, _x) \
 do{	\
-	if(current_byte + _x >= ending_byte) {	\
-		LOG(LOG_ERROR, "tried to advance byte out of the valid range\n current byte: %ld, ending byte: %ld, and tried to shift by: %d", current_byte, ending_byte, _x);	\
+	if(_decoder->current_byte + _x > _decoder->ending_byte) {	\
+		LOG(LOG_ERROR, "tried to advance byte out of the valid range\n current byte: %ld, ending byte: %ld, and tried to shift by: %d", _decoder->current_byte, _decoder->ending_byte, _x);	\
 		ASSERT_AND_FLUSH(0); \
 	} \
-	current_byte += _x;	\
+	_decoder->current_byte += _x;	\
 }while(0);
 
-#define GET_TOKEN_NAME(_x)		 \
-((_x) == TOK_INIT ? "TOK_INIT" : \
-(_x)  == TOK_IHDR ? "TOK_IHDR" : \
-(_x)  == TOK_PLTE ? "TOK_PLTE" : \
-(_x)  == TOK_IDAT ? "TOK_IDAT" : \
-(_x)  == TOK_IEND ? "TOK_IEND" : \
-(_x)  == TOK_BKGD ? "TOK_BKGD" : \
-(_x)  == TOK_PHYS ? "TOK_PHYS" : \
-"TOK_UNKNOWN")
-
 #define AS_HEX_ARR(_arr) (bytes_to_hex(_arr, sizeof(_arr) - 1))
 #define AS_HEX_N(_arr, _size) (bytes_to_hex(_arr, _size))
 #define AS_HEX(_x) (bytes_to_hex(_x, 1))
+//peeks at up to _n bytes ahead of the cursor without running off the end of the input
+#define AS_HEX_AHEAD(_decoder, _n) (bytes_to_hex((const char*)(_decoder)->current_byte, \
+	(size_t)((_decoder)->ending_byte - (_decoder)->current_byte) < (size_t)(_n) ? (size_t)((_decoder)->ending_byte - (_decoder)->current_byte) : (size_t)(_n)))
 
 ////////////////////////// global variables
-static uint8_t* ending_byte;
-static uint8_t* current_byte;
+//adam7 pass geometry - where the first pixel of each pass lives and how far apart the next ones are
+static const uint8_t adam7_start_x[ADAM7_PASSES] = {0, 4, 0, 2, 0, 1, 0};
+static const uint8_t adam7_start_y[ADAM7_PASSES] = {0, 0, 4, 0, 2, 0, 1};
+static const uint8_t adam7_step_x[ADAM7_PASSES]	 = {8, 8, 4, 4, 2, 2, 1};
+static const uint8_t adam7_step_y[ADAM7_PASSES]	 = {8, 8, 8, 4, 4, 2, 2};
 
 
 ////////////////////////// declarations
-static png_external_context_s* process_next_chunk(const token_e _current_token);
-static token_e get_next_token();
-static bool look_for_magic_bytes();
+static png_external_context_s* walk_chunks(png_decoder_s* _decoder);
+static const bool process_chunk(png_decoder_s* _decoder, const uint32_t _current_token);
+static png_external_context_s* finish_image(png_decoder_s* _decoder);
+static uint32_t get_next_token(png_decoder_s* _decoder);
+static const png_chunk_handler_s* find_chunk_handler(const png_decoder_s* _decoder, const uint32_t _type);
+static bool look_for_magic_bytes(png_decoder_s* _decoder);
 static const char* bytes_to_hex(const char*, const size_t);
-static const uint32_t get_next_chunk_size();
-static const bool check_CRC();
-static const uint parse_header(header_chunk_s* _header);
+static const uint32_t get_next_chunk_size(png_decoder_s* _decoder);
+static const bool check_CRC(png_decoder_s* _decoder);
+static const uint parse_header(png_decoder_s* _decoder, header_chunk_s* _header);
 static const bool check_header(const header_chunk_s _header);
-static const uint parse_palette(palette_chunk_s* _palette, const uint8_t _size);
-static const uint parse_data(data_chunk_s* _data);
-static const void save_to_temp_file(const char* _file_path, const data_chunk_s* _data);
-static const void preprocess(const data_chunk_s* _data, png_external_context_s* _ret_ctx);
+static const bool ensure_input(png_decoder_s* _decoder, const size_t _needed);
+static const bool skip_input(png_decoder_s* _decoder);
+static const walk_state_e stall_or_fail(const png_decoder_s* _decoder);
+static void rewind_arena(png_decoder_s* _decoder);
+static const bool chunk_crc_wanted(const png_decoder_s* _decoder);
+static size_t fd_read(void* _user, uint8_t* _buffer, const size_t _size);
+static const uint parse_palette(png_decoder_s* _decoder, palette_chunk_s* _palette, const uint _size);
+static const uint parse_transparency(png_decoder_s* _decoder, palette_chunk_s* _palette, const uint _size);
+static const uint parse_colour_key(png_decoder_s* _decoder, palette_chunk_s* _palette, const uint _samples);
+static const uint8_t get_channels(const uint8_t _color_type);
+static const uint get_pass_count(const header_chunk_s* _header);
+static const void get_pass_size(const header_chunk_s* _header, const uint _pass, size_t* _width, size_t* _height);
+static const size_t get_scanlines_size(const header_chunk_s* _header);
+static const size_t get_output_stride(const header_chunk_s* _header, const png_format_e _format, const size_t _width);
+static const png_format_e get_output_format(const png_decoder_s* _decoder);
+static const bool init_data_stream(png_decoder_s* _decoder, data_chunk_s* _data, const header_chunk_s* _header);
+static const uint inflate_data(png_decoder_s* _decoder, data_chunk_s* _data, const uint8_t* _input, const uint32_t _size);
+static const bool finish_data_stream(data_chunk_s* _data);
+static const uint defer_data(png_decoder_s* _decoder, data_chunk_s* _data, const uint8_t* _input, const uint32_t _size);
+static const bool inflate_deferred(png_decoder_s* _decoder, data_chunk_s* _data, const header_chunk_s* _header);
+static const uint gather_data(png_decoder_s* _decoder, data_chunk_s* _data, const uint8_t* _input, const uint32_t _size);
+static const bool inflate_whole(png_decoder_s* _decoder, data_chunk_s* _data, const png_span_s* _spans, const size_t _span_count);
+static const bool preprocess(png_decoder_s* _decoder, const header_chunk_s* _header, data_chunk_s* _data, png_external_context_s* _ret_ctx);
+static const bool allocate_pixels(png_decoder_s* _decoder, const header_chunk_s* _header, png_external_context_s* _ret_ctx);
+static png_external_context_s* allocate_result(png_decoder_s* _decoder);
+static const bool ensure_zero_row(png_decoder_s* _decoder, const size_t _size);
+static const bool start_pipeline(png_decoder_s* _decoder, data_chunk_s* _data, const header_chunk_s* _header);
+static const bool next_pipeline_region(data_chunk_s* _data);
+static void convert_sink(void* _decoder, const size_t _y, const uint8_t* _row);
+static void abandon_image(png_decoder_s* _decoder);
+static const bool start_row_stream(png_decoder_s* _decoder, data_chunk_s* _data, const header_chunk_s* _header);
+static void slide_row_window(png_decoder_s* _decoder, data_chunk_s* _data);
+static const bool reconstruct_rows(png_decoder_s* _decoder, data_chunk_s* _data);
+static const bool rows_complete(const png_decoder_s* _decoder);
+static const bool region_done(const png_decoder_s* _decoder);
+static const bool start_passes(png_decoder_s* _decoder, data_chunk_s* _data, const header_chunk_s* _header);
+static const bool reconstruct_passes(png_decoder_s* _decoder, data_chunk_s* _data, const size_t _inflated);
+static const bool reconstruct_pass(png_decoder_s* _decoder, const uint _pass, uint8_t* _scanlines);
+static const bool get_pass_window(const png_decoder_s* _decoder, const uint _pass, size_t* _first_x, size_t* _width, size_t* _first_y, size_t* _height);
+static const void scatter_pixels(const uint8_t* _src, uint8_t* _dst, const size_t _count, const size_t _pixel_size, const size_t _dst_step);
+static void* decoder_alloc(png_decoder_s* _decoder, const size_t _size, const size_t _alignment);
+static void  decoder_free(png_decoder_s* _decoder, void* _ptr);
+static voidpf zlib_alloc(voidpf _opaque, uInt _items, uInt _size);
+static void   zlib_free(voidpf _opaque, voidpf _ptr);
+static void stats_begin(png_decoder_s* _decoder);
+static void stats_resume(png_decoder_s* _decoder);
+static void stats_pause(png_decoder_s* _decoder, const png_external_context_s* _result);
+static inline png_stage_e stats_enter(png_decoder_s* _decoder, const png_stage_e _stage);
+static inline void stats_unfiltered(png_decoder_s* _decoder, const uint8_t _filter_type);
 
 static const int inf(FILE *source, FILE *dest);
 static const int def(FILE *source, FILE *dest, int level);
@@ -57,72 +137,560 @@ void zerr(int ret);
 
 
 ////////////////////////// definitions
-png_external_context_s* decode_from_png(char* _input_png, const uint _size)
+png_decoder_s* png_decoder_create(const png_decoder_options_s* _options)
+{
+	//decoder itself comes from the caller's allocator too, but never from the arena - it outlives every reset
+	const png_allocator_s allocator = (_options != NULL && _options->allocator.alloc != NULL) ? _options->allocator : png_default_allocator();
+	png_decoder_s* decoder = allocator.alloc(allocator.user, sizeof(png_decoder_s), _Alignof(png_decoder_s));
+	if(decoder == NULL) {
+		LOG_ERRNO(LOG_ERROR, "could not allocate decoder");
+		return NULL;
+	}
+	memset(decoder, 0, sizeof(png_decoder_s));
+	if(_options != NULL) {
+		decoder->options = *_options;
+	}
+	if(!png_format_valid(decoder->options.format)) {
+		LOG(LOG_ERROR, "unknown output format %d", decoder->options.format);
+		allocator.free(allocator.user, decoder);
+		return NULL;
+	}
+	for(uint h = 0; h < decoder->options.chunk_handler_count; ++h) {
+		const png_chunk_handler_s* handler = &(decoder->options.chunk_handlers[h]);
+		if(handler->handle == NULL || handler->type == TOK_IDAT) {
+			//image data is never whole in one place, so it cannot be handed out
+			LOG(LOG_ERROR, "chunk handler %u is either empty or wants IDAT", h);
+			allocator.free(allocator.user, decoder);
+			return NULL;
+		}
+	}
+	decoder->options.allocator = allocator;
+	decoder->allocator		   = allocator;
+	if(decoder->options.use_arena) {
+		png_arena_init(&(decoder->arena), &allocator, 0);
+	}
+	return decoder;
+}
+
+png_external_context_s* png_decoder_decode(png_decoder_s* _decoder, char* _input_png, const uint _size)
 {
+	ASSERT_AND_FLUSH(_decoder != NULL);
 	ASSERT_AND_FLUSH(_size > 0);
 	ASSERT_AND_FLUSH(_input_png != NULL);
 
-	ending_byte  = _input_png + _size;
-	current_byte = _input_png;
+	//whatever the previous image left behind is dropped here, scratch buffers stay
+	png_decoder_reset(_decoder);
+	rewind_arena(_decoder);
+	stats_begin(_decoder);
 
-	return process_next_chunk(TOK_INIT);
+	_decoder->ending_byte  = (uint8_t*)_input_png + _size;
+	_decoder->current_byte = (uint8_t*)_input_png;
+
+	return walk_chunks(_decoder);
 }
 
-png_external_context_s* process_next_chunk(const token_e _current_token)
+png_external_context_s* png_decoder_decode_stream(png_decoder_s* _decoder, png_read_fn _read, void* _user)
 {
-	ASSERT_AND_FLUSH(ending_byte  != NULL);
-	ASSERT_AND_FLUSH(current_byte != NULL);
-	ASSERT_AND_FLUSH(current_byte != ending_byte);	//TODO: could they every be equal according to spec?
-	ASSERT_AND_FLUSH(current_byte <  ending_byte);	//make sure we are not about to loop for ever
+	ASSERT_AND_FLUSH(_decoder != NULL);
+	ASSERT_AND_FLUSH(_read	  != NULL);
 
-	LOG(LOG_INFO, "starting processing chunk: %s", GET_TOKEN_NAME(_current_token));
+	png_decoder_reset(_decoder);
+	rewind_arena(_decoder);
+	stats_begin(_decoder);
 
-	token_e next_token;
-	png_external_context_s* ret_ctx = malloc(sizeof(png_external_context_s));
+	//nothing is buffered yet - the first ensure_input() pulls the signature in
+	_decoder->input.read = _read;
+	_decoder->input.user = _user;
+	_decoder->current_byte = _decoder->input_window;
+	_decoder->ending_byte  = _decoder->input_window;
 
-	static png_internal_context_s internal_context;
-	static arena_s arena;		//TODO: be careful with this arena
-	static int32_t next_chunk_size;
+	return walk_chunks(_decoder);
+}
 
-	switch(_current_token) {
-		//for now we just gonna care about critical chunks
-		case TOK_INIT: {
-			//this is entry point to the png parser - here we init all the shit
-			//later this func will be called recursively until we encounter IEND
-			//token or something goes south really bad
-			//TODO: add magic number handling here
-			if(!look_for_magic_bytes()) {
-				//this is not even PNG!!!
-				LOG(LOG_ERROR, "provided file is not a png");
-				return NULL;
+void png_decoder_begin_push(png_decoder_s* _decoder)
+{
+	ASSERT_AND_FLUSH(_decoder != NULL);
+
+	png_decoder_reset(_decoder);
+	rewind_arena(_decoder);
+	stats_begin(_decoder);
+
+	//nothing is buffered yet - the first png_feed() is walked in place
+	_decoder->input.push   = true;
+	_decoder->current_byte = _decoder->input_window;
+	_decoder->ending_byte  = _decoder->input_window;
+}
+
+png_feed_e png_feed(png_decoder_s* _decoder, const uint8_t* _bytes, const size_t _size)
+{
+	ASSERT_AND_FLUSH(_decoder != NULL);
+	ASSERT_AND_FLUSH(_decoder->input.push);
+	ASSERT_AND_FLUSH(_bytes != NULL || _size == 0);
+
+	const uint8_t* bytes = _bytes;
+	size_t left			 = _size;
+	while(left > 0 && _decoder->state != WALK_FINISHED && _decoder->state != WALK_FAILED) {
+		const size_t buffered = _decoder->ending_byte - _decoder->current_byte;
+		if(buffered > 0) {
+			//walk is stuck on something split between fragments - it gets completed in the window, but with no more
+			//of this fragment than it asked for, the rest is walked in place again right after
+			const size_t wanted = _decoder->input.needed - buffered;
+			const size_t taken	= left < wanted ? left : wanted;
+			memcpy(_decoder->ending_byte, bytes, taken);
+			_decoder->ending_byte += taken;
+			bytes				  += taken;
+			left				  -= taken;
+			if(taken < wanted) {
+				break;
 			}
+		} else {
+			//input is only ever read, and nothing keeps pointing into the fragment once the walk stops - whatever is
+			//left of it is moved to the window then
+			if(_decoder->chunk_start != NULL) {
+				_decoder->chunk_start = (uint8_t*)bytes;
+			}
+			_decoder->current_byte = (uint8_t*)bytes;
+			_decoder->ending_byte  = (uint8_t*)bytes + left;
+			left				   = 0;
+		}
+		_decoder->input.starved = false;
+		_decoder->pushed		= walk_chunks(_decoder);
+		if(_decoder->state == WALK_FINISHED && _decoder->pushed == NULL) {
+			//every chunk was there, but the image could not be put together from them
+			_decoder->state = WALK_FAILED;
+		}
+	}
+
+	switch(_decoder->state) {
+		case WALK_FINISHED: return PNG_FEED_DONE;
+		case WALK_FAILED:	return PNG_FEED_ERROR;
+		default:			return PNG_FEED_MORE;
+	}
+}
+
+png_external_context_s* png_feed_finish(png_decoder_s* _decoder)
+{
+	ASSERT_AND_FLUSH(_decoder != NULL);
+	ASSERT_AND_FLUSH(_decoder->input.push);
+
+	if(_decoder->state != WALK_FINISHED && _decoder->state != WALK_FAILED) {
+		LOG(LOG_ERROR, "input ended too early - walk still waits for %zu bytes", _decoder->input.needed);
+		abandon_image(_decoder);
+		_decoder->state = WALK_FAILED;
+	}
+	png_external_context_s* ret_ctx = _decoder->pushed;
+	_decoder->pushed = NULL;
+	return ret_ctx;
+}
+
+png_external_context_s* png_decoder_decode_file(png_decoder_s* _decoder, const char* _path)
+{
+	ASSERT_AND_FLUSH(_decoder != NULL);
+	ASSERT_AND_FLUSH(_path	  != NULL);
+
+	const int fd = open(_path, O_RDONLY);
+	if(fd < 0) {
+		LOG_ERRNO(LOG_ERROR, "cannot open %s", _path);
+		return NULL;
+	}
+
+	struct stat file_stat;
+	if(fstat(fd, &file_stat) != 0) {
+		LOG_ERRNO(LOG_ERROR, "cannot stat %s", _path);
+		close(fd);
+		return NULL;
+	}
+
+	png_external_context_s* ret_ctx = NULL;
+	void* mapping = MAP_FAILED;
+	if(S_ISREG(file_stat.st_mode) && file_stat.st_size > 0 && (uint64_t)file_stat.st_size <= UINT_MAX) {
+		mapping = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+
+	if(mapping != MAP_FAILED) {
+		//chunks are walked front to back exactly once, so let the kernel read ahead aggressively
+		(void)madvise(mapping, file_stat.st_size, MADV_SEQUENTIAL);
+		ret_ctx = png_decoder_decode(_decoder, mapping, (uint)file_stat.st_size);
+		munmap(mapping, file_stat.st_size);
+	} else {
+		//pipes, devices and anything mmap refuses still work, just through the window
+		LOG(LOG_INFO, "%s cannot be mapped, streaming it instead", _path);
+		int fd_user = fd;
+		ret_ctx = png_decoder_decode_stream(_decoder, fd_read, &fd_user);
+	}
+
+	close(fd);
+	return ret_ctx;
+}
+
+void png_decoder_reset(png_decoder_s* _decoder)
+{
+	ASSERT_AND_FLUSH(_decoder != NULL);
+
+	//a decode that was left halfway may still have its reconstruct thread running
+	abandon_image(_decoder);
+	free_decoded_png(_decoder->pushed);
+	_decoder->pushed		  = NULL;
+	_decoder->current_byte	  = NULL;
+	_decoder->ending_byte	  = NULL;
+	_decoder->chunk_start	  = NULL;
+	_decoder->chunk_crc		  = 0;
+	_decoder->next_chunk_size = 0;
+	_decoder->input.read	  = NULL;
+	_decoder->input.user	  = NULL;
+	_decoder->input.eof		  = false;
+	_decoder->input.push	  = false;
+	_decoder->input.starved	  = false;
+	_decoder->input.needed	  = 0;
+	_decoder->state			  = WALK_SIGNATURE;
+	_decoder->current_token	  = TOK_INIT;
+	_decoder->chunk_handler	  = NULL;
+
+	png_internal_context_s* ctx = &(_decoder->internal_context);
+	memset(&(ctx->ihdr), 0, sizeof(header_chunk_s));
+	ctx->plte.actual_size	   = 0;
+	ctx->plte.has_colour_key   = false;
+	ctx->idat.stream_initialized = false;
+	ctx->idat.stream_finished	 = false;
+	ctx->idat.scanlines_size	 = 0;
+	ctx->idat.rows_streamed		 = false;
+	ctx->idat.progressive		 = false;
+	ctx->idat.rows_failed		 = false;
+	ctx->idat.data_started		 = false;
+}
+
+void png_decoder_set_region(png_decoder_s* _decoder, const png_region_s* _region)
+{
+	ASSERT_AND_FLUSH(_decoder != NULL);
+
+	_decoder->region_requested = _region != NULL;
+	if(_region != NULL) {
+		_decoder->requested_region = *_region;
+	}
+}
+
+void png_decoder_set_output(png_decoder_s* _decoder, const png_output_s* _output)
+{
+	ASSERT_AND_FLUSH(_decoder != NULL);
+
+	_decoder->output_requested = _output != NULL;
+	if(_output != NULL) {
+		_decoder->output = *_output;
+	}
+}
+
+void png_decoder_destroy(png_decoder_s* _decoder)
+{
+	if(_decoder == NULL) {
+		return;
+	}
+
+	abandon_image(_decoder);
+	free_decoded_png(_decoder->pushed);
+	data_chunk_s* idat = &(_decoder->internal_context.idat);
+	if(idat->stream_allocated) {
+		(void)inflateEnd(&(idat->stream));
+	}
+	decoder_free(_decoder, idat->scanlines);
+	decoder_free(_decoder, idat->compressed);
+	decoder_free(_decoder, idat->spans);
+	decoder_free(_decoder, _decoder->zero_row);
+	decoder_free(_decoder, _decoder->pass_pixels);
+	decoder_free(_decoder, _decoder->input_window);
+	if(_decoder->options.use_arena) {
+		png_arena_release(&(_decoder->arena));
+	}
+	const png_allocator_s allocator = _decoder->allocator;
+	allocator.free(allocator.user, _decoder);
+}
+
+png_external_context_s* decode_from_png(char* _input_png, const uint _size)
+{
+	//result has to outlive the decoder, so no arena here
+	png_decoder_s* decoder = png_decoder_create(NULL);
+	if(decoder == NULL) {
+		return NULL;
+	}
+	png_external_context_s* ret_ctx = png_decoder_decode(decoder, _input_png, _size);
+	png_decoder_destroy(decoder);
+	return ret_ctx;
+}
+
+bool png_probe(const char* _input_png, const uint _size, const bool _scan_chunks, png_probe_s* _info)
+{
+	ASSERT_AND_FLUSH(_info != NULL);
+	ASSERT_AND_FLUSH(_input_png != NULL || _size == 0);
+
+	memset(_info, 0, sizeof(png_probe_s));
+	//only the cursor of a decoder is needed to reuse the parsing code - it lives on the stack and never touches
+	//an allocator, inflate or the input window
+	png_decoder_s cursor = {
+		.current_byte = (uint8_t*)_input_png,
+		.ending_byte  = (uint8_t*)_input_png + _size,
+	};
+
+	//signature, then IHDR as a whole: length, type, 13 bytes of data and crc
+	if(_size < PNG_MAGIC_NUM_LEN + PNG_CHUNK_HEADER_LEN + IHDR_LEN + PNG_CRC_LEN) {
+		LOG(LOG_ERROR, "%u bytes are too few for a png signature and header", _size);
+		return false;
+	}
+	if(!look_for_magic_bytes(&cursor)) {
+		return false;
+	}
+	const int32_t header_size = get_next_chunk_size(&cursor);
+	const uint8_t* header_type = cursor.current_byte;
+	if(get_next_token(&cursor) != TOK_IHDR || header_size != IHDR_LEN) {
+		LOG(LOG_ERROR, "first chunk is not a %d byte IHDR - got %.4s with %d bytes", IHDR_LEN, header_type, header_size);
+		return false;
+	}
+	parse_header(&cursor, &(_info->ihdr));
+	if(png_crc32(0, header_type, cursor.current_byte - header_type) != png_read_be32(cursor.current_byte)) {
+		LOG(LOG_ERROR, "crc mismatch in IHDR");
+		return false;
+	}
+	ADVANCE_BYTE((&cursor), PNG_CRC_LEN);
+	if(!check_header(_info->ihdr)) {
+		return false;
+	}
+
+	_info->channels			 = png_format_channels(PNG_FORMAT_NATIVE, _info->ihdr.color_type);
+	_info->bytes_per_channel = png_format_bytes_per_channel(PNG_FORMAT_NATIVE, _info->ihdr.bit_depth);
+	_info->decoded_size		 = get_output_stride(&(_info->ihdr), PNG_FORMAT_NATIVE, _info->ihdr.width) * _info->ihdr.height;
+	if(!_scan_chunks) {
+		return true;
+	}
+
+	//PLTE and tRNS have to come before the first IDAT, so nothing past it is looked at - payloads and crcs are only stepped over
+	const uint8_t* png = (const uint8_t*)_input_png;
+	size_t offset = cursor.current_byte - png;
+	png_chunk_view_s chunk;
+	png_chunk_walk_e walked;
+	while((walked = png_chunk_next(png, _size, &offset, &chunk)) != CHUNK_WALK_END) {
+		if(walked == CHUNK_WALK_TOO_LONG) {
+			LOG(LOG_ERROR, "chunk length does not fit in 31 bits");
+			return false;
+		}
+		if(chunk.type == TOK_IDAT || chunk.type == TOK_IEND) {
+			_info->chunks_scanned = true;
+			break;
+		}
+		if(chunk.type == TOK_PLTE) {
+			_info->has_plte		= true;
+			_info->palette_size = chunk.size / 3;
+		} else if(chunk.type == TOK_TRNS) {
+			_info->has_trns = true;
+		}
+		//whatever is left may be less than the chunk claims - that is truncation, not something to fail on here
+		if(walked == CHUNK_WALK_TRUNCATED) {
 			break;
 		}
+	}
+	return true;
+}
+
+uint8_t** get_png_rows(png_external_context_s* _ctx)
+{
+	ASSERT_AND_FLUSH(_ctx != NULL);
+	ASSERT_AND_FLUSH(_ctx->pixels != NULL);
+	if(_ctx->rows != NULL) {
+		return _ctx->rows;
+	}
+
+	//views only - pixels stay in the one contiguous block
+	_ctx->rows = _ctx->allocator.alloc(_ctx->allocator.user, sizeof(uint8_t*) * _ctx->height, _Alignof(uint8_t*));
+	if(_ctx->rows == NULL) {
+		LOG_ERRNO(LOG_ERROR, "could not allocate row views");
+		return NULL;
+	}
+	for(uint y = 0; y < _ctx->height; ++y) {
+		_ctx->rows[y] = PNG_ROW(_ctx, y);
+	}
+	return _ctx->rows;
+}
+
+void free_decoded_png(png_external_context_s* _ctx)
+{
+	if(_ctx == NULL) {
+		return;
+	}
+	//with an arena behind it these are no-ops, the memory goes back on the next decode
+	const png_allocator_s allocator = _ctx->allocator;
+	allocator.free(allocator.user, _ctx->rows);
+	if(!_ctx->pixels_borrowed) {
+		allocator.free(allocator.user, _ctx->pixels);
+	}
+	allocator.free(allocator.user, _ctx);
+}
+
+static png_external_context_s* walk_chunks(png_decoder_s* _decoder)
+{
+	//flat loop instead of recursion - stack use does not depend on the number of chunks
+	//and nothing gets allocated per chunk, the result is allocated once after IEND
+	//push input may run dry in any state - the walk then stays in it, and picks up from there on the next png_feed()
+	stats_resume(_decoder);
+	while(_decoder->state != WALK_FINISHED && _decoder->state != WALK_FAILED && !_decoder->input.starved) {
+		switch(_decoder->state) {
+			case WALK_SIGNATURE: {
+				if(!ensure_input(_decoder, PNG_MAGIC_NUM_LEN)) {
+					_decoder->state = stall_or_fail(_decoder);
+					break;
+				}
+				if(!look_for_magic_bytes(_decoder)) {
+					//this is not even PNG!!!
+					LOG(LOG_ERROR, "provided file is not a png");
+					_decoder->state = WALK_FAILED;
+					break;
+				}
+				if(_decoder->options.stats != NULL) {
+					_decoder->options.stats->bytes_in += PNG_MAGIC_NUM_LEN;
+				}
+				_decoder->state = WALK_CHUNK_HEADER;
+				break;
+			}
+			case WALK_CHUNK_HEADER: {
+				//length and type
+				if(!ensure_input(_decoder, 2 * sizeof(uint32_t))) {
+					_decoder->state = stall_or_fail(_decoder);
+					break;
+				}
+				_decoder->next_chunk_size = get_next_chunk_size(_decoder);
+				if(_decoder->next_chunk_size < 0) {
+					//spec caps chunk length at 2^31 - 1
+					LOG(LOG_ERROR, "chunk length does not fit in 31 bits");
+					_decoder->state = WALK_FAILED;
+					break;
+				}
+				_decoder->chunk_start	  = _decoder->current_byte;
+				_decoder->chunk_crc		  = 0;
+				memcpy(_decoder->chunk_type, _decoder->current_byte, sizeof(_decoder->chunk_type));
+				if(_decoder->options.stats != NULL) {
+					png_stats_count_chunk(_decoder->options.stats, _decoder->chunk_type);
+					_decoder->options.stats->bytes_in += PNG_CHUNK_HEADER_LEN + (uint64_t)_decoder->next_chunk_size + PNG_CRC_LEN;
+				}
+				_decoder->current_token	  = get_next_token(_decoder);
+				_decoder->chunk_handler	  = find_chunk_handler(_decoder, _decoder->current_token);
+				_decoder->state			  = WALK_CHUNK_DATA;
+				break;
+			}
+			case WALK_CHUNK_DATA: {
+				const bool processed = process_chunk(_decoder, _decoder->current_token);
+				//region decodes end as soon as the last row they need is there, without the crc of the chunk it came from
+				//every handler checks for its bytes before it changes anything, so a stalled one is simply run again
+				_decoder->state = !processed ? stall_or_fail(_decoder) : (region_done(_decoder) ? WALK_FINISHED : WALK_CHUNK_CRC);
+				break;
+			}
+			case WALK_CHUNK_CRC: {
+				if(!ensure_input(_decoder, PNG_CRC_LEN)) {
+					_decoder->state = stall_or_fail(_decoder);
+					break;
+				}
+				if(!check_CRC(_decoder)) {
+					_decoder->state = WALK_FAILED;
+					break;
+				}
+				_decoder->chunk_start = NULL;
+				_decoder->state = _decoder->current_token == TOK_IEND ? WALK_FINISHED : WALK_CHUNK_HEADER;
+				break;
+			}
+			default: {
+				//should never be reached
+				LOG(LOG_ERROR, "chunk walk ended up in unknown state: %d", _decoder->state);
+				ASSERT_AND_FLUSH(0);
+			}
+		}
+	}
+
+	png_external_context_s* ret_ctx = NULL;
+	if(_decoder->state == WALK_FAILED) {
+		abandon_image(_decoder);
+	} else if(!_decoder->input.starved) {
+		//a starved walk has nothing to hand out yet, the image is still being put together
+		ret_ctx = finish_image(_decoder);
+	}
+	stats_pause(_decoder, ret_ctx);
+	return ret_ctx;
+}
+
+static const walk_state_e stall_or_fail(const png_decoder_s* _decoder)
+{
+	//only a push walk runs out of input without the input being too short
+	return _decoder->input.starved ? _decoder->state : WALK_FAILED;
+}
+
+static const bool process_chunk(png_decoder_s* _decoder, const uint32_t _current_token)
+{
+	ASSERT_AND_FLUSH(_decoder->ending_byte  != NULL);
+	ASSERT_AND_FLUSH(_decoder->current_byte != NULL);
+	ASSERT_AND_FLUSH(_decoder->current_byte <= _decoder->ending_byte);
+
+	LOG(LOG_INFO, "starting processing chunk: %.4s", _decoder->chunk_type);
+
+	const bool handled = _decoder->chunk_handler != NULL;
+	if(handled) {
+		//caller gets the payload first and in one piece - the cursor stays where it is, so the decoder still handles
+		//chunks it knows afterwards, and cannot stall on them anymore
+		if(!ensure_input(_decoder, _decoder->next_chunk_size)) {
+			return false;
+		}
+		const png_chunk_handler_s* handler = _decoder->chunk_handler;
+		_decoder->chunk_handler = NULL;
+		if(!handler->handle(handler->user, _current_token, _decoder->current_byte, _decoder->next_chunk_size)) {
+			LOG(LOG_ERROR, "chunk handler turned down %.4s", _decoder->chunk_type);
+			return false;
+		}
+	}
+
+	switch(_current_token) {
+		//for now we just gonna care about critical chunks
 		case TOK_IHDR: {
 			//CRITICAL: it needs to be the first encountered chunk
-			uint shifted_bytes = parse_header(&(internal_context.ihdr));
-			next_chunk_size -= shifted_bytes;
-			if(next_chunk_size < 0) {
-				LOG(LOG_ERROR, "read too little bytes from header");
+			if(_decoder->internal_context.idat.stream_initialized) {
+				//rows of the first header may already be reconstructed on another thread, so it must not be overwritten
+				LOG(LOG_ERROR, "duplicated IHDR");
+				return false;
+			}
+			if(_decoder->next_chunk_size != IHDR_LEN) {
+				//anything else would leave the cursor off the crc
+				LOG(LOG_ERROR, "header is %d bytes long instead of %d", _decoder->next_chunk_size, IHDR_LEN);
+				return false;
 			}
-			if(!check_header(internal_context.ihdr)) {
+			if(!ensure_input(_decoder, _decoder->next_chunk_size)) {
+				return false;
+			}
+			uint shifted_bytes = parse_header(_decoder, &(_decoder->internal_context.ihdr));
+			_decoder->next_chunk_size -= shifted_bytes;
+			if(!check_header(_decoder->internal_context.ihdr)) {
 				LOG(LOG_ERROR, "error eouncountered while parsing header");
-			};
+				return false;
+			}
+			if(!init_data_stream(_decoder, &(_decoder->internal_context.idat), &(_decoder->internal_context.ihdr))) {
+				LOG(LOG_ERROR, "could not prepare data stream for this header");
+				return false;
+			}
 			break;
 		}
 		case TOK_PLTE: {
 			//CRITICAL: it contains the indexed palette that later is used for colors encoding
 			//TODO: make sure it appears for correct color types and bit depths or sth
-			if((next_chunk_size % 3) != 0) {
-				LOG(LOG_ERROR, "data section of palette chunk is not divisible by 3 - its equal: %d", next_chunk_size);
+			if(_decoder->internal_context.idat.data_started) {
+				//rows may already be expanded with the old one
+				LOG(LOG_ERROR, "palette after image data");
+				return false;
+			}
+			if((_decoder->next_chunk_size % 3) != 0) {
+				LOG(LOG_ERROR, "data section of palette chunk is not divisible by 3 - its equal: %d", _decoder->next_chunk_size);
+			} else if(!ensure_input(_decoder, _decoder->next_chunk_size)) {
+				return false;
 			} else {
-				const uint8_t number_of_entries = next_chunk_size / 3;
+				//256 entries do not fit in a byte
+				const uint number_of_entries = _decoder->next_chunk_size / 3;
 				if(number_of_entries == 0 || number_of_entries > 256) {
 					LOG(LOG_ERROR, "number of entries is either too big of too small: %d (allowed values are from 1 to 256)", number_of_entries);
+					return false;
 				}
-				uint shifted_bytes = parse_palette(&(internal_context.plte), number_of_entries);
-				next_chunk_size -= shifted_bytes;
-				if(next_chunk_size > 0) {
+				uint shifted_bytes = parse_palette(_decoder, &(_decoder->internal_context.plte), number_of_entries);
+				_decoder->next_chunk_size -= shifted_bytes;
+				if(_decoder->next_chunk_size > 0) {
 					LOG(LOG_ERROR, "read too little bytes from palette");
 				}
 			}
@@ -130,160 +698,282 @@ png_external_context_s* process_next_chunk(const token_e _current_token)
 		}
 		case TOK_IDAT: {
 			//CRITICAL: this is THE data
-			LOG(LOG_DEBUG_CRITICAL, "len of IDAT: %ld", next_chunk_size);
-			LOG(LOG_DEBUG_CRITICAL, "contents of IDAT: %s", AS_HEX_N(current_byte, next_chunk_size));
+			LOG(LOG_DEBUG_3, "len of IDAT: %ld", _decoder->next_chunk_size);
+			LOG(LOG_DEBUG_3, "start of IDAT: %s", AS_HEX_AHEAD(_decoder, IDAT_DUMP_LEN));
 
-			//prepare idat chunk
-			internal_context.idat.actual_size = next_chunk_size;
-			internal_context.idat.data = malloc(sizeof(uint8_t) * internal_context.idat.actual_size);
+			if(!_decoder->internal_context.idat.stream_initialized) {
+				LOG(LOG_ERROR, "encountered IDAT before IHDR");
+				return false;
+			}
+			if(_decoder->internal_context.ihdr.color_type == 3 && _decoder->internal_context.plte.actual_size == 0) {
+				LOG(LOG_ERROR, "indexed image without a palette");
+				return false;
+			}
+			if(!_decoder->internal_context.idat.data_started) {
+				//no row is converted before this point, and nothing that changes how rows are converted may come after it
+				const palette_chunk_s* palette = &(_decoder->internal_context.plte);
+				png_converter_init(&(_decoder->internal_context.converter), get_output_format(_decoder),
+						_decoder->internal_context.ihdr.color_type, _decoder->internal_context.ihdr.bit_depth, &(palette->lut),
+						palette->has_colour_key ? palette->colour_key : NULL);
+				_decoder->internal_context.idat.data_started = true;
+			}
 
-			uint shifted_bytes = parse_data(&(internal_context.idat));
-			next_chunk_size -= shifted_bytes;
-			if(next_chunk_size > 0) {
-				LOG(LOG_ERROR, "read too little bytes from idat chunk");
+			//payload is inflated in place - multiple IDATs simply continue the same stream
+			//whole chunk is already there for in memory input, streamed input hands it over window by window
+			while(_decoder->next_chunk_size > 0 && !region_done(_decoder)) {
+				if(!ensure_input(_decoder, 1)) {
+					return false;
+				}
+				const size_t available = _decoder->ending_byte - _decoder->current_byte;
+				const uint32_t piece   = available < (size_t)_decoder->next_chunk_size ? available : (uint32_t)_decoder->next_chunk_size;
+				ASSERT_AND_FLUSH(_decoder->current_byte + piece <= _decoder->ending_byte);
+				const png_stage_e outer = stats_enter(_decoder, PNG_STAGE_INFLATE);
+				uint shifted_bytes = _decoder->internal_context.idat.deferred ?
+									 defer_data(_decoder, &(_decoder->internal_context.idat), _decoder->current_byte, piece) :
+									 _decoder->internal_context.idat.gathered ?
+									 gather_data(_decoder, &(_decoder->internal_context.idat), _decoder->current_byte, piece) :
+									 inflate_data(_decoder, &(_decoder->internal_context.idat), _decoder->current_byte, piece);
+				(void)stats_enter(_decoder, outer);
+				if(_decoder->options.stats != NULL) {
+					_decoder->options.stats->compressed_bytes += shifted_bytes;
+				}
+				ADVANCE_BYTE(_decoder, shifted_bytes);
+				_decoder->next_chunk_size -= shifted_bytes;
+			}
+			if((_decoder->internal_context.idat.pipelined && png_pipeline_failed(&(_decoder->internal_context.idat.pipeline))) ||
+					_decoder->internal_context.idat.rows_failed) {
+				//a bad row was already found - no point inflating the rest
+				return false;
+			}
+			if(region_done(_decoder)) {
+				//rest of this chunk and everything after it is not needed
+				return true;
 			}
 
 			//TODO: here we should see if all the chunks provided so far match all the bit depth and so on
 			break;
 		}
-		case TOK_PHYS: {
-			//ANCILLARY
-			//idk what this is for
+		case TOK_TRNS: {
+			//ANCILLARY: alpha of palette entries - grey and rgb images have a single transparent colour here instead,
+			//which only formats with alpha apply
+			palette_chunk_s* palette = &(_decoder->internal_context.plte);
+			const uint8_t color_type = _decoder->internal_context.ihdr.color_type;
+			if(color_type == 0 || color_type == 2) {
+				const uint key_size = color_type == 0 ? 2 : 6;
+				if(_decoder->internal_context.idat.data_started || _decoder->next_chunk_size != key_size) {
+					LOG(LOG_WARNING, "ignoring tRNS of %d bytes after the first IDAT or not matching the colour type", _decoder->next_chunk_size);
+					break;
+				}
+				if(!ensure_input(_decoder, key_size)) {
+					return false;
+				}
+				_decoder->next_chunk_size -= parse_colour_key(_decoder, palette, key_size / 2);
+				break;
+			}
+			if(color_type != 3) {
+				LOG(LOG_WARNING, "ignoring tRNS of an image that already has alpha");
+				break;
+			}
+			if(palette->actual_size == 0 || _decoder->internal_context.idat.data_started) {
+				LOG(LOG_WARNING, "ignoring tRNS outside of PLTE and the first IDAT");
+				break;
+			}
+			if(_decoder->next_chunk_size > palette->actual_size) {
+				LOG(LOG_WARNING, "tRNS has %d entries for a palette of %u, ignoring the rest", _decoder->next_chunk_size, palette->actual_size);
+			}
+			const uint entries = (uint)_decoder->next_chunk_size < palette->actual_size ? (uint)_decoder->next_chunk_size : palette->actual_size;
+			if(!ensure_input(_decoder, entries)) {
+				return false;
+			}
+			_decoder->next_chunk_size -= parse_transparency(_decoder, palette, entries);
+			break;
+		}
+		case TOK_IEND: {
+			//CRITICAL: this is ending token - it carries no data, the image is put together once its crc is checked
+			LOG(LOG_INFO, "recieved end token");
 			break;
 		}
-		case TOK_BKGD: {
-			//ANCILLARY
-			//idk what this is for
+		default: {
+			//spec only lets unknown chunks be skipped when they are ancillary - a critical one may change how the
+			//image has to be read, unless the caller's handler knew what to do with it
+			if(!handled && !PNG_CHUNK_ANCILLARY(_current_token)) {
+				LOG(LOG_ERROR, "unknown critical chunk %.4s", _decoder->chunk_type);
+				return false;
+			}
+			//in memory this only moves the cursor past the payload
+			LOG(LOG_INFO, "skipping %d bytes of %.4s", _decoder->next_chunk_size, _decoder->chunk_type);
+			if(!skip_input(_decoder)) {
+				return false;
+			}
 			break;
 		}
-		case TOK_IEND: {
-			//CRITICAL: this is ending token - if it's not we gotta throw
-
+	}
 
-			ret_ctx.width = internal_context.ihdr.width;
-			ret_ctx.height = internal_context.ihdr.height;
+	if(_decoder->next_chunk_size > 0) {
+		//only a chunk the decoder knows gets here with bytes left - one it parsed just part of, like a tRNS longer than
+		//the palette, or one it ignored as a whole (misplaced tRNS, PLTE not made of whole entries)
+		LOG(LOG_WARNING, "skipping %d bytes of %.4s the decoder did not parse", _decoder->next_chunk_size, _decoder->chunk_type);
+		if(!skip_input(_decoder)) {
+			return false;
+		}
+	} else if(_decoder->next_chunk_size < 0) {
+		LOG(LOG_ERROR, "expected to read more data from the current chunk - byte left: %ld", _decoder->next_chunk_size);
+		return false;
+	}
+	return true;
+}
 
-			preprocess(&(internal_context.idat), ret_ctx);
-			save_to_temp_file(TEMP_SAVE_FILE, &(internal_context.idat));
-			LOG(LOG_INFO, "recieved end token");
-			return ret_ctx;
+static png_external_context_s* finish_image(png_decoder_s* _decoder)
+{
+	data_chunk_s* idat = &(_decoder->internal_context.idat);
+	if(idat->rows_streamed) {
+		//rows went straight into the result - all that is left is to check they are all there, and for whole images
+		//that the stream ended right after them
+		png_external_context_s* ret_ctx = _decoder->result;
+		_decoder->result		  = NULL;
+		const bool ended		  = _decoder->region_requested || finish_data_stream(idat);
+		idat->stream_initialized  = false;
+		if(_decoder->options.stats != NULL) {
+			_decoder->options.stats->inflated_bytes = idat->stream.total_out;
 		}
-		default: {
-			//should never be reached
-			LOG(LOG_ERROR, "revievied unknown token");
-			ASSERT_AND_FLUSH(0);
+		if(!rows_complete(_decoder) || !ended) {
+			LOG(LOG_ERROR, "image data ended after %zu rows", idat->rows_done);
+			free_decoded_png(ret_ctx);
+			return NULL;
 		}
+		return ret_ctx;
+	}
+
+	const png_stage_e outer = stats_enter(_decoder, PNG_STAGE_INFLATE);
+	const bool inflated = idat->deferred ? inflate_deferred(_decoder, idat, &(_decoder->internal_context.ihdr)) :
+						  idat->gathered ? inflate_whole(_decoder, idat, idat->spans, idat->span_count) :
+						  finish_data_stream(idat);
+	(void)stats_enter(_decoder, outer);
+	if(!inflated) {
+		LOG(LOG_ERROR, "image data is incomplete");
+		abandon_image(_decoder);
+		return NULL;
+	}
+	if(_decoder->options.stats != NULL) {
+		//every way of inflating that gets here checked the stream came out at exactly this size
+		_decoder->options.stats->inflated_bytes = idat->scanlines_size;
 	}
 
-	{	//TEMP
-		LOG(LOG_WARNING, "skiping whole block for now");
-		ADVANCE_BYTE(next_chunk_size);
-		next_chunk_size = 0;
+	if(idat->progressive) {
+		//passes that only just got completed - all of them when the stream was inflated after IEND
+		const bool reconstructed = reconstruct_passes(_decoder, idat, idat->scanlines_size);
+		png_external_context_s* ret_ctx = _decoder->result;
+		_decoder->result = NULL;
+		if(!reconstructed) {
+			LOG(LOG_ERROR, "could not reconstruct image data");
+			free_decoded_png(ret_ctx);
+			return NULL;
+		}
+		return ret_ctx;
 	}
 
-	{ //TEMP
-		if(_current_token != TOK_INIT) {
-			check_CRC();
+	if(idat->pipelined) {
+		//every row is already inflated - only the last few may still be waiting for reconstruction
+		png_external_context_s* ret_ctx = _decoder->result;
+		const bool reconstructed = png_pipeline_finish(&(idat->pipeline));
+		idat->pipelined	 = false;
+		_decoder->result = NULL;
+		if(!reconstructed) {
+			LOG(LOG_ERROR, "could not reconstruct image data");
+			free_decoded_png(ret_ctx);
+			return NULL;
 		}
+		return ret_ctx;
 	}
 
-	if(next_chunk_size > 0)		  LOG(LOG_ERROR, "expected to read less data from the current chunk - byte left: %ld", next_chunk_size);
-	else if(next_chunk_size != 0) LOG(LOG_ERROR, "expected to read more data from the current chunk - byte left: %ld", next_chunk_size);
+	//parallel inflate already put its rows into the result
+	png_external_context_s* ret_ctx = _decoder->result != NULL ? _decoder->result : allocate_result(_decoder);
+	_decoder->result = NULL;
+	if(ret_ctx == NULL) {
+		return NULL;
+	}
 
-	next_chunk_size = get_next_chunk_size();
-	next_token = get_next_token();
-	return process_next_chunk(next_token);
+	if(!preprocess(_decoder, &(_decoder->internal_context.ihdr), &(_decoder->internal_context.idat), ret_ctx)) {
+		LOG(LOG_ERROR, "could not reconstruct image data");
+		free_decoded_png(ret_ctx);
+		return NULL;
+	}
+	return ret_ctx;
 }
 
-token_e get_next_token()
+uint32_t get_next_token(png_decoder_s* _decoder)
 {
 	const uint chunk_str_len = 4;
 
-	ASSERT_AND_FLUSH(ending_byte  != NULL);
-	ASSERT_AND_FLUSH(current_byte != NULL);
-	ASSERT_AND_FLUSH(current_byte != ending_byte);
+	ASSERT_AND_FLUSH(_decoder->ending_byte  != NULL);
+	ASSERT_AND_FLUSH(_decoder->current_byte != NULL);
+	ASSERT_AND_FLUSH(_decoder->current_byte != _decoder->ending_byte);
 	//png chunks are guaranteed to be 4 letters long
-	ASSERT_AND_FLUSH(current_byte + chunk_str_len < ending_byte);	//TODO: check specs if png can end with token and no data? prolly not
-
-	char chunk_name[chunk_str_len + 1];
-	memset(chunk_name, 0, sizeof(char) * (chunk_str_len + 1));
-
-	LOG(LOG_DEBUG_2, "10 next bytes before shifting: %s", AS_HEX_N(current_byte, 10));
-
-	for(int i = 0; i < chunk_str_len; ++i) {
-		//chunks in png can be lower or upper case - this means a lot of things
-		//that I dont care about, so just make them lowercase for now
-		chunk_name[i] = *current_byte | (1 << 5);
-		ADVANCE_BYTE(1);
-	}
-	LOG(LOG_DEBUG_3, "read chunk as: %s (%s)", chunk_name, AS_HEX_N(chunk_name, 4));
-	LOG(LOG_DEBUG_2, "10 next bytes after shifting: %s", AS_HEX_N(current_byte, 10));
-
-#define TOKEN_MATCHES(_str) (strncmp(chunk_name, _str, chunk_str_len) == 0)
-	token_e token;
-	if(TOKEN_MATCHES("ihdr")) {
-		token = TOK_IHDR;
-	} else if(TOKEN_MATCHES("plte")) {
-		token = TOK_PLTE;
-	} else if(TOKEN_MATCHES("idat")) {
-		token = TOK_IDAT;
-	} else if(TOKEN_MATCHES("iend")) {
-		token = TOK_IEND;
-	} else if(TOKEN_MATCHES("phys")) {
-		token = TOK_PHYS;
-	} else if(TOKEN_MATCHES("bkgd")) {
-		token = TOK_BKGD;
-	} else {
-		//something went wrong
-		//TODO: add rest of tokens later
-		char temp_log_arr[chunk_str_len + 1];
-		memset(temp_log_arr, 0, sizeof(char) * chunk_str_len + 1);
-		memcpy(temp_log_arr, chunk_name, chunk_str_len);
-		temp_log_arr[chunk_str_len] = '\0';
-		LOG(LOG_ERROR, "there is a unrecognized chunk: %s (%s)\n", chunk_name, AS_HEX_ARR(temp_log_arr));
-		ASSERT_AND_FLUSH(0);
-	}
+	ASSERT_AND_FLUSH(_decoder->current_byte + chunk_str_len <= _decoder->ending_byte);
+
+	//case of every letter means something (ancillary, private, safe to copy), so the type is kept exactly as stored -
+	//as a number known chunks are a single switch away
+	const uint8_t* type = _decoder->current_byte;
+	const uint32_t token = PNG_CHUNK_TYPE(type[0], type[1], type[2], type[3]);
+	LOG(LOG_DEBUG_3, "read chunk as: %.4s (%s)", (const char*)type, AS_HEX_N((const char*)type, chunk_str_len));
+	ADVANCE_BYTE(_decoder, chunk_str_len);
 	return token;
-#undef TOKEN_MATCHES
 }
 
-static bool look_for_magic_bytes()
+static const png_chunk_handler_s* find_chunk_handler(const png_decoder_s* _decoder, const uint32_t _type)
+{
+	//callers opt in to a handful of types at most, so looking through them beats anything smarter
+	for(uint h = 0; h < _decoder->options.chunk_handler_count; ++h) {
+		if(_decoder->options.chunk_handlers[h].type == _type) {
+			return &(_decoder->options.chunk_handlers[h]);
+		}
+	}
+	return NULL;
+}
+
+static bool look_for_magic_bytes(png_decoder_s* _decoder)
 {
-	ASSERT_AND_FLUSH(current_byte != NULL);
-	if(memcmp(current_byte, PNG_MAGIC_NUMBER, MAGIC_NUM_LEN) != 0) {
-		char temp_log_arr[MAGIC_NUM_LEN + 1];
-		memcpy(temp_log_arr, current_byte, MAGIC_NUM_LEN);
-		temp_log_arr[MAGIC_NUM_LEN] = '\0';
+	ASSERT_AND_FLUSH(_decoder->current_byte != NULL);
+	if(memcmp(_decoder->current_byte, PNG_MAGIC_NUMBER, PNG_MAGIC_NUM_LEN) != 0) {
+		char temp_log_arr[PNG_MAGIC_NUM_LEN + 1];
+		memcpy(temp_log_arr, _decoder->current_byte, PNG_MAGIC_NUM_LEN);
+		temp_log_arr[PNG_MAGIC_NUM_LEN] = '\0';
 		LOG(LOG_ERROR, "incorrect magic numbers - expected: %s got: %s", PNG_MAGIC_NUMBER, temp_log_arr);
 		return false;
 	}
-	ADVANCE_BYTE(MAGIC_NUM_LEN);
+	ADVANCE_BYTE(_decoder, PNG_MAGIC_NUM_LEN);
 	return true;
 }
 
 static const char* bytes_to_hex(const char* _data, const size_t _len)
 {
-    static char hex_buffer[1028];
-    memset(hex_buffer, 0, sizeof(hex_buffer));
-
-    for (size_t i = 0; i < _len; i++) {
-        snprintf(hex_buffer + strlen(hex_buffer),
-                 sizeof(hex_buffer) - strlen(hex_buffer),
-                 "%02X ", (unsigned char)_data[i]);
-    }
+	//only runs for log lines that actually get written - per thread, so concurrent decoders do not scribble over each other's logs
+	static __thread char hex_buffer[1028];
+	static const char digits[] = "0123456789ABCDEF";
+
+	//three characters per byte, whatever does not fit is left out
+	const size_t max_len = (sizeof(hex_buffer) - 1) / 3;
+	const size_t len	 = _len < max_len ? _len : max_len;
+	for(size_t i = 0; i < len; ++i) {
+		const uint8_t byte	  = (uint8_t)_data[i];
+		hex_buffer[i * 3]	  = digits[byte >> 4];
+		hex_buffer[i * 3 + 1] = digits[byte & 0xf];
+		hex_buffer[i * 3 + 2] = ' ';
+	}
+	hex_buffer[len * 3] = '\0';
 	return hex_buffer;
 }
 
-static const uint32_t get_next_chunk_size()
+static const uint32_t get_next_chunk_size(png_decoder_s* _decoder)
 {
 	const uint shift_size = sizeof(uint32_t)/sizeof(uint8_t);
-	ASSERT_AND_FLUSH(ending_byte  != NULL);
-	ASSERT_AND_FLUSH(current_byte != NULL);
-	ASSERT_AND_FLUSH(current_byte != ending_byte);
-	ASSERT_AND_FLUSH(current_byte + shift_size < ending_byte);
+	ASSERT_AND_FLUSH(_decoder->ending_byte  != NULL);
+	ASSERT_AND_FLUSH(_decoder->current_byte != NULL);
+	ASSERT_AND_FLUSH(_decoder->current_byte != _decoder->ending_byte);
+	ASSERT_AND_FLUSH(_decoder->current_byte + shift_size <= _decoder->ending_byte);
 
 	//4 bytes at the beggining of the chunk define its len
-	LOG(LOG_DEBUG_2, "10 next bytes before shifting: %s", AS_HEX_N(current_byte, 10));
+	LOG(LOG_DEBUG_2, "10 next bytes before shifting: %s", AS_HEX_AHEAD(_decoder, 10));
 
 	int32_t len = 0;
 	union byte_u {
@@ -292,28 +982,177 @@ static const uint32_t get_next_chunk_size()
 	} temp_union;
 
 	for(uint i = 0; i < shift_size; ++i) {
-		temp_union.padding[shift_size - i - 1] = (uint8_t)*current_byte;
-		LOG(LOG_DEBUG_2, "adding: %ld (%s)", (uint8_t)*current_byte, AS_HEX_N((char*)(current_byte), sizeof(int32_t)));
-		ADVANCE_BYTE(1);
+		temp_union.padding[shift_size - i - 1] = (uint8_t)*_decoder->current_byte;
+		LOG(LOG_DEBUG_2, "adding: %ld (%s)", (uint8_t)*_decoder->current_byte, AS_HEX_AHEAD(_decoder, sizeof(int32_t)));
+		ADVANCE_BYTE(_decoder, 1);
 	}
 
 	LOG(LOG_DEBUG_1, "union: %ld", temp_union.len);
 	LOG(LOG_INFO, "len for next block: %ld (%s)", temp_union.len, AS_HEX_N((char*)(&temp_union.len), sizeof(int32_t)));
 
-	LOG(LOG_DEBUG_2, "10 next bytes after shifting: %s", AS_HEX_N(current_byte, 10));
+	LOG(LOG_DEBUG_2, "10 next bytes after shifting: %s", AS_HEX_AHEAD(_decoder, 10));
 	LOG(LOG_DEBUG_3, "next block size is: %ld", temp_union.len);
 	return temp_union.len;
 }
 
-const bool check_CRC()
+const bool check_CRC(png_decoder_s* _decoder)
+{
+	ASSERT_AND_FLUSH(_decoder->chunk_start != NULL);
+	LOG(LOG_DEBUG_3, "CRC bytes: %s", AS_HEX_AHEAD(_decoder, PNG_CRC_LEN));
+
+	if(chunk_crc_wanted(_decoder)) {
+		const uint32_t expected = png_read_be32(_decoder->current_byte);
+		//crc covers chunk type and data, but not the length in front of them
+		//streamed input may have already dropped the front of the chunk - its crc is carried in chunk_crc
+		const png_stage_e outer = stats_enter(_decoder, PNG_STAGE_CRC);
+		const uint32_t actual = png_crc32(_decoder->chunk_crc, _decoder->chunk_start, _decoder->current_byte - _decoder->chunk_start);
+		(void)stats_enter(_decoder, outer);
+		if(actual != expected) {
+			LOG(LOG_ERROR, "crc mismatch in chunk %.4s - stored: %08x, computed: %08x", _decoder->chunk_type, expected, actual);
+			return false;
+		}
+	}
+
+	ADVANCE_BYTE(_decoder, PNG_CRC_LEN);
+	return true;
+}
+
+static const bool chunk_crc_wanted(const png_decoder_s* _decoder)
+{
+	//critical chunks have bit 5 of the first type letter cleared (uppercase)
+	const bool critical = !PNG_CHUNK_ANCILLARY(_decoder->current_token);
+	switch(_decoder->options.crc_policy) {
+		case CRC_VERIFY_ALL:	  return true;
+		case CRC_VERIFY_CRITICAL: return critical;
+		case CRC_SKIP:			  return false;
+	}
+	return true;
+}
+
+static const bool ensure_input(png_decoder_s* _decoder, const size_t _needed)
+{
+	//makes sure at least _needed bytes sit between current_byte and ending_byte
+	//in memory input either has them or is truncated, streamed input gets refilled through the window
+	size_t available = _decoder->ending_byte - _decoder->current_byte;
+	if(available >= _needed) {
+		return true;
+	}
+	if((_decoder->input.read == NULL && !_decoder->input.push) || _decoder->input.eof) {
+		LOG(LOG_ERROR, "input ended too early - needed %zu bytes, only %zu left", _needed, available);
+		return false;
+	}
+
+	//bytes of the current chunk that are about to be dropped still count towards its crc
+	if(_decoder->chunk_start != NULL && chunk_crc_wanted(_decoder)) {
+		const png_stage_e outer = stats_enter(_decoder, PNG_STAGE_CRC);
+		_decoder->chunk_crc = png_crc32(_decoder->chunk_crc, _decoder->chunk_start, _decoder->current_byte - _decoder->chunk_start);
+		(void)stats_enter(_decoder, outer);
+	}
+
+	const size_t window_size = _decoder->input.push ? PUSH_WINDOW_SIZE : INPUT_WINDOW_SIZE;
+	const size_t wanted		 = _needed > window_size ? _needed : window_size;
+	if(_decoder->input_window_capacity < wanted) {
+		//only chunks that have to be parsed as a whole (IHDR, PLTE) can make the window grow past its default size
+		uint8_t* window = decoder_alloc(_decoder, wanted, PNG_ROW_ALIGNMENT);
+		if(window == NULL) {
+			LOG_ERRNO(LOG_ERROR, "could not allocate %zu bytes of input window", wanted);
+			return false;
+		}
+		if(available > 0) {
+			memcpy(window, _decoder->current_byte, available);
+		}
+		decoder_free(_decoder, _decoder->input_window);
+		_decoder->input_window			= window;
+		_decoder->input_window_capacity = wanted;
+	} else if(available > 0) {
+		memmove(_decoder->input_window, _decoder->current_byte, available);
+	}
+	_decoder->current_byte = _decoder->input_window;
+	if(_decoder->chunk_start != NULL) {
+		_decoder->chunk_start = _decoder->input_window;
+	}
+
+	if(_decoder->input.push) {
+		//nobody to ask - the leftover stays in the window until png_feed() brings the rest
+		_decoder->ending_byte	= _decoder->input_window + available;
+		_decoder->input.needed	= _needed;
+		_decoder->input.starved = true;
+		return false;
+	}
+
+	//fill as much of the window as the source gives us, but keep asking until the request is covered
+	do {
+		const size_t got = _decoder->input.read(_decoder->input.user, _decoder->input_window + available, _decoder->input_window_capacity - available);
+		if(got == 0) {
+			_decoder->input.eof = true;
+			break;
+		}
+		available += got;
+	} while(available < _needed);
+	_decoder->ending_byte = _decoder->input_window + available;
+
+	if(available < _needed) {
+		LOG(LOG_ERROR, "input ended too early - needed %zu bytes, only %zu left", _needed, available);
+		return false;
+	}
+	return true;
+}
+
+static const bool skip_input(png_decoder_s* _decoder)
 {
-	LOG(LOG_WARNING, "this is not implemented yet - add it later");
-	LOG(LOG_DEBUG_3, "CRC bytes: %s", AS_HEX_N(current_byte, CRC_LEN));
-	ADVANCE_BYTE(CRC_LEN);
+	//skips the rest of the current chunk - skipped bytes still go through the window, so the crc sees them
+	//what is left to skip lives in the decoder, so a push walk that runs dry halfway carries on where it stopped
+	while(_decoder->next_chunk_size > 0) {
+		if(!ensure_input(_decoder, 1)) {
+			return false;
+		}
+		const size_t available = _decoder->ending_byte - _decoder->current_byte;
+		const size_t step	   = available < (size_t)_decoder->next_chunk_size ? available : (size_t)_decoder->next_chunk_size;
+		ADVANCE_BYTE(_decoder, step);
+		_decoder->next_chunk_size -= step;
+	}
 	return true;
 }
 
-static const uint parse_header(header_chunk_s* _header)
+static void rewind_arena(png_decoder_s* _decoder)
+{
+	if(!_decoder->options.use_arena) {
+		return;
+	}
+	//everything the previous decode handed out - result included - goes away in one go,
+	//and with it the scratch and the inflate state that lived in the arena
+	png_arena_reset(&(_decoder->arena));
+	data_chunk_s* idat = &(_decoder->internal_context.idat);
+	idat->stream_allocated	  = false;
+	idat->scanlines			  = NULL;
+	idat->scanlines_capacity  = 0;
+	idat->compressed		  = NULL;
+	idat->compressed_capacity = 0;
+	idat->spans				  = NULL;
+	idat->span_capacity		  = 0;
+	_decoder->zero_row		  = NULL;
+	_decoder->zero_row_capacity = 0;
+	_decoder->pass_pixels	  = NULL;
+	_decoder->pass_pixels_capacity = 0;
+	_decoder->input_window	  = NULL;
+	_decoder->input_window_capacity = 0;
+}
+
+static size_t fd_read(void* _user, uint8_t* _buffer, const size_t _size)
+{
+	const int fd = *(int*)_user;
+	ssize_t got;
+	do {
+		got = read(fd, _buffer, _size);
+	} while(got < 0 && errno == EINTR);
+	if(got < 0) {
+		LOG_ERRNO(LOG_ERROR, "reading input failed");
+		return 0;
+	}
+	return (size_t)got;
+}
+
+static const uint parse_header(png_decoder_s* _decoder, header_chunk_s* _header)
 {
 #define DIM_LEN		4
 #define HEADER_LEN 13
@@ -332,39 +1171,39 @@ static const uint parse_header(header_chunk_s* _header)
 	} casting_union;
 
 	for(int i = 0; i < DIM_LEN; ++i) {
-		casting_union.padding[DIM_LEN - i - 1] = (uint8_t)*current_byte;
-		LOG(LOG_DEBUG_1, "width - adding: %ld (%s)", (uint8_t)*current_byte, AS_HEX_N((char*)(current_byte), sizeof(int32_t)));
-		ADVANCE_BYTE(1);
+		casting_union.padding[DIM_LEN - i - 1] = (uint8_t)*_decoder->current_byte;
+		LOG(LOG_DEBUG_1, "width - adding: %ld (%s)", (uint8_t)*_decoder->current_byte, AS_HEX_AHEAD(_decoder, sizeof(int32_t)));
+		ADVANCE_BYTE(_decoder, 1);
 	}
 	_header->width = casting_union.value;
 
 	casting_union.value = 0;
 
 	for(int i = 0; i < DIM_LEN; ++i) {
-		casting_union.padding[DIM_LEN - i - 1] = (uint8_t)*current_byte;
-		LOG(LOG_DEBUG_1, "height - adding: %ld (%s)", (uint8_t)*current_byte, AS_HEX_N((char*)(current_byte), sizeof(int32_t)));
-		ADVANCE_BYTE(1);
+		casting_union.padding[DIM_LEN - i - 1] = (uint8_t)*_decoder->current_byte;
+		LOG(LOG_DEBUG_1, "height - adding: %ld (%s)", (uint8_t)*_decoder->current_byte, AS_HEX_AHEAD(_decoder, sizeof(int32_t)));
+		ADVANCE_BYTE(_decoder, 1);
 	}
 	_header->height = casting_union.value;
 
-	_header->bit_depth = (uint8_t)*current_byte;
-	ADVANCE_BYTE(1);
+	_header->bit_depth = (uint8_t)*_decoder->current_byte;
+	ADVANCE_BYTE(_decoder, 1);
 	LOG(LOG_DEBUG_1, "bit_depth: %d", _header->bit_depth);
 
-	_header->color_type = (uint8_t)*current_byte;
-	ADVANCE_BYTE(1);
+	_header->color_type = (uint8_t)*_decoder->current_byte;
+	ADVANCE_BYTE(_decoder, 1);
 	LOG(LOG_DEBUG_1, "color_type: %d", _header->color_type);
 
-	_header->compression_method = (uint8_t)*current_byte;
-	ADVANCE_BYTE(1);
+	_header->compression_method = (uint8_t)*_decoder->current_byte;
+	ADVANCE_BYTE(_decoder, 1);
 	LOG(LOG_DEBUG_1, "compression_method: %d", _header->compression_method);
 
-	_header->filter_method = (uint8_t)*current_byte;
-	ADVANCE_BYTE(1);
+	_header->filter_method = (uint8_t)*_decoder->current_byte;
+	ADVANCE_BYTE(_decoder, 1);
 	LOG(LOG_DEBUG_1, "filter_method: %d", _header->filter_method);
 
-	_header->interlace_method = (uint8_t)*current_byte;
-	ADVANCE_BYTE(1);
+	_header->interlace_method = (uint8_t)*_decoder->current_byte;
+	ADVANCE_BYTE(_decoder, 1);
 	LOG(LOG_DEBUG_1, "interlace_method: %d", _header->interlace_method);
 
 	return HEADER_LEN;
@@ -377,7 +1216,11 @@ static const bool check_header(const header_chunk_s _header)
 {
 	bool ret_status = true;
 	//header fields can only take specyfic values - we check that here:
-	//width and height is fine as it is
+	//width and height: 1 to 2^31 - 1
+	if(_header.width == 0 || _header.height == 0 || _header.width > INT32_MAX || _header.height > INT32_MAX) {
+		LOG(LOG_ERROR, "encountered disallowed dimensions: %ux%u", _header.width, _header.height);
+		ret_status = false;
+	}
 
 	//bit depth can be: 1, 2, 4, 8, 16
 	if(_header.bit_depth != 1 && _header.bit_depth != 2 &&
@@ -449,7 +1292,7 @@ static const bool check_header(const header_chunk_s _header)
 		case 2:	//fallthrough
 		case 4:	//fallthrough
 		case 6:{
-			if(_header.bit_depth != 8 || _header.bit_depth != 16) {
+			if(_header.bit_depth != 8 && _header.bit_depth != 16) {
 				LOG(LOG_ERROR, "encountered disallowed bit depth and color type configuration - bit depth: %d, color type: %d",
 						_header.bit_depth, _header.color_type);
 				ret_status = false;
@@ -457,117 +1300,1049 @@ static const bool check_header(const header_chunk_s _header)
 			break;
 		}
 		default: {
-			LOG(LOG_ERROR, "encountered unrecognized color type: %d", _header.color_type);
-			ASSERT_AND_FLUSH(0);
+			//already reported above - header comes straight from the input, so this is not a bug in here
+			ret_status = false;
 		}
 	}
 
 	return ret_status;
 }
 
-static const uint parse_palette(palette_chunk_s* _palette, const uint8_t _size)
+static const uint parse_palette(png_decoder_s* _decoder, palette_chunk_s* _palette, const uint _size)
 {
 	ASSERT_AND_FLUSH(_palette != NULL);
 	ASSERT_AND_FLUSH(_size != 0);
 	ASSERT_AND_FLUSH(_size <= 256);
 
 	_palette->actual_size = _size;
-	_palette->colour_array = malloc(sizeof(colour_s) * _size);
 
 	for(int i = 0; i < _size; ++i) {
-		_palette->colour_array[i].r = (uint8_t)*current_byte;
-		ADVANCE_BYTE(1);
-		_palette->colour_array[i].g = (uint8_t)*current_byte;
-		ADVANCE_BYTE(1);
-		_palette->colour_array[i].b = (uint8_t)*current_byte;
-		ADVANCE_BYTE(1);
+		_palette->colour_array[i].r = (uint8_t)*_decoder->current_byte;
+		ADVANCE_BYTE(_decoder, 1);
+		_palette->colour_array[i].g = (uint8_t)*_decoder->current_byte;
+		ADVANCE_BYTE(_decoder, 1);
+		_palette->colour_array[i].b = (uint8_t)*_decoder->current_byte;
+		ADVANCE_BYTE(_decoder, 1);
+	}
+
+	//indices past the end of the palette are an encoder bug - they come out opaque black instead of failing the image
+	for(uint i = 0; i < 256; ++i) {
+		const colour_s colour = i < _size ? _palette->colour_array[i] : (colour_s){0, 0, 0};
+		_palette->lut.rgba[i][0] = colour.r;
+		_palette->lut.rgba[i][1] = colour.g;
+		_palette->lut.rgba[i][2] = colour.b;
+		_palette->lut.rgba[i][3] = 0xff;
 	}
+	_palette->alpha_size = 0;
+	png_palette_lut_update(&(_palette->lut));
 	return _size * 3;
 }
 
-static const uint parse_data(data_chunk_s* _data)
+static const uint parse_transparency(png_decoder_s* _decoder, palette_chunk_s* _palette, const uint _size)
 {
-	ASSERT_AND_FLUSH(_data->data != NULL);
-	ASSERT_AND_FLUSH(_data->actual_size != 0);
-	ASSERT_AND_FLUSH(current_byte + _data->actual_size < ending_byte);
+	ASSERT_AND_FLUSH(_palette != NULL);
+	ASSERT_AND_FLUSH(_size <= _palette->actual_size);
 
-	memcpy(_data->data, current_byte, _data->actual_size);
-	ADVANCE_BYTE(_data->actual_size);
-	return _data->actual_size;
+	//one alpha per palette entry, in order - entries it does not reach stay opaque
+	_palette->alpha_size = _size;
+	for(uint i = 0; i < _size; ++i) {
+		_palette->lut.rgba[i][3] = (uint8_t)*_decoder->current_byte;
+		ADVANCE_BYTE(_decoder, 1);
+	}
+	png_palette_lut_update(&(_palette->lut));
+	return _size;
 }
 
-static const void save_to_temp_file(const char* _file_path, const data_chunk_s* _data)
+static const uint parse_colour_key(png_decoder_s* _decoder, palette_chunk_s* _palette, const uint _samples)
 {
-	assert(_file_path != NULL);
-	LOG(LOG_DEBUG_CRITICAL, "got end token - saving to temp file: %s", _file_path);
-
-	//this is fucking ugly but let's roll with it
-	//will this even compile?
-	*(_data->data + _data->actual_size) = '\0';
+	ASSERT_AND_FLUSH(_palette != NULL);
+	ASSERT_AND_FLUSH(_samples == 1 || _samples == 3);
 
-	uint8_t* buff = malloc(sizeof(uint8_t) * (_data->actual_size + 1));
-	FILE* temp_input_stream = fmemopen(buff, _data->actual_size + 1, "w+");
-	if(temp_input_stream == NULL) {
-		LOG_ERRNO(LOG_DEBUG_CRITICAL, "error - can not create a stream in memory!");
-		return;
+	//always 16 bit big endian, whatever the bit depth - smaller depths only use the low bits
+	memset(_palette->colour_key, 0, sizeof(_palette->colour_key));
+	for(uint i = 0; i < _samples; ++i) {
+		_palette->colour_key[i] = (uint16_t)((_decoder->current_byte[0] << 8) | _decoder->current_byte[1]);
+		ADVANCE_BYTE(_decoder, 2);
 	}
+	_palette->has_colour_key = true;
+	return 2 * _samples;
+}
 
-
-	if(fwrite(_data->data, sizeof(uint8_t), _data->actual_size, temp_input_stream) == 0) {
-		LOG_ERRNO(LOG_DEBUG_CRITICAL, "something went wrong");
+static const uint8_t get_channels(const uint8_t _color_type)
+{
+	switch(_color_type) {
+		case 0: return 1;	//grayscale
+		case 2: return 3;	//rgb
+		case 3: return 1;	//palette index
+		case 4: return 2;	//grayscale + alpha
+		case 6: return 4;	//rgb + alpha
 	}
-	rewind(temp_input_stream);
+	return 0;
+}
+
+static const uint get_pass_count(const header_chunk_s* _header)
+{
+	return _header->interlace_method == 1 ? ADAM7_PASSES : 1;
+}
+
+static const void get_pass_size(const header_chunk_s* _header, const uint _pass, size_t* _width, size_t* _height)
+{
+	//non interlaced image is treated as a single pass covering everything
+	if(_header->interlace_method != 1) {
+		*_width	 = _header->width;
+		*_height = _header->height;
+		return;
+	}
+	ASSERT_AND_FLUSH(_pass < ADAM7_PASSES);
+
+	if(_header->width <= adam7_start_x[_pass] || _header->height <= adam7_start_y[_pass]) {
+		*_width	 = 0;
+		*_height = 0;
+		return;
+	}
+	*_width	 = (_header->width	- adam7_start_x[_pass] + adam7_step_x[_pass] - 1) / adam7_step_x[_pass];
+	*_height = (_header->height - adam7_start_y[_pass] + adam7_step_y[_pass] - 1) / adam7_step_y[_pass];
+}
 
-	FILE* fp = fopen(_file_path, "w+");
-	if(fp == NULL) {
-		LOG_ERRNO(LOG_DEBUG_CRITICAL, "something went wrong with opening other file");
+static const size_t get_scanlines_size(const header_chunk_s* _header)
+{
+	//each scanline is prepended with a filter type byte and padded to a byte boundary
+	//for interlaced images every adam7 pass is a separate sub-image with its own scanlines
+	const size_t bits_per_pixel = (size_t)get_channels(_header->color_type) * _header->bit_depth;
+
+	size_t total = 0;
+	for(uint pass = 0; pass < get_pass_count(_header); ++pass) {
+		size_t pass_width, pass_height;
+		get_pass_size(_header, pass, &pass_width, &pass_height);
+		if(pass_width == 0 || pass_height == 0) {
+			//empty passes contribute no scanlines at all - not even the filter byte
+			continue;
+		}
+		total += pass_height * ((pass_width * bits_per_pixel + 7) / 8 + 1);
 	}
+	return total;
+}
+
+static const size_t get_output_stride(const header_chunk_s* _header, const png_format_e _format, const size_t _width)
+{
+	const size_t row_bytes = _width * png_format_channels(_format, _header->color_type) * png_format_bytes_per_channel(_format, _header->bit_depth);
+	return (row_bytes + PNG_ROW_ALIGNMENT - 1) & ~((size_t)PNG_ROW_ALIGNMENT - 1);
+}
 
-	int ret = inf(temp_input_stream, fp);
+static const png_format_e get_output_format(const png_decoder_s* _decoder)
+{
+	return _decoder->output_requested ? _decoder->output.format : _decoder->options.format;
+}
+
+static const bool init_data_stream(png_decoder_s* _decoder, data_chunk_s* _data, const header_chunk_s* _header)
+{
+	ASSERT_AND_FLUSH(_data	 != NULL);
+	ASSERT_AND_FLUSH(_header != NULL);
+
+	if(_data->stream_initialized) {
+		LOG(LOG_ERROR, "data stream was already initialized - duplicated IHDR?");
+		return false;
+	}
+
+	_data->scanlines_size = get_scanlines_size(_header);
+	if(_data->scanlines_size == 0) {
+		LOG(LOG_ERROR, "header describes an empty image");
+		return false;
+	}
+
+	//adam7 passes are reconstructed as a whole, so only plain images are worth pipelining
+	//region is resolved against the actual image once its size is known
+	png_region_s* region = &(_decoder->internal_context.region);
+	*region = (png_region_s){.x = 0, .y = 0, .width = _header->width, .height = _header->height};
+	if(_decoder->region_requested) {
+		const png_region_s* requested = &(_decoder->requested_region);
+		if(requested->x >= _header->width || requested->y >= _header->height || requested->width == 0 || requested->height == 0) {
+			LOG(LOG_ERROR, "requested region %ux%u at %u,%u is outside of the %ux%u image",
+					requested->width, requested->height, requested->x, requested->y, _header->width, _header->height);
+			return false;
+		}
+		region->x	   = requested->x;
+		region->y	   = requested->y;
+		region->width  = requested->width  < _header->width  - requested->x ? requested->width	: _header->width  - requested->x;
+		region->height = requested->height < _header->height - requested->y ? requested->height : _header->height - requested->y;
+	}
+
+	//adam7 spreads every row over the whole stream, so only plain images can stop early
+	//a region down to the last row cannot stop early either - streamed, it would only pay for zlib and the sliding
+	//window on top of a whole decode, so it goes the whole image way and gets cropped as its rows are converted,
+	//unless on_rows wants to see its rows as they come
+	//push decodes stream rows of whole images too - they come out while the rest of the file is still on its way
+	const bool stops_early = _decoder->region_requested &&
+							 ((size_t)region->y + region->height < _header->height || _decoder->options.on_rows != NULL);
+	_data->rows_streamed = (stops_early || _decoder->input.push) && _header->interlace_method == 0;
+	if(_data->rows_streamed && !start_row_stream(_decoder, _data, _header)) {
+		return false;
+	}
+	//adam7 passes are the smallest part of an interlaced image that can be put in its place before the stream ends
+	_data->progressive = _header->interlace_method == 1;
+	if(_data->progressive && !start_passes(_decoder, _data, _header)) {
+		return false;
+	}
 
+	//whole stream has to be there before it can be split, so it is collected first and inflated after IEND
+	_data->deferred		   = !_data->rows_streamed && _decoder->options.inflate_threads > 1 && _data->scanlines_size >= PARALLEL_MIN_SIZE;
+	_data->compressed_size = 0;
+	_data->unfiltered	   = false;
+	//if the pipeline cannot be started the image is simply decoded the serial way
+	_data->pipelined = !_data->deferred && !_data->rows_streamed && _decoder->options.pipeline && _header->interlace_method == 0 && _data->scanlines_size >= PIPELINE_MIN_SIZE &&
+					   start_pipeline(_decoder, _data, _header);
+	//in memory input stays where it is until the decode returns, so its stream can be inflated in one go after IEND
+	_data->gathered	  = !_data->deferred && !_data->pipelined && !_data->rows_streamed && _decoder->input.read == NULL && !_decoder->input.push;
+	_data->span_count = 0;
+	if(!_data->pipelined && !_data->rows_streamed && _data->scanlines_capacity < _data->scanlines_size) {
+		decoder_free(_decoder, _data->scanlines);
+		_data->scanlines		  = decoder_alloc(_decoder, sizeof(uint8_t) * _data->scanlines_size, PNG_ROW_ALIGNMENT);
+		_data->scanlines_capacity = _data->scanlines == NULL ? 0 : _data->scanlines_size;
+		if(_data->scanlines == NULL) {
+			LOG_ERRNO(LOG_ERROR, "could not allocate %zu bytes for scanlines", _data->scanlines_size);
+			return false;
+		}
+	}
 
+	z_stream* strm = &(_data->stream);
+	int ret;
+	if(_data->stream_allocated) {
+		//window and inflate state from the previous image are reused as they are
+		ret = inflateReset(strm);
+	} else {
+		memset(strm, 0, sizeof(z_stream));
+		//inflate state and window come from the same place as everything else
+		strm->zalloc	= zlib_alloc;
+		strm->zfree		= zlib_free;
+		strm->opaque	= _decoder;
+		strm->next_in	= Z_NULL;
+		strm->avail_in	= 0;
+		ret = inflateInit(strm);
+		_data->stream_allocated = ret == Z_OK;
+	}
 	if(ret != Z_OK) {
-		LOG_ERRNO(LOG_DEBUG_CRITICAL, "idk, seems like it failed");
+		LOG(LOG_ERROR, "could not prepare inflate stream: %d", ret);
 		zerr(ret);
+		return false;
 	}
 
-	fclose(fp);
-	fclose(temp_input_stream);
+	if(_data->pipelined) {
+		//output goes through the ring instead, one free region at a time
+		strm->next_out		= Z_NULL;
+		strm->avail_out		= 0;
+		_data->region_start = NULL;
+	} else if(_data->rows_streamed) {
+		//window is slid down as soon as it fills up
+		strm->next_out	= _data->scanlines;
+		strm->avail_out = _data->scanlines_capacity < _data->scanlines_size ? _data->scanlines_capacity : _data->scanlines_size;
+	} else {
+		//output is written once, straight into its final place
+		strm->next_out	= _data->scanlines;
+		strm->avail_out = _data->scanlines_size;
+	}
 
-	LOG(LOG_DEBUG_CRITICAL, "this thing might have succeeded");
+	_data->stream_initialized = true;
+	_data->stream_finished	  = false;
+	return true;
 }
 
+static const uint inflate_data(png_decoder_s* _decoder, data_chunk_s* _data, const uint8_t* _input, const uint32_t _size)
+{
+	ASSERT_AND_FLUSH(_data != NULL);
+	ASSERT_AND_FLUSH(_data->stream_initialized);
+
+	z_stream* strm = &(_data->stream);
+	strm->next_in  = (Bytef*)_input;
+	strm->avail_in = _size;
 
-static const void preprocess(const data_chunk_s* _data, png_external_context_s* _ret_ctx)
+	while(strm->avail_in > 0 && !_data->stream_finished) {
+		if(_data->pipelined && strm->avail_out == 0 && !next_pipeline_region(_data)) {
+			//reconstruct thread gave up - the IDAT handler reports it
+			return _size;
+		}
+		if(_data->rows_streamed && strm->avail_out == 0) {
+			slide_row_window(_decoder, _data);
+		}
+		int ret = inflate(strm, Z_NO_FLUSH);
+		if(_data->pipelined) {
+			png_pipeline_commit(&(_data->pipeline), strm->next_out - _data->region_start);
+			_data->region_start = strm->next_out;
+		}
+		if(_data->rows_streamed) {
+			if(!reconstruct_rows(_decoder, _data)) {
+				return _size;
+			}
+			if(region_done(_decoder)) {
+				//last requested row is out - whatever input is left is never looked at
+				return _size - strm->avail_in;
+			}
+		}
+		if(_data->progressive && !reconstruct_passes(_decoder, _data, strm->next_out - _data->scanlines)) {
+			return _size;
+		}
+		switch(ret) {
+			case Z_OK: {
+				break;
+			}
+			case Z_STREAM_END: {
+				_data->stream_finished = true;
+				break;
+			}
+			case Z_BUF_ERROR: {
+				//output is full but there is still input - image data is larger than IHDR claims
+				LOG(LOG_ERROR, "inflated data does not fit in %zu bytes of scanlines", _data->scanlines_size);
+				return _size;
+			}
+			default: {
+				LOG(LOG_ERROR, "inflate failed: %d (%s)", ret, strm->msg ? strm->msg : "no message");
+				zerr(ret);
+				return _size;
+			}
+		}
+	}
+
+	if(strm->avail_in > 0) {
+		LOG(LOG_WARNING, "ignoring %d bytes after the end of compressed stream", strm->avail_in);
+	}
+	return _size;
+}
+
+static const bool finish_data_stream(data_chunk_s* _data)
 {
-	//according to specs each line of data is prepended with a byte
+	ASSERT_AND_FLUSH(_data != NULL);
+
+	if(!_data->stream_initialized) {
+		LOG(LOG_ERROR, "no data stream was ever started");
+		return false;
+	}
+
+	//stream itself stays allocated for the next image
+	const size_t total_out = _data->stream.total_out;
+	_data->stream_initialized = false;
+
+	if(!_data->stream_finished) {
+		LOG(LOG_ERROR, "compressed stream ended prematurely - got %zu out of %zu bytes", total_out, _data->scanlines_size);
+		return false;
+	}
+	if(total_out != _data->scanlines_size) {
+		LOG(LOG_ERROR, "inflated %zu bytes but expected %zu", total_out, _data->scanlines_size);
+		return false;
+	}
+	return true;
+}
+
+static const uint defer_data(png_decoder_s* _decoder, data_chunk_s* _data, const uint8_t* _input, const uint32_t _size)
+{
+	//copied out, since neither the streamed window nor the chunk layout can be relied on until IEND
+	if(_data->compressed_capacity - _data->compressed_size < _size) {
+		size_t capacity = _data->compressed_capacity == 0 ? INPUT_WINDOW_SIZE : _data->compressed_capacity;
+		while(capacity - _data->compressed_size < _size) {
+			capacity *= 2;
+		}
+		uint8_t* compressed = decoder_alloc(_decoder, capacity, PNG_ROW_ALIGNMENT);
+		if(compressed == NULL) {
+			LOG_ERRNO(LOG_ERROR, "could not allocate %zu bytes for compressed data", capacity);
+			//nothing gets inflated, so the image ends up incomplete
+			_data->deferred = false;
+			return _size;
+		}
+		if(_data->compressed_size > 0) {
+			memcpy(compressed, _data->compressed, _data->compressed_size);
+		}
+		decoder_free(_decoder, _data->compressed);
+		_data->compressed		   = compressed;
+		_data->compressed_capacity = capacity;
+	}
+	memcpy(_data->compressed + _data->compressed_size, _input, _size);
+	_data->compressed_size += _size;
+	return _size;
+}
+
+static const bool inflate_deferred(png_decoder_s* _decoder, data_chunk_s* _data, const header_chunk_s* _header)
+{
+	//non-interlaced rows are reconstructed and converted by the same threads - adam7 passes are left to reconstruct_passes
+	const size_t bits_per_pixel = (size_t)get_channels(_header->color_type) * _header->bit_depth;
+	const size_t row_size		= ((size_t)_header->width * bits_per_pixel + 7) / 8;
+	const bool	 rows			= _header->interlace_method == 0 && ensure_zero_row(_decoder, row_size);
+	if(rows) {
+		_decoder->result = allocate_result(_decoder);
+		if(_decoder->result == NULL || !allocate_pixels(_decoder, _header, _decoder->result)) {
+			free_decoded_png(_decoder->result);
+			_decoder->result = NULL;
+			return false;
+		}
+	}
+	const png_row_layout_s layout = {
+		.row_size  = row_size,
+		.row_count = _header->height,
+		.bpp	   = bits_per_pixel < 8 ? 1 : bits_per_pixel / 8,
+		.zero_row  = _decoder->zero_row,
+		.sink	   = convert_sink,
+		.sink_user = _decoder,
+	};
+
+	//workers allocate concurrently, so they never touch the arena
+	if(png_parallel_inflate(_data->compressed, _data->compressed_size, _data->scanlines, _data->scanlines_size,
+				_decoder->options.inflate_threads, &(_decoder->allocator), rows ? &layout : NULL)) {
+		_data->stream_initialized = false;
+		_data->unfiltered		  = rows;
+		return true;
+	}
+
+	//no restart points - one stream, one thread, same as any other stream that is all in memory
+	_data->deferred = false;
+	const png_span_s whole = {.data = _data->compressed, .size = _data->compressed_size};
+	return inflate_whole(_decoder, _data, &whole, 1);
+}
+
+static const uint gather_data(png_decoder_s* _decoder, data_chunk_s* _data, const uint8_t* _input, const uint32_t _size)
+{
+	//nothing is copied - the payload is only remembered where it is
+	if(_data->span_count == _data->span_capacity) {
+		const size_t capacity = _data->span_capacity == 0 ? IDAT_SPANS_MIN : 2 * _data->span_capacity;
+		png_span_s* spans = decoder_alloc(_decoder, capacity * sizeof(png_span_s), _Alignof(png_span_s));
+		if(spans == NULL) {
+			LOG_ERRNO(LOG_ERROR, "could not allocate room for %zu IDAT payloads", capacity);
+			//zlib stream never got any of it, so it ends up empty and the image incomplete
+			_data->gathered		   = false;
+			_data->stream_finished = true;
+			return _size;
+		}
+		if(_data->span_count > 0) {
+			memcpy(spans, _data->spans, _data->span_count * sizeof(png_span_s));
+		}
+		decoder_free(_decoder, _data->spans);
+		_data->spans		 = spans;
+		_data->span_capacity = capacity;
+	}
+	_data->spans[_data->span_count++] = (png_span_s){.data = _input, .size = _size};
+	return _size;
+}
+
+static const bool inflate_whole(png_decoder_s* _decoder, data_chunk_s* _data, const png_span_s* _spans, const size_t _span_count)
+{
+	//output is all the scanlines, so the inflater never needs a window of its own
+	const png_inflater_s* inflater	 = &(_decoder->options.inflater);
+	const png_inflate_fn  inflate_fn = inflater->inflate != NULL ? inflater->inflate : png_inflate_builtin;
+	LOG(LOG_DEBUG_1, "inflating %zu pieces of compressed data in one go", _span_count);
+	_data->stream_initialized = false;
+	return inflate_fn(inflater->user, _spans, _span_count, _data->scanlines, _data->scanlines_size);
+}
+
+static const bool preprocess(png_decoder_s* _decoder, const header_chunk_s* _header, data_chunk_s* _data, png_external_context_s* _ret_ctx)
+{
+	//according to specs each line of data is prepended with a filter type byte
 	//and then padded to line it up to a byte boundary
-	//this means we need to first divide it into lines, then subtract 1 byte
-	//from the beggining of each line and later subtract from the end whatever
-	//was added to line it up
+	//filters are reversed in place, top to bottom, since every row is predicted
+	//from the already reconstructed row above it (and from the pixel to the left)
+	//rows of the region are converted to the output format right after, while they are still in cache
 
+	assert(_header	!= NULL);
 	assert(_data	!= NULL);
 	assert(_ret_ctx != NULL);
 	assert(_ret_ctx->height > 0);
 	assert(_ret_ctx->width	> 0);
+	//adam7 images never get here, their passes are put in place as they come in
+	ASSERT_AND_FLUSH(_header->interlace_method == 0);
+
+	if(_ret_ctx->pixels == NULL && !allocate_pixels(_decoder, _header, _ret_ctx)) {
+		return false;
+	}
+	if(_data->unfiltered) {
+		//parallel inflate already reconstructed and converted every row
+		return true;
+	}
+
+	const size_t  bits_per_pixel  = (size_t)get_channels(_header->color_type) * _header->bit_depth;
+	//filters operate on whole bytes - sub byte pixels use the previous byte
+	const uint8_t bytes_per_pixel = bits_per_pixel < 8 ? 1 : bits_per_pixel / 8;
+	const size_t  row_size		  = ((size_t)_header->width * bits_per_pixel + 7) / 8;
+	const png_region_s* region	  = &(_decoder->internal_context.region);
+
+	//first row has nothing above it
+	if(!ensure_zero_row(_decoder, row_size)) {
+		return false;
+	}
+	const uint8_t* prev = _decoder->zero_row;
+	uint8_t* scanline	= _data->scanlines;
+	const png_stage_e outer = _decoder->stage;
+	//rows below the region are not needed by anything
+	for(size_t y = 0; y < (size_t)region->y + region->height; ++y) {
+		const uint8_t filter_type = scanline[0];
+		uint8_t* row = scanline + 1;
+		(void)stats_enter(_decoder, PNG_STAGE_UNFILTER);
+		if(!unfilter_row(filter_type, row, prev, row_size, bytes_per_pixel)) {
+			LOG(LOG_ERROR, "invalid filter type %d in row %zu", filter_type, y);
+			(void)stats_enter(_decoder, outer);
+			return false;
+		}
+		stats_unfiltered(_decoder, filter_type);
+		if(y >= region->y) {
+			png_convert_row(&(_decoder->internal_context.converter), row, PNG_ROW(_ret_ctx, y - region->y), region->x, region->width);
+		}
+		prev = row;
+		scanline += row_size + 1;
+	}
+	(void)stats_enter(_decoder, outer);
+	return true;
+}
+
+static const bool allocate_pixels(png_decoder_s* _decoder, const header_chunk_s* _header, png_external_context_s* _ret_ctx)
+{
+	_ret_ctx->format			= get_output_format(_decoder);
+	if(!png_format_valid(_ret_ctx->format)) {
+		LOG(LOG_ERROR, "unknown output format %d", _ret_ctx->format);
+		return false;
+	}
+	_ret_ctx->channels			= png_format_channels(_ret_ctx->format, _header->color_type);
+	_ret_ctx->bytes_per_channel = png_format_bytes_per_channel(_ret_ctx->format, _header->bit_depth);
+	_ret_ctx->rows				= NULL;
+
+	if(_decoder->output_requested) {
+		//rows are converted straight into the caller's memory - nothing of the result's pixels is ever allocated
+		const png_output_s* output = &(_decoder->output);
+		const size_t row_bytes	   = (size_t)_ret_ctx->width * _ret_ctx->channels * _ret_ctx->bytes_per_channel;
+		const bool fits = output->pixels != NULL && output->stride >= row_bytes && output->size >= row_bytes &&
+						  (size_t)(_ret_ctx->height - 1) <= (output->size - row_bytes) / output->stride;
+		if(!fits) {
+			LOG(LOG_ERROR, "%ux%u pixels of %zu bytes per row do not fit in an output of %zu bytes with a stride of %zu",
+					_ret_ctx->width, _ret_ctx->height, row_bytes, output->size, output->stride);
+			return false;
+		}
+		if((uintptr_t)output->pixels % _ret_ctx->bytes_per_channel != 0 || output->stride % _ret_ctx->bytes_per_channel != 0) {
+			LOG(LOG_ERROR, "output pixels and stride have to be aligned to %d bytes", _ret_ctx->bytes_per_channel);
+			return false;
+		}
+		_ret_ctx->stride		  = output->stride;
+		_ret_ctx->pixels		  = output->pixels;
+		_ret_ctx->pixels_borrowed = true;
+		return true;
+	}
+
+	_ret_ctx->stride			= get_output_stride(_header, _ret_ctx->format, _ret_ctx->width);
+
+	_ret_ctx->pixels = decoder_alloc(_decoder, _ret_ctx->stride * _ret_ctx->height, PNG_ROW_ALIGNMENT);
+	if(_ret_ctx->pixels == NULL) {
+		LOG_ERRNO(LOG_ERROR, "could not allocate %zu bytes for pixels", _ret_ctx->stride * _ret_ctx->height);
+		return false;
+	}
+	return true;
+}
+
+static png_external_context_s* allocate_result(png_decoder_s* _decoder)
+{
+	png_external_context_s* ret_ctx = decoder_alloc(_decoder, sizeof(png_external_context_s), _Alignof(png_external_context_s));
+	if(ret_ctx == NULL) {
+		LOG_ERRNO(LOG_ERROR, "could not allocate result");
+		return NULL;
+	}
+	memset(ret_ctx, 0, sizeof(png_external_context_s));
+	ret_ctx->allocator = _decoder->options.use_arena ? png_arena_allocator(&(_decoder->arena)) : _decoder->allocator;
+	ret_ctx->x		= _decoder->internal_context.region.x;
+	ret_ctx->y		= _decoder->internal_context.region.y;
+	ret_ctx->width	= _decoder->internal_context.region.width;
+	ret_ctx->height = _decoder->internal_context.region.height;
+	return ret_ctx;
+}
+
+static const bool ensure_zero_row(png_decoder_s* _decoder, const size_t _size)
+{
+	if(_decoder->zero_row_capacity >= _size) {
+		return true;
+	}
+	decoder_free(_decoder, _decoder->zero_row);
+	_decoder->zero_row			= decoder_alloc(_decoder, _size, PNG_ROW_ALIGNMENT);
+	_decoder->zero_row_capacity = _decoder->zero_row == NULL ? 0 : _size;
+	if(_decoder->zero_row == NULL) {
+		LOG_ERRNO(LOG_ERROR, "could not allocate empty row");
+		return false;
+	}
+	memset(_decoder->zero_row, 0, _size);
+	return true;
+}
+
+////////////////////////// pipelined reconstruction
+static const bool start_pipeline(png_decoder_s* _decoder, data_chunk_s* _data, const header_chunk_s* _header)
+{
+	//everything the serial path allocates after IEND is needed up front here - rows are written out while inflating
+	const size_t  bits_per_pixel  = (size_t)get_channels(_header->color_type) * _header->bit_depth;
+	const uint8_t bytes_per_pixel = bits_per_pixel < 8 ? 1 : bits_per_pixel / 8;
+	const size_t  row_size		  = ((size_t)_header->width * bits_per_pixel + 7) / 8;
+
+	size_t ring_size = PIPELINE_RING_SIZE > PIPELINE_MIN_ROWS * (row_size + 1) ? PIPELINE_RING_SIZE : PIPELINE_MIN_ROWS * (row_size + 1);
+	ring_size = ring_size < _data->scanlines_size ? ring_size : _data->scanlines_size;
+	if(ring_size < 2 * (row_size + 1) || !ensure_zero_row(_decoder, row_size)) {
+		return false;
+	}
+	if(_data->scanlines_capacity < ring_size) {
+		decoder_free(_decoder, _data->scanlines);
+		_data->scanlines		  = decoder_alloc(_decoder, ring_size, PNG_ROW_ALIGNMENT);
+		_data->scanlines_capacity = _data->scanlines == NULL ? 0 : ring_size;
+		if(_data->scanlines == NULL) {
+			LOG_ERRNO(LOG_ERROR, "could not allocate %zu bytes for scanline ring", ring_size);
+			return false;
+		}
+	}
+
+	_decoder->result = allocate_result(_decoder);
+	if(_decoder->result == NULL || !allocate_pixels(_decoder, _header, _decoder->result)) {
+		free_decoded_png(_decoder->result);
+		_decoder->result = NULL;
+		return false;
+	}
+
+	if(!png_pipeline_start(&(_data->pipeline), _data->scanlines, ring_size, row_size, _header->height, bytes_per_pixel,
+				_decoder->zero_row, convert_sink, _decoder, _decoder->options.stats)) {
+		LOG(LOG_WARNING, "falling back to serial reconstruction");
+		free_decoded_png(_decoder->result);
+		_decoder->result = NULL;
+		return false;
+	}
+	return true;
+}
+
+static const bool next_pipeline_region(data_chunk_s* _data)
+{
+	//inflate never gets more than the image is supposed to have, so an oversized stream still ends in Z_BUF_ERROR
+	z_stream* strm = &(_data->stream);
+	const size_t left = _data->scanlines_size - strm->total_out;
+	if(left == 0) {
+		return true;
+	}
+	size_t size;
+	uint8_t* region = png_pipeline_acquire(&(_data->pipeline), &size);
+	if(region == NULL) {
+		return false;
+	}
+	strm->next_out		= region;
+	strm->avail_out		= size < left ? size : left;
+	_data->region_start = region;
+	return true;
+}
+
+static void convert_sink(void* _decoder, const size_t _y, const uint8_t* _row)
+{
+	//runs on the reconstruct thread, or on any of the parallel inflate ones - every row only ever goes to its own place
+	//in the result, and nothing else touches it until they are joined
+	png_decoder_s* decoder	   = _decoder;
+	const png_region_s* region = &(decoder->internal_context.region);
+	if(_y < region->y || _y >= (size_t)region->y + region->height) {
+		return;
+	}
+	png_convert_row(&(decoder->internal_context.converter), _row, PNG_ROW(decoder->result, _y - region->y), region->x, region->width);
+}
+
+static void abandon_image(png_decoder_s* _decoder)
+{
+	//rows may already be going into a result that is never going to be handed out
+	data_chunk_s* idat = &(_decoder->internal_context.idat);
+	if(idat->pipelined) {
+		png_pipeline_abort(&(idat->pipeline));
+		idat->pipelined = false;
+	}
+	free_decoded_png(_decoder->result);
+	_decoder->result = NULL;
+}
+
+////////////////////////// region decode
+static const bool start_row_stream(png_decoder_s* _decoder, data_chunk_s* _data, const header_chunk_s* _header)
+{
+	//rows are reconstructed in a window that slides down the image, so scratch does not depend on the height
+	const size_t bits_per_pixel = (size_t)get_channels(_header->color_type) * _header->bit_depth;
+	const size_t stride			= ((size_t)_header->width * bits_per_pixel + 7) / 8 + 1;
+
+	size_t window_size = ROW_WINDOW_SIZE > ROW_WINDOW_MIN_ROWS * stride ? ROW_WINDOW_SIZE : ROW_WINDOW_MIN_ROWS * stride;
+	window_size = window_size < _data->scanlines_size ? window_size : _data->scanlines_size;
+	if(!ensure_zero_row(_decoder, stride - 1)) {
+		return false;
+	}
+	if(_data->scanlines_capacity < window_size) {
+		decoder_free(_decoder, _data->scanlines);
+		_data->scanlines		  = decoder_alloc(_decoder, window_size, PNG_ROW_ALIGNMENT);
+		_data->scanlines_capacity = _data->scanlines == NULL ? 0 : window_size;
+		if(_data->scanlines == NULL) {
+			LOG_ERRNO(LOG_ERROR, "could not allocate %zu bytes for scanline window", window_size);
+			return false;
+		}
+	}
+
+	//output only ever covers the region
+	_decoder->result = allocate_result(_decoder);
+	if(_decoder->result == NULL || !allocate_pixels(_decoder, _header, _decoder->result)) {
+		free_decoded_png(_decoder->result);
+		_decoder->result = NULL;
+		return false;
+	}
+	_data->rows_done   = 0;
+	_data->row_start   = 0;
+	_data->rows_failed = false;
+	return true;
+}
 
-	_ret_ctx->pixels = malloc(sizeof(uint8_t) * _ret_ctx->height);
-	for(int i = 0; i < _ret_ctx->height; ++i) {
-		*(_ret_ctx->pixels + i) = malloc(sizeof(uint8_t) * _ret_ctx->width);
+static void slide_row_window(png_decoder_s* _decoder, data_chunk_s* _data)
+{
+	//keeps the last reconstructed row - it is prev of the next one - and whatever part of the next row is already in
+	const header_chunk_s* header = &(_decoder->internal_context.ihdr);
+	const size_t stride	 = ((size_t)header->width * get_channels(header->color_type) * header->bit_depth + 7) / 8 + 1;
+	z_stream* strm		 = &(_data->stream);
+	const size_t written = strm->next_out - _data->scanlines;
+	const size_t keep	 = _data->rows_done == 0 ? _data->row_start : _data->row_start - stride;
+
+	memmove(_data->scanlines, _data->scanlines + keep, written - keep);
+	_data->row_start -= keep;
+	const size_t space = _data->scanlines_capacity - (written - keep);
+	const size_t left  = _data->scanlines_size - strm->total_out;
+	strm->next_out	= _data->scanlines + (written - keep);
+	strm->avail_out = space < left ? space : left;
+}
+
+static const bool reconstruct_rows(png_decoder_s* _decoder, data_chunk_s* _data)
+{
+	const header_chunk_s* header = &(_decoder->internal_context.ihdr);
+	const png_region_s*	  region = &(_decoder->internal_context.region);
+	const size_t  bits_per_pixel  = (size_t)get_channels(header->color_type) * header->bit_depth;
+	const uint8_t bytes_per_pixel = bits_per_pixel < 8 ? 1 : bits_per_pixel / 8;
+	const size_t  row_size		  = ((size_t)header->width * bits_per_pixel + 7) / 8;
+	const size_t  end_row		  = (size_t)region->y + region->height;
+	const size_t  written		  = _data->stream.next_out - _data->scanlines;
+	const size_t  first_row		  = _data->rows_done > region->y ? _data->rows_done : region->y;
+
+	const png_stage_e outer = _decoder->stage;
+	while(_data->rows_done < end_row && written - _data->row_start >= row_size + 1) {
+		uint8_t* scanline	= _data->scanlines + _data->row_start;
+		const uint8_t* prev = _data->rows_done == 0 ? _decoder->zero_row : scanline - row_size;
+		(void)stats_enter(_decoder, PNG_STAGE_UNFILTER);
+		if(!unfilter_row(scanline[0], scanline + 1, prev, row_size, bytes_per_pixel)) {
+			LOG(LOG_ERROR, "invalid filter type %d in row %zu", scanline[0], _data->rows_done);
+			(void)stats_enter(_decoder, outer);
+			_data->rows_failed = true;
+			return false;
+		}
+		stats_unfiltered(_decoder, scanline[0]);
+		if(_data->rows_done >= region->y) {
+			png_convert_row(&(_decoder->internal_context.converter), scanline + 1, PNG_ROW(_decoder->result, _data->rows_done - region->y), region->x, region->width);
+		}
+		++_data->rows_done;
+		_data->row_start += row_size + 1;
+	}
+	(void)stats_enter(_decoder, outer);
+	if(_decoder->options.on_rows != NULL && _data->rows_done > first_row) {
+		_decoder->options.on_rows(_decoder->options.on_rows_user, first_row - region->y, _data->rows_done - first_row, _decoder->result);
 	}
+	return true;
+}
 
-	for(int i = 0; i < _ret_ctx->height; ++i) {
-		asm("nop");
+static const bool rows_complete(const png_decoder_s* _decoder)
+{
+	const data_chunk_s* idat	 = &(_decoder->internal_context.idat);
+	const png_region_s* region = &(_decoder->internal_context.region);
+	return idat->rows_streamed && idat->rows_done == (size_t)region->y + region->height;
+}
+
+static const bool region_done(const png_decoder_s* _decoder)
+{
+	//only region decodes stop right after their last row - whole images still have the end of the stream
+	//and every crc checked, however their rows got reconstructed
+	return _decoder->region_requested && rows_complete(_decoder);
+}
+
+////////////////////////// adam7
+static const bool start_passes(png_decoder_s* _decoder, data_chunk_s* _data, const header_chunk_s* _header)
+{
+	const size_t bits_per_pixel = (size_t)get_channels(_header->color_type) * _header->bit_depth;
+	if(!ensure_zero_row(_decoder, ((size_t)_header->width * bits_per_pixel + 7) / 8)) {
+		return false;
 	}
-	LOG(LOG_ERROR, "unfinished code part");
 
+	//output only ever covers the region, same as for plain images
+	_decoder->result = allocate_result(_decoder);
+	if(_decoder->result == NULL || !allocate_pixels(_decoder, _header, _decoder->result)) {
+		free_decoded_png(_decoder->result);
+		_decoder->result = NULL;
+		return false;
+	}
+
+	//passes whose pixels are not next to each other in the output are expanded into pass_pixels first - one row at
+	//a time that stays in l1, or the whole pass when the callback is going to look at it
+	const png_external_context_s* result = _decoder->result;
+	const size_t pixel_size = (size_t)result->channels * result->bytes_per_channel;
+	size_t needed = 0;
+	for(uint pass = 0; pass < ADAM7_PASSES; ++pass) {
+		size_t first_x, width, first_y, height;
+		if(adam7_step_x[pass] == 1 || !get_pass_window(_decoder, pass, &first_x, &width, &first_y, &height)) {
+			continue;
+		}
+		const size_t stride = (width * pixel_size + PNG_ROW_ALIGNMENT - 1) & ~((size_t)PNG_ROW_ALIGNMENT - 1);
+		const size_t size	= _decoder->options.on_pass != NULL ? stride * height : stride;
+		needed = size > needed ? size : needed;
+	}
+	if(_decoder->pass_pixels_capacity < needed) {
+		decoder_free(_decoder, _decoder->pass_pixels);
+		_decoder->pass_pixels		   = decoder_alloc(_decoder, needed, PNG_ROW_ALIGNMENT);
+		_decoder->pass_pixels_capacity = _decoder->pass_pixels == NULL ? 0 : needed;
+		if(_decoder->pass_pixels == NULL) {
+			LOG_ERRNO(LOG_ERROR, "could not allocate %zu bytes for adam7 passes", needed);
+			return false;
+		}
+	}
+	_data->passes_done = 0;
+	_data->pass_start  = 0;
+	_data->rows_failed = false;
+	return true;
+}
+
+static const bool reconstruct_passes(png_decoder_s* _decoder, data_chunk_s* _data, const size_t _inflated)
+{
+	//every pass that is inflated as a whole by now, in order - pass n + 1 starts right where pass n ends
+	const header_chunk_s* header = &(_decoder->internal_context.ihdr);
+	const size_t bits_per_pixel	 = (size_t)get_channels(header->color_type) * header->bit_depth;
+	while(!_data->rows_failed && _data->passes_done < ADAM7_PASSES) {
+		size_t pass_width, pass_height;
+		get_pass_size(header, _data->passes_done, &pass_width, &pass_height);
+		const size_t pass_size = pass_width == 0 || pass_height == 0 ? 0 : pass_height * ((pass_width * bits_per_pixel + 7) / 8 + 1);
+		if(_data->pass_start + pass_size > _inflated) {
+			break;
+		}
+		if(!reconstruct_pass(_decoder, _data->passes_done, _data->scanlines + _data->pass_start)) {
+			_data->rows_failed = true;
+			break;
+		}
+		_data->pass_start += pass_size;
+		++_data->passes_done;
+	}
+	return !_data->rows_failed;
+}
+
+static const bool reconstruct_pass(png_decoder_s* _decoder, const uint _pass, uint8_t* _scanlines)
+{
+	const header_chunk_s* header = &(_decoder->internal_context.ihdr);
+	const png_region_s*	  region = &(_decoder->internal_context.region);
+	png_external_context_s* result = _decoder->result;
+	const size_t  bits_per_pixel  = (size_t)get_channels(header->color_type) * header->bit_depth;
+	const uint8_t bytes_per_pixel = bits_per_pixel < 8 ? 1 : bits_per_pixel / 8;
+
+	size_t pass_width, pass_height;
+	get_pass_size(header, _pass, &pass_width, &pass_height);
+	size_t first_x, width, first_y, height;
+	if(!get_pass_window(_decoder, _pass, &first_x, &width, &first_y, &height)) {
+		//nothing of this pass lands in the region - still has to be inflated, but not even unfiltered
+		return true;
+	}
+
+	//every row of the window is converted and scattered right after it is unfiltered, while it is still in cache -
+	//in the last pass pixels are already next to each other, so its rows are converted right into the result
+	//rows below the region are not needed by anything
+	const size_t row_size	= (pass_width * bits_per_pixel + 7) / 8;
+	const size_t pixel_size	= (size_t)result->channels * result->bytes_per_channel;
+	const size_t step_x		= adam7_step_x[_pass];
+	const size_t out_x		= adam7_start_x[_pass] + first_x * step_x - region->x;
+	const size_t out_y		= adam7_start_y[_pass] + first_y * adam7_step_y[_pass] - region->y;
+	const bool	 keep_pass	= _decoder->options.on_pass != NULL;
+	const size_t tight_stride = (width * pixel_size + PNG_ROW_ALIGNMENT - 1) & ~((size_t)PNG_ROW_ALIGNMENT - 1);
+	const png_converter_s* converter = &(_decoder->internal_context.converter);
+	const uint8_t* prev = _decoder->zero_row;
+	uint8_t* scanline	= _scanlines;
+	const png_stage_e outer = _decoder->stage;
+	for(size_t y = 0; y < first_y + height; ++y) {
+		uint8_t* row = scanline + 1;
+		(void)stats_enter(_decoder, PNG_STAGE_UNFILTER);
+		if(!unfilter_row(scanline[0], row, prev, row_size, bytes_per_pixel)) {
+			LOG(LOG_ERROR, "invalid filter type %d in row %zu of pass %d", scanline[0], y, _pass);
+			(void)stats_enter(_decoder, outer);
+			return false;
+		}
+		stats_unfiltered(_decoder, scanline[0]);
+		prev = row;
+		scanline += row_size + 1;
+		if(y >= first_y) {
+			uint8_t* dst = PNG_ROW(result, out_y + (y - first_y) * adam7_step_y[_pass]) + out_x * pixel_size;
+			if(step_x == 1) {
+				png_convert_row(converter, row, dst, first_x, width);
+			} else {
+				uint8_t* tight = _decoder->pass_pixels + (keep_pass ? (y - first_y) * tight_stride : 0);
+				png_convert_row(converter, row, tight, first_x, width);
+				scatter_pixels(tight, dst, width, pixel_size, step_x * pixel_size);
+			}
+		}
+	}
+	(void)stats_enter(_decoder, outer);
+
+	if(keep_pass) {
+		//the last pass is looked at straight in the result, every other row of it
+		png_external_context_s preview = {
+			.width	= width,
+			.height = height,
+			.x		= first_x,
+			.y		= first_y,
+			.format			   = result->format,
+			.channels		   = result->channels,
+			.bytes_per_channel = result->bytes_per_channel,
+			.stride = step_x == 1 ? adam7_step_y[_pass] * result->stride : tight_stride,
+			.pixels = step_x == 1 ? PNG_ROW(result, out_y) + out_x * pixel_size : _decoder->pass_pixels,
+		};
+		_decoder->options.on_pass(_decoder->options.on_pass_user, _pass, &preview, result);
+	}
+	return true;
+}
+
+static const bool get_pass_window(const png_decoder_s* _decoder, const uint _pass, size_t* _first_x, size_t* _width, size_t* _first_y, size_t* _height)
+{
+	//part of the pass grid that falls into the region - false when there is none
+	const png_region_s* region = &(_decoder->internal_context.region);
+	size_t pass_width, pass_height;
+	get_pass_size(&(_decoder->internal_context.ihdr), _pass, &pass_width, &pass_height);
+
+	//first pass pixel at or after _from - pass pixel i sits at start + i * step
+#define FIRST_AT(_from, _start, _step) ((_from) > (_start) ? ((size_t)(_from) - (_start) + (_step) - 1) / (_step) : 0)
+	const size_t x0 = FIRST_AT(region->x, adam7_start_x[_pass], adam7_step_x[_pass]);
+	const size_t y0 = FIRST_AT(region->y, adam7_start_y[_pass], adam7_step_y[_pass]);
+	size_t x1 = FIRST_AT((size_t)region->x + region->width,  adam7_start_x[_pass], adam7_step_x[_pass]);
+	size_t y1 = FIRST_AT((size_t)region->y + region->height, adam7_start_y[_pass], adam7_step_y[_pass]);
+#undef FIRST_AT
+	x1 = x1 < pass_width  ? x1 : pass_width;
+	y1 = y1 < pass_height ? y1 : pass_height;
+	if(x0 >= x1 || y0 >= y1) {
+		return false;
+	}
+	*_first_x = x0;
+	*_width	  = x1 - x0;
+	*_first_y = y0;
+	*_height  = y1 - y0;
+	return true;
+}
+
+static const void scatter_pixels(const uint8_t* _src, uint8_t* _dst, const size_t _count, const size_t _pixel_size, const size_t _dst_step)
+{
+	//every output pixel size gets its own loop, so the copies turn into plain loads and stores
+#define SCATTER(_size) for(size_t i = 0; i < _count; ++i) { memcpy(_dst + i * _dst_step, _src + i * (_size), (_size)); } break
+	switch(_pixel_size) {
+		case 1: SCATTER(1);
+		case 2: SCATTER(2);
+		case 3: SCATTER(3);
+		case 4: SCATTER(4);
+		case 6: SCATTER(6);
+		case 8: SCATTER(8);
+		default: {
+			LOG(LOG_ERROR, "unexpected pixel size: %zu", _pixel_size);
+			ASSERT_AND_FLUSH(0);
+		}
+	}
+#undef SCATTER
+}
+
+static void* decoder_alloc(png_decoder_s* _decoder, const size_t _size, const size_t _alignment)
+{
+	//every per image allocation goes through here - either a bump in the arena or a call to the caller's allocator
+	if(_decoder->options.stats != NULL) {
+		++_decoder->options.stats->allocations;
+		_decoder->options.stats->allocated_bytes += _size;
+	}
+	if(_decoder->options.use_arena) {
+		return png_arena_alloc(&(_decoder->arena), _size, _alignment);
+	}
+	return _decoder->allocator.alloc(_decoder->allocator.user, _size, _alignment);
+}
+
+static void decoder_free(png_decoder_s* _decoder, void* _ptr)
+{
+	if(_ptr == NULL || _decoder->options.use_arena) {
+		return;
+	}
+	_decoder->allocator.free(_decoder->allocator.user, _ptr);
+}
+
+static voidpf zlib_alloc(voidpf _opaque, uInt _items, uInt _size)
+{
+	return decoder_alloc((png_decoder_s*)_opaque, (size_t)_items * _size, sizeof(max_align_t));
+}
+
+static void zlib_free(voidpf _opaque, voidpf _ptr)
+{
+	decoder_free((png_decoder_s*)_opaque, _ptr);
+}
+
+
+////////////////////////// stats
+static void stats_begin(png_decoder_s* _decoder)
+{
+	if(_decoder->options.stats != NULL) {
+		memset(_decoder->options.stats, 0, sizeof(png_stats_s));
+	}
+}
+
+static void stats_resume(png_decoder_s* _decoder)
+{
+	//push decodes come through here with every png_feed() - time between them is not the decoder's
+	if(_decoder->options.stats == NULL) {
+		return;
+	}
+	_decoder->stage			= PNG_STAGE_WALK;
+	_decoder->stage_started = png_cycles();
+	_decoder->walk_started	= _decoder->stage_started;
+}
+
+static void stats_pause(png_decoder_s* _decoder, const png_external_context_s* _result)
+{
+	png_stats_s* stats = _decoder->options.stats;
+	if(stats == NULL) {
+		return;
+	}
+	(void)stats_enter(_decoder, PNG_STAGE_WALK);
+	png_stats_add(&(stats->total_cycles), _decoder->stage_started - _decoder->walk_started);
+	if(_result != NULL) {
+		stats->bytes_out += (uint64_t)_result->height * _result->width * _result->channels * _result->bytes_per_channel;
+	}
+
+	//scratch buffers only ever grow, so whatever they are now is the most they held
+	const data_chunk_s* idat = &(_decoder->internal_context.idat);
+	const size_t scratch = _decoder->options.use_arena ? _decoder->arena.peak :
+						   idat->scanlines_capacity + idat->compressed_capacity + idat->span_capacity * sizeof(png_span_s) +
+						   _decoder->zero_row_capacity + _decoder->pass_pixels_capacity + _decoder->input_window_capacity;
+	stats->peak_scratch = scratch > stats->peak_scratch ? scratch : stats->peak_scratch;
+}
+
+static inline png_stage_e stats_enter(png_decoder_s* _decoder, const png_stage_e _stage)
+{
+	//time since the last switch goes to the stage that was running - which is handed back, so it can be returned to
+	const png_stage_e previous = _decoder->stage;
+	png_stats_s* stats = _decoder->options.stats;
+	if(stats == NULL) {
+		return previous;
+	}
+	const uint64_t now = png_cycles();
+	png_stats_add(&(stats->cycles[previous]), now - _decoder->stage_started);
+	_decoder->stage			= _stage;
+	_decoder->stage_started = now;
+	return previous;
+}
+
+static inline void stats_unfiltered(png_decoder_s* _decoder, const uint8_t _filter_type)
+{
+	//row was just unfiltered - its time goes to its filter type as well, and converting it comes next
+	png_stats_s* stats = _decoder->options.stats;
+	if(stats == NULL) {
+		return;
+	}
+	const uint64_t now = png_cycles();
+	png_stats_row(stats, _filter_type, now - _decoder->stage_started, 0);
+	_decoder->stage			= PNG_STAGE_CONVERT;
+	_decoder->stage_started = now;
 }
 
 
-#undef GET_TOKEN_NAME
-#undef MAGIC_NUM_LEN
-#undef PNG_MAGIC_NUMBER
-#undef CRC_LEN
+#undef INPUT_WINDOW_SIZE
+#undef PUSH_WINDOW_SIZE
+#undef IDAT_DUMP_LEN
+#undef PIPELINE_MIN_SIZE
+#undef PARALLEL_MIN_SIZE
+#undef PIPELINE_RING_SIZE
+#undef PIPELINE_MIN_ROWS
+#undef ROW_WINDOW_SIZE
+#undef ROW_WINDOW_MIN_ROWS
+#undef IDAT_SPANS_MIN
+#undef AS_HEX_AHEAD
+#undef IHDR_LEN
+#undef ADAM7_PASSES
 #undef AS_HEX
 #undef AS_HEX_ARR
 #undef AS_HEX_N
@@ -7,28 +7,60 @@
 #include <assert.h>
 #include <stdbool.h>
 #include "logger.h"
+#include "zlib.h"
 
 
 //////////////////////////custom includes
-#include "../../std_lib/allocators/arena.h"
+#include "png_arena.h"
+#include "png_pipeline.h"
+#include "png_palette.h"
+#include "png_convert.h"
+#include "png_inflate.h"
+#include "png_stats.h"
+
+////////////////////////// defines
+//every row of output starts on this boundary, so rows can be fed straight to simd code
+#define PNG_ROW_ALIGNMENT 64
+#define PNG_ROW(_ctx, _y) ((_ctx)->pixels + (size_t)(_y) * (_ctx)->stride)
+//chunk type as the big endian number its four letters make - a whole type is compared or switched on in one go
+#define PNG_CHUNK_TYPE(_a, _b, _c, _d) (((uint32_t)(_a) << 24) | ((uint32_t)(_b) << 16) | ((uint32_t)(_c) << 8) | (uint32_t)(_d))
+//bit 5 of the first letter (lowercase) - a decoder may skip ancillary chunks it does not know, but not critical ones
+#define PNG_CHUNK_ANCILLARY(_type) (((_type) & (1u << 29)) != 0)
 
 ////////////////////////// typedefs
 typedef unsigned uint;
 
 typedef enum {
+	//chunks the decoder handles itself - every token is the PNG_CHUNK_TYPE() of its chunk, so the type read from
+	//a chunk header is switched on as it is, and any other type goes to options.chunk_handlers or gets skipped
 	//state initialization
 	TOK_INIT = 0,
 	//critical headers
-	TOK_IHDR,
-	TOK_PLTE,
-	TOK_IDAT,
-	TOK_IEND,
-	//ancillary headers
-	//we dont need them for now, but can still parse them
-	TOK_BKGD,
-	TOK_PHYS,
+	TOK_IHDR = PNG_CHUNK_TYPE('I', 'H', 'D', 'R'),
+	TOK_PLTE = PNG_CHUNK_TYPE('P', 'L', 'T', 'E'),
+	TOK_IDAT = PNG_CHUNK_TYPE('I', 'D', 'A', 'T'),
+	TOK_IEND = PNG_CHUNK_TYPE('I', 'E', 'N', 'D'),
+	//ancillary headers - the rest of them (bKGD, pHYs, text...) go to handlers or get skipped
+	TOK_TRNS = PNG_CHUNK_TYPE('t', 'R', 'N', 'S'),
 } token_e;
 
+typedef enum {
+	//where the chunk walk currently is - one iteration of the loop moves it by one step
+	WALK_SIGNATURE = 0,
+	WALK_CHUNK_HEADER,
+	WALK_CHUNK_DATA,
+	WALK_CHUNK_CRC,
+	WALK_FINISHED,
+	WALK_FAILED,
+} walk_state_e;
+
+typedef enum {
+	//which chunks get their crc checked
+	CRC_VERIFY_ALL = 0,		//default - for input we do not trust
+	CRC_VERIFY_CRITICAL,	//only chunks with the critical bit set (uppercase first letter)
+	CRC_SKIP,				//trusted input - crc bytes are just stepped over
+} crc_policy_e;
+
 typedef struct {
 	uint8_t r, g, b;
 } colour_s;
@@ -39,13 +71,52 @@ typedef struct {
 } header_chunk_s;
 
 typedef struct {
-	uint	  actual_size;
-	colour_s* colour_array;
+	//part of the image to decode - rows above it are still inflated and reconstructed, since every row
+	//depends on the one above, but nothing below it is ever read
+	uint x, y;
+	uint width, height;
+} png_region_s;
+
+typedef struct {
+	uint	 actual_size;
+	colour_s colour_array[256];	//spec caps the palette at 256 entries, so no need to allocate it
+	uint	 alpha_size;		//entries tRNS gave an alpha to, the rest stay opaque
+	png_palette_lut_s lut;		//what indexed pixels expand to
+	bool	 has_colour_key;	//tRNS of grey and rgb images - pixels of exactly this colour are transparent
+	uint16_t colour_key[3];		//as stored, grey only uses the first one
 } palette_chunk_s;
 
 typedef struct {
-	uint32_t actual_size;
-	uint8_t* data;
+	//single inflate stream kept alive across all IDAT chunks - each chunk payload
+	//is fed to it in place and the output lands directly in the scanline buffer
+	z_stream stream;
+	bool	 stream_allocated;		//inflate state outlives a single image - between images it is only reset
+	bool	 stream_initialized;	//IHDR was seen and the stream accepts IDAT payloads
+	bool	 stream_finished;
+	uint8_t* scanlines;				//filtered scanlines (filter byte + row), sized from IHDR
+	size_t	 scanlines_size;
+	size_t	 scanlines_capacity;	//scratch kept between images - it only ever grows
+	bool	 pipelined;				//scanlines is only a ring of rows and the reconstruct thread drains it
+	png_pipeline_s pipeline;
+	uint8_t* region_start;			//start of the ring region inflate is currently writing to
+	bool	 deferred;				//IDAT payloads are only collected here - the whole stream is inflated after IEND
+	bool	 gathered;				//in memory input - only where IDAT payloads are gets recorded, and options.inflater
+									//inflates them in one go after IEND, straight from the input
+	png_span_s* spans;
+	size_t	 span_count;
+	size_t	 span_capacity;			//scratch kept between images - it only ever grows
+	uint8_t* compressed;
+	size_t	 compressed_size;
+	size_t	 compressed_capacity;	//scratch kept between images - it only ever grows
+	bool	 unfiltered;			//scanlines were already reconstructed along with inflating
+	bool	 rows_streamed;			//region decode - scanlines is a small window and rows are reconstructed as soon as they are inflated
+	bool	 rows_failed;
+	size_t	 rows_done;
+	size_t	 row_start;				//offset in scanlines of the first row that is not reconstructed yet - the one above sits right before it
+	bool	 progressive;			//adam7 - every pass is reconstructed and scattered into the result as soon as it is all inflated
+	uint	 passes_done;
+	size_t	 pass_start;			//offset in scanlines of the first pass that is not reconstructed yet
+	bool	 data_started;			//first IDAT was seen - palette and transparency cannot change anymore
 } data_chunk_s;
 
 typedef struct {
@@ -53,15 +124,174 @@ typedef struct {
 	header_chunk_s	ihdr;
 	palette_chunk_s plte;
 	data_chunk_s	idat;
+	png_region_s	region;		//what actually gets decoded - requested region clipped to IHDR, or the whole image
+	png_converter_s converter;	//reconstructed rows to output pixels - set up at the first IDAT, once PLTE and tRNS are known
 } png_internal_context_s;
 
 typedef struct {
 	//this contains info about which user may care
 	uint width, height;
-	uint8_t** pixels;
+	uint x, y;					//where this sits in the full image - non zero only for region decodes
+	png_format_e format;		//what the pixels are laid out as - channels and bytes_per_channel follow from it
+	uint8_t channels;			//samples per pixel - for the native format straight from the colour type, except indexed images, which come out as rgba
+	uint8_t bytes_per_channel;	//2 for rgba16 and 16 bit native samples, both in host order - 1 otherwise (sub byte samples get unpacked)
+	size_t	stride;				//distance in bytes between starts of consecutive rows
+	uint8_t* pixels;			//single PNG_ROW_ALIGNMENT aligned block of height * stride bytes - or the caller's own memory
+	bool	 pixels_borrowed;	//pixels came from png_decoder_set_output() - free_decoded_png() leaves them alone
+	uint8_t** rows;				//optional row views into pixels - NULL until get_png_rows() is called
+	png_allocator_s allocator;	//what the result was allocated with, free_decoded_png() gives it back here
 } png_external_context_s;
 
+typedef struct {
+	//what png_probe() finds out - header fields as stored in IHDR, the rest derived from them
+	header_chunk_s ihdr;
+	uint8_t channels;			//of the native format
+	uint8_t bytes_per_channel;
+	size_t	decoded_size;		//bytes a whole image decode to the native format allocates for pixels, stride padding included
+	bool	chunks_scanned;		//chunk headers were walked up to the first IDAT - the fields below are only meaningful with it
+	bool	has_plte;
+	bool	has_trns;
+	uint	palette_size;		//entries, 0 without PLTE
+} png_probe_s;
+
+typedef struct {
+	//caller owned destination - final pixels are written here once each and never copied afterwards
+	uint8_t*	 pixels;
+	size_t		 stride;	//distance in bytes between starts of consecutive rows, at least one row of the region in format
+	size_t		 size;		//bytes usable from pixels on - the last row only needs its pixels, not a whole stride
+	png_format_e format;	//takes the place of options.format for decodes into this output
+} png_output_s;
+
+//adam7 progress - called once _pass (0 - 6) is scattered into _image, with _preview holding only the pixels of that pass
+//packed together, so pass 0 is a 1/64 resolution version of the image - its x and y are where it starts in the pass grid
+//both only stay valid during the call, the rest of _image is not written yet
+typedef void (*png_pass_fn)(void* _user, const uint _pass, const png_external_context_s* _preview, const png_external_context_s* _image);
+
+//rows _first to _first + _count - 1 of _image are final - called while the stream is still being inflated, so
+//everything below them is not written yet
+typedef void (*png_rows_fn)(void* _user, const uint _first, const uint _count, const png_external_context_s* _image);
+
+//caller's own handling of a chunk - _data is its whole payload, in place for in memory input, and only valid during
+//the call - returning false fails the decode
+typedef bool (*png_chunk_fn)(void* _user, const uint32_t _type, const uint8_t* _data, const uint32_t _size);
+
+typedef struct {
+	uint32_t	 type;		//PNG_CHUNK_TYPE() of the chunks it wants - IDAT is never handed out, its data is inflated as it comes
+	png_chunk_fn handle;
+	void*		 user;
+} png_chunk_handler_s;
+
+//pull based input - copies up to _size bytes into _buffer and returns how many it copied, 0 means end of input or error
+typedef size_t (*png_read_fn)(void* _user, uint8_t* _buffer, const size_t _size);
+
+typedef struct {
+	//where a streamed decode gets its bytes from - read is NULL when decoding from memory
+	png_read_fn read;
+	void*		user;
+	bool		eof;
+	bool		push;		//bytes come in through png_feed() - running out of them pauses the walk instead of failing it
+	bool		starved;	//push walk stopped until more bytes are fed
+	size_t		needed;		//bytes the paused walk waits for, counting the ones already in the window
+} png_input_s;
+
+typedef enum {
+	//where a push decode is after png_feed()
+	PNG_FEED_MORE = 0,	//every byte fed so far was used, the image needs more of them
+	PNG_FEED_DONE,		//image is complete - png_feed_finish() hands it over, bytes after its end are ignored
+	PNG_FEED_ERROR,
+} png_feed_e;
+
+typedef struct {
+	//knobs set once when the decoder is created - zeroed struct means defaults
+	crc_policy_e	crc_policy;
+	png_allocator_s allocator;	//backing memory for everything - NULL alloc means malloc/free
+	bool			use_arena;	//reset-and-reuse mode: all per image memory is bumped out of one arena that is
+								//rewound at the start of every decode, so results only live until the next decode
+	bool			pipeline;	//large non-interlaced images get unfiltered on a second thread while they are still being inflated
+	uint			inflate_threads;	//above one, large images are inflated on this many threads when the encoder split the
+									//stream with full flushes - capped by png_thread_count(), takes precedence over
+									//pipeline, and needs a thread safe allocator
+	png_format_e	format;		//every image comes out in this - converted row by row right after each row is unfiltered
+	png_inflater_s	inflater;	//whole stream inflate of in memory input - NULL inflate means the built-in one, zlib is
+								//still what streamed, push, pipelined and region decodes inflate with as data comes in
+	png_pass_fn		on_pass;	//optional, only interlaced images have passes
+	void*			on_pass_user;
+	png_rows_fn		on_rows;	//optional, only decodes that reconstruct rows while inflating - push decodes and regions of
+								//non-interlaced images - call it
+	void*			on_rows_user;
+	png_stats_s*	stats;		//optional, every decode fills it in from scratch - without it nothing is counted or timed
+	const png_chunk_handler_s* chunk_handlers;	//optional, chunks the caller opts in to - they are called before the
+									//decoder handles chunks it knows itself, the array has to outlive the decoder
+	uint			chunk_handler_count;
+} png_decoder_options_s;
+
+typedef struct {
+	//everything a single decode touches - use one per thread and reuse it between images
+	png_decoder_options_s options;
+	uint8_t* current_byte;
+	uint8_t* ending_byte;
+	uint8_t* chunk_start;			//type field of the current chunk, or window start once it scrolled past - crc is computed from here
+	uint32_t chunk_crc;				//crc of the part of the current chunk that already left the input window
+	uint8_t	 chunk_type[4];			//kept aside, since streamed input does not keep the chunk header around
+	int32_t	 next_chunk_size;
+	walk_state_e state;
+	uint32_t current_token;			//PNG_CHUNK_TYPE() of the current chunk - one of token_e for chunks the decoder knows
+	const png_chunk_handler_s* chunk_handler;	//the caller's one for the current chunk, NULL without one
+	png_internal_context_s internal_context;
+	png_allocator_s allocator;		//resolved options.allocator
+	png_arena_s	arena;				//only used with options.use_arena
+	uint8_t* zero_row;				//stands in for the row above the first scanline of every pass
+	size_t	 zero_row_capacity;
+	uint8_t* pass_pixels;			//adam7 rows on their way into the result - a whole pass when on_pass wants to see it
+	size_t	 pass_pixels_capacity;
+	png_input_s input;
+	uint8_t* input_window;			//streamed input lands here - current_byte and ending_byte point into it
+	size_t	 input_window_capacity;
+	png_external_context_s* result;	//pipelined, region and adam7 decodes write rows out while inflating, so the result exists from IHDR on
+	png_region_s requested_region;
+	bool		 region_requested;
+	png_output_s output;
+	bool		 output_requested;
+	png_external_context_s* pushed;	//push decode that reached its end, waiting for png_feed_finish()
+	png_stage_e	 stage;				//what the decoding thread is busy with, for options.stats
+	uint64_t	 stage_started;		//png_cycles() when it started with it
+	uint64_t	 walk_started;		//same for the current decode call
+} png_decoder_s;
+
 ////////////////////////// declarations
+png_decoder_s* png_decoder_create(const png_decoder_options_s* _options);
+png_external_context_s* png_decoder_decode(png_decoder_s* _decoder, char* _input_png, const uint _size);
+//compressed data never has to be in memory as a whole - IDAT payloads are inflated as they come in
+png_external_context_s* png_decoder_decode_stream(png_decoder_s* _decoder, png_read_fn _read, void* _user);
+//push based input for data that arrives in pieces, like from a socket - begin, feed fragments of any size as they come
+//and finish - the walk pauses wherever a fragment ends, inside a chunk header or crc too, and only the few bytes it got
+//stuck on are kept, so IDAT payloads are inflated straight from the fragments and rows come out (see on_rows) while
+//the rest is still on its way - a result png_feed_finish() was not called for is dropped by the next decode
+void png_decoder_begin_push(png_decoder_s* _decoder);
+png_feed_e png_feed(png_decoder_s* _decoder, const uint8_t* _bytes, const size_t _size);
+//the image once png_feed() said it is done, NULL after an error or when the input ended before the image did
+png_external_context_s* png_feed_finish(png_decoder_s* _decoder);
+//maps regular files and decodes straight from the mapping, anything else is streamed
+png_external_context_s* png_decoder_decode_file(png_decoder_s* _decoder, const char* _path);
+//every following decode only produces _region of the image (NULL goes back to whole images) - for plain images
+//inflating stops right after the last row of it, so the rest of the file, CRCs included, is never even read
+//regions that end at the bottom of the image are decoded like the whole image and cropped, which is never slower
+void png_decoder_set_region(png_decoder_s* _decoder, const png_region_s* _region);
+//every following decode writes its pixels to _output instead of allocating them (NULL goes back to allocated ones) - the
+//result still describes them, only without owning them, and a decode whose region does not fit in _output fails
+//rows do not have to be PNG_ROW_ALIGNMENT aligned, but pixels and stride have to be aligned to a channel
+//a failed decode may have written any part of _output
+void png_decoder_set_output(png_decoder_s* _decoder, const png_output_s* _output);
+void png_decoder_reset(png_decoder_s* _decoder);
+void png_decoder_destroy(png_decoder_s* _decoder);
+
+//one shot convenience wrapper - creates a decoder, decodes and destroys it
 png_external_context_s* decode_from_png(char* _input_png, const uint _size);
+//checks the signature and IHDR (crc included) and fills _info without allocating or inflating anything - with
+//_scan_chunks it also steps over chunk headers up to the first IDAT, skipping their payloads, to see PLTE and tRNS
+//false means the input is not a png this decoder would accept, truncation after IHDR only leaves chunks_scanned unset
+bool png_probe(const char* _input_png, const uint _size, const bool _scan_chunks, png_probe_s* _info);
+uint8_t** get_png_rows(png_external_context_s* _ctx);
+void free_decoded_png(png_external_context_s* _ctx);
 
 #endif //__PNG_DECODER__
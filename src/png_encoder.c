@@ -0,0 +1,437 @@
+#include "png_encoder.h"
+#include "png_chunk.h"
+#include "png_filter.h"
+#include "png_crc.h"
+#include "png_parallel.h"
+#include "logger.h"
+#include "zlib.h"
+
+#include <string.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define IHDR_LEN		 13
+//length, type and crc around every payload
+#define CHUNK_OVERHEAD	 (PNG_CHUNK_HEADER_LEN + PNG_CRC_LEN)
+#define ZLIB_HEADER_LEN	 2
+#define ZLIB_TRAILER_LEN 4
+#define DEFAULT_LEVEL	 6
+//a few blocks per thread, so one slow block does not leave everybody else waiting
+#define BLOCKS_PER_THREAD 4
+//filtered bytes - every block starts with an empty window, so smaller ones lose more ratio than threads win back
+#ifndef MIN_BLOCK_SIZE
+#define MIN_BLOCK_SIZE (256 * 1024)
+#endif
+//zlib takes uInt sized pieces, and every block becomes a single IDAT
+#define MAX_BLOCK_SIZE (1u << 30)
+
+typedef struct {
+	uint32_t first_row;
+	uint32_t end_row;
+	uint8_t* output;		//raw deflate - ends with a full flush, or with the final block for the last one
+	size_t	 output_size;
+	size_t	 output_capacity;
+	uint32_t adler;			//of the filtered rows, combined into the stream's one afterwards
+	size_t	 filtered_size;
+} block_s;
+
+typedef struct {
+	const png_image_s*	   image;
+	block_s*			   blocks;
+	size_t				   block_count;
+	_Atomic size_t		   next_block;
+	const png_allocator_s* allocator;
+	int					   level;
+	size_t				   row_size;
+	uint8_t				   bpp;
+	bool				   adaptive;	//filter per row, otherwise everything goes out unfiltered
+	atomic_bool			   failed;
+} encode_job_s;
+
+////////////////////////// declarations
+static const bool check_image(const png_image_s* _image);
+static void run_workers(encode_job_s* _job, const uint32_t _threads);
+static void* encode_worker(void* _job);
+static const bool deflate_block(encode_job_s* _job, block_s* _block, z_stream* _strm, uint8_t* _filtered, const uint8_t* _zero_row);
+static const bool deflate_row(encode_job_s* _job, block_s* _block, z_stream* _strm, const int _flush);
+static png_encoded_s* assemble(encode_job_s* _job, const png_allocator_s* _allocator);
+static uint8_t* write_chunk(uint8_t* _out, const char* _type, const uint8_t* const* _parts, const size_t* _sizes, const size_t _count);
+static uint8_t* write_u32(uint8_t* _out, const uint32_t _value);
+static voidpf encoder_zalloc(voidpf _allocator, uInt _items, uInt _size);
+static void   encoder_zfree(voidpf _allocator, voidpf _ptr);
+
+
+////////////////////////// definitions
+png_encoded_s* encode_to_png(const png_image_s* _image, const png_encoder_options_s* _options)
+{
+	ASSERT_AND_FLUSH(_image != NULL);
+	if(!check_image(_image)) {
+		return NULL;
+	}
+
+	png_encoder_options_s options = {0};
+	if(_options != NULL) {
+		options = *_options;
+	}
+	const png_allocator_s allocator = options.allocator.alloc != NULL ? options.allocator : png_default_allocator();
+	if(options.compression_level < 0 || options.compression_level > 9) {
+		LOG(LOG_ERROR, "compression level %d is not one of 1 - 9", options.compression_level);
+		return NULL;
+	}
+
+	const uint32_t threads = png_thread_count(options.threads);
+
+	const size_t bits_per_pixel = (size_t)(_image->color_type == 2 ? 3 : _image->color_type == 4 ? 2 : _image->color_type == 6 ? 4 : 1) *
+								  _image->bit_depth;
+	const size_t row_size		= ((size_t)_image->width * bits_per_pixel + 7) / 8;
+	const size_t filtered_size	= (size_t)_image->height * (row_size + 1);
+
+	//as many blocks as threads can use, but none so small its empty window costs real ratio - a single thread gets a
+	//single block, which is exactly what serial zlib would write
+	size_t block_count = threads == 1 ? 1 : filtered_size / MIN_BLOCK_SIZE;
+	block_count = block_count < (size_t)threads * BLOCKS_PER_THREAD ? block_count : (size_t)threads * BLOCKS_PER_THREAD;
+	block_count = block_count > (filtered_size + MAX_BLOCK_SIZE - 1) / MAX_BLOCK_SIZE ? block_count : (filtered_size + MAX_BLOCK_SIZE - 1) / MAX_BLOCK_SIZE;
+	block_count = block_count < _image->height ? block_count : _image->height;
+	if(_image->stride < row_size) {
+		LOG(LOG_ERROR, "stride of %zu bytes is shorter than a row of %zu", _image->stride, row_size);
+		return NULL;
+	}
+	if(row_size + 1 > MAX_BLOCK_SIZE) {
+		LOG(LOG_ERROR, "rows of %zu bytes do not fit in a block", row_size);
+		return NULL;
+	}
+
+	block_s* blocks = allocator.alloc(allocator.user, sizeof(block_s) * block_count, _Alignof(block_s));
+	if(blocks == NULL) {
+		LOG_ERRNO(LOG_ERROR, "could not allocate %zu blocks", block_count);
+		return NULL;
+	}
+	memset(blocks, 0, sizeof(block_s) * block_count);
+	for(size_t b = 0; b < block_count; ++b) {
+		blocks[b].first_row = (uint32_t)((uint64_t)_image->height * b / block_count);
+		blocks[b].end_row	= (uint32_t)((uint64_t)_image->height * (b + 1) / block_count);
+	}
+
+	encode_job_s job = {
+		.image		 = _image,
+		.blocks		 = blocks,
+		.block_count = block_count,
+		.allocator	 = &allocator,
+		.level		 = options.compression_level == 0 ? DEFAULT_LEVEL : options.compression_level,
+		.row_size	 = row_size,
+		.bpp		 = bits_per_pixel < 8 ? 1 : bits_per_pixel / 8,
+		.adaptive	 = _image->color_type != 3 && _image->bit_depth >= 8,
+	};
+	atomic_init(&job.next_block, 0);
+	atomic_init(&job.failed, false);
+
+	run_workers(&job, threads < block_count ? threads : (uint32_t)block_count);
+
+	png_encoded_s* encoded = atomic_load(&job.failed) ? NULL : assemble(&job, &allocator);
+	for(size_t b = 0; b < block_count; ++b) {
+		allocator.free(allocator.user, blocks[b].output);
+	}
+	allocator.free(allocator.user, blocks);
+	return encoded;
+}
+
+void free_encoded_png(png_encoded_s* _png)
+{
+	if(_png == NULL) {
+		return;
+	}
+	const png_allocator_s allocator = _png->allocator;
+	allocator.free(allocator.user, _png->data);
+	allocator.free(allocator.user, _png);
+}
+
+static const bool check_image(const png_image_s* _image)
+{
+	//same combinations the decoder accepts
+	bool depth_allowed = false;
+	switch(_image->color_type) {
+		case 0: depth_allowed = _image->bit_depth == 1 || _image->bit_depth == 2 || _image->bit_depth == 4 || _image->bit_depth == 8 || _image->bit_depth == 16; break;
+		case 3: depth_allowed = _image->bit_depth == 1 || _image->bit_depth == 2 || _image->bit_depth == 4 || _image->bit_depth == 8; break;
+		case 2:
+		case 4:
+		case 6: depth_allowed = _image->bit_depth == 8 || _image->bit_depth == 16; break;
+	}
+	if(!depth_allowed) {
+		LOG(LOG_ERROR, "colour type %d cannot have bit depth %d", _image->color_type, _image->bit_depth);
+		return false;
+	}
+	if(_image->width == 0 || _image->height == 0 || _image->width > INT32_MAX || _image->height > INT32_MAX) {
+		LOG(LOG_ERROR, "%ux%u is not a size png can store", _image->width, _image->height);
+		return false;
+	}
+	if(_image->pixels == NULL) {
+		LOG(LOG_ERROR, "image has no pixels");
+		return false;
+	}
+	if(_image->color_type == 3) {
+		if(_image->palette == NULL || _image->palette_size == 0 || _image->palette_size > 256) {
+			LOG(LOG_ERROR, "indexed image needs a palette of 1 - 256 entries, got %u", _image->palette_size);
+			return false;
+		}
+		if(_image->palette_alpha_size > _image->palette_size || (_image->palette_alpha_size > 0 && _image->palette_alpha == NULL)) {
+			LOG(LOG_ERROR, "%u alpha entries for a palette of %u", _image->palette_alpha_size, _image->palette_size);
+			return false;
+		}
+	}
+	return true;
+}
+
+static void run_workers(encode_job_s* _job, const uint32_t _threads)
+{
+	//caller is one of the threads - if some fail to start, the rest simply take more blocks
+	pthread_t threads[_threads];
+	uint32_t started = 1;
+	for(uint32_t t = 1; t < _threads; ++t, ++started) {
+		if(pthread_create(&threads[t], NULL, encode_worker, _job) != 0) {
+			LOG(LOG_WARNING, "could only start %d out of %d encode threads", started, _threads);
+			break;
+		}
+	}
+	(void)encode_worker(_job);
+	for(uint32_t t = 1; t < started; ++t) {
+		pthread_join(threads[t], NULL);
+	}
+}
+
+static void* encode_worker(void* _job)
+{
+	//deflate state and row scratch belong to the thread and are reused for every block it takes
+	encode_job_s* job = _job;
+	const png_allocator_s* allocator = job->allocator;
+	uint8_t* filtered = allocator->alloc(allocator->user, job->row_size + 1, 64);
+	uint8_t* zero_row = allocator->alloc(allocator->user, job->row_size, 64);
+	z_stream strm;
+	memset(&strm, 0, sizeof(z_stream));
+	strm.zalloc = encoder_zalloc;
+	strm.zfree	= encoder_zfree;
+	strm.opaque = (voidpf)allocator;
+	//raw deflate - the zlib header and adler32 of the whole stream are written around the blocks afterwards
+	//filtered rows are mostly small values, which is what Z_FILTERED is tuned for
+	const int ret = filtered == NULL || zero_row == NULL ? Z_MEM_ERROR :
+					deflateInit2(&strm, job->level, Z_DEFLATED, -MAX_WBITS, 8, job->adaptive ? Z_FILTERED : Z_DEFAULT_STRATEGY);
+	if(ret != Z_OK) {
+		LOG(LOG_ERROR, "could not prepare deflate stream: %d", ret);
+		atomic_store(&job->failed, true);
+	} else {
+		memset(zero_row, 0, job->row_size);
+		size_t b;
+		while((b = atomic_fetch_add(&job->next_block, 1)) < job->block_count) {
+			if(atomic_load_explicit(&job->failed, memory_order_relaxed)) {
+				break;
+			}
+			if(!deflate_block(job, &(job->blocks[b]), &strm, filtered, zero_row)) {
+				atomic_store(&job->failed, true);
+			}
+		}
+		(void)deflateEnd(&strm);
+	}
+	allocator->free(allocator->user, filtered);
+	allocator->free(allocator->user, zero_row);
+	return NULL;
+}
+
+static const bool deflate_block(encode_job_s* _job, block_s* _block, z_stream* _strm, uint8_t* _filtered, const uint8_t* _zero_row)
+{
+	const png_image_s* image = _job->image;
+	const bool last = _block == &(_job->blocks[_job->block_count - 1]);
+	_block->filtered_size = (size_t)(_block->end_row - _block->first_row) * (_job->row_size + 1);
+	_block->adler		  = adler32(0, Z_NULL, 0);
+
+	//sized for the worst case up front - growing is only a fallback for the flush at the end
+	(void)deflateReset(_strm);
+	_block->output_capacity = deflateBound(_strm, _block->filtered_size) + 64;
+	_block->output			= _job->allocator->alloc(_job->allocator->user, _block->output_capacity, 64);
+	if(_block->output == NULL) {
+		LOG_ERRNO(LOG_ERROR, "could not allocate %zu bytes for a compressed block", _block->output_capacity);
+		return false;
+	}
+	_strm->next_out	 = _block->output;
+	_strm->avail_out = _block->output_capacity;
+
+	for(uint32_t y = _block->first_row; y < _block->end_row; ++y) {
+		//the row above comes straight from the image, so blocks do not depend on each other
+		const uint8_t* row	= image->pixels + (size_t)y * image->stride;
+		const uint8_t* prev = y == 0 ? _zero_row : row - image->stride;
+		if(_job->adaptive) {
+			(void)filter_row_adaptive(row, prev, _filtered, _job->row_size, _job->bpp);
+		} else {
+			_filtered[0] = FILTER_NONE;
+			memcpy(_filtered + 1, row, _job->row_size);
+		}
+		_block->adler	= adler32(_block->adler, _filtered, _job->row_size + 1);
+		_strm->next_in	= _filtered;
+		_strm->avail_in = _job->row_size + 1;
+		const int flush = y + 1 < _block->end_row ? Z_NO_FLUSH : (last ? Z_FINISH : Z_FULL_FLUSH);
+		if(!deflate_row(_job, _block, _strm, flush)) {
+			return false;
+		}
+	}
+	_block->output_size = _strm->next_out - _block->output;
+	return true;
+}
+
+static const bool deflate_row(encode_job_s* _job, block_s* _block, z_stream* _strm, const int _flush)
+{
+	while(true) {
+		const int ret = deflate(_strm, _flush);
+		if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+			LOG(LOG_ERROR, "deflate failed: %d (%s)", ret, _strm->msg ? _strm->msg : "no message");
+			return false;
+		}
+		//done once the input is in and deflate did not stop for lack of room - the last block only once it is finished
+		if(ret == Z_STREAM_END || (_flush != Z_FINISH && _strm->avail_in == 0 && _strm->avail_out > 0)) {
+			return true;
+		}
+
+		//deflateBound should have covered it - only the flush markers can push a block past it
+		const size_t used	  = _strm->next_out - _block->output;
+		const size_t capacity = _block->output_capacity * 2;
+		uint8_t* output = _job->allocator->alloc(_job->allocator->user, capacity, 64);
+		if(output == NULL) {
+			LOG_ERRNO(LOG_ERROR, "could not grow a compressed block to %zu bytes", capacity);
+			return false;
+		}
+		memcpy(output, _block->output, used);
+		_job->allocator->free(_job->allocator->user, _block->output);
+		_block->output			= output;
+		_block->output_capacity = capacity;
+		_strm->next_out			= output + used;
+		_strm->avail_out		= capacity - used;
+	}
+}
+
+static png_encoded_s* assemble(encode_job_s* _job, const png_allocator_s* _allocator)
+{
+	const png_image_s* image = _job->image;
+	const bool indexed		 = image->color_type == 3;
+
+	size_t size = PNG_MAGIC_NUM_LEN + CHUNK_OVERHEAD + IHDR_LEN + CHUNK_OVERHEAD;
+	if(indexed) {
+		size += CHUNK_OVERHEAD + 3 * (size_t)image->palette_size;
+		size += image->palette_alpha_size > 0 ? CHUNK_OVERHEAD + image->palette_alpha_size : 0;
+	}
+	uint32_t adler = adler32(0, Z_NULL, 0);
+	for(size_t b = 0; b < _job->block_count; ++b) {
+		size  += CHUNK_OVERHEAD + _job->blocks[b].output_size;
+		adler  = adler32_combine(adler, _job->blocks[b].adler, (z_off_t)_job->blocks[b].filtered_size);
+	}
+	size += ZLIB_HEADER_LEN + ZLIB_TRAILER_LEN;
+
+	png_encoded_s* encoded = _allocator->alloc(_allocator->user, sizeof(png_encoded_s), _Alignof(png_encoded_s));
+	uint8_t* data = _allocator->alloc(_allocator->user, size, 64);
+	if(encoded == NULL || data == NULL) {
+		LOG_ERRNO(LOG_ERROR, "could not allocate %zu bytes of output", size);
+		_allocator->free(_allocator->user, encoded);
+		_allocator->free(_allocator->user, data);
+		return NULL;
+	}
+	*encoded = (png_encoded_s){.data = data, .size = size, .allocator = *_allocator};
+
+	uint8_t* out = data;
+	memcpy(out, PNG_MAGIC_NUMBER, PNG_MAGIC_NUM_LEN);
+	out += PNG_MAGIC_NUM_LEN;
+
+	uint8_t header[IHDR_LEN];
+	(void)write_u32(write_u32(header, image->width), image->height);
+	header[8]  = image->bit_depth;
+	header[9]  = image->color_type;
+	header[10] = 0;	//deflate
+	header[11] = 0;	//adaptive filtering
+	header[12] = 0;	//no interlace
+	const uint8_t* header_part = header;
+	const size_t   header_size = IHDR_LEN;
+	out = write_chunk(out, "IHDR", &header_part, &header_size, 1);
+
+	if(indexed) {
+		uint8_t palette[3 * 256];
+		for(uint i = 0; i < image->palette_size; ++i) {
+			palette[3 * i]	   = image->palette[i].r;
+			palette[3 * i + 1] = image->palette[i].g;
+			palette[3 * i + 2] = image->palette[i].b;
+		}
+		const uint8_t* palette_part = palette;
+		const size_t   palette_size = 3 * (size_t)image->palette_size;
+		out = write_chunk(out, "PLTE", &palette_part, &palette_size, 1);
+		if(image->palette_alpha_size > 0) {
+			const size_t alpha_size = image->palette_alpha_size;
+			out = write_chunk(out, "tRNS", &(image->palette_alpha), &alpha_size, 1);
+		}
+	}
+
+	//one IDAT per block - the zlib header goes in front of the first one and the adler32 behind the last one
+	//level only ends up in the header as a hint, the check bits make the pair divisible by 31
+	const uint8_t cmf	 = 0x78;
+	const uint8_t flevel = _job->level == 1 ? 0 : _job->level < 6 ? 1 : _job->level == 6 ? 2 : 3;
+	uint8_t zlib_header[ZLIB_HEADER_LEN] = {cmf, flevel << 6};
+	zlib_header[1] += 31 - ((cmf << 8) | zlib_header[1]) % 31;
+	uint8_t zlib_trailer[ZLIB_TRAILER_LEN];
+	(void)write_u32(zlib_trailer, adler);
+	for(size_t b = 0; b < _job->block_count; ++b) {
+		const block_s* block = &(_job->blocks[b]);
+		const bool first = b == 0;
+		const bool last	 = b + 1 == _job->block_count;
+		const uint8_t* parts[3] = {zlib_header, block->output, zlib_trailer};
+		const size_t   sizes[3] = {first ? ZLIB_HEADER_LEN : 0, block->output_size, last ? ZLIB_TRAILER_LEN : 0};
+		out = write_chunk(out, "IDAT", parts, sizes, 3);
+	}
+	out = write_chunk(out, "IEND", NULL, NULL, 0);
+	ASSERT_AND_FLUSH(out == data + size);
+	return encoded;
+}
+
+static uint8_t* write_chunk(uint8_t* _out, const char* _type, const uint8_t* const* _parts, const size_t* _sizes, const size_t _count)
+{
+	//payload may come in pieces - crc covers the type and all of them
+	size_t size = 0;
+	for(size_t p = 0; p < _count; ++p) {
+		size += _sizes[p];
+	}
+	ASSERT_AND_FLUSH(size <= INT32_MAX);
+	uint8_t* type = write_u32(_out, (uint32_t)size);
+	memcpy(type, _type, 4);
+	uint8_t* out = type + 4;
+	for(size_t p = 0; p < _count; ++p) {
+		if(_sizes[p] > 0) {
+			memcpy(out, _parts[p], _sizes[p]);
+			out += _sizes[p];
+		}
+	}
+	return write_u32(out, png_crc32(0, type, out - type));
+}
+
+static uint8_t* write_u32(uint8_t* _out, const uint32_t _value)
+{
+	//big endian, like every number in a png
+	_out[0] = _value >> 24;
+	_out[1] = _value >> 16;
+	_out[2] = _value >> 8;
+	_out[3] = _value;
+	return _out + 4;
+}
+
+static voidpf encoder_zalloc(voidpf _allocator, uInt _items, uInt _size)
+{
+	const png_allocator_s* allocator = _allocator;
+	return allocator->alloc(allocator->user, (size_t)_items * _size, sizeof(max_align_t));
+}
+
+static void encoder_zfree(voidpf _allocator, voidpf _ptr)
+{
+	const png_allocator_s* allocator = _allocator;
+	allocator->free(allocator->user, _ptr);
+}
+
+#undef IHDR_LEN
+#undef CHUNK_OVERHEAD
+#undef ZLIB_HEADER_LEN
+#undef ZLIB_TRAILER_LEN
+#undef DEFAULT_LEVEL
+#undef BLOCKS_PER_THREAD
+#undef MIN_BLOCK_SIZE
+#undef MAX_BLOCK_SIZE
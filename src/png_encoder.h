@@ -0,0 +1,47 @@
+#ifndef __PNG_ENCODER__
+#define __PNG_ENCODER__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "png_arena.h"
+#include "png_decoder.h"
+
+////////////////////////// typedefs
+typedef struct {
+	//what gets encoded - rows are laid out the way a scanline stores them: samples below 8 bits packed most significant
+	//bits first, 16 bit samples big endian - so 8 bit output of the decoder (rgba8, rgb8, gray8) goes in as it is
+	const uint8_t*	pixels;
+	size_t			stride;				//distance in bytes between starts of consecutive rows
+	uint32_t		width, height;
+	uint8_t			color_type, bit_depth;
+	const colour_s* palette;			//indexed images only
+	uint			palette_size;
+	const uint8_t*	palette_alpha;		//optional - alpha of the first palette_alpha_size entries, written as tRNS
+	uint			palette_alpha_size;
+} png_image_s;
+
+typedef struct {
+	//knobs - zeroed struct means defaults
+	int				compression_level;	//zlib level 1 - 9, 0 means 6
+	uint			threads;			//resolved by png_thread_count(), the caller counts as one - with more than one, rows are
+										//split into blocks that are filtered and deflated on their own, so the stream gets a
+										//full flush between them and decoders can inflate them in parallel too
+	png_allocator_s allocator;			//output and scratch - has to be thread safe, NULL alloc means malloc/free
+} png_encoder_options_s;
+
+typedef struct {
+	uint8_t*		data;				//complete file, signature to IEND
+	size_t			size;
+	png_allocator_s allocator;			//what it was allocated with, free_encoded_png() gives it back here
+} png_encoded_s;
+
+////////////////////////// declarations
+//writes IHDR, PLTE and tRNS for indexed images, IDAT and IEND - every row gets the filter with the smallest sum of
+//absolute differences, except for indexed and sub byte images, where filtering hurts more than it helps and none is used
+//non-interlaced only, NULL when the image is not something png can store or memory ran out
+png_encoded_s* encode_to_png(const png_image_s* _image, const png_encoder_options_s* _options);
+void free_encoded_png(png_encoded_s* _png);
+
+#endif //__PNG_ENCODER__
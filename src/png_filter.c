@@ -0,0 +1,794 @@
+#include "png_filter.h"
+#include "logger.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FILTER_X86
+#include <immintrin.h>
+#endif
+
+#define BPP_CASES 6
+
+typedef void (*unfilter_fn)(uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp);
+//forward kernels - scoring fills one sum per filter type
+typedef void (*score_fn)(const uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp, uint64_t* _sums);
+typedef void (*filter_fn)(const uint8_t _filter_type, const uint8_t* _row, const uint8_t* _prev, uint8_t* _out, const size_t _row_size, const uint8_t _bpp);
+
+////////////////////////// global variables
+//filled once at startup from cpuid - afterwards only read, so it is safe to share between threads
+static unfilter_fn	 unfilter_table[FILTER_SIZE][BPP_CASES];
+static filter_impl_e selected_impl = FILTER_IMPL_SCALAR;
+static score_fn		 score_impl;
+static filter_fn	 filter_impl;
+static filter_impl_e selected_filter_impl = FILTER_IMPL_SCALAR;
+
+
+////////////////////////// declarations
+static int	bpp_to_index(const uint8_t _bpp);
+static void unfilter_none_scalar(uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp);
+static void unfilter_sub_scalar(uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp);
+static void unfilter_up_scalar(uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp);
+static void unfilter_average_scalar(uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp);
+static void unfilter_paeth_scalar(uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp);
+static void unfilter_init() __attribute__((constructor));
+static void score_filters_scalar(const uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp, uint64_t* _sums);
+static void filter_row_scalar(const uint8_t _filter_type, const uint8_t* _row, const uint8_t* _prev, uint8_t* _out, const size_t _row_size, const uint8_t _bpp);
+static const uint8_t pick_filter(const uint64_t* _sums);
+static void filter_init() __attribute__((constructor));
+
+
+////////////////////////// definitions
+bool unfilter_row(const uint8_t _filter_type, uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp)
+{
+	const int bpp_index = bpp_to_index(_bpp);
+	if(_filter_type >= FILTER_SIZE || bpp_index < 0) {
+		LOG(LOG_ERROR, "cannot unfilter row - filter type: %d, bytes per pixel: %d", _filter_type, _bpp);
+		return false;
+	}
+	unfilter_table[_filter_type][bpp_index](_row, _prev, _row_size, _bpp);
+	return true;
+}
+
+void unfilter_row_scalar(const uint8_t _filter_type, uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp)
+{
+	switch(_filter_type) {
+		case FILTER_NONE:	 unfilter_none_scalar(_row, _prev, _row_size, _bpp);	break;
+		case FILTER_SUB:	 unfilter_sub_scalar(_row, _prev, _row_size, _bpp);		break;
+		case FILTER_UP:		 unfilter_up_scalar(_row, _prev, _row_size, _bpp);		break;
+		case FILTER_AVERAGE: unfilter_average_scalar(_row, _prev, _row_size, _bpp); break;
+		case FILTER_PAETH:	 unfilter_paeth_scalar(_row, _prev, _row_size, _bpp);	break;
+		default: {
+			LOG(LOG_ERROR, "unknown filter type: %d", _filter_type);
+		}
+	}
+}
+
+filter_impl_e unfilter_get_impl()
+{
+	return selected_impl;
+}
+
+void filter_row(const uint8_t _filter_type, const uint8_t* _row, const uint8_t* _prev, uint8_t* _out, const size_t _row_size, const uint8_t _bpp)
+{
+	ASSERT_AND_FLUSH(_filter_type < FILTER_SIZE);
+	ASSERT_AND_FLUSH(_bpp >= 1 && _bpp <= 8);
+	filter_impl(_filter_type, _row, _prev, _out, _row_size, _bpp);
+}
+
+uint8_t filter_row_adaptive(const uint8_t* _row, const uint8_t* _prev, uint8_t* _out, const size_t _row_size, const uint8_t _bpp)
+{
+	ASSERT_AND_FLUSH(_bpp >= 1 && _bpp <= 8);
+	//every filter is only scored first - the winner is the only one whose output gets written
+	uint64_t sums[FILTER_SIZE];
+	score_impl(_row, _prev, _row_size, _bpp, sums);
+	_out[0] = pick_filter(sums);
+	filter_impl(_out[0], _row, _prev, _out + 1, _row_size, _bpp);
+	return _out[0];
+}
+
+uint8_t filter_row_adaptive_scalar(const uint8_t* _row, const uint8_t* _prev, uint8_t* _out, const size_t _row_size, const uint8_t _bpp)
+{
+	uint64_t sums[FILTER_SIZE];
+	score_filters_scalar(_row, _prev, _row_size, _bpp, sums);
+	_out[0] = pick_filter(sums);
+	filter_row_scalar(_out[0], _row, _prev, _out + 1, _row_size, _bpp);
+	return _out[0];
+}
+
+filter_impl_e filter_get_impl()
+{
+	return selected_filter_impl;
+}
+
+static int bpp_to_index(const uint8_t _bpp)
+{
+	switch(_bpp) {
+		case 1: return 0;
+		case 2: return 1;
+		case 3: return 2;
+		case 4: return 3;
+		case 6: return 4;
+		case 8: return 5;
+	}
+	return -1;
+}
+
+////////////////////////// scalar reference
+static void unfilter_none_scalar(uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp)
+{
+	//nothing to do - row is stored as it is
+	(void)_row; (void)_prev; (void)_row_size; (void)_bpp;
+}
+
+static void unfilter_sub_scalar(uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp)
+{
+	(void)_prev;
+	for(size_t i = _bpp; i < _row_size; ++i) {
+		_row[i] += _row[i - _bpp];
+	}
+}
+
+static void unfilter_up_scalar(uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp)
+{
+	(void)_bpp;
+	for(size_t i = 0; i < _row_size; ++i) {
+		_row[i] += _prev[i];
+	}
+}
+
+static void unfilter_average_scalar(uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp)
+{
+	size_t i = 0;
+	for(; i < _bpp && i < _row_size; ++i) {
+		_row[i] += _prev[i] >> 1;
+	}
+	for(; i < _row_size; ++i) {
+		_row[i] += (uint8_t)(((unsigned)_row[i - _bpp] + _prev[i]) >> 1);
+	}
+}
+
+static inline uint8_t paeth_predictor(const int _a, const int _b, const int _c)
+{
+	const int p  = _a + _b - _c;
+	const int pa = abs(p - _a);
+	const int pb = abs(p - _b);
+	const int pc = abs(p - _c);
+	//same picks as the spec's if chain, written as selects - branches on it mispredict all the time on noisy rows
+	const int near_bc = pb <= pc ? _b : _c;
+	const int dist_bc = pb <= pc ? pb : pc;
+	return pa <= dist_bc ? _a : near_bc;
+}
+
+static void unfilter_paeth_scalar(uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp)
+{
+	size_t i = 0;
+	for(; i < _bpp && i < _row_size; ++i) {
+		//left and upper left are outside of the image - predictor degrades to up
+		_row[i] += _prev[i];
+	}
+	for(; i < _row_size; ++i) {
+		_row[i] += paeth_predictor(_row[i - _bpp], _prev[i], _prev[i - _bpp]);
+	}
+}
+
+////////////////////////// forward scalar reference
+static inline uint8_t filter_byte(const uint8_t _filter_type, const uint8_t _x, const uint8_t _a, const uint8_t _b, const uint8_t _c)
+{
+	switch(_filter_type) {
+		case FILTER_SUB:	 return _x - _a;
+		case FILTER_UP:		 return _x - _b;
+		case FILTER_AVERAGE: return _x - (uint8_t)(((unsigned)_a + _b) >> 1);
+		case FILTER_PAETH:	 return _x - paeth_predictor(_a, _b, _c);
+	}
+	return _x;
+}
+
+static inline uint32_t abs_signed(const uint8_t _x)
+{
+	//filtered bytes count as signed - written so it ends up as a conditional move, a branch mispredicts on noisy rows
+	const int v = (int8_t)_x;
+	return v < 0 ? -v : v;
+}
+
+static void score_range_scalar(const uint8_t* _row, const uint8_t* _prev, const size_t _from, const size_t _to, const uint8_t _bpp, uint64_t* _sums)
+{
+	//pixels left of the row are zero, so is the one above them
+	//filters spelled out instead of going through filter_byte() per filter, which keeps the loop free of branches
+	uint64_t none = 0, sub = 0, up = 0, average = 0, paeth = 0;
+	for(size_t i = _from; i < _to; ++i) {
+		const uint8_t x = _row[i];
+		const uint8_t b = _prev[i];
+		const uint8_t a = i >= _bpp ? _row[i - _bpp]  : 0;
+		const uint8_t c = i >= _bpp ? _prev[i - _bpp] : 0;
+		none	+= abs_signed(x);
+		sub		+= abs_signed(x - a);
+		up		+= abs_signed(x - b);
+		average += abs_signed(x - (uint8_t)(((unsigned)a + b) >> 1));
+		paeth	+= abs_signed(x - paeth_predictor(a, b, c));
+	}
+	_sums[FILTER_NONE]	  += none;
+	_sums[FILTER_SUB]	  += sub;
+	_sums[FILTER_UP]	  += up;
+	_sums[FILTER_AVERAGE] += average;
+	_sums[FILTER_PAETH]	  += paeth;
+}
+
+static void filter_range_scalar(const uint8_t _filter_type, const uint8_t* _row, const uint8_t* _prev, uint8_t* _out,
+		const size_t _from, const size_t _to, const uint8_t _bpp)
+{
+	//one loop per filter, so filter_byte() folds to a single expression instead of switching on every byte
+	#define FILTER_RANGE(_type)												\
+		for(size_t i = _from; i < _to; ++i) {								\
+			const uint8_t a = i >= _bpp ? _row[i - _bpp]  : 0;				\
+			const uint8_t c = i >= _bpp ? _prev[i - _bpp] : 0;				\
+			_out[i] = filter_byte(_type, _row[i], a, _prev[i], c);			\
+		}
+	switch(_filter_type) {
+		case FILTER_SUB:	 FILTER_RANGE(FILTER_SUB);	   break;
+		case FILTER_UP:		 FILTER_RANGE(FILTER_UP);	   break;
+		case FILTER_AVERAGE: FILTER_RANGE(FILTER_AVERAGE); break;
+		case FILTER_PAETH:	 FILTER_RANGE(FILTER_PAETH);   break;
+		default:			 FILTER_RANGE(FILTER_NONE);	   break;
+	}
+	#undef FILTER_RANGE
+}
+
+static void score_filters_scalar(const uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp, uint64_t* _sums)
+{
+	memset(_sums, 0, sizeof(uint64_t) * FILTER_SIZE);
+	score_range_scalar(_row, _prev, 0, _row_size, _bpp, _sums);
+}
+
+static void filter_row_scalar(const uint8_t _filter_type, const uint8_t* _row, const uint8_t* _prev, uint8_t* _out, const size_t _row_size, const uint8_t _bpp)
+{
+	filter_range_scalar(_filter_type, _row, _prev, _out, 0, _row_size, _bpp);
+}
+
+static const uint8_t pick_filter(const uint64_t* _sums)
+{
+	//ties go to the simpler filter
+	uint8_t best = FILTER_NONE;
+	for(uint8_t f = FILTER_SUB; f < FILTER_SIZE; ++f) {
+		if(_sums[f] < _sums[best]) {
+			best = f;
+		}
+	}
+	return best;
+}
+
+#ifdef FILTER_X86
+////////////////////////// x86 simd kernels
+//sub/average/paeth depend on the pixel to the left, so for 3, 4, 6 and 8 bytes per pixel
+//we keep one whole pixel per register and walk the row pixel by pixel.
+//sub for 1, 2, 4 and 8 bytes per pixel is a prefix sum, so it can be done 16 bytes at a time.
+//average and paeth with 1 or 2 bytes per pixel are byte serial - there is nothing to vectorize
+
+__attribute__((target("sse2")))
+static inline __m128i load_pixel(const uint8_t* _p, const uint8_t _bpp)
+{
+	//straight from the row into the low lanes - 3 and 6 byte pixels bring the start of the next pixel along, which only
+	//ever lands in lanes nobody stores, so callers stop before the last pixel and leave it to unfilter_tail()
+	uint32_t low;
+	switch(_bpp) {
+		case 3:
+		case 4: memcpy(&low, _p, 4); return _mm_cvtsi32_si128((int)low);
+		default: return _mm_loadl_epi64((const __m128i*)_p);
+	}
+}
+
+__attribute__((target("sse2")))
+static inline void store_pixel(uint8_t* _p, const __m128i _value, const uint8_t _bpp)
+{
+	//exactly _bpp bytes - the rest of the register is garbage, and the next pixel still has to be read
+	const uint32_t low = (uint32_t)_mm_cvtsi128_si32(_value);
+	switch(_bpp) {
+		case 3: memcpy(_p, &low, 2); _p[2] = (uint8_t)(low >> 16); break;
+		case 4: memcpy(_p, &low, 4); break;
+		case 6: {
+			const uint16_t high = (uint16_t)_mm_extract_epi16(_value, 2);
+			memcpy(_p, &low, 4);
+			memcpy(_p + 4, &high, 2);
+			break;
+		}
+		default: _mm_storel_epi64((__m128i*)_p, _value); break;
+	}
+}
+
+static inline size_t pixel_loop_end(const size_t _row_size, const uint8_t _bpp)
+{
+	//first byte load_pixel() would read past the row from - 3 and 6 byte pixels are loaded 4 and 8 bytes wide
+	const size_t load_size = _bpp == 3 ? 4 : _bpp == 6 ? 8 : _bpp;
+	return _row_size >= load_size ? _row_size - load_size + 1 : 0;
+}
+
+static inline void unfilter_tail(const uint8_t _filter_type, uint8_t* _row, const uint8_t* _prev, size_t _from,
+		const size_t _row_size, const uint8_t _bpp)
+{
+	//whatever the pixel loop left at the end of the row - left and upper left are zero for the first pixel
+	for(; _from < _row_size; ++_from) {
+		const uint8_t a = _from >= _bpp ? _row[_from - _bpp]  : 0;
+		const uint8_t c = _from >= _bpp ? _prev[_from - _bpp] : 0;
+		switch(_filter_type) {
+			case FILTER_SUB:	 _row[_from] += a; break;
+			case FILTER_AVERAGE: _row[_from] += (uint8_t)(((unsigned)a + _prev[_from]) >> 1); break;
+			case FILTER_PAETH:	 _row[_from] += paeth_predictor(a, _prev[_from], c); break;
+		}
+	}
+}
+
+__attribute__((target("sse2")))
+static void unfilter_up_sse2(uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp)
+{
+	size_t i = 0;
+	for(; i + 16 <= _row_size; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(_row + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(_prev + i));
+		_mm_storeu_si128((__m128i*)(_row + i), _mm_add_epi8(x, b));
+	}
+	unfilter_up_scalar(_row + i, _prev + i, _row_size - i, _bpp);
+}
+
+__attribute__((target("sse2")))
+static void unfilter_sub_prefix_sse2(uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp)
+{
+	//works for bpp 1, 2, 4 and 8 - every 16 byte block holds whole pixels
+	__m128i carry = _mm_setzero_si128();
+	size_t i = 0;
+	for(; i + 16 <= _row_size; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(_row + i));
+		switch(_bpp) {
+			case 1: x = _mm_add_epi8(x, _mm_slli_si128(x, 1));	//fallthrough
+			case 2: x = _mm_add_epi8(x, _mm_slli_si128(x, 2));	//fallthrough
+			case 4: x = _mm_add_epi8(x, _mm_slli_si128(x, 4));	//fallthrough
+			case 8: x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+		}
+		x = _mm_add_epi8(x, carry);
+		_mm_storeu_si128((__m128i*)(_row + i), x);
+
+		//broadcast last pixel of this block as the left neighbour of the next one
+		switch(_bpp) {
+			case 1: carry = _mm_set1_epi8((char)_row[i + 15]); break;
+			case 2: carry = _mm_shufflelo_epi16(_mm_srli_si128(x, 14), 0); carry = _mm_unpacklo_epi64(carry, carry); break;
+			case 4: carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3)); break;
+			case 8: carry = _mm_unpackhi_epi64(x, x); break;
+		}
+	}
+	if(i == 0) {
+		unfilter_sub_scalar(_row, _prev, _row_size, _bpp);
+		return;
+	}
+	for(; i < _row_size; ++i) {
+		_row[i] += _row[i - _bpp];
+	}
+}
+
+__attribute__((target("sse2"), always_inline))
+static inline void unfilter_sub_pixel_sse2(uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp)
+{
+	__m128i a = _mm_setzero_si128();
+	const size_t end = pixel_loop_end(_row_size, _bpp);
+	size_t i = 0;
+	for(; i < end; i += _bpp) {
+		a = _mm_add_epi8(a, load_pixel(_row + i, _bpp));
+		store_pixel(_row + i, a, _bpp);
+	}
+	unfilter_tail(FILTER_SUB, _row, _prev, i, _row_size, _bpp);
+}
+
+__attribute__((target("sse2"), always_inline))
+static inline void unfilter_average_pixel_sse2(uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp)
+{
+	const __m128i ones = _mm_set1_epi8(1);
+	__m128i a = _mm_setzero_si128();
+	const size_t end = pixel_loop_end(_row_size, _bpp);
+	size_t i = 0;
+	for(; i < end; i += _bpp) {
+		const __m128i b = load_pixel(_prev + i, _bpp);
+		//avg_epu8 rounds up, the spec wants floor
+		__m128i avg = _mm_avg_epu8(a, b);
+		avg = _mm_sub_epi8(avg, _mm_and_si128(_mm_xor_si128(a, b), ones));
+		a = _mm_add_epi8(load_pixel(_row + i, _bpp), avg);
+		store_pixel(_row + i, a, _bpp);
+	}
+	unfilter_tail(FILTER_AVERAGE, _row, _prev, i, _row_size, _bpp);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i if_then_else_sse2(const __m128i _cond, const __m128i _then, const __m128i _else)
+{
+	return _mm_or_si128(_mm_and_si128(_cond, _then), _mm_andnot_si128(_cond, _else));
+}
+
+__attribute__((target("sse2"), always_inline))
+static inline void unfilter_paeth_pixel_sse2(uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp)
+{
+	//every channel widened to 16 bits - 8 bytes per pixel still fits a single register
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a = zero, c = zero;
+	const size_t end = pixel_loop_end(_row_size, _bpp);
+	size_t i = 0;
+	for(; i < end; i += _bpp) {
+		const __m128i b = _mm_unpacklo_epi8(load_pixel(_prev + i, _bpp), zero);
+		const __m128i x = _mm_unpacklo_epi8(load_pixel(_row + i, _bpp), zero);
+
+		__m128i pa = _mm_sub_epi16(b, c);	//|p - a| = |b - c|
+		__m128i pb = _mm_sub_epi16(a, c);	//|p - b| = |a - c|
+		__m128i pc = _mm_add_epi16(pa, pb); //|p - c| = |a + b - 2c|
+		pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+		pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+		pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+
+		//ties are broken in favour of a, then b, then c
+		const __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+		const __m128i nearest  = if_then_else_sse2(_mm_cmpeq_epi16(smallest, pa), a,
+								 if_then_else_sse2(_mm_cmpeq_epi16(smallest, pb), b, c));
+
+		//add modulo 256 and drop back to 16 bit lanes for the next pixel
+		const __m128i d = _mm_and_si128(_mm_add_epi16(x, nearest), _mm_set1_epi16(0xff));
+		store_pixel(_row + i, _mm_packus_epi16(d, d), _bpp);
+		c = b;
+		a = d;
+	}
+	unfilter_tail(FILTER_PAETH, _row, _prev, i, _row_size, _bpp);
+}
+
+__attribute__((target("ssse3"), always_inline))
+static inline void unfilter_paeth_pixel_ssse3(uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a = zero, c = zero;
+	const size_t end = pixel_loop_end(_row_size, _bpp);
+	size_t i = 0;
+	for(; i < end; i += _bpp) {
+		const __m128i b = _mm_unpacklo_epi8(load_pixel(_prev + i, _bpp), zero);
+		const __m128i x = _mm_unpacklo_epi8(load_pixel(_row + i, _bpp), zero);
+
+		__m128i pa = _mm_sub_epi16(b, c);
+		__m128i pb = _mm_sub_epi16(a, c);
+		__m128i pc = _mm_abs_epi16(_mm_add_epi16(pa, pb));
+		pa = _mm_abs_epi16(pa);
+		pb = _mm_abs_epi16(pb);
+
+		const __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+		const __m128i use_a	   = _mm_cmpeq_epi16(smallest, pa);
+		const __m128i use_b	   = _mm_cmpeq_epi16(smallest, pb);
+		__m128i nearest = _mm_or_si128(_mm_and_si128(use_b, b), _mm_andnot_si128(use_b, c));
+		nearest = _mm_or_si128(_mm_and_si128(use_a, a), _mm_andnot_si128(use_a, nearest));
+
+		const __m128i d = _mm_and_si128(_mm_add_epi16(x, nearest), _mm_set1_epi16(0xff));
+		store_pixel(_row + i, _mm_packus_epi16(d, d), _bpp);
+		c = b;
+		a = d;
+	}
+	unfilter_tail(FILTER_PAETH, _row, _prev, i, _row_size, _bpp);
+}
+
+//the pixel kernels are only ever called through these - one copy per pixel size, so load_pixel() and store_pixel()
+//fold to single moves instead of sitting on the pixel to pixel dependency chain as memcpy calls
+#define PIXEL_INSTANCE(_kernel, _target, _bpp)																	\
+	__attribute__((target(_target)))																			\
+	static void _kernel##_##_bpp(uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _unused)	\
+	{																											\
+		(void)_unused;																							\
+		_kernel(_row, _prev, _row_size, _bpp);																	\
+	}
+#define PIXEL_INSTANCES(_kernel, _target)																		\
+	PIXEL_INSTANCE(_kernel, _target, 3)																			\
+	PIXEL_INSTANCE(_kernel, _target, 4)																			\
+	PIXEL_INSTANCE(_kernel, _target, 6)																			\
+	PIXEL_INSTANCE(_kernel, _target, 8)																			\
+	static const unfilter_fn _kernel##_by_bpp[BPP_CASES] = {NULL, NULL, _kernel##_3, _kernel##_4, _kernel##_6, _kernel##_8};
+
+PIXEL_INSTANCES(unfilter_sub_pixel_sse2, "sse2")
+PIXEL_INSTANCES(unfilter_average_pixel_sse2, "sse2")
+PIXEL_INSTANCES(unfilter_paeth_pixel_sse2, "sse2")
+PIXEL_INSTANCES(unfilter_paeth_pixel_ssse3, "ssse3")
+#undef PIXEL_INSTANCES
+#undef PIXEL_INSTANCE
+
+__attribute__((target("avx2")))
+static void unfilter_up_avx2(uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp)
+{
+	size_t i = 0;
+	for(; i + 32 <= _row_size; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(_row + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(_prev + i));
+		_mm256_storeu_si256((__m256i*)(_row + i), _mm256_add_epi8(x, b));
+	}
+	unfilter_up_scalar(_row + i, _prev + i, _row_size - i, _bpp);
+}
+
+__attribute__((target("avx2")))
+static void unfilter_sub_prefix_avx2(uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp)
+{
+	//prefix sum inside each 128 bit lane, then the low lane total is carried into the high lane
+	__m256i carry = _mm256_setzero_si256();
+	size_t i = 0;
+	for(; i + 32 <= _row_size; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(_row + i));
+		switch(_bpp) {
+			case 1: x = _mm256_add_epi8(x, _mm256_slli_si256(x, 1));	//fallthrough
+			case 2: x = _mm256_add_epi8(x, _mm256_slli_si256(x, 2));	//fallthrough
+			case 4: x = _mm256_add_epi8(x, _mm256_slli_si256(x, 4));	//fallthrough
+			case 8: x = _mm256_add_epi8(x, _mm256_slli_si256(x, 8));
+		}
+
+		//last pixel of each lane broadcast across that lane
+		__m256i last;
+		switch(_bpp) {
+			case 1: last = _mm256_shuffle_epi8(x, _mm256_set1_epi8(15)); break;
+			case 2: last = _mm256_shuffle_epi8(x, _mm256_set1_epi16(0x0f0e)); break;
+			case 4: last = _mm256_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3)); break;
+			default: last = _mm256_unpackhi_epi64(x, x); break;
+		}
+		//low lane last pixel goes into the high lane only
+		x = _mm256_add_epi8(x, _mm256_permute2x128_si256(last, last, 0x08));
+		x = _mm256_add_epi8(x, carry);
+		_mm256_storeu_si256((__m256i*)(_row + i), x);
+
+		//high lane total now already includes the low lane, so its last pixel is the new carry
+		const __m256i high_last = _mm256_add_epi8(last, _mm256_permute2x128_si256(last, last, 0x08));
+		carry = _mm256_add_epi8(_mm256_permute2x128_si256(high_last, high_last, 0x11), carry);
+	}
+	if(i == 0) {
+		unfilter_sub_prefix_sse2(_row, _prev, _row_size, _bpp);
+		return;
+	}
+	for(; i < _row_size; ++i) {
+		_row[i] += _row[i - _bpp];
+	}
+}
+
+////////////////////////// x86 forward kernels
+//unlike reconstruction, filtering only ever looks at unfiltered bytes, so every byte of a row is independent - the
+//first pixel is done scalar (its left neighbours are zero) and the rest a whole register at a time, with left and
+//upper left loaded from _bpp bytes back
+
+__attribute__((target("sse2")))
+static inline __m128i paeth_half_sse2(const __m128i _a, const __m128i _b, const __m128i _c)
+{
+	//16 bit lanes, same reasoning as when reconstructing
+	const __m128i zero = _mm_setzero_si128();
+	__m128i pa = _mm_sub_epi16(_b, _c);
+	__m128i pb = _mm_sub_epi16(_a, _c);
+	__m128i pc = _mm_add_epi16(pa, pb);
+	pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+	pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+	pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+	const __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+	return if_then_else_sse2(_mm_cmpeq_epi16(smallest, pa), _a, if_then_else_sse2(_mm_cmpeq_epi16(smallest, pb), _b, _c));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i filter_block_sse2(const uint8_t _filter_type, const __m128i _x, const __m128i _a, const __m128i _b, const __m128i _c)
+{
+	switch(_filter_type) {
+		case FILTER_SUB: return _mm_sub_epi8(_x, _a);
+		case FILTER_UP:	 return _mm_sub_epi8(_x, _b);
+		case FILTER_AVERAGE: {
+			//avg_epu8 rounds up, the spec wants floor
+			const __m128i avg = _mm_sub_epi8(_mm_avg_epu8(_a, _b), _mm_and_si128(_mm_xor_si128(_a, _b), _mm_set1_epi8(1)));
+			return _mm_sub_epi8(_x, avg);
+		}
+		case FILTER_PAETH: {
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i low  = paeth_half_sse2(_mm_unpacklo_epi8(_a, zero), _mm_unpacklo_epi8(_b, zero), _mm_unpacklo_epi8(_c, zero));
+			const __m128i high = paeth_half_sse2(_mm_unpackhi_epi8(_a, zero), _mm_unpackhi_epi8(_b, zero), _mm_unpackhi_epi8(_c, zero));
+			return _mm_sub_epi8(_x, _mm_packus_epi16(low, high));
+		}
+	}
+	return _x;
+}
+
+__attribute__((target("sse2")))
+static inline __m128i abs_sum_sse2(const __m128i _sum, const __m128i _filtered)
+{
+	//|x| of a signed byte is min(x, -x) taken as unsigned - -128 stays 128
+	const __m128i magnitude = _mm_min_epu8(_filtered, _mm_sub_epi8(_mm_setzero_si128(), _filtered));
+	return _mm_add_epi64(_sum, _mm_sad_epu8(magnitude, _mm_setzero_si128()));
+}
+
+__attribute__((target("sse2")))
+static void score_filters_sse2(const uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp, uint64_t* _sums)
+{
+	memset(_sums, 0, sizeof(uint64_t) * FILTER_SIZE);
+	const size_t head = _bpp < _row_size ? _bpp : _row_size;
+	score_range_scalar(_row, _prev, 0, head, _bpp, _sums);
+
+	__m128i sums[FILTER_SIZE];
+	for(int f = 0; f < FILTER_SIZE; ++f) {
+		sums[f] = _mm_setzero_si128();
+	}
+	size_t i = head;
+	for(; i + 16 <= _row_size; i += 16) {
+		const __m128i x = _mm_loadu_si128((const __m128i*)(_row + i));
+		const __m128i a = _mm_loadu_si128((const __m128i*)(_row + i - _bpp));
+		const __m128i b = _mm_loadu_si128((const __m128i*)(_prev + i));
+		const __m128i c = _mm_loadu_si128((const __m128i*)(_prev + i - _bpp));
+		for(uint8_t f = 0; f < FILTER_SIZE; ++f) {
+			sums[f] = abs_sum_sse2(sums[f], filter_block_sse2(f, x, a, b, c));
+		}
+	}
+	for(int f = 0; f < FILTER_SIZE; ++f) {
+		_sums[f] += (uint64_t)_mm_cvtsi128_si64(sums[f]) + (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(sums[f], sums[f]));
+	}
+	score_range_scalar(_row, _prev, i, _row_size, _bpp, _sums);
+}
+
+__attribute__((target("sse2")))
+static void filter_row_sse2(const uint8_t _filter_type, const uint8_t* _row, const uint8_t* _prev, uint8_t* _out, const size_t _row_size, const uint8_t _bpp)
+{
+	const size_t head = _bpp < _row_size ? _bpp : _row_size;
+	filter_range_scalar(_filter_type, _row, _prev, _out, 0, head, _bpp);
+	size_t i = head;
+	for(; i + 16 <= _row_size; i += 16) {
+		const __m128i x = _mm_loadu_si128((const __m128i*)(_row + i));
+		const __m128i a = _mm_loadu_si128((const __m128i*)(_row + i - _bpp));
+		const __m128i b = _mm_loadu_si128((const __m128i*)(_prev + i));
+		const __m128i c = _mm_loadu_si128((const __m128i*)(_prev + i - _bpp));
+		_mm_storeu_si128((__m128i*)(_out + i), filter_block_sse2(_filter_type, x, a, b, c));
+	}
+	filter_range_scalar(_filter_type, _row, _prev, _out, i, _row_size, _bpp);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i paeth_half_avx2(const __m256i _a, const __m256i _b, const __m256i _c)
+{
+	__m256i pa = _mm256_sub_epi16(_b, _c);
+	__m256i pb = _mm256_sub_epi16(_a, _c);
+	__m256i pc = _mm256_abs_epi16(_mm256_add_epi16(pa, pb));
+	pa = _mm256_abs_epi16(pa);
+	pb = _mm256_abs_epi16(pb);
+	const __m256i smallest = _mm256_min_epi16(pc, _mm256_min_epi16(pa, pb));
+	const __m256i nearest  = _mm256_blendv_epi8(_c, _b, _mm256_cmpeq_epi16(smallest, pb));
+	return _mm256_blendv_epi8(nearest, _a, _mm256_cmpeq_epi16(smallest, pa));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i filter_block_avx2(const uint8_t _filter_type, const __m256i _x, const __m256i _a, const __m256i _b, const __m256i _c)
+{
+	switch(_filter_type) {
+		case FILTER_SUB: return _mm256_sub_epi8(_x, _a);
+		case FILTER_UP:	 return _mm256_sub_epi8(_x, _b);
+		case FILTER_AVERAGE: {
+			const __m256i avg = _mm256_sub_epi8(_mm256_avg_epu8(_a, _b), _mm256_and_si256(_mm256_xor_si256(_a, _b), _mm256_set1_epi8(1)));
+			return _mm256_sub_epi8(_x, avg);
+		}
+		case FILTER_PAETH: {
+			//unpacking and packing both stay inside 128 bit lanes, so bytes come back in order
+			const __m256i zero = _mm256_setzero_si256();
+			const __m256i low  = paeth_half_avx2(_mm256_unpacklo_epi8(_a, zero), _mm256_unpacklo_epi8(_b, zero), _mm256_unpacklo_epi8(_c, zero));
+			const __m256i high = paeth_half_avx2(_mm256_unpackhi_epi8(_a, zero), _mm256_unpackhi_epi8(_b, zero), _mm256_unpackhi_epi8(_c, zero));
+			return _mm256_sub_epi8(_x, _mm256_packus_epi16(low, high));
+		}
+	}
+	return _x;
+}
+
+__attribute__((target("avx2")))
+static void score_filters_avx2(const uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp, uint64_t* _sums)
+{
+	memset(_sums, 0, sizeof(uint64_t) * FILTER_SIZE);
+	const size_t head = _bpp < _row_size ? _bpp : _row_size;
+	score_range_scalar(_row, _prev, 0, head, _bpp, _sums);
+
+	__m256i sums[FILTER_SIZE];
+	for(int f = 0; f < FILTER_SIZE; ++f) {
+		sums[f] = _mm256_setzero_si256();
+	}
+	size_t i = head;
+	for(; i + 32 <= _row_size; i += 32) {
+		const __m256i x = _mm256_loadu_si256((const __m256i*)(_row + i));
+		const __m256i a = _mm256_loadu_si256((const __m256i*)(_row + i - _bpp));
+		const __m256i b = _mm256_loadu_si256((const __m256i*)(_prev + i));
+		const __m256i c = _mm256_loadu_si256((const __m256i*)(_prev + i - _bpp));
+		for(uint8_t f = 0; f < FILTER_SIZE; ++f) {
+			const __m256i filtered = filter_block_avx2(f, x, a, b, c);
+			sums[f] = _mm256_add_epi64(sums[f], _mm256_sad_epu8(_mm256_abs_epi8(filtered), _mm256_setzero_si256()));
+		}
+	}
+	for(int f = 0; f < FILTER_SIZE; ++f) {
+		uint64_t lanes[4];
+		_mm256_storeu_si256((__m256i*)lanes, sums[f]);
+		_sums[f] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+	score_range_scalar(_row, _prev, i, _row_size, _bpp, _sums);
+}
+
+__attribute__((target("avx2")))
+static void filter_row_avx2(const uint8_t _filter_type, const uint8_t* _row, const uint8_t* _prev, uint8_t* _out, const size_t _row_size, const uint8_t _bpp)
+{
+	const size_t head = _bpp < _row_size ? _bpp : _row_size;
+	filter_range_scalar(_filter_type, _row, _prev, _out, 0, head, _bpp);
+	size_t i = head;
+	for(; i + 32 <= _row_size; i += 32) {
+		const __m256i x = _mm256_loadu_si256((const __m256i*)(_row + i));
+		const __m256i a = _mm256_loadu_si256((const __m256i*)(_row + i - _bpp));
+		const __m256i b = _mm256_loadu_si256((const __m256i*)(_prev + i));
+		const __m256i c = _mm256_loadu_si256((const __m256i*)(_prev + i - _bpp));
+		_mm256_storeu_si256((__m256i*)(_out + i), filter_block_avx2(_filter_type, x, a, b, c));
+	}
+	filter_range_scalar(_filter_type, _row, _prev, _out, i, _row_size, _bpp);
+}
+#endif //FILTER_X86
+
+static void unfilter_init()
+{
+	static const uint8_t bpp_values[BPP_CASES] = {1, 2, 3, 4, 6, 8};
+	for(int i = 0; i < BPP_CASES; ++i) {
+		unfilter_table[FILTER_NONE][i]	  = unfilter_none_scalar;
+		unfilter_table[FILTER_SUB][i]	  = unfilter_sub_scalar;
+		unfilter_table[FILTER_UP][i]	  = unfilter_up_scalar;
+		unfilter_table[FILTER_AVERAGE][i] = unfilter_average_scalar;
+		unfilter_table[FILTER_PAETH][i]	  = unfilter_paeth_scalar;
+	}
+	selected_impl = FILTER_IMPL_SCALAR;
+
+#ifdef FILTER_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("sse2")) {
+		for(int i = 0; i < BPP_CASES; ++i) {
+			const uint8_t bpp = bpp_values[i];
+			unfilter_table[FILTER_UP][i] = unfilter_up_sse2;
+			if(bpp == 3 || bpp == 6) {
+				unfilter_table[FILTER_SUB][i] = unfilter_sub_pixel_sse2_by_bpp[i];
+			} else {
+				unfilter_table[FILTER_SUB][i] = unfilter_sub_prefix_sse2;
+			}
+			if(bpp >= 3) {
+				unfilter_table[FILTER_AVERAGE][i] = unfilter_average_pixel_sse2_by_bpp[i];
+				unfilter_table[FILTER_PAETH][i]	  = unfilter_paeth_pixel_sse2_by_bpp[i];
+			}
+		}
+		selected_impl = FILTER_IMPL_SSE2;
+	}
+	if(__builtin_cpu_supports("ssse3")) {
+		for(int i = 0; i < BPP_CASES; ++i) {
+			if(bpp_values[i] >= 3) {
+				unfilter_table[FILTER_PAETH][i] = unfilter_paeth_pixel_ssse3_by_bpp[i];
+			}
+		}
+		selected_impl = FILTER_IMPL_SSSE3;
+	}
+	if(__builtin_cpu_supports("avx2")) {
+		for(int i = 0; i < BPP_CASES; ++i) {
+			const uint8_t bpp = bpp_values[i];
+			unfilter_table[FILTER_UP][i] = unfilter_up_avx2;
+			if(bpp != 3 && bpp != 6) {
+				unfilter_table[FILTER_SUB][i] = unfilter_sub_prefix_avx2;
+			}
+		}
+		selected_impl = FILTER_IMPL_AVX2;
+	}
+#else
+	(void)bpp_values;
+#endif
+}
+
+static void filter_init()
+{
+	score_impl			 = score_filters_scalar;
+	filter_impl			 = filter_row_scalar;
+	selected_filter_impl = FILTER_IMPL_SCALAR;
+
+#ifdef FILTER_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("sse2")) {
+		score_impl			 = score_filters_sse2;
+		filter_impl			 = filter_row_sse2;
+		selected_filter_impl = FILTER_IMPL_SSE2;
+	}
+	if(__builtin_cpu_supports("avx2")) {
+		score_impl			 = score_filters_avx2;
+		filter_impl			 = filter_row_avx2;
+		selected_filter_impl = FILTER_IMPL_AVX2;
+	}
+#endif
+}
+
+#undef BPP_CASES
+#ifdef FILTER_X86
+#undef FILTER_X86
+#endif
@@ -0,0 +1,47 @@
+#ifndef __PNG_FILTER__
+#define __PNG_FILTER__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+////////////////////////// typedefs
+typedef enum {
+	FILTER_NONE = 0,
+	FILTER_SUB,
+	FILTER_UP,
+	FILTER_AVERAGE,
+	FILTER_PAETH,
+	FILTER_SIZE
+} filter_type_e;
+
+typedef enum {
+	//which implementation got picked for the running cpu
+	FILTER_IMPL_SCALAR = 0,
+	FILTER_IMPL_SSE2,
+	FILTER_IMPL_SSSE3,
+	FILTER_IMPL_AVX2,
+} filter_impl_e;
+
+////////////////////////// declarations
+//reverses filter of a single scanline in place
+//_prev has to point at the previous, already reconstructed scanline (all zeros for the first one)
+//_bpp is the number of bytes per complete pixel rounded up to 1 - so one of 1, 2, 3, 4, 6, 8
+bool unfilter_row(const uint8_t _filter_type, uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp);
+
+//scalar reference version - always available, mostly useful for checking simd kernels against
+void unfilter_row_scalar(const uint8_t _filter_type, uint8_t* _row, const uint8_t* _prev, const size_t _row_size, const uint8_t _bpp);
+
+filter_impl_e unfilter_get_impl();
+
+//forward direction, for the encoder - filters _row into _out (filter byte not included), _prev is the unfiltered row
+//above it (all zeros for the first one) - any _bpp from 1 to 8 works
+void filter_row(const uint8_t _filter_type, const uint8_t* _row, const uint8_t* _prev, uint8_t* _out, const size_t _row_size, const uint8_t _bpp);
+//picks the filter whose output has the smallest sum of absolute values, bytes taken as signed - the heuristic most
+//encoders use - and writes its type to _out[0] with the filtered row right after it
+uint8_t filter_row_adaptive(const uint8_t* _row, const uint8_t* _prev, uint8_t* _out, const size_t _row_size, const uint8_t _bpp);
+uint8_t filter_row_adaptive_scalar(const uint8_t* _row, const uint8_t* _prev, uint8_t* _out, const size_t _row_size, const uint8_t _bpp);
+
+filter_impl_e filter_get_impl();
+
+#endif //__PNG_FILTER__
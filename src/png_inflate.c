@@ -0,0 +1,714 @@
+#include "png_inflate.h"
+#include "logger.h"
+#include "zlib.h"
+
+#include <string.h>
+#include <limits.h>
+
+#define MAX_CODE_LEN		15
+#define LITLEN_SYMBOLS		288
+#define DIST_SYMBOLS		32
+#define PRECODE_SYMBOLS		19
+#define END_OF_BLOCK		256
+//dynamic blocks may not use the last two symbols of either alphabet
+#define MAX_LITLEN_CODES	286
+#define MAX_DIST_CODES		30
+//primary lookup bits of each table - codes longer than that continue in a subtable of their prefix
+#define LITLEN_TABLE_BITS	11
+#define DIST_TABLE_BITS		8
+#define PRECODE_TABLE_BITS	7
+//there is at most one subtable per code longer than the primary bits, each one as large as the longest code needs
+#define LITLEN_TABLE_SIZE	((1 << LITLEN_TABLE_BITS) + LITLEN_SYMBOLS * (1 << (MAX_CODE_LEN - LITLEN_TABLE_BITS)))
+#define DIST_TABLE_SIZE		((1 << DIST_TABLE_BITS) + DIST_SYMBOLS * (1 << (MAX_CODE_LEN - DIST_TABLE_BITS)))
+//a refill leaves at least this many bits in the buffer - enough for a length and a distance code with all their extra bits
+#define REFILL_BITS			56
+//fast loop refills twice per step straight from the current piece, and writes up to 3 literals and a whole match plus up
+//to 7 bytes past it, all unchecked
+#define FAST_INPUT_MARGIN	16
+#define FAST_OUTPUT_MARGIN	(3 + 258 + 8)
+//literals decoded from a single refill - three of the longest codes still fit in it
+#define FAST_LITERALS		3
+//zlib takes uInt sized pieces
+#define MAX_INFLATE_PIECE	(1u << 30)
+
+//table entry - bits the code takes in the low byte, then its kind, then how many extra bits follow (or how many bits
+//index the subtable), and the literal, the length or distance base, or where the subtable starts in the upper half
+#define ENTRY(_value, _kind, _extra, _bits) \
+	(((uint32_t)(_value) << 16) | ((uint32_t)(_extra) << 12) | ((uint32_t)(_kind) << 8) | (uint32_t)(_bits))
+#define ENTRY_BITS(_entry)	((_entry) & 0xff)
+#define ENTRY_KIND(_entry)	(((_entry) >> 8) & 0xf)
+#define ENTRY_EXTRA(_entry) (((_entry) >> 12) & 0xf)
+#define ENTRY_VALUE(_entry) ((_entry) >> 16)
+#define LOW_BITS(_bits, _n) ((uint32_t)(_bits) & ((1u << (_n)) - 1))
+
+//looks the next code up and drops its bits - codes that go on in a subtable drop the primary bits first
+#define DECODE_ENTRY(_entry, _table, _table_bits, _bits, _count)								\
+do {																							\
+	_entry = (_table)[LOW_BITS(_bits, _table_bits)];											\
+	if(ENTRY_KIND(_entry) == ENTRY_SUBTABLE) {													\
+		_bits  >>= (_table_bits);																\
+		_count  -= (_table_bits);																\
+		_entry	 = (_table)[ENTRY_VALUE(_entry) + LOW_BITS(_bits, ENTRY_EXTRA(_entry))];		\
+	}																							\
+	_bits  >>= ENTRY_BITS(_entry);																\
+	_count	-= ENTRY_BITS(_entry);																\
+} while(0)
+
+//at least REFILL_BITS in the buffer from a single unaligned load - only the bytes that fit whole are counted, the rest
+//stays above count and gets or-ed over with the same bits by the next refill
+#define REFILL_FAST(_bits, _count, _next)				\
+do {													\
+	_bits  |= load_le64(_next) << (_count);				\
+	_next  += (63 - (_count)) >> 3;						\
+	_count |= REFILL_BITS;								\
+} while(0)
+
+typedef enum {
+	ENTRY_INVALID = 0,	//zeroed tables decode to errors
+	ENTRY_LITERAL,		//code length symbols too
+	ENTRY_LENGTH,
+	ENTRY_END,
+	ENTRY_DISTANCE,
+	ENTRY_SUBTABLE,
+} entry_kind_e;
+
+typedef struct {
+	uint64_t		  bits;			//next bits of the stream, first one lowest
+	uint			  count;		//how many of them are valid
+	const uint8_t*	  next;			//first byte that is not in bits yet
+	const uint8_t*	  end;			//of the current piece
+	const png_span_s* pieces;		//the ones after the current piece
+	size_t			  pieces_left;
+	size_t			  overrun;		//zero bytes made up past the end of the input - no code may take bits from them
+} bit_reader_s;
+
+typedef struct {
+	uint8_t* start;					//matches never reach before it - there is no window, the whole output is the history
+	uint8_t* next;
+	uint8_t* end;
+} output_s;
+
+typedef struct {
+	//rebuilt for every dynamic block
+	uint32_t litlen[LITLEN_TABLE_SIZE];
+	uint32_t dist[DIST_TABLE_SIZE];
+	uint32_t precode[1 << PRECODE_TABLE_BITS];
+} dynamic_tables_s;
+
+////////////////////////// global variables
+static const uint16_t length_base[]	 = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t  length_extra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t dist_base[]	 = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049,
+										3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t  dist_extra[]	 = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+//order the code length code lengths are stored in - the ones most likely to be zero last
+static const uint8_t  precode_order[PRECODE_SYMBOLS] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+//filled once at startup - afterwards only read, so it is safe to share between threads
+static uint32_t litlen_symbols[LITLEN_SYMBOLS];
+static uint32_t dist_symbols[DIST_SYMBOLS];
+static uint32_t precode_symbols[PRECODE_SYMBOLS];
+static uint32_t fixed_litlen[1 << LITLEN_TABLE_BITS];
+static uint32_t fixed_dist[1 << DIST_TABLE_BITS];
+
+
+////////////////////////// declarations
+static const bool build_table(const uint8_t* _lengths, const uint _count, const uint32_t* _symbols, const uint _table_bits,
+		const uint _table_size, const bool _allow_incomplete, uint32_t* _table);
+static inline uint64_t load_le64(const uint8_t* _data);
+static void refill(bit_reader_s* _reader);
+static inline uint32_t take_bits(bit_reader_s* _reader, const uint _count);
+static inline bool overran(const bit_reader_s* _reader);
+static const bool read_dynamic_tables(bit_reader_s* _reader, dynamic_tables_s* _tables);
+static const bool copy_stored(bit_reader_s* _reader, output_s* _out);
+static const bool decode_huffman(bit_reader_s* _reader, const uint32_t* _litlen, const uint32_t* _dist, output_s* _out);
+static inline void copy_match(uint8_t* _out, const size_t _distance, const size_t _length);
+static void inflate_init() __attribute__((constructor));
+
+
+////////////////////////// definitions
+bool png_inflate_builtin(void* _user, const png_span_s* _input, const size_t _input_count, uint8_t* _output, const size_t _output_size)
+{
+	(void)_user;
+	bit_reader_s reader = {.pieces = _input, .pieces_left = _input_count};
+	output_s	 out	= {.start = _output, .next = _output, .end = _output + _output_size};
+
+	//deflate with at most a 32k window and no preset dictionary - png allows nothing else
+	refill(&reader);
+	const uint32_t method = take_bits(&reader, 8);
+	const uint32_t flags  = take_bits(&reader, 8);
+	if(overran(&reader) || (method & 0xf) != Z_DEFLATED || (method >> 4) > 7 || ((method << 8) | flags) % 31 != 0 || (flags & 0x20) != 0) {
+		LOG(LOG_ERROR, "invalid zlib header %02x %02x", method, flags);
+		return false;
+	}
+
+	dynamic_tables_s dynamic;
+	bool final = false;
+	while(!final) {
+		refill(&reader);
+		final = take_bits(&reader, 1);
+		const uint32_t type = take_bits(&reader, 2);
+		bool decoded = false;
+		switch(type) {
+			case 0: {
+				decoded = copy_stored(&reader, &out);
+				break;
+			}
+			case 1: {
+				decoded = decode_huffman(&reader, fixed_litlen, fixed_dist, &out);
+				break;
+			}
+			case 2: {
+				decoded = read_dynamic_tables(&reader, &dynamic) && decode_huffman(&reader, dynamic.litlen, dynamic.dist, &out);
+				break;
+			}
+			default: {
+				LOG(LOG_ERROR, "invalid block type %u", type);
+				break;
+			}
+		}
+		if(!decoded) {
+			return false;
+		}
+	}
+
+	//adler32 of the output, big endian, on the first byte boundary after the last block
+	reader.bits	 >>= reader.count & 7;
+	reader.count  -= reader.count & 7;
+	refill(&reader);
+	uint32_t expected = 0;
+	for(int i = 0; i < 4; ++i) {
+		expected = (expected << 8) | take_bits(&reader, 8);
+	}
+	const size_t produced = out.next - out.start;
+	if(overran(&reader)) {
+		LOG(LOG_ERROR, "compressed stream ended prematurely - got %zu out of %zu bytes", produced, _output_size);
+		return false;
+	}
+	if(produced != _output_size) {
+		LOG(LOG_ERROR, "inflated %zu bytes but expected %zu", produced, _output_size);
+		return false;
+	}
+	const uint32_t adler = adler32_z(adler32(0, Z_NULL, 0), _output, produced);
+	if(adler != expected) {
+		LOG(LOG_ERROR, "adler32 of inflated data is %08x but the stream says %08x", adler, expected);
+		return false;
+	}
+
+	size_t trailing = reader.count / 8 - reader.overrun + (reader.end - reader.next);
+	for(size_t p = 0; p < reader.pieces_left; ++p) {
+		trailing += reader.pieces[p].size;
+	}
+	if(trailing > 0) {
+		LOG(LOG_WARNING, "ignoring %zu bytes after the end of compressed stream", trailing);
+	}
+	return true;
+}
+
+bool png_inflate_zlib(void* _user, const png_span_s* _input, const size_t _input_count, uint8_t* _output, const size_t _output_size)
+{
+	(void)_user;
+	z_stream strm;
+	memset(&strm, 0, sizeof(z_stream));
+	int ret = inflateInit(&strm);
+	if(ret != Z_OK) {
+		LOG(LOG_ERROR, "could not prepare inflate stream: %d", ret);
+		return false;
+	}
+
+	strm.next_out = _output;
+	size_t trailing = 0;
+	for(size_t p = 0; p < _input_count; ++p) {
+		const uint8_t* data = _input[p].data;
+		size_t		   left = _input[p].size;
+		while(left > 0 && ret != Z_STREAM_END) {
+			const size_t produced = strm.next_out - _output;
+			strm.next_in   = (Bytef*)data;
+			strm.avail_in  = left < MAX_INFLATE_PIECE ? (uInt)left : MAX_INFLATE_PIECE;
+			strm.avail_out = _output_size - produced < MAX_INFLATE_PIECE ? (uInt)(_output_size - produced) : MAX_INFLATE_PIECE;
+			const uInt piece = strm.avail_in;
+			ret = inflate(&strm, Z_NO_FLUSH);
+			data += piece - strm.avail_in;
+			left -= piece - strm.avail_in;
+			if(ret == Z_BUF_ERROR) {
+				//no room left but still input - image data is larger than the output
+				LOG(LOG_ERROR, "inflated data does not fit in %zu bytes", _output_size);
+				(void)inflateEnd(&strm);
+				return false;
+			}
+			if(ret != Z_OK && ret != Z_STREAM_END) {
+				LOG(LOG_ERROR, "inflate failed: %d (%s)", ret, strm.msg ? strm.msg : "no message");
+				(void)inflateEnd(&strm);
+				return false;
+			}
+		}
+		trailing += left;
+	}
+
+	const size_t produced = strm.next_out - _output;
+	(void)inflateEnd(&strm);
+	if(ret != Z_STREAM_END) {
+		LOG(LOG_ERROR, "compressed stream ended prematurely - got %zu out of %zu bytes", produced, _output_size);
+		return false;
+	}
+	if(produced != _output_size) {
+		LOG(LOG_ERROR, "inflated %zu bytes but expected %zu", produced, _output_size);
+		return false;
+	}
+	if(trailing > 0) {
+		LOG(LOG_WARNING, "ignoring %zu bytes after the end of compressed stream", trailing);
+	}
+	return true;
+}
+
+static const bool build_table(const uint8_t* _lengths, const uint _count, const uint32_t* _symbols, const uint _table_bits,
+		const uint _table_size, const bool _allow_incomplete, uint32_t* _table)
+{
+	uint counts[MAX_CODE_LEN + 1] = {0};
+	for(uint s = 0; s < _count; ++s) {
+		++counts[_lengths[s]];
+	}
+	//kraft sum - an over-subscribed set is never valid, an incomplete one only as a single one bit code, which is what
+	//encoders write for blocks that use a single distance
+	int	 left	 = 1;
+	uint max_len = 0;
+	for(uint len = 1; len <= MAX_CODE_LEN; ++len) {
+		left = 2 * left - (int)counts[len];
+		if(left < 0) {
+			return false;
+		}
+		max_len = counts[len] > 0 ? len : max_len;
+	}
+	const uint primary_size = 1u << _table_bits;
+	if(max_len == 0 || left > 0) {
+		if(max_len > 1 || (max_len == 1 && !_allow_incomplete)) {
+			return false;
+		}
+		//whatever no code reaches decodes to an error - with no codes at all, that is everything
+		memset(_table, 0, sizeof(uint32_t) * primary_size);
+	}
+
+	//symbols in code order - shorter codes first, codes of the same length in symbol order
+	uint offsets[MAX_CODE_LEN + 1];
+	offsets[1] = 0;
+	for(uint len = 1; len < MAX_CODE_LEN; ++len) {
+		offsets[len + 1] = offsets[len] + counts[len];
+	}
+	uint16_t sorted[LITLEN_SYMBOLS];
+	for(uint s = 0; s < _count; ++s) {
+		if(_lengths[s] != 0) {
+			sorted[offsets[_lengths[s]]++] = s;
+		}
+	}
+
+	//codes sharing their first _table_bits bits come one after another in code order, so each subtable is filled in one go
+	const uint sub_bits		  = max_len > _table_bits ? max_len - _table_bits : 0;
+	uint	   next_sub		  = primary_size;
+	uint	   sub_start	  = 0;
+	uint	   current_prefix = UINT_MAX;
+	uint	   code			  = 0;
+	uint	   index		  = 0;
+	for(uint len = 1; len <= max_len; ++len, code <<= 1) {
+		for(uint n = 0; n < counts[len]; ++n, ++code) {
+			const uint32_t symbol = _symbols[sorted[index++]];
+			//codes are stored most significant bit first, which ends up lowest in the bit buffer
+			uint reversed = 0;
+			for(uint bit = 0; bit < len; ++bit) {
+				reversed |= ((code >> bit) & 1) << (len - 1 - bit);
+			}
+			if(len <= _table_bits) {
+				for(uint i = reversed; i < primary_size; i += 1u << len) {
+					_table[i] = symbol | len;
+				}
+				continue;
+			}
+			const uint prefix = reversed & (primary_size - 1);
+			if(prefix != current_prefix) {
+				if(next_sub + (1u << sub_bits) > _table_size) {
+					return false;
+				}
+				current_prefix	= prefix;
+				sub_start		= next_sub;
+				next_sub	   += 1u << sub_bits;
+				_table[prefix]	= ENTRY(sub_start, ENTRY_SUBTABLE, sub_bits, _table_bits);
+			}
+			for(uint i = reversed >> _table_bits; i < (1u << sub_bits); i += 1u << (len - _table_bits)) {
+				_table[sub_start + i] = symbol | (len - _table_bits);
+			}
+		}
+	}
+	return true;
+}
+
+static inline uint64_t load_le64(const uint8_t* _data)
+{
+	uint64_t value;
+	memcpy(&value, _data, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	value = __builtin_bswap64(value);
+#endif
+	return value;
+}
+
+static void refill(bit_reader_s* _reader)
+{
+	//byte by byte near the end of a piece, moving on to the next one - past the last one there are only zeros
+	while(_reader->count < REFILL_BITS) {
+		if(_reader->end - _reader->next >= (ptrdiff_t)sizeof(uint64_t)) {
+			REFILL_FAST(_reader->bits, _reader->count, _reader->next);
+			return;
+		}
+		if(_reader->next == _reader->end && _reader->pieces_left > 0) {
+			_reader->next = _reader->pieces->data;
+			_reader->end  = _reader->pieces->data + _reader->pieces->size;
+			++_reader->pieces;
+			--_reader->pieces_left;
+			continue;
+		}
+		uint64_t byte = 0;
+		if(_reader->next < _reader->end) {
+			byte = *_reader->next++;
+		} else {
+			++_reader->overrun;
+		}
+		_reader->bits  |= byte << _reader->count;
+		_reader->count += 8;
+	}
+}
+
+static inline uint32_t take_bits(bit_reader_s* _reader, const uint _count)
+{
+	const uint32_t value = LOW_BITS(_reader->bits, _count);
+	_reader->bits  >>= _count;
+	_reader->count	-= _count;
+	return value;
+}
+
+static inline bool overran(const bit_reader_s* _reader)
+{
+	//made up bytes are the last ones in the buffer, so a code took some of them once fewer bits are left than they have
+	return _reader->count < 8 * _reader->overrun;
+}
+
+static const bool read_dynamic_tables(bit_reader_s* _reader, dynamic_tables_s* _tables)
+{
+	refill(_reader);
+	const uint litlen_count	 = take_bits(_reader, 5) + 257;
+	const uint dist_count	 = take_bits(_reader, 5) + 1;
+	const uint precode_count = take_bits(_reader, 4) + 4;
+	if(litlen_count > MAX_LITLEN_CODES || dist_count > MAX_DIST_CODES) {
+		LOG(LOG_ERROR, "dynamic block has %u literal/length and %u distance codes", litlen_count, dist_count);
+		return false;
+	}
+
+	uint8_t precode_lengths[PRECODE_SYMBOLS] = {0};
+	for(uint i = 0; i < precode_count; ++i) {
+		refill(_reader);
+		precode_lengths[precode_order[i]] = take_bits(_reader, 3);
+	}
+	if(!build_table(precode_lengths, PRECODE_SYMBOLS, precode_symbols, PRECODE_TABLE_BITS, 1 << PRECODE_TABLE_BITS, false, _tables->precode)) {
+		LOG(LOG_ERROR, "invalid code lengths set");
+		return false;
+	}
+
+	//literal/length and distance code lengths are one sequence - repeats may run from one into the other
+	uint8_t lengths[MAX_LITLEN_CODES + MAX_DIST_CODES];
+	const uint total = litlen_count + dist_count;
+	for(uint i = 0; i < total;) {
+		refill(_reader);
+		uint32_t entry;
+		DECODE_ENTRY(entry, _tables->precode, PRECODE_TABLE_BITS, _reader->bits, _reader->count);
+		if(ENTRY_KIND(entry) != ENTRY_LITERAL) {
+			LOG(LOG_ERROR, "invalid code lengths code");
+			return false;
+		}
+		const uint symbol = ENTRY_VALUE(entry);
+		if(symbol < 16) {
+			lengths[i++] = symbol;
+			continue;
+		}
+		uint8_t value = 0;
+		uint	repeat;
+		if(symbol == 16) {
+			if(i == 0) {
+				LOG(LOG_ERROR, "code length repeat with no length before it");
+				return false;
+			}
+			value  = lengths[i - 1];
+			repeat = 3 + take_bits(_reader, 2);
+		} else if(symbol == 17) {
+			repeat = 3 + take_bits(_reader, 3);
+		} else {
+			repeat = 11 + take_bits(_reader, 7);
+		}
+		if(repeat > total - i) {
+			LOG(LOG_ERROR, "code length repeat of %u runs past %u lengths", repeat, total);
+			return false;
+		}
+		memset(lengths + i, value, repeat);
+		i += repeat;
+	}
+	if(overran(_reader)) {
+		LOG(LOG_ERROR, "compressed stream ended prematurely inside a block header");
+		return false;
+	}
+
+	if(lengths[END_OF_BLOCK] == 0) {
+		LOG(LOG_ERROR, "dynamic block has no end-of-block code");
+		return false;
+	}
+	if(!build_table(lengths, litlen_count, litlen_symbols, LITLEN_TABLE_BITS, LITLEN_TABLE_SIZE, true, _tables->litlen)) {
+		LOG(LOG_ERROR, "invalid literal/lengths set");
+		return false;
+	}
+	if(!build_table(lengths + litlen_count, dist_count, dist_symbols, DIST_TABLE_BITS, DIST_TABLE_SIZE, true, _tables->dist)) {
+		LOG(LOG_ERROR, "invalid distances set");
+		return false;
+	}
+	return true;
+}
+
+static const bool copy_stored(bit_reader_s* _reader, output_s* _out)
+{
+	//LEN and its complement start on the next byte boundary
+	_reader->bits  >>= _reader->count & 7;
+	_reader->count	-= _reader->count & 7;
+	refill(_reader);
+	const uint32_t length	  = take_bits(_reader, 16);
+	const uint32_t complement = take_bits(_reader, 16);
+	if(overran(_reader)) {
+		LOG(LOG_ERROR, "compressed stream ended prematurely inside a block header");
+		return false;
+	}
+	if(length != (~complement & 0xffff)) {
+		LOG(LOG_ERROR, "stored block length %u does not match its complement %u", length, complement);
+		return false;
+	}
+	if(length > (size_t)(_out->end - _out->next)) {
+		LOG(LOG_ERROR, "inflated data does not fit in %zu bytes", (size_t)(_out->end - _out->start));
+		return false;
+	}
+
+	//whatever is left in the bit buffer goes first, the rest is copied straight from the input
+	size_t left = length;
+	for(; left > 0 && _reader->count > 0; --left) {
+		*_out->next++ = take_bits(_reader, 8);
+	}
+	if(overran(_reader)) {
+		LOG(LOG_ERROR, "compressed stream ended prematurely inside a stored block");
+		return false;
+	}
+	if(left > 0) {
+		//bytes above count are the ones about to be copied - the buffer starts over behind them
+		_reader->bits = 0;
+	}
+	while(left > 0) {
+		if(_reader->next == _reader->end) {
+			if(_reader->pieces_left == 0) {
+				LOG(LOG_ERROR, "compressed stream ended prematurely inside a stored block");
+				return false;
+			}
+			_reader->next = _reader->pieces->data;
+			_reader->end  = _reader->pieces->data + _reader->pieces->size;
+			++_reader->pieces;
+			--_reader->pieces_left;
+			continue;
+		}
+		const size_t available = _reader->end - _reader->next;
+		const size_t piece	   = left < available ? left : available;
+		memcpy(_out->next, _reader->next, piece);
+		_out->next	  += piece;
+		_reader->next += piece;
+		left		  -= piece;
+	}
+	return true;
+}
+
+static const bool decode_huffman(bit_reader_s* _reader, const uint32_t* _litlen, const uint32_t* _dist, output_s* _out)
+{
+	const char* error = NULL;
+	while(true) {
+		if(_reader->end - _reader->next > FAST_INPUT_MARGIN && _out->end - _out->next > FAST_OUTPUT_MARGIN) {
+			//far from either end nothing has to be checked but the codes themselves - the reader lives in registers
+			uint64_t	   bits		 = _reader->bits;
+			uint		   count	 = _reader->count;
+			const uint8_t* next		 = _reader->next;
+			const uint8_t* in_limit	 = _reader->end - FAST_INPUT_MARGIN;
+			uint8_t*	   out		 = _out->next;
+			uint8_t*	   out_limit = _out->end - FAST_OUTPUT_MARGIN;
+			bool		   ended	 = false;
+			while(next < in_limit && out < out_limit) {
+				REFILL_FAST(bits, count, next);
+				uint32_t entry;
+				DECODE_ENTRY(entry, _litlen, LITLEN_TABLE_BITS, bits, count);
+				//runs of literals are what unfiltered and noisy rows mostly are
+				for(int literals = 1; literals < FAST_LITERALS && ENTRY_KIND(entry) == ENTRY_LITERAL; ++literals) {
+					*out++ = ENTRY_VALUE(entry);
+					DECODE_ENTRY(entry, _litlen, LITLEN_TABLE_BITS, bits, count);
+				}
+				if(ENTRY_KIND(entry) == ENTRY_LITERAL) {
+					*out++ = ENTRY_VALUE(entry);
+					continue;
+				}
+				//the codes before it may have taken most of the buffer - a length and a distance need up to 48 bits
+				REFILL_FAST(bits, count, next);
+				if(ENTRY_KIND(entry) != ENTRY_LENGTH) {
+					ended = ENTRY_KIND(entry) == ENTRY_END;
+					error = ended ? NULL : "invalid literal/length code";
+					break;
+				}
+				const size_t length = ENTRY_VALUE(entry) + LOW_BITS(bits, ENTRY_EXTRA(entry));
+				bits  >>= ENTRY_EXTRA(entry);
+				count  -= ENTRY_EXTRA(entry);
+				DECODE_ENTRY(entry, _dist, DIST_TABLE_BITS, bits, count);
+				if(ENTRY_KIND(entry) != ENTRY_DISTANCE) {
+					error = "invalid distance code";
+					break;
+				}
+				const size_t distance = ENTRY_VALUE(entry) + LOW_BITS(bits, ENTRY_EXTRA(entry));
+				bits  >>= ENTRY_EXTRA(entry);
+				count  -= ENTRY_EXTRA(entry);
+				if(distance > (size_t)(out - _out->start)) {
+					error = "invalid distance too far back";
+					break;
+				}
+				copy_match(out, distance, length);
+				out += length;
+			}
+			_reader->bits  = bits;
+			_reader->count = count;
+			_reader->next  = next;
+			_out->next	   = out;
+			if(error != NULL) {
+				break;
+			}
+			if(ended) {
+				return true;
+			}
+		}
+
+		//one code at a time close to either end
+		refill(_reader);
+		uint32_t entry;
+		DECODE_ENTRY(entry, _litlen, LITLEN_TABLE_BITS, _reader->bits, _reader->count);
+		if(ENTRY_KIND(entry) == ENTRY_END) {
+			if(overran(_reader)) {
+				error = "compressed stream ended prematurely";
+				break;
+			}
+			return true;
+		}
+		if(ENTRY_KIND(entry) == ENTRY_LITERAL) {
+			if(_out->next == _out->end) {
+				error = "inflated data does not fit in the output";
+				break;
+			}
+			*_out->next++ = ENTRY_VALUE(entry);
+		} else if(ENTRY_KIND(entry) == ENTRY_LENGTH) {
+			const size_t length = ENTRY_VALUE(entry) + take_bits(_reader, ENTRY_EXTRA(entry));
+			DECODE_ENTRY(entry, _dist, DIST_TABLE_BITS, _reader->bits, _reader->count);
+			if(ENTRY_KIND(entry) != ENTRY_DISTANCE) {
+				error = "invalid distance code";
+				break;
+			}
+			const size_t distance = ENTRY_VALUE(entry) + take_bits(_reader, ENTRY_EXTRA(entry));
+			if(distance > (size_t)(_out->next - _out->start)) {
+				error = "invalid distance too far back";
+				break;
+			}
+			if(length > (size_t)(_out->end - _out->next)) {
+				error = "inflated data does not fit in the output";
+				break;
+			}
+			for(size_t i = 0; i < length; ++i) {
+				_out->next[i] = _out->next[i - distance];
+			}
+			_out->next += length;
+		} else {
+			error = "invalid literal/length code";
+			break;
+		}
+		if(overran(_reader)) {
+			error = "compressed stream ended prematurely";
+			break;
+		}
+	}
+	LOG(LOG_ERROR, "%s after %zu bytes", error, (size_t)(_out->next - _out->start));
+	return false;
+}
+
+static inline void copy_match(uint8_t* _out, const size_t _distance, const size_t _length)
+{
+	const uint8_t* src	= _out - _distance;
+	uint8_t*	   stop = _out + _length;
+	if(_distance >= sizeof(uint64_t)) {
+		//8 bytes at a time - they were all written before even when the match overlaps itself, and the few bytes past
+		//the end land where the next codes write anyway
+		do {
+			memcpy(_out, src, sizeof(uint64_t));
+			_out += sizeof(uint64_t);
+			src	 += sizeof(uint64_t);
+		} while(_out < stop);
+	} else if(_distance == 1) {
+		memset(_out, *src, _length);
+	} else {
+		//short repeating pattern - usually runs of identical pixels, with the pixel size as distance
+		do {
+			*_out++ = *src++;
+		} while(_out < stop);
+	}
+}
+
+static void inflate_init()
+{
+	for(uint s = 0; s < LITLEN_SYMBOLS; ++s) {
+		//last two symbols have a fixed code, but mean nothing
+		litlen_symbols[s] = s < END_OF_BLOCK ? ENTRY(s, ENTRY_LITERAL, 0, 0) :
+							s == END_OF_BLOCK ? ENTRY(0, ENTRY_END, 0, 0) :
+							s < END_OF_BLOCK + 1 + sizeof(length_base) / sizeof(length_base[0]) ?
+							ENTRY(length_base[s - END_OF_BLOCK - 1], ENTRY_LENGTH, length_extra[s - END_OF_BLOCK - 1], 0) :
+							ENTRY(0, ENTRY_INVALID, 0, 0);
+	}
+	for(uint s = 0; s < DIST_SYMBOLS; ++s) {
+		dist_symbols[s] = s < MAX_DIST_CODES ? ENTRY(dist_base[s], ENTRY_DISTANCE, dist_extra[s], 0) : ENTRY(0, ENTRY_INVALID, 0, 0);
+	}
+	for(uint s = 0; s < PRECODE_SYMBOLS; ++s) {
+		precode_symbols[s] = ENTRY(s, ENTRY_LITERAL, 0, 0);
+	}
+
+	//fixed codes are short enough to never need a subtable
+	uint8_t lengths[LITLEN_SYMBOLS];
+	memset(lengths,		  8, 144);
+	memset(lengths + 144, 9, 256 - 144);
+	memset(lengths + 256, 7, 280 - 256);
+	memset(lengths + 280, 8, LITLEN_SYMBOLS - 280);
+	(void)build_table(lengths, LITLEN_SYMBOLS, litlen_symbols, LITLEN_TABLE_BITS, 1 << LITLEN_TABLE_BITS, false, fixed_litlen);
+	memset(lengths, 5, DIST_SYMBOLS);
+	(void)build_table(lengths, DIST_SYMBOLS, dist_symbols, DIST_TABLE_BITS, 1 << DIST_TABLE_BITS, false, fixed_dist);
+}
+
+#undef MAX_CODE_LEN
+#undef LITLEN_SYMBOLS
+#undef DIST_SYMBOLS
+#undef PRECODE_SYMBOLS
+#undef END_OF_BLOCK
+#undef MAX_LITLEN_CODES
+#undef MAX_DIST_CODES
+#undef LITLEN_TABLE_BITS
+#undef DIST_TABLE_BITS
+#undef PRECODE_TABLE_BITS
+#undef LITLEN_TABLE_SIZE
+#undef DIST_TABLE_SIZE
+#undef REFILL_BITS
+#undef FAST_INPUT_MARGIN
+#undef FAST_OUTPUT_MARGIN
+#undef FAST_LITERALS
+#undef MAX_INFLATE_PIECE
+#undef ENTRY
+#undef ENTRY_BITS
+#undef ENTRY_KIND
+#undef ENTRY_EXTRA
+#undef ENTRY_VALUE
+#undef LOW_BITS
+#undef DECODE_ENTRY
+#undef REFILL_FAST
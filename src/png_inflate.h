@@ -0,0 +1,33 @@
+#ifndef __PNG_INFLATE__
+#define __PNG_INFLATE__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+////////////////////////// typedefs
+typedef struct {
+	//one contiguous piece of compressed input - an IDAT payload where it sits in the file
+	const uint8_t* data;
+	size_t		   size;
+} png_span_s;
+
+//inflates a complete zlib stream (header and adler32 included) that is the concatenation of _input_count pieces, into
+//exactly _output_size bytes of _output - the whole image, so nothing ever has to be copied out of a window
+//false when the stream is corrupt, ends early or inflates to any other size - _output is then in an undefined state
+typedef bool (*png_inflate_fn)(void* _user, const png_span_s* _input, const size_t _input_count, uint8_t* _output, const size_t _output_size);
+
+typedef struct {
+	//whole stream inflate backend - NULL inflate means png_inflate_builtin
+	png_inflate_fn inflate;
+	void*		   user;
+} png_inflater_s;
+
+////////////////////////// declarations
+//table driven huffman decode straight into _output - ignores _user and never allocates
+bool png_inflate_builtin(void* _user, const png_span_s* _input, const size_t _input_count, uint8_t* _output, const size_t _output_size);
+
+//same through zlib's inflate(), piece by piece - ignores _user, inflate state comes from malloc
+bool png_inflate_zlib(void* _user, const png_span_s* _input, const size_t _input_count, uint8_t* _output, const size_t _output_size);
+
+#endif //__PNG_INFLATE__
@@ -0,0 +1,429 @@
+#include "png_metadata.h"
+#include "png_chunk.h"
+#include "png_crc.h"
+#include "logger.h"
+#include "zlib.h"
+
+#include <string.h>
+
+//entries before the array has to grow - most files have fewer chunks than this
+#define INDEX_MIN_ENTRIES 32
+//spec keeps keywords and profile names between 1 and 79 bytes
+#define KEYWORD_MAX_LEN 79
+#define TIME_LEN	7
+#define EXIF_MIN_LEN 8
+//first guess of what compressed text inflates to - it doubles from there until the stream ends
+#define INFLATE_MIN_SIZE 256
+#define TYPE_TEXT	PNG_CHUNK_TYPE('t', 'E', 'X', 't')
+#define TYPE_ZTEXT	PNG_CHUNK_TYPE('z', 'T', 'X', 't')
+#define TYPE_ITEXT	PNG_CHUNK_TYPE('i', 'T', 'X', 't')
+#define TYPE_ICC	PNG_CHUNK_TYPE('i', 'C', 'C', 'P')
+#define TYPE_EXIF	PNG_CHUNK_TYPE('e', 'X', 'I', 'f')
+#define TYPE_TIME	PNG_CHUNK_TYPE('t', 'I', 'M', 'E')
+//four letters of a chunk type as printf arguments for "%c%c%c%c"
+#define TYPE_LETTERS(_type) (char)((_type) >> 24), (char)((_type) >> 16), (char)((_type) >> 8), (char)(_type)
+
+////////////////////////// declarations
+static const bool grow_entries(png_chunk_index_s* _index);
+static const bool is_text(const uint32_t _type);
+static const uint8_t* checked_data(const png_chunk_index_s* _index, const png_chunk_entry_s* _entry);
+static const uint8_t* split_keyword(const uint8_t* _data, const uint8_t* _end, const char** _keyword, size_t* _keyword_size);
+static const uint8_t* split_string(const uint8_t* _data, const uint8_t* _end, const char** _string, size_t* _string_size);
+static uint8_t* inflate_all(const png_chunk_index_s* _index, const uint8_t* _data, const size_t _size, size_t* _inflated_size);
+
+
+////////////////////////// definitions
+void png_chunk_index_init(png_chunk_index_s* _index, const png_allocator_s* _allocator)
+{
+	ASSERT_AND_FLUSH(_index != NULL);
+	memset(_index, 0, sizeof(png_chunk_index_s));
+	_index->allocator = (_allocator != NULL && _allocator->alloc != NULL) ? *_allocator : png_default_allocator();
+}
+
+bool png_chunk_index_build(png_chunk_index_s* _index, const uint8_t* _png, const uint _size)
+{
+	ASSERT_AND_FLUSH(_index != NULL);
+	ASSERT_AND_FLUSH(_png != NULL || _size == 0);
+
+	_index->png		 = _png;
+	_index->size	 = _size;
+	_index->count	 = 0;
+	_index->complete = false;
+	if(_size < PNG_MAGIC_NUM_LEN || memcmp(_png, PNG_MAGIC_NUMBER, PNG_MAGIC_NUM_LEN) != 0) {
+		LOG(LOG_ERROR, "provided data is not a png");
+		return false;
+	}
+
+	//only the 8 bytes in front of every payload are read - the walk jumps straight from one to the next
+	size_t offset = PNG_MAGIC_NUM_LEN;
+	png_chunk_view_s chunk;
+	png_chunk_walk_e walked;
+	while((walked = png_chunk_next(_png, _size, &offset, &chunk)) == CHUNK_WALK_OK) {
+		if(_index->count == _index->capacity && !grow_entries(_index)) {
+			return false;
+		}
+		_index->entries[_index->count++] = (png_chunk_entry_s){.type = chunk.type, .size = chunk.size, .offset = (uint32_t)chunk.payload};
+		if(chunk.type == TOK_IEND) {
+			_index->complete = true;
+			break;
+		}
+	}
+	if(walked == CHUNK_WALK_TOO_LONG) {
+		LOG(LOG_ERROR, "chunk length does not fit in 31 bits");
+	} else if(walked == CHUNK_WALK_TRUNCATED) {
+		//truncated - chunks in front of this one are still whole
+		LOG(LOG_WARNING, "input ends inside %c%c%c%c", TYPE_LETTERS(chunk.type));
+	}
+
+	if(_index->count == 0 || _index->entries[0].type != TOK_IHDR) {
+		LOG(LOG_ERROR, "first chunk is not IHDR");
+		_index->count = 0;
+		return false;
+	}
+	LOG(LOG_DEBUG_1, "indexed %zu chunks%s", _index->count, _index->complete ? "" : " before the input ended");
+	return true;
+}
+
+void png_chunk_index_release(png_chunk_index_s* _index)
+{
+	if(_index == NULL) {
+		return;
+	}
+	_index->allocator.free(_index->allocator.user, _index->entries);
+	_index->entries	 = NULL;
+	_index->count	 = 0;
+	_index->capacity = 0;
+}
+
+const png_chunk_entry_s* png_chunk_find(const png_chunk_index_s* _index, const uint32_t _type, const png_chunk_entry_s* _after)
+{
+	ASSERT_AND_FLUSH(_index != NULL);
+	//a few dozen entries of 12 bytes each - a scan is a handful of cache lines
+	const size_t first = _after == NULL ? 0 : (size_t)(_after - _index->entries) + 1;
+	for(size_t i = first; i < _index->count; ++i) {
+		if(_index->entries[i].type == _type) {
+			return &(_index->entries[i]);
+		}
+	}
+	return NULL;
+}
+
+const uint8_t* png_chunk_data(const png_chunk_index_s* _index, const png_chunk_entry_s* _entry)
+{
+	ASSERT_AND_FLUSH(_index != NULL);
+	ASSERT_AND_FLUSH(_entry != NULL);
+	return _index->png + _entry->offset;
+}
+
+bool png_chunk_verify(const png_chunk_index_s* _index, const png_chunk_entry_s* _entry)
+{
+	//crc covers chunk type and data, but not the length in front of them
+	const uint8_t* data	  = png_chunk_data(_index, _entry);
+	const uint32_t stored = png_read_be32(data + _entry->size);
+	return png_crc32(0, data - sizeof(uint32_t), (size_t)_entry->size + sizeof(uint32_t)) == stored;
+}
+
+const png_chunk_entry_s* png_metadata_next_text(const png_chunk_index_s* _index, const png_chunk_entry_s* _after)
+{
+	ASSERT_AND_FLUSH(_index != NULL);
+	const size_t first = _after == NULL ? 0 : (size_t)(_after - _index->entries) + 1;
+	for(size_t i = first; i < _index->count; ++i) {
+		if(is_text(_index->entries[i].type)) {
+			return &(_index->entries[i]);
+		}
+	}
+	return NULL;
+}
+
+bool png_metadata_text(const png_chunk_index_s* _index, const png_chunk_entry_s* _entry, png_text_s* _text)
+{
+	ASSERT_AND_FLUSH(_entry != NULL);
+	ASSERT_AND_FLUSH(_text	!= NULL);
+
+	memset(_text, 0, sizeof(png_text_s));
+	if(!is_text(_entry->type)) {
+		LOG(LOG_ERROR, "%c%c%c%c is not a text chunk", TYPE_LETTERS(_entry->type));
+		return false;
+	}
+	const uint8_t* data = checked_data(_index, _entry);
+	if(data == NULL) {
+		return false;
+	}
+	const uint8_t* end	= data + _entry->size;
+	const uint8_t* rest = split_keyword(data, end, &(_text->keyword), &(_text->keyword_size));
+	if(rest == NULL) {
+		return false;
+	}
+
+	//everything after the keyword depends on the kind - only the text itself may be compressed
+	bool compressed = false;
+	switch(_entry->type) {
+		case TYPE_TEXT: {
+			_text->kind = PNG_TEXT_PLAIN;
+			break;
+		}
+		case TYPE_ZTEXT: {
+			_text->kind = PNG_TEXT_COMPRESSED;
+			if(rest == end || *rest != 0) {
+				LOG(LOG_ERROR, "zTXt uses an unknown compression method");
+				return false;
+			}
+			compressed = true;
+			++rest;
+			break;
+		}
+		case TYPE_ITEXT: {
+			//compression flag and method, then language and translated keyword, both terminated
+			_text->kind = PNG_TEXT_INTERNATIONAL;
+			if(end - rest < 2 || rest[0] > 1 || rest[1] != 0) {
+				LOG(LOG_ERROR, "iTXt has a bad compression flag or method");
+				return false;
+			}
+			compressed = rest[0] == 1;
+			rest	   = split_string(rest + 2, end, &(_text->language), &(_text->language_size));
+			rest	   = rest == NULL ? NULL : split_string(rest, end, &(_text->translated_keyword), &(_text->translated_keyword_size));
+			if(rest == NULL) {
+				LOG(LOG_ERROR, "iTXt ends before its language tag and translated keyword do");
+				return false;
+			}
+			break;
+		}
+	}
+
+	if(!compressed) {
+		_text->text		 = (const char*)rest;
+		_text->text_size = end - rest;
+		return true;
+	}
+	_text->inflated = inflate_all(_index, rest, end - rest, &(_text->text_size));
+	_text->text		= (const char*)_text->inflated;
+	return _text->inflated != NULL;
+}
+
+bool png_metadata_icc(const png_chunk_index_s* _index, png_icc_s* _icc)
+{
+	ASSERT_AND_FLUSH(_icc != NULL);
+
+	memset(_icc, 0, sizeof(png_icc_s));
+	const png_chunk_entry_s* entry = png_chunk_find(_index, TYPE_ICC, NULL);
+	if(entry == NULL) {
+		LOG(LOG_INFO, "there is no iCCP chunk");
+		return false;
+	}
+	const uint8_t* data = checked_data(_index, entry);
+	if(data == NULL) {
+		return false;
+	}
+	//profile name, compression method and the profile itself, always compressed
+	const uint8_t* end	= data + entry->size;
+	const uint8_t* rest = split_keyword(data, end, &(_icc->name), &(_icc->name_size));
+	if(rest == NULL) {
+		return false;
+	}
+	if(rest == end || *rest != 0) {
+		LOG(LOG_ERROR, "iCCP uses an unknown compression method");
+		return false;
+	}
+	++rest;
+	_icc->profile = inflate_all(_index, rest, end - rest, &(_icc->profile_size));
+	return _icc->profile != NULL;
+}
+
+bool png_metadata_exif(const png_chunk_index_s* _index, png_span_s* _exif)
+{
+	ASSERT_AND_FLUSH(_exif != NULL);
+
+	const png_chunk_entry_s* entry = png_chunk_find(_index, TYPE_EXIF, NULL);
+	if(entry == NULL) {
+		LOG(LOG_INFO, "there is no eXIf chunk");
+		return false;
+	}
+	const uint8_t* data = checked_data(_index, entry);
+	if(data == NULL) {
+		return false;
+	}
+	//tiff header - byte order mark and 42 in that order
+	if(entry->size < EXIF_MIN_LEN || (memcmp(data, "MM\0*", 4) != 0 && memcmp(data, "II*\0", 4) != 0)) {
+		LOG(LOG_ERROR, "eXIf of %u bytes does not start with a tiff header", entry->size);
+		return false;
+	}
+	*_exif = (png_span_s){.data = data, .size = entry->size};
+	return true;
+}
+
+bool png_metadata_time(const png_chunk_index_s* _index, png_time_s* _time)
+{
+	ASSERT_AND_FLUSH(_time != NULL);
+
+	const png_chunk_entry_s* entry = png_chunk_find(_index, TYPE_TIME, NULL);
+	if(entry == NULL) {
+		LOG(LOG_INFO, "there is no tIME chunk");
+		return false;
+	}
+	if(entry->size != TIME_LEN) {
+		LOG(LOG_ERROR, "tIME is %u bytes long instead of %d", entry->size, TIME_LEN);
+		return false;
+	}
+	const uint8_t* data = checked_data(_index, entry);
+	if(data == NULL) {
+		return false;
+	}
+	*_time = (png_time_s){
+		.year = (uint16_t)((data[0] << 8) | data[1]), .month = data[2], .day = data[3], .hour = data[4], .minute = data[5], .second = data[6],
+	};
+	//60 is a leap second
+	if(_time->month < 1 || _time->month > 12 || _time->day < 1 || _time->day > 31 || _time->hour > 23 || _time->minute > 59 ||
+			_time->second > 60) {
+		LOG(LOG_ERROR, "tIME holds an impossible date: %u-%u-%u %u:%u:%u", _time->year, _time->month, _time->day, _time->hour,
+				_time->minute, _time->second);
+		return false;
+	}
+	return true;
+}
+
+void png_text_free(const png_chunk_index_s* _index, png_text_s* _text)
+{
+	if(_text == NULL) {
+		return;
+	}
+	_index->allocator.free(_index->allocator.user, _text->inflated);
+	_text->inflated	 = NULL;
+	_text->text		 = NULL;
+	_text->text_size = 0;
+}
+
+void png_icc_free(const png_chunk_index_s* _index, png_icc_s* _icc)
+{
+	if(_icc == NULL) {
+		return;
+	}
+	_index->allocator.free(_index->allocator.user, _icc->profile);
+	_icc->profile	   = NULL;
+	_icc->profile_size = 0;
+}
+
+static const bool grow_entries(png_chunk_index_s* _index)
+{
+	const size_t capacity = _index->capacity == 0 ? INDEX_MIN_ENTRIES : 2 * _index->capacity;
+	png_chunk_entry_s* entries = _index->allocator.alloc(_index->allocator.user, capacity * sizeof(png_chunk_entry_s), _Alignof(png_chunk_entry_s));
+	if(entries == NULL) {
+		LOG_ERRNO(LOG_ERROR, "could not allocate %zu chunk entries", capacity);
+		return false;
+	}
+	if(_index->count > 0) {
+		memcpy(entries, _index->entries, _index->count * sizeof(png_chunk_entry_s));
+	}
+	_index->allocator.free(_index->allocator.user, _index->entries);
+	_index->entries	 = entries;
+	_index->capacity = capacity;
+	return true;
+}
+
+static const bool is_text(const uint32_t _type)
+{
+	return _type == TYPE_TEXT || _type == TYPE_ZTEXT || _type == TYPE_ITEXT;
+}
+
+static const uint8_t* checked_data(const png_chunk_index_s* _index, const png_chunk_entry_s* _entry)
+{
+	//accessors only ever trust the one chunk they read, so that is the only crc they pay for
+	if(!png_chunk_verify(_index, _entry)) {
+		LOG(LOG_ERROR, "crc mismatch in %c%c%c%c", TYPE_LETTERS(_entry->type));
+		return NULL;
+	}
+	return png_chunk_data(_index, _entry);
+}
+
+static const uint8_t* split_keyword(const uint8_t* _data, const uint8_t* _end, const char** _keyword, size_t* _keyword_size)
+{
+	//terminated keyword - returns what comes after the terminator
+	const uint8_t* rest = split_string(_data, _end, _keyword, _keyword_size);
+	if(rest == NULL || *_keyword_size == 0 || *_keyword_size > KEYWORD_MAX_LEN) {
+		LOG(LOG_ERROR, "keyword is not terminated or not 1 - %d bytes long", KEYWORD_MAX_LEN);
+		return NULL;
+	}
+	return rest;
+}
+
+static const uint8_t* split_string(const uint8_t* _data, const uint8_t* _end, const char** _string, size_t* _string_size)
+{
+	const uint8_t* terminator = memchr(_data, 0, _end - _data);
+	if(terminator == NULL) {
+		return NULL;
+	}
+	*_string	  = (const char*)_data;
+	*_string_size = terminator - _data;
+	return terminator + 1;
+}
+
+static uint8_t* inflate_all(const png_chunk_index_s* _index, const uint8_t* _data, const size_t _size, size_t* _inflated_size)
+{
+	//nothing stores the inflated size, so the buffer starts at a guess and doubles until the stream ends
+	z_stream strm;
+	memset(&strm, 0, sizeof(z_stream));
+	if(inflateInit(&strm) != Z_OK) {
+		LOG(LOG_ERROR, "could not initialize inflate: %s", strm.msg != NULL ? strm.msg : "no message");
+		return NULL;
+	}
+	const png_allocator_s* allocator = &(_index->allocator);
+	size_t capacity = 4 * _size < INFLATE_MIN_SIZE ? INFLATE_MIN_SIZE : 4 * _size;
+	capacity		= capacity < PNG_METADATA_MAX_INFLATED ? capacity : PNG_METADATA_MAX_INFLATED;
+	uint8_t* output = allocator->alloc(allocator->user, capacity, 1);
+	size_t produced = 0;
+	strm.next_in	= (Bytef*)_data;
+	strm.avail_in	= _size;
+	int ret			= Z_OK;
+	while(output != NULL) {
+		strm.next_out  = output + produced;
+		strm.avail_out = capacity - produced;
+		ret			   = inflate(&strm, Z_NO_FLUSH);
+		produced	   = capacity - strm.avail_out;
+		if(ret != Z_OK) {
+			break;
+		}
+		if(strm.avail_out != 0) {
+			//all input is used up and the stream did not end
+			ret = Z_BUF_ERROR;
+			break;
+		}
+		if(capacity == PNG_METADATA_MAX_INFLATED) {
+			LOG(LOG_ERROR, "metadata inflates to more than %d bytes", PNG_METADATA_MAX_INFLATED);
+			ret = Z_MEM_ERROR;
+			break;
+		}
+		const size_t grown = 2 * capacity < PNG_METADATA_MAX_INFLATED ? 2 * capacity : PNG_METADATA_MAX_INFLATED;
+		uint8_t* bigger	   = allocator->alloc(allocator->user, grown, 1);
+		if(bigger != NULL) {
+			memcpy(bigger, output, produced);
+		}
+		allocator->free(allocator->user, output);
+		output	 = bigger;
+		capacity = grown;
+	}
+	inflateEnd(&strm);
+
+	if(output == NULL) {
+		LOG_ERRNO(LOG_ERROR, "could not allocate %zu bytes for inflated metadata", capacity);
+		return NULL;
+	}
+	if(ret != Z_STREAM_END) {
+		LOG(LOG_ERROR, "compressed metadata is corrupt or incomplete: %d", ret);
+		allocator->free(allocator->user, output);
+		return NULL;
+	}
+	*_inflated_size = produced;
+	return output;
+}
+
+#undef INDEX_MIN_ENTRIES
+#undef KEYWORD_MAX_LEN
+#undef TIME_LEN
+#undef EXIF_MIN_LEN
+#undef INFLATE_MIN_SIZE
+#undef TYPE_TEXT
+#undef TYPE_ZTEXT
+#undef TYPE_ITEXT
+#undef TYPE_ICC
+#undef TYPE_EXIF
+#undef TYPE_TIME
+#undef TYPE_LETTERS
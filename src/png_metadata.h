@@ -0,0 +1,98 @@
+#ifndef __PNG_METADATA__
+#define __PNG_METADATA__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "png_arena.h"
+#include "png_inflate.h"
+#include "png_decoder.h"
+
+////////////////////////// defines
+//most a single accessor inflates text or a profile to - compressed metadata is tiny on disk, and can still be a zip bomb
+#ifndef PNG_METADATA_MAX_INFLATED
+#define PNG_METADATA_MAX_INFLATED (64 * 1024 * 1024)
+#endif
+
+////////////////////////// typedefs
+typedef struct {
+	//where one chunk sits in the input - nothing of its payload was read to get here
+	uint32_t type;		//PNG_CHUNK_TYPE()
+	uint32_t size;		//of the payload
+	uint32_t offset;	//of the payload from the start of the input
+} png_chunk_entry_s;
+
+typedef struct {
+	//every chunk of one png in file order - reuse it between files, entries are scratch that only ever grows
+	const uint8_t*	   png;			//borrowed input - entries and everything accessors hand out point into it
+	uint			   size;
+	png_chunk_entry_s* entries;
+	size_t			   count;
+	size_t			   capacity;
+	bool			   complete;	//walk got to IEND - otherwise the input ended first, the entries up to there are still usable
+	png_allocator_s	   allocator;
+} png_chunk_index_s;
+
+typedef enum {
+	PNG_TEXT_PLAIN = 0,		//tEXt
+	PNG_TEXT_COMPRESSED,	//zTXt
+	PNG_TEXT_INTERNATIONAL,	//iTXt
+} png_text_kind_e;
+
+typedef struct {
+	//one text chunk - strings are not terminated, each comes with its size
+	//all of them point into the input, except text that was compressed, which points at inflated
+	png_text_kind_e kind;
+	const char* keyword;
+	size_t		keyword_size;
+	const char* language;				//iTXt only, empty otherwise
+	size_t		language_size;
+	const char* translated_keyword;		//iTXt only, empty otherwise
+	size_t		translated_keyword_size;
+	const char* text;					//latin-1, utf-8 for iTXt
+	size_t		text_size;
+	uint8_t*	inflated;				//owned, png_text_free() gives it back - NULL when nothing had to be inflated
+} png_text_s;
+
+typedef struct {
+	//embedded icc profile of iCCP - name points into the input, profile is always inflated
+	const char* name;
+	size_t		name_size;
+	uint8_t*	profile;				//owned, png_icc_free() gives it back
+	size_t		profile_size;
+} png_icc_s;
+
+typedef struct {
+	//last modification of tIME, in UTC
+	uint16_t year;
+	uint8_t	 month, day, hour, minute, second;
+} png_time_s;
+
+////////////////////////// declarations
+//NULL _allocator means malloc/free - it backs the entries and whatever accessors inflate
+void png_chunk_index_init(png_chunk_index_s* _index, const png_allocator_s* _allocator);
+//steps from chunk header to chunk header up to IEND and records where each chunk is - payloads and crcs are only jumped
+//over, so IDAT is never inflated and nothing gets copied
+//false when the input is not a png starting with IHDR or the entries could not be allocated
+bool png_chunk_index_build(png_chunk_index_s* _index, const uint8_t* _png, const uint _size);
+void png_chunk_index_release(png_chunk_index_s* _index);
+//first chunk of _type after _after, which may be NULL to start from the beginning - NULL when there is none
+const png_chunk_entry_s* png_chunk_find(const png_chunk_index_s* _index, const uint32_t _type, const png_chunk_entry_s* _after);
+const uint8_t* png_chunk_data(const png_chunk_index_s* _index, const png_chunk_entry_s* _entry);
+//stored crc against the chunk - building the index does not check any, and accessors only check the chunk they read
+bool png_chunk_verify(const png_chunk_index_s* _index, const png_chunk_entry_s* _entry);
+
+//accessors - each one parses, and inflates when it has to, only the chunk it is after, and checks its crc first
+//false when there is no such chunk, it is malformed or memory ran out
+//first text chunk of any kind after _after (NULL for the first one)
+const png_chunk_entry_s* png_metadata_next_text(const png_chunk_index_s* _index, const png_chunk_entry_s* _after);
+bool png_metadata_text(const png_chunk_index_s* _index, const png_chunk_entry_s* _entry, png_text_s* _text);
+bool png_metadata_icc(const png_chunk_index_s* _index, png_icc_s* _icc);
+//raw exif block (tiff header on) where it sits in the input
+bool png_metadata_exif(const png_chunk_index_s* _index, png_span_s* _exif);
+bool png_metadata_time(const png_chunk_index_s* _index, png_time_s* _time);
+void png_text_free(const png_chunk_index_s* _index, png_text_s* _text);
+void png_icc_free(const png_chunk_index_s* _index, png_icc_s* _icc);
+
+#endif //__PNG_METADATA__
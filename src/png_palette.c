@@ -0,0 +1,252 @@
+#include "png_palette.h"
+#include "logger.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PALETTE_X86
+#include <immintrin.h>
+#endif
+
+//one entry per supported bit depth - 1, 2, 4 and 8
+#define DEPTH_CASES 4
+
+//kernels always start on a byte boundary of the scanline
+typedef void (*expand_fn)(const uint8_t* _src, uint8_t* _dst, const size_t _width, const png_palette_lut_s* _lut);
+
+////////////////////////// global variables
+//filled once at startup from cpuid - afterwards only read, so it is safe to share between threads
+static expand_fn	  expand_table[DEPTH_CASES];
+static palette_impl_e selected_impl = PALETTE_IMPL_SCALAR;
+
+
+////////////////////////// declarations
+static int	depth_to_index(const uint8_t _bit_depth);
+static void expand_1_scalar(const uint8_t* _src, uint8_t* _dst, const size_t _width, const png_palette_lut_s* _lut);
+static void expand_2_scalar(const uint8_t* _src, uint8_t* _dst, const size_t _width, const png_palette_lut_s* _lut);
+static void expand_4_scalar(const uint8_t* _src, uint8_t* _dst, const size_t _width, const png_palette_lut_s* _lut);
+static void expand_8_scalar(const uint8_t* _src, uint8_t* _dst, const size_t _width, const png_palette_lut_s* _lut);
+static void palette_init() __attribute__((constructor));
+
+
+////////////////////////// definitions
+void png_palette_lut_update(png_palette_lut_s* _lut)
+{
+	for(int channel = 0; channel < 4; ++channel) {
+		for(int i = 0; i < 16; ++i) {
+			_lut->planes[channel][i] = _lut->rgba[i][channel];
+		}
+	}
+}
+
+void png_expand_palette(const uint8_t* _src, uint8_t* _dst, const size_t _x, const size_t _width, const uint8_t _bit_depth,
+		const png_palette_lut_s* _lut)
+{
+	const int depth_index = depth_to_index(_bit_depth);
+	ASSERT_AND_FLUSH(depth_index >= 0);
+
+	//indices that share their byte with the ones in front of _x go one by one, the rest starts on a byte boundary
+	const size_t per_byte = 8 / _bit_depth;
+	size_t head = (per_byte - _x % per_byte) % per_byte;
+	head = head < _width ? head : _width;
+	if(head > 0) {
+		png_expand_palette_scalar(_src, _dst, _x, head, _bit_depth, _lut);
+	}
+	expand_table[depth_index](_src + (_x + head) / per_byte, _dst + 4 * head, _width - head, _lut);
+}
+
+void png_expand_palette_scalar(const uint8_t* _src, uint8_t* _dst, const size_t _x, const size_t _width, const uint8_t _bit_depth,
+		const png_palette_lut_s* _lut)
+{
+	const uint8_t mask = (1 << _bit_depth) - 1;
+	for(size_t i = 0; i < _width; ++i) {
+		const size_t  bit	= (_x + i) * _bit_depth;
+		const uint8_t index = (_src[bit >> 3] >> (8 - _bit_depth - (bit & 7))) & mask;
+		memcpy(_dst + 4 * i, _lut->rgba[index], 4);
+	}
+}
+
+palette_impl_e png_expand_palette_get_impl()
+{
+	return selected_impl;
+}
+
+static int depth_to_index(const uint8_t _bit_depth)
+{
+	switch(_bit_depth) {
+		case 1: return 0;
+		case 2: return 1;
+		case 4: return 2;
+		case 8: return 3;
+	}
+	return -1;
+}
+
+////////////////////////// scalar reference
+static inline void expand_bits_scalar(const uint8_t* _src, uint8_t* _dst, const size_t _width, const png_palette_lut_s* _lut,
+		const uint8_t _bit_depth)
+{
+	//inlined with a constant depth, so every shift and mask is known up front
+	png_expand_palette_scalar(_src, _dst, 0, _width, _bit_depth, _lut);
+}
+
+static void expand_1_scalar(const uint8_t* _src, uint8_t* _dst, const size_t _width, const png_palette_lut_s* _lut)
+{
+	expand_bits_scalar(_src, _dst, _width, _lut, 1);
+}
+
+static void expand_2_scalar(const uint8_t* _src, uint8_t* _dst, const size_t _width, const png_palette_lut_s* _lut)
+{
+	expand_bits_scalar(_src, _dst, _width, _lut, 2);
+}
+
+static void expand_4_scalar(const uint8_t* _src, uint8_t* _dst, const size_t _width, const png_palette_lut_s* _lut)
+{
+	expand_bits_scalar(_src, _dst, _width, _lut, 4);
+}
+
+static void expand_8_scalar(const uint8_t* _src, uint8_t* _dst, const size_t _width, const png_palette_lut_s* _lut)
+{
+	for(size_t i = 0; i < _width; ++i) {
+		memcpy(_dst + 4 * i, _lut->rgba[_src[i]], 4);
+	}
+}
+
+#ifdef PALETTE_X86
+////////////////////////// x86 simd kernels
+//indices of up to 4 bits can only point at the first 16 entries, so each channel fits in one register and pshufb
+//looks up 16 pixels at once - the four channel registers are then interleaved back into rgba.
+//8 bit indices need the whole table, there avx2 gathers 8 entries per instruction
+
+__attribute__((target("ssse3")))
+static inline void store_rgba_ssse3(const __m128i _indices, uint8_t* _dst, const __m128i* _planes)
+{
+	const __m128i r = _mm_shuffle_epi8(_planes[0], _indices);
+	const __m128i g = _mm_shuffle_epi8(_planes[1], _indices);
+	const __m128i b = _mm_shuffle_epi8(_planes[2], _indices);
+	const __m128i a = _mm_shuffle_epi8(_planes[3], _indices);
+
+	const __m128i rg_low  = _mm_unpacklo_epi8(r, g);
+	const __m128i rg_high = _mm_unpackhi_epi8(r, g);
+	const __m128i ba_low  = _mm_unpacklo_epi8(b, a);
+	const __m128i ba_high = _mm_unpackhi_epi8(b, a);
+	_mm_storeu_si128((__m128i*)(_dst),		_mm_unpacklo_epi16(rg_low,  ba_low));
+	_mm_storeu_si128((__m128i*)(_dst + 16), _mm_unpackhi_epi16(rg_low,  ba_low));
+	_mm_storeu_si128((__m128i*)(_dst + 32), _mm_unpacklo_epi16(rg_high, ba_high));
+	_mm_storeu_si128((__m128i*)(_dst + 48), _mm_unpackhi_epi16(rg_high, ba_high));
+}
+
+__attribute__((target("ssse3")))
+static inline void load_planes_ssse3(const png_palette_lut_s* _lut, __m128i* _planes)
+{
+	for(int channel = 0; channel < 4; ++channel) {
+		_planes[channel] = _mm_loadu_si128((const __m128i*)_lut->planes[channel]);
+	}
+}
+
+__attribute__((target("ssse3")))
+static void expand_1_ssse3(const uint8_t* _src, uint8_t* _dst, const size_t _width, const png_palette_lut_s* _lut)
+{
+	//16 indices live in 2 bytes - every byte is copied to 8 lanes and each lane keeps its own bit
+	__m128i planes[4];
+	load_planes_ssse3(_lut, planes);
+	const __m128i spread = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1);
+	const __m128i bits	 = _mm_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+	const __m128i one	 = _mm_set1_epi8(1);
+
+	size_t i = 0;
+	for(; i + 16 <= _width; i += 16) {
+		uint16_t packed;
+		memcpy(&packed, _src + i / 8, sizeof(packed));
+		const __m128i bytes	  = _mm_shuffle_epi8(_mm_cvtsi32_si128(packed), spread);
+		const __m128i indices = _mm_min_epu8(_mm_and_si128(bytes, bits), one);
+		store_rgba_ssse3(indices, _dst + 4 * i, planes);
+	}
+	expand_1_scalar(_src + i / 8, _dst + 4 * i, _width - i, _lut);
+}
+
+__attribute__((target("ssse3")))
+static void expand_2_ssse3(const uint8_t* _src, uint8_t* _dst, const size_t _width, const png_palette_lut_s* _lut)
+{
+	//16 indices live in 4 bytes - the four of every byte are split out by shifts, then interleaved back in order
+	__m128i planes[4];
+	load_planes_ssse3(_lut, planes);
+	const __m128i mask = _mm_set1_epi8(3);
+
+	size_t i = 0;
+	for(; i + 16 <= _width; i += 16) {
+		uint32_t packed;
+		memcpy(&packed, _src + i / 4, sizeof(packed));
+		const __m128i bytes = _mm_cvtsi32_si128(packed);
+		const __m128i first	 = _mm_and_si128(_mm_srli_epi16(bytes, 6), mask);
+		const __m128i second = _mm_and_si128(_mm_srli_epi16(bytes, 4), mask);
+		const __m128i third	 = _mm_and_si128(_mm_srli_epi16(bytes, 2), mask);
+		const __m128i fourth = _mm_and_si128(bytes, mask);
+		const __m128i indices = _mm_unpacklo_epi16(_mm_unpacklo_epi8(first, second), _mm_unpacklo_epi8(third, fourth));
+		store_rgba_ssse3(indices, _dst + 4 * i, planes);
+	}
+	expand_2_scalar(_src + i / 4, _dst + 4 * i, _width - i, _lut);
+}
+
+__attribute__((target("ssse3")))
+static void expand_4_ssse3(const uint8_t* _src, uint8_t* _dst, const size_t _width, const png_palette_lut_s* _lut)
+{
+	//16 indices live in 8 bytes - high and low nibbles, interleaved back in order
+	__m128i planes[4];
+	load_planes_ssse3(_lut, planes);
+	const __m128i mask = _mm_set1_epi8(15);
+
+	size_t i = 0;
+	for(; i + 16 <= _width; i += 16) {
+		uint64_t packed;
+		memcpy(&packed, _src + i / 2, sizeof(packed));
+		const __m128i bytes	  = _mm_loadl_epi64((const __m128i*)&packed);
+		const __m128i high	  = _mm_and_si128(_mm_srli_epi16(bytes, 4), mask);
+		const __m128i low	  = _mm_and_si128(bytes, mask);
+		store_rgba_ssse3(_mm_unpacklo_epi8(high, low), _dst + 4 * i, planes);
+	}
+	expand_4_scalar(_src + i / 2, _dst + 4 * i, _width - i, _lut);
+}
+
+__attribute__((target("avx2")))
+static void expand_8_avx2(const uint8_t* _src, uint8_t* _dst, const size_t _width, const png_palette_lut_s* _lut)
+{
+	size_t i = 0;
+	for(; i + 8 <= _width; i += 8) {
+		uint64_t packed;
+		memcpy(&packed, _src + i, sizeof(packed));
+		const __m256i indices = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)&packed));
+		const __m256i pixels  = _mm256_i32gather_epi32((const int*)_lut->rgba, indices, 4);
+		_mm256_storeu_si256((__m256i*)(_dst + 4 * i), pixels);
+	}
+	expand_8_scalar(_src + i, _dst + 4 * i, _width - i, _lut);
+}
+#endif //PALETTE_X86
+
+static void palette_init()
+{
+	expand_table[0] = expand_1_scalar;
+	expand_table[1] = expand_2_scalar;
+	expand_table[2] = expand_4_scalar;
+	expand_table[3] = expand_8_scalar;
+	selected_impl	= PALETTE_IMPL_SCALAR;
+
+#ifdef PALETTE_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("ssse3")) {
+		expand_table[0] = expand_1_ssse3;
+		expand_table[1] = expand_2_ssse3;
+		expand_table[2] = expand_4_ssse3;
+		selected_impl	= PALETTE_IMPL_SSSE3;
+	}
+	if(__builtin_cpu_supports("avx2")) {
+		expand_table[3] = expand_8_avx2;
+		selected_impl	= PALETTE_IMPL_AVX2;
+	}
+#endif
+}
+
+#undef DEPTH_CASES
+#ifdef PALETTE_X86
+#undef PALETTE_X86
+#endif
@@ -0,0 +1,37 @@
+#ifndef __PNG_PALETTE__
+#define __PNG_PALETTE__
+
+#include <stdint.h>
+#include <stddef.h>
+
+////////////////////////// typedefs
+typedef enum {
+	//which implementation got picked for the running cpu
+	PALETTE_IMPL_SCALAR = 0,
+	PALETTE_IMPL_SSSE3,
+	PALETTE_IMPL_AVX2,
+} palette_impl_e;
+
+typedef struct {
+	//rgba of every possible index, filled by whoever parses PLTE and tRNS - call png_palette_lut_update() afterwards
+	uint8_t rgba[256][4];
+	//first 16 entries again, one channel per row - indices of up to 4 bits are looked up in these 16 at a time
+	uint8_t planes[4][16];
+} png_palette_lut_s;
+
+////////////////////////// declarations
+//refreshes whatever is derived from rgba
+void png_palette_lut_update(png_palette_lut_s* _lut);
+
+//turns _width indices of a packed scanline, starting at index _x, into _width rgba pixels
+//_bit_depth is 1, 2, 4 or 8 - sub byte indices are packed from the most significant bit, like in png
+void png_expand_palette(const uint8_t* _src, uint8_t* _dst, const size_t _x, const size_t _width, const uint8_t _bit_depth,
+		const png_palette_lut_s* _lut);
+
+//scalar reference version - always available, mostly useful for checking simd kernels against
+void png_expand_palette_scalar(const uint8_t* _src, uint8_t* _dst, const size_t _x, const size_t _width, const uint8_t _bit_depth,
+		const png_palette_lut_s* _lut);
+
+palette_impl_e png_expand_palette_get_impl();
+
+#endif //__PNG_PALETTE__
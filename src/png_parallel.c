@@ -0,0 +1,416 @@
+#include "png_parallel.h"
+#include "png_filter.h"
+#include "logger.h"
+#include "zlib.h"
+
+#include <string.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define ZLIB_HEADER_LEN	 2
+#define ZLIB_TRAILER_LEN 4
+//a few segments per thread, so one slow segment does not leave everybody else waiting
+#define SEGMENTS_PER_THREAD 4
+//compressed bytes - restart points closer than this to the previous one are skipped
+#ifndef MIN_SEGMENT_SIZE
+#define MIN_SEGMENT_SIZE (256 * 1024)
+#endif
+//zlib takes uInt sized pieces
+#define MAX_INFLATE_PIECE (1u << 30)
+
+typedef struct {
+	const uint8_t* input;
+	size_t		   input_size;
+	uint8_t*	   output;			//private until the copy phase - where it goes in _out is not known yet
+	size_t		   output_size;
+	size_t		   output_capacity;
+	size_t		   offset;
+	uint32_t	   adler;
+	bool		   last;
+	bool		   inflated;		//ended exactly on a block boundary, or on the final block for the last segment
+	size_t		   first_row;		//rows that start inside this segment
+	size_t		   end_row;
+	bool		   reconstructed;
+} segment_s;
+
+typedef struct {
+	segment_s*				segments;
+	size_t					segment_count;
+	_Atomic size_t			next_segment;	//shared work counter of the current phase
+	uint8_t*				out;
+	size_t					out_size;
+	const png_allocator_s*	allocator;
+	const png_row_layout_s* rows;
+	atomic_bool				failed;
+} parallel_job_s;
+
+////////////////////////// declarations
+static const size_t find_restart_points(const uint8_t* _data, const size_t _size, size_t* _points, const size_t _max_points);
+static void run_phase(parallel_job_s* _job, void* (*_phase)(void*), const uint32_t _threads);
+static void* inflate_phase(void* _job);
+static void* copy_phase(void* _job);
+static void* unfilter_phase(void* _job);
+static const bool inflate_segment(parallel_job_s* _job, segment_s* _segment);
+static const bool place_segments(parallel_job_s* _job, const uint32_t _adler);
+static const bool unfilter_segment(parallel_job_s* _job, segment_s* _segment);
+static voidpf segment_zalloc(voidpf _allocator, uInt _items, uInt _size);
+static void   segment_zfree(voidpf _allocator, voidpf _ptr);
+
+
+////////////////////////// definitions
+bool png_parallel_inflate(const uint8_t* _zlib, const size_t _size, uint8_t* _out, const size_t _out_size,
+		const uint32_t _threads, const png_allocator_s* _allocator, const png_row_layout_s* _rows)
+{
+	ASSERT_AND_FLUSH(_zlib		!= NULL);
+	ASSERT_AND_FLUSH(_out		!= NULL);
+	ASSERT_AND_FLUSH(_allocator != NULL);
+
+	if(_size < ZLIB_HEADER_LEN + ZLIB_TRAILER_LEN) {
+		return false;
+	}
+	//deflate only, no preset dictionary and a valid check - anything else is left for zlib to complain about
+	if((_zlib[0] & 0x0f) != Z_DEFLATED || (_zlib[1] & 0x20) != 0 || ((_zlib[0] << 8) | _zlib[1]) % 31 != 0) {
+		return false;
+	}
+
+	uint32_t threads = png_thread_count(_threads);
+
+	//raw deflate data between the zlib header and the adler32
+	const uint8_t* body		 = _zlib + ZLIB_HEADER_LEN;
+	const size_t   body_size = _size - ZLIB_HEADER_LEN - ZLIB_TRAILER_LEN;
+	const size_t   max_points = (size_t)threads * SEGMENTS_PER_THREAD;
+	size_t* points = _allocator->alloc(_allocator->user, sizeof(size_t) * max_points, _Alignof(size_t));
+	if(points == NULL) {
+		LOG_ERRNO(LOG_ERROR, "could not allocate %zu restart points", max_points);
+		return false;
+	}
+	const size_t point_count = find_restart_points(body, body_size, points, max_points);
+	if(point_count == 0) {
+		LOG(LOG_DEBUG_1, "no restart points in %zu bytes of compressed data", body_size);
+		_allocator->free(_allocator->user, points);
+		return false;
+	}
+	LOG(LOG_DEBUG_1, "%zu restart points in %zu bytes of compressed data", point_count, body_size);
+
+	const size_t segment_count = point_count + 1;
+	segment_s* segments = _allocator->alloc(_allocator->user, sizeof(segment_s) * segment_count, _Alignof(segment_s));
+	if(segments == NULL) {
+		LOG_ERRNO(LOG_ERROR, "could not allocate %zu segments", segment_count);
+		_allocator->free(_allocator->user, points);
+		return false;
+	}
+	memset(segments, 0, sizeof(segment_s) * segment_count);
+	for(size_t s = 0; s < segment_count; ++s) {
+		const size_t begin = s == 0 ? 0 : points[s - 1];
+		const size_t end   = s == point_count ? body_size : points[s];
+		segments[s].input	   = body + begin;
+		segments[s].input_size = end - begin;
+		segments[s].last	   = s == point_count;
+	}
+	_allocator->free(_allocator->user, points);
+
+	parallel_job_s job = {
+		.segments	   = segments,
+		.segment_count = segment_count,
+		.out		   = _out,
+		.out_size	   = _out_size,
+		.allocator	   = _allocator,
+		.rows		   = _rows,
+	};
+	atomic_init(&job.next_segment, 0);
+	atomic_init(&job.failed, false);
+
+	threads = threads > segment_count ? segment_count : threads;
+	run_phase(&job, inflate_phase, threads);
+
+	const uint32_t adler = ((uint32_t)_zlib[_size - 4] << 24) | ((uint32_t)_zlib[_size - 3] << 16) |
+						   ((uint32_t)_zlib[_size - 2] << 8)  | _zlib[_size - 1];
+	bool succeeded = !atomic_load(&job.failed) && place_segments(&job, adler);
+	if(succeeded) {
+		run_phase(&job, copy_phase, threads);
+		if(_rows != NULL) {
+			run_phase(&job, unfilter_phase, threads);
+			//whatever was left depends on the last row of the segment before it - in order, that is always ready
+			for(size_t s = 0; s < segment_count && !atomic_load(&job.failed); ++s) {
+				if(!segments[s].reconstructed && !unfilter_segment(&job, &segments[s])) {
+					atomic_store(&job.failed, true);
+				}
+			}
+		}
+		succeeded = !atomic_load(&job.failed);
+	}
+
+	for(size_t s = 0; s < segment_count; ++s) {
+		_allocator->free(_allocator->user, segments[s].output);
+	}
+	_allocator->free(_allocator->user, segments);
+	return succeeded;
+}
+
+uint32_t png_thread_count(const uint32_t _requested)
+{
+	const long	   cpus		   = sysconf(_SC_NPROCESSORS_ONLN);
+	const uint32_t online	   = cpus > 0 ? (uint32_t)cpus : 1;
+	const uint32_t max_threads = online * PNG_MAX_THREADS_PER_CPU;
+	if(_requested > max_threads) {
+		LOG(LOG_INFO, "%u threads asked for, %u at most", _requested, max_threads);
+		return max_threads;
+	}
+	return _requested == 0 ? online : _requested;
+}
+
+static const size_t find_restart_points(const uint8_t* _data, const size_t _size, size_t* _points, const size_t _max_points)
+{
+	//a full flush ends with an empty stored block, which is byte aligned: 00 00 ff ff (len and its complement)
+	//the next block - and a fresh window - starts right after it
+	//only the first candidate after every gap is taken, so the scan mostly skips ahead
+	const size_t gap = _size / (_max_points + 1) > MIN_SEGMENT_SIZE ? _size / (_max_points + 1) : MIN_SEGMENT_SIZE;
+	size_t count = 0;
+	size_t from	 = gap;
+	while(count < _max_points && from + 2 < _size) {
+		const uint8_t* found = memchr(_data + from, 0xff, _size - from - 1);
+		if(found == NULL) {
+			break;
+		}
+		const size_t at = found - _data;
+		if(at >= 2 && found[1] == 0xff && found[-1] == 0x00 && found[-2] == 0x00 && at + 2 < _size) {
+			_points[count++] = at + 2;
+			from = at + 2 + gap;
+		} else {
+			from = at + 1;
+		}
+	}
+	return count;
+}
+
+static void run_phase(parallel_job_s* _job, void* (*_phase)(void*), const uint32_t _threads)
+{
+	//caller is one of the threads - if some fail to start, the rest simply take more segments
+	pthread_t threads[_threads];
+	uint32_t started = 1;
+	atomic_store(&_job->next_segment, 0);
+	for(uint32_t t = 1; t < _threads; ++t, ++started) {
+		if(pthread_create(&threads[t], NULL, _phase, _job) != 0) {
+			LOG(LOG_WARNING, "could only start %d out of %d inflate threads", started, _threads);
+			break;
+		}
+	}
+	(void)_phase(_job);
+	for(uint32_t t = 1; t < started; ++t) {
+		pthread_join(threads[t], NULL);
+	}
+}
+
+static void* inflate_phase(void* _job)
+{
+	parallel_job_s* job = _job;
+	size_t s;
+	while((s = atomic_fetch_add(&job->next_segment, 1)) < job->segment_count) {
+		if(atomic_load_explicit(&job->failed, memory_order_relaxed)) {
+			break;
+		}
+		if(!inflate_segment(job, &(job->segments[s]))) {
+			atomic_store(&job->failed, true);
+		}
+	}
+	return NULL;
+}
+
+static void* copy_phase(void* _job)
+{
+	parallel_job_s* job = _job;
+	size_t s;
+	while((s = atomic_fetch_add(&job->next_segment, 1)) < job->segment_count) {
+		segment_s* segment = &(job->segments[s]);
+		memcpy(job->out + segment->offset, segment->output, segment->output_size);
+		job->allocator->free(job->allocator->user, segment->output);
+		segment->output = NULL;
+	}
+	return NULL;
+}
+
+static void* unfilter_phase(void* _job)
+{
+	//every row needs the reconstructed row above it, except when it is filtered with none or sub -
+	//a segment starting on such a row does not wait for anything
+	parallel_job_s* job = _job;
+	const size_t stride = job->rows->row_size + 1;
+	size_t s;
+	while((s = atomic_fetch_add(&job->next_segment, 1)) < job->segment_count) {
+		segment_s* segment = &(job->segments[s]);
+		if(segment->first_row >= segment->end_row) {
+			segment->reconstructed = true;
+			continue;
+		}
+		const uint8_t filter_type = job->out[segment->first_row * stride];
+		if(segment->first_row != 0 && filter_type != 0 && filter_type != 1) {
+			continue;
+		}
+		if(!unfilter_segment(job, segment)) {
+			atomic_store(&job->failed, true);
+		}
+	}
+	return NULL;
+}
+
+static const bool inflate_segment(parallel_job_s* _job, segment_s* _segment)
+{
+	z_stream strm;
+	memset(&strm, 0, sizeof(z_stream));
+	strm.zalloc = segment_zalloc;
+	strm.zfree	= segment_zfree;
+	strm.opaque = (voidpf)_job->allocator;
+	//raw deflate with an empty window - a back reference across the restart point fails instead of reading garbage
+	if(inflateInit2(&strm, -MAX_WBITS) != Z_OK) {
+		LOG(LOG_ERROR, "could not prepare inflate stream for a segment");
+		return false;
+	}
+
+	//first guess assumes the whole stream compresses evenly, a quarter more to avoid most regrowing
+	const size_t total_input = _job->segments[_job->segment_count - 1].input + _job->segments[_job->segment_count - 1].input_size -
+							   _job->segments[0].input;
+	size_t capacity = (size_t)((double)_job->out_size * _segment->input_size / total_input * 1.25) + 4096;
+	capacity = capacity > _job->out_size ? _job->out_size : capacity;
+
+	bool succeeded = true;
+	int ret = Z_OK;
+	size_t consumed = 0;
+	while(succeeded) {
+		if(_segment->output_size == _segment->output_capacity) {
+			if(_segment->output_capacity == _job->out_size) {
+				//more than the whole image
+				succeeded = false;
+				break;
+			}
+			const size_t grown = _segment->output_capacity == 0 ? capacity :
+								 (_segment->output_capacity * 2 > _job->out_size ? _job->out_size : _segment->output_capacity * 2);
+			uint8_t* output = _job->allocator->alloc(_job->allocator->user, grown, 64);
+			if(output == NULL) {
+				LOG_ERRNO(LOG_ERROR, "could not allocate %zu bytes for a segment", grown);
+				succeeded = false;
+				break;
+			}
+			if(_segment->output != NULL) {
+				memcpy(output, _segment->output, _segment->output_size);
+				_job->allocator->free(_job->allocator->user, _segment->output);
+			}
+			_segment->output		  = output;
+			_segment->output_capacity = grown;
+		}
+
+		const size_t input_left	 = _segment->input_size - consumed;
+		const size_t output_left = _segment->output_capacity - _segment->output_size;
+		strm.next_in   = (Bytef*)_segment->input + consumed;
+		strm.avail_in  = input_left > MAX_INFLATE_PIECE ? MAX_INFLATE_PIECE : input_left;
+		strm.next_out  = _segment->output + _segment->output_size;
+		strm.avail_out = output_left > MAX_INFLATE_PIECE ? MAX_INFLATE_PIECE : output_left;
+		const uInt avail_in	 = strm.avail_in;
+		const uInt avail_out = strm.avail_out;
+
+		ret = inflate(&strm, Z_NO_FLUSH);
+		consumed			 += avail_in - strm.avail_in;
+		_segment->output_size += avail_out - strm.avail_out;
+		if(ret == Z_STREAM_END || consumed == _segment->input_size) {
+			break;
+		}
+		if(ret != Z_OK && ret != Z_BUF_ERROR) {
+			//most likely a back reference into the previous segment - a sync flush, not a full one
+			LOG(LOG_DEBUG_1, "segment does not inflate on its own: %d (%s)", ret, strm.msg ? strm.msg : "no message");
+			succeeded = false;
+		}
+	}
+
+	if(succeeded) {
+		if(_segment->last) {
+			//final block has to end exactly where the adler32 starts
+			succeeded = ret == Z_STREAM_END && consumed == _segment->input_size;
+		} else {
+			//all input used, stopped between blocks on a byte boundary and not in the final block
+			succeeded = ret != Z_STREAM_END && consumed == _segment->input_size && strm.data_type == 128;
+		}
+	}
+	if(succeeded) {
+		_segment->adler = adler32(adler32(0, Z_NULL, 0), _segment->output, _segment->output_size);
+	}
+	_segment->inflated = succeeded;
+	(void)inflateEnd(&strm);
+	return succeeded;
+}
+
+static const bool place_segments(parallel_job_s* _job, const uint32_t _adler)
+{
+	//offsets only become known once every segment before is inflated
+	size_t	 offset = 0;
+	uint32_t adler	= adler32(0, Z_NULL, 0);
+	for(size_t s = 0; s < _job->segment_count; ++s) {
+		segment_s* segment = &(_job->segments[s]);
+		if(!segment->inflated) {
+			return false;
+		}
+		segment->offset = offset;
+		offset += segment->output_size;
+		adler = adler32_combine(adler, segment->adler, segment->output_size);
+	}
+	if(offset != _job->out_size) {
+		LOG(LOG_DEBUG_1, "segments inflated to %zu bytes instead of %zu", offset, _job->out_size);
+		return false;
+	}
+	if(adler != _adler) {
+		LOG(LOG_DEBUG_1, "segments do not add up to the adler32 of the stream");
+		return false;
+	}
+
+	if(_job->rows != NULL) {
+		//a segment owns the rows that start inside it - their tails may come from the next one
+		const size_t stride = _job->rows->row_size + 1;
+		for(size_t s = 0; s < _job->segment_count; ++s) {
+			segment_s* segment	= &(_job->segments[s]);
+			segment->first_row	= (segment->offset + stride - 1) / stride;
+			segment->end_row	= (segment->offset + segment->output_size + stride - 1) / stride;
+			segment->end_row	= segment->end_row > _job->rows->row_count ? _job->rows->row_count : segment->end_row;
+		}
+	}
+	return true;
+}
+
+static const bool unfilter_segment(parallel_job_s* _job, segment_s* _segment)
+{
+	const png_row_layout_s* rows = _job->rows;
+	const size_t stride = rows->row_size + 1;
+	//none and sub never look at prev, so a standalone segment is fine with the zero row as well
+	const uint8_t* prev = (_segment->first_row == 0 || _job->out[_segment->first_row * stride] <= 1) ?
+						  rows->zero_row : _job->out + (_segment->first_row - 1) * stride + 1;
+	for(size_t y = _segment->first_row; y < _segment->end_row; ++y) {
+		uint8_t* scanline = _job->out + y * stride;
+		if(!unfilter_row(scanline[0], scanline + 1, prev, rows->row_size, rows->bpp)) {
+			LOG(LOG_ERROR, "invalid filter type %d in row %zu", scanline[0], y);
+			return false;
+		}
+		if(rows->sink != NULL) {
+			rows->sink(rows->sink_user, y, scanline + 1);
+		}
+		prev = scanline + 1;
+	}
+	_segment->reconstructed = true;
+	return true;
+}
+
+static voidpf segment_zalloc(voidpf _allocator, uInt _items, uInt _size)
+{
+	const png_allocator_s* allocator = _allocator;
+	return allocator->alloc(allocator->user, (size_t)_items * _size, sizeof(max_align_t));
+}
+
+static void segment_zfree(voidpf _allocator, voidpf _ptr)
+{
+	const png_allocator_s* allocator = _allocator;
+	allocator->free(allocator->user, _ptr);
+}
+
+#undef ZLIB_HEADER_LEN
+#undef ZLIB_TRAILER_LEN
+#undef SEGMENTS_PER_THREAD
+#undef MIN_SEGMENT_SIZE
+#undef MAX_INFLATE_PIECE
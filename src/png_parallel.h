@@ -0,0 +1,46 @@
+#ifndef __PNG_PARALLEL__
+#define __PNG_PARALLEL__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "png_arena.h"
+#include "png_pipeline.h"
+
+////////////////////////// defines
+//more threads than this per online cpu only queue up behind each other - everything that starts threads asks
+//png_thread_count() and gets at most this many
+#ifndef PNG_MAX_THREADS_PER_CPU
+#define PNG_MAX_THREADS_PER_CPU 4
+#endif
+
+////////////////////////// typedefs
+typedef struct {
+	//how the inflated bytes split into filtered rows (filter byte + row_size each) - with it, segments
+	//whose first row does not look at the row above are reconstructed on their own thread too
+	size_t		   row_size;
+	size_t		   row_count;
+	uint8_t		   bpp;
+	const uint8_t* zero_row;
+	png_row_sink_fn sink;		//optional - gets every row as soon as it is unfiltered, while it is still in cache, on
+	void*		   sink_user;	//whichever thread unfiltered it, so rows arrive out of order and it has to be thread safe
+} png_row_layout_s;
+
+////////////////////////// declarations
+//inflates a complete zlib stream (header and adler32 included) into exactly _out_size bytes of _out on _threads threads
+//(as png_thread_count() resolves them, the caller counts as one), splitting it at the empty stored blocks a full flush
+//leaves behind
+//every segment is checked to start and end on a block boundary and the segments together against the adler32, so a
+//sync flush or a look-alike byte pattern never produces wrong output - only a false return
+//with _rows the scanlines are also unfiltered in place on return, and handed to its sink one by one
+//false means there were no usable restart points or some segment did not check out - _out is left in an undefined
+//state and the stream should be inflated serially, which also reports whatever is actually wrong with it
+//temporary memory comes from _allocator, which has to be safe to call from several threads
+bool png_parallel_inflate(const uint8_t* _zlib, const size_t _size, uint8_t* _out, const size_t _out_size,
+		const uint32_t _threads, const png_allocator_s* _allocator, const png_row_layout_s* _rows);
+//threads to actually start for _requested - 0 means one per online cpu, and anything above PNG_MAX_THREADS_PER_CPU per
+//online cpu gets capped to that, since stack arrays of whoever starts them are sized by it
+uint32_t png_thread_count(const uint32_t _requested);
+
+#endif //__PNG_PARALLEL__
@@ -0,0 +1,184 @@
+#include "png_pipeline.h"
+#include "png_filter.h"
+#include "logger.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_RELAX() _mm_pause()
+#else
+#define CPU_RELAX() do{} while(0)
+#endif
+
+//both sides spin this many times before going to sleep - a row is usually only a few microseconds away
+#define SPIN_COUNT 256
+
+////////////////////////// declarations
+static void* consumer_loop(void* _pipeline);
+static const bool wait_for(png_pipeline_s* _pipeline, _Atomic size_t* _counter, const size_t _target, atomic_bool* _waiting);
+static void wake(png_pipeline_s* _pipeline, atomic_bool* _waiting);
+
+
+////////////////////////// definitions
+bool png_pipeline_start(png_pipeline_s* _pipeline, uint8_t* _ring, const size_t _ring_size, const size_t _row_size,
+		const size_t _row_count, const uint8_t _bpp, const uint8_t* _zero_row, png_row_sink_fn _sink, void* _user,
+		png_stats_s* _stats)
+{
+	ASSERT_AND_FLUSH(_pipeline != NULL);
+	ASSERT_AND_FLUSH(_ring	   != NULL);
+	ASSERT_AND_FLUSH(_sink	   != NULL);
+	ASSERT_AND_FLUSH(_ring_size >= 2 * (_row_size + 1));
+
+	_pipeline->row_stride = _row_size + 1;
+	_pipeline->ring		  = _ring;
+	_pipeline->ring_size  = _ring_size / _pipeline->row_stride * _pipeline->row_stride;
+	_pipeline->row_count  = _row_count;
+	_pipeline->bpp		  = _bpp;
+	_pipeline->zero_row	  = _zero_row;
+	_pipeline->sink		  = _sink;
+	_pipeline->user		  = _user;
+	_pipeline->stats	  = _stats;
+	atomic_init(&_pipeline->produced, 0);
+	atomic_init(&_pipeline->released, 0);
+	atomic_init(&_pipeline->producer_waiting, false);
+	atomic_init(&_pipeline->consumer_waiting, false);
+	atomic_init(&_pipeline->aborted, false);
+	atomic_init(&_pipeline->failed, false);
+	pthread_mutex_init(&_pipeline->lock, NULL);
+	pthread_cond_init(&_pipeline->cond, NULL);
+
+	if(pthread_create(&_pipeline->thread, NULL, consumer_loop, _pipeline) != 0) {
+		LOG_ERRNO(LOG_ERROR, "could not start reconstruct thread");
+		pthread_mutex_destroy(&_pipeline->lock);
+		pthread_cond_destroy(&_pipeline->cond);
+		return false;
+	}
+	_pipeline->running = true;
+	return true;
+}
+
+uint8_t* png_pipeline_acquire(png_pipeline_s* _pipeline, size_t* _size)
+{
+	//released counts rows, so free space is recomputed from it every time
+	const size_t produced = atomic_load_explicit(&_pipeline->produced, memory_order_relaxed);
+	const size_t target	  = (produced + 1 > _pipeline->ring_size ? produced + 1 - _pipeline->ring_size : 0);
+	const size_t rows	  = (target + _pipeline->row_stride - 1) / _pipeline->row_stride;
+	if(!wait_for(_pipeline, &_pipeline->released, rows, &_pipeline->producer_waiting)) {
+		return NULL;
+	}
+
+	const size_t released = atomic_load_explicit(&_pipeline->released, memory_order_acquire) * _pipeline->row_stride;
+	const size_t free_space = _pipeline->ring_size - (produced - released);
+	const size_t offset		= produced % _pipeline->ring_size;
+	const size_t contiguous = _pipeline->ring_size - offset;
+	*_size = free_space < contiguous ? free_space : contiguous;
+	return _pipeline->ring + offset;
+}
+
+void png_pipeline_commit(png_pipeline_s* _pipeline, const size_t _size)
+{
+	if(_size == 0) {
+		return;
+	}
+	atomic_fetch_add_explicit(&_pipeline->produced, _size, memory_order_seq_cst);
+	wake(_pipeline, &_pipeline->consumer_waiting);
+}
+
+bool png_pipeline_finish(png_pipeline_s* _pipeline)
+{
+	if(!_pipeline->running) {
+		return false;
+	}
+	pthread_join(_pipeline->thread, NULL);
+	_pipeline->running = false;
+	pthread_mutex_destroy(&_pipeline->lock);
+	pthread_cond_destroy(&_pipeline->cond);
+	return !atomic_load(&_pipeline->failed) && !atomic_load(&_pipeline->aborted);
+}
+
+void png_pipeline_abort(png_pipeline_s* _pipeline)
+{
+	if(!_pipeline->running) {
+		return;
+	}
+	atomic_store(&_pipeline->aborted, true);
+	pthread_mutex_lock(&_pipeline->lock);
+	pthread_cond_broadcast(&_pipeline->cond);
+	pthread_mutex_unlock(&_pipeline->lock);
+	(void)png_pipeline_finish(_pipeline);
+}
+
+bool png_pipeline_failed(png_pipeline_s* _pipeline)
+{
+	return atomic_load_explicit(&_pipeline->failed, memory_order_relaxed);
+}
+
+static void* consumer_loop(void* _pipeline)
+{
+	png_pipeline_s* pipeline = _pipeline;
+	const size_t rows_in_ring = pipeline->ring_size / pipeline->row_stride;
+	const size_t row_size	  = pipeline->row_stride - 1;
+
+	const uint8_t* prev = pipeline->zero_row;
+	for(size_t y = 0; y < pipeline->row_count; ++y) {
+		if(!wait_for(pipeline, &pipeline->produced, (y + 1) * pipeline->row_stride, &pipeline->consumer_waiting)) {
+			break;
+		}
+
+		uint8_t* scanline = pipeline->ring + (y % rows_in_ring) * pipeline->row_stride;
+		const uint64_t started = pipeline->stats != NULL ? png_cycles() : 0;
+		if(!unfilter_row(scanline[0], scanline + 1, prev, row_size, pipeline->bpp)) {
+			LOG(LOG_ERROR, "invalid filter type %d in row %zu", scanline[0], y);
+			atomic_store(&pipeline->failed, true);
+			wake(pipeline, &pipeline->producer_waiting);
+			break;
+		}
+		const uint64_t unfiltered = pipeline->stats != NULL ? png_cycles() : 0;
+		pipeline->sink(pipeline->user, y, scanline + 1);
+		if(pipeline->stats != NULL) {
+			png_stats_row(pipeline->stats, scanline[0], unfiltered - started, png_cycles() - unfiltered);
+		}
+		prev = scanline + 1;
+
+		//row above is not needed any more - this one still is, as prev of the next
+		atomic_store_explicit(&pipeline->released, y, memory_order_seq_cst);
+		wake(pipeline, &pipeline->producer_waiting);
+	}
+	return NULL;
+}
+
+static const bool wait_for(png_pipeline_s* _pipeline, _Atomic size_t* _counter, const size_t _target, atomic_bool* _waiting)
+{
+	//returns false if the other side gave up in the meantime
+	for(int spin = 0; spin < SPIN_COUNT; ++spin) {
+		if(atomic_load_explicit(_counter, memory_order_acquire) >= _target) {
+			return true;
+		}
+		if(atomic_load_explicit(&_pipeline->aborted, memory_order_relaxed) || atomic_load_explicit(&_pipeline->failed, memory_order_relaxed)) {
+			return false;
+		}
+		CPU_RELAX();
+	}
+
+	pthread_mutex_lock(&_pipeline->lock);
+	atomic_store(_waiting, true);
+	while(atomic_load(_counter) < _target && !atomic_load(&_pipeline->aborted) && !atomic_load(&_pipeline->failed)) {
+		pthread_cond_wait(&_pipeline->cond, &_pipeline->lock);
+	}
+	atomic_store(_waiting, false);
+	pthread_mutex_unlock(&_pipeline->lock);
+	return atomic_load(_counter) >= _target;
+}
+
+static void wake(png_pipeline_s* _pipeline, atomic_bool* _waiting)
+{
+	//only pay for the lock when the other side is actually asleep
+	if(!atomic_load(_waiting)) {
+		return;
+	}
+	pthread_mutex_lock(&_pipeline->lock);
+	pthread_cond_broadcast(&_pipeline->cond);
+	pthread_mutex_unlock(&_pipeline->lock);
+}
+
+#undef SPIN_COUNT
+#undef CPU_RELAX
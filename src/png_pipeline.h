@@ -0,0 +1,57 @@
+#ifndef __PNG_PIPELINE__
+#define __PNG_PIPELINE__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "png_stats.h"
+
+////////////////////////// typedefs
+//gets every reconstructed row, in order, on the reconstruct thread - _row stays valid until the call returns
+typedef void (*png_row_sink_fn)(void* _user, const size_t _y, const uint8_t* _row);
+
+typedef struct {
+	//bounded ring of filtered scanlines between the inflate thread (producer) and
+	//the reconstruct thread (consumer) - rows are unfiltered in place and handed to the sink
+	uint8_t*		ring;
+	size_t			ring_size;		//whole number of rows, so a row never wraps around
+	size_t			row_stride;		//filter byte + row
+	size_t			row_count;
+	uint8_t			bpp;
+	const uint8_t*	zero_row;
+	png_row_sink_fn sink;
+	void*			user;
+	png_stats_s*	stats;			//optional - every row is timed into it from the reconstruct thread
+
+	_Atomic size_t	produced;		//bytes the producer has written so far
+	_Atomic size_t	released;		//rows the consumer no longer needs - the last reconstructed one is kept as prev
+	atomic_bool		producer_waiting;
+	atomic_bool		consumer_waiting;
+	atomic_bool		aborted;		//producer gave up - consumer stops at the next row
+	atomic_bool		failed;			//consumer hit a bad filter type
+	pthread_mutex_t lock;
+	pthread_cond_t	cond;
+	pthread_t		thread;
+	bool			running;
+} png_pipeline_s;
+
+////////////////////////// declarations
+//_ring has to hold at least two rows - anything past a whole number of rows is left unused
+bool png_pipeline_start(png_pipeline_s* _pipeline, uint8_t* _ring, const size_t _ring_size, const size_t _row_size,
+		const size_t _row_count, const uint8_t _bpp, const uint8_t* _zero_row, png_row_sink_fn _sink, void* _user,
+		png_stats_s* _stats);
+
+//producer side - waits until some space is free and returns the contiguous part of it, NULL once the consumer failed
+uint8_t* png_pipeline_acquire(png_pipeline_s* _pipeline, size_t* _size);
+void	 png_pipeline_commit(png_pipeline_s* _pipeline, const size_t _size);
+
+//waits for the last row and joins the consumer - false if any row failed
+bool png_pipeline_finish(png_pipeline_s* _pipeline);
+//stops the consumer wherever it is and joins it
+void png_pipeline_abort(png_pipeline_s* _pipeline);
+bool png_pipeline_failed(png_pipeline_s* _pipeline);
+
+#endif //__PNG_PIPELINE__
@@ -0,0 +1,71 @@
+#include "png_stats.h"
+#include "logger.h"
+
+#include <string.h>
+#include <pthread.h>
+
+//long enough for the tick rate to come out right to a few parts per million
+#define CALIBRATION_NS (20 * 1000 * 1000)
+
+////////////////////////// global variables
+static pthread_once_t calibrated = PTHREAD_ONCE_INIT;
+static double		  ticks_per_second;
+
+////////////////////////// declarations
+static void calibrate();
+static inline uint64_t monotonic_ns();
+
+
+////////////////////////// definitions
+double png_stats_ticks_per_second()
+{
+	pthread_once(&calibrated, calibrate);
+	return ticks_per_second;
+}
+
+const char* png_stats_stage_name(const png_stage_e _stage)
+{
+	static const char* names[PNG_STAGE_SIZE] = {"walk", "crc", "inflate", "unfilter", "convert"};
+	return _stage < PNG_STAGE_SIZE ? names[_stage] : "unknown";
+}
+
+void png_stats_count_chunk(png_stats_s* _stats, const uint8_t _type[4])
+{
+	//a handful of types per image, so a linear look up beats anything smarter
+	for(uint32_t i = 0; i < _stats->chunk_types; ++i) {
+		if(memcmp(_stats->chunks[i].type, _type, sizeof(_stats->chunks[i].type)) == 0) {
+			++_stats->chunks[i].count;
+			return;
+		}
+	}
+	if(_stats->chunk_types == PNG_STATS_CHUNK_TYPES) {
+		++_stats->chunks_other;
+		return;
+	}
+	png_chunk_count_s* entry = &(_stats->chunks[_stats->chunk_types++]);
+	memcpy(entry->type, _type, sizeof(entry->type));
+	entry->count = 1;
+}
+
+static void calibrate()
+{
+	//both clocks read back to back at either end of a busy wait - nothing in between can stretch one of them only
+	const uint64_t start_ns	   = monotonic_ns();
+	const uint64_t start_ticks = png_cycles();
+	uint64_t now_ns;
+	do {
+		now_ns = monotonic_ns();
+	} while(now_ns - start_ns < CALIBRATION_NS);
+	const uint64_t ticks = png_cycles() - start_ticks;
+	ticks_per_second = (double)ticks * 1e9 / (double)(now_ns - start_ns);
+	LOG(LOG_DEBUG_1, "cycle counter ticks %.0f times a second", ticks_per_second);
+}
+
+static inline uint64_t monotonic_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+#undef CALIBRATION_NS
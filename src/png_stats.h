@@ -0,0 +1,94 @@
+#ifndef __PNG_STATS__
+#define __PNG_STATS__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "png_filter.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+////////////////////////// defines
+//distinct chunk types counted one by one - any more than that only show up in chunks_other
+#define PNG_STATS_CHUNK_TYPES 16
+
+////////////////////////// typedefs
+typedef enum {
+	//where a decode spends its time - every cycle of the decoding thread goes to exactly one of them
+	PNG_STAGE_WALK = 0,	//signature, chunk headers, every chunk but IDAT, reading input and putting the result together
+	PNG_STAGE_CRC,
+	PNG_STAGE_INFLATE,	//with inflate_threads the rows its threads reconstruct on the way are in here too
+	PNG_STAGE_UNFILTER,
+	PNG_STAGE_CONVERT,	//reconstructed rows to the output format, adam7 scattering included
+	PNG_STAGE_SIZE,
+} png_stage_e;
+
+typedef struct {
+	char	 type[4];
+	uint32_t count;
+} png_chunk_count_s;
+
+typedef struct {
+	//what a single decode did - zeroed when it starts, filled while it runs, complete once it returns
+	//cycles are png_cycles() ticks, png_stats_ticks_per_second() turns them into time
+	//work the reconstruct thread of options.pipeline does comes on top of the decoding thread, so with it the stages
+	//can add up to more than total_cycles
+	uint64_t total_cycles;					//spent inside the decode calls - push decodes only count their png_feed()s
+	uint64_t cycles[PNG_STAGE_SIZE];
+	uint64_t unfilter_cycles[FILTER_SIZE];	//PNG_STAGE_UNFILTER split by the filter type of the row
+	uint64_t unfilter_rows[FILTER_SIZE];
+	uint64_t bytes_in;						//png bytes walked - every chunk whose header was read counts whole
+	uint64_t compressed_bytes;				//IDAT payloads handed to inflate
+	uint64_t inflated_bytes;				//filtered scanlines the stream inflated to
+	uint64_t bytes_out;						//pixel bytes of the result, without stride padding
+	png_chunk_count_s chunks[PNG_STATS_CHUNK_TYPES];	//in the order the types first showed up
+	uint32_t chunk_types;
+	uint32_t chunks_other;
+	uint64_t allocations;					//calls to options.allocator, or bumps of the arena
+	uint64_t allocated_bytes;
+	size_t	 peak_scratch;					//most per image memory held at once - the whole arena with use_arena,
+											//otherwise the scratch buffers kept between images (zlib state not included)
+} png_stats_s;
+
+////////////////////////// declarations
+//how many png_cycles() ticks make a second - measured once, on the first call
+double png_stats_ticks_per_second();
+const char* png_stats_stage_name(const png_stage_e _stage);
+void png_stats_count_chunk(png_stats_s* _stats, const uint8_t _type[4]);
+
+//cheapest clock there is - time stamp counter on x86, which ticks at a constant rate whatever the core clock does
+static inline uint64_t png_cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#elif defined(__aarch64__)
+	uint64_t ticks;
+	__asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+	return ticks;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+//safe from any thread - the reconstruct thread adds to the same stats as the decoding one
+static inline void png_stats_add(uint64_t* _counter, const uint64_t _value)
+{
+	__atomic_fetch_add(_counter, _value, __ATOMIC_RELAXED);
+}
+
+//a row was unfiltered in _unfilter cycles and then converted in _convert
+static inline void png_stats_row(png_stats_s* _stats, const uint8_t _filter_type, const uint64_t _unfilter, const uint64_t _convert)
+{
+	png_stats_add(&(_stats->cycles[PNG_STAGE_UNFILTER]), _unfilter);
+	png_stats_add(&(_stats->cycles[PNG_STAGE_CONVERT]), _convert);
+	png_stats_add(&(_stats->unfilter_cycles[_filter_type]), _unfilter);
+	png_stats_add(&(_stats->unfilter_rows[_filter_type]), 1);
+}
+
+#endif //__PNG_STATS__